@@ -0,0 +1,85 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * Arbitrary serial port baudrates on Linux (termios2/BOTHER).
+ *
+ * The kernel's termios2 structure cannot be used in the same
+ * file as the libc <termios.h>, so these live on their own.
+ * Each returns -1 with errno set on failure, or ENOSYS where
+ * the system has no way to set an arbitrary rate.
+ */
+
+#include	<errno.h>
+#include	"baudrate.h"
+
+#if	defined(__linux__)
+#include	<asm/termbits.h>
+#include	<asm/ioctls.h>
+#endif
+
+#if	defined(__linux__) && defined(BOTHER) && defined(TCGETS2)
+
+extern int ioctl(int, unsigned long, ...);
+
+/**************************************************************
+ * Set both input and output speed of an open tty to baud.
+ */
+
+int set_custom_baudrate(int fd, int baud)
+{
+	struct termios2 cfg;
+
+	if(ioctl(fd, TCGETS2, &cfg) < 0) {
+		return -1;
+	}
+
+	cfg.c_cflag &= ~(CBAUD | (CBAUD << IBSHIFT));
+	cfg.c_cflag |= BOTHER | (BOTHER << IBSHIFT);
+	cfg.c_ospeed = baud;
+	cfg.c_ispeed = baud;
+
+	if(ioctl(fd, TCSETS2, &cfg) < 0) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * Get the output speed of an open tty.
+ */
+
+int get_custom_baudrate(int fd)
+{
+	struct termios2 cfg;
+
+	if(ioctl(fd, TCGETS2, &cfg) < 0) {
+		return -1;
+	}
+
+	return cfg.c_ospeed;
+}
+
+#else
+
+/**************************************************************/
+
+int set_custom_baudrate(int fd, int baud)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+/**************************************************************/
+
+int get_custom_baudrate(int fd)
+{
+	errno = ENOSYS;
+	return -1;
+}
+
+#endif
+
+/**************************************************************/
+
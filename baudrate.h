@@ -0,0 +1,23 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * Arbitrary serial port baudrates on Linux (termios2/BOTHER).
+ */
+
+#ifndef	BAUDRATE_H
+#define	BAUDRATE_H
+
+#ifdef	__cplusplus
+extern "C" { 
+#endif
+
+int set_custom_baudrate(int, int);
+int get_custom_baudrate(int);
+
+#ifdef	__cplusplus
+};
+#endif
+
+#endif	/* BAUDRATE_H */
+
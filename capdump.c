@@ -0,0 +1,908 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This program decodes a binary link capture back into
+ * on-chip debugger commands, with the time each was sent and
+ * how long its reply took.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<inttypes.h>
+#include	<unistd.h>
+#include	<time.h>
+#include	"xmalloc.h"
+
+#include	"ez8.h"
+#include	"capture.h"
+#include	"netproto.h"
+
+/**************************************************************/
+
+#define	PROGNAME	"capdump"
+int raw = 0;
+int quiet = 0;
+
+extern const char *build;
+const char *progname;
+
+/* reply bytes shown per command */
+#define	SHOW_BYTES	16
+
+/**************************************************************/
+
+struct command {
+	uint64_t start;			/* first byte sent */
+	uint64_t end;			/* last reply byte read */
+	const char *name;
+	char args[64];
+	size_t need;			/* reply size */
+	size_t got;
+	uint8_t reply[SHOW_BYTES];
+};
+
+/* commands waiting for their reply, oldest first */
+struct command *pending = NULL;
+int pending_head = 0;
+int pending_count = 0;
+int pending_max = 0;
+
+/* host bytes not yet parsed into a command */
+uint8_t *host = NULL;
+size_t host_len = 0;
+size_t host_max = 0;
+uint64_t host_start;
+
+/* totals */
+struct total {
+	const char *name;
+	unsigned long count;
+	unsigned long replied;
+	uint64_t latency;
+	uint64_t max;
+};
+#define	MAX_TOTALS	32
+struct total totals[MAX_TOTALS];
+int total_count = 0;
+
+unsigned long records = 0;
+uint64_t bytes_out = 0;
+uint64_t bytes_in = 0;
+unsigned long resets = 0;
+unsigned long errors = 0;
+unsigned long unsolicited = 0;
+
+/* server operation waiting for its result */
+struct command op;
+int op_pending = 0;
+
+/**************************************************************/
+
+void help(void)
+{
+printf("%s - build %s\n", progname, build);
+printf(
+"Usage: capdump [OPTIONS] FILE\n"
+"This utility will decode a binary on-chip debugger link capture.\n\n"
+"  -h               show this help\n"
+"  -r               show raw records instead of commands\n"
+"  -s               only show the summary\n"
+"  -o OUTPUT        write results to FILE\n\n");
+printf(
+"Captures are written by ez8mon and flashutil with the -C option.\n"
+"Each command is shown with the time it was sent, in seconds from the\n"
+"start of the capture, and the time from its first byte sent to the last\n"
+"byte of its reply.\n");
+
+	return;
+}
+
+/**************************************************************/
+
+int setup(int argc, char **argv)
+{
+	int c;
+	char *s;
+
+	progname = *argv;
+	s = strrchr(progname, '/');
+	if(s) {
+		progname = s+1;
+	}
+	s = strrchr(progname, '\\');
+	if(s) {
+		progname = s+1;
+	}
+
+	while((c = getopt(argc, argv, "hrso:")) != EOF) {
+		switch(c) {
+		case '?':
+			printf("Try '%s -h' for more information.\n", PROGNAME);
+			return -1;
+		case 'h':
+			help();
+			exit(EXIT_SUCCESS);
+		case 'r':
+			raw = 1;
+			break;
+		case 's':
+			quiet = 1;
+			break;
+		case 'o':
+			if(!freopen(optarg, "w", stdout)) {
+				perror("freopen");
+				return -1;
+			}
+			break;
+		}
+	}
+
+	if(optind >= argc) {
+		fprintf(stderr, "%s: too few arguments\n", PROGNAME);
+		printf("Try '%s -h' for more information.\n", PROGNAME);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * Print bytes in hex, at most max of them.
+ */
+
+void show_bytes(const uint8_t *data, size_t size, size_t max)
+{
+	size_t i;
+
+	for(i=0; i<size && i<max; i++) {
+		printf(" %02X", data[i]);
+	}
+	if(size > max) {
+		printf(" ...");
+	}
+
+	return;
+}
+
+/**************************************************************
+ * A command's reply time is known once its reply is read, or
+ * for a server operation, once its result has arrived.
+ */
+
+int replied(struct command *cmd)
+{
+	if(cmd->need) {
+		return cmd->got == cmd->need;
+	}
+
+	return cmd->end != 0;
+}
+
+/**************************************************************
+ * Add a command to the totals.
+ */
+
+void add_total(struct command *cmd)
+{
+	int i;
+
+	for(i=0; i<total_count; i++) {
+		if(totals[i].name == cmd->name) {
+			break;
+		}
+	}
+	if(i == total_count) {
+		if(total_count >= MAX_TOTALS) {
+			return;
+		}
+		memset(&totals[i], 0, sizeof(struct total));
+		totals[i].name = cmd->name;
+		total_count++;
+	}
+
+	totals[i].count++;
+	if(replied(cmd)) {
+		uint64_t latency;
+
+		latency = cmd->end - cmd->start;
+		totals[i].replied++;
+		totals[i].latency += latency;
+		if(latency > totals[i].max) {
+			totals[i].max = latency;
+		}
+	}
+
+	return;
+}
+
+/**************************************************************
+ * Print a command.
+ */
+
+void show_command(struct command *cmd)
+{
+	add_total(cmd);
+
+	if(quiet) {
+		return;
+	}
+
+	printf("%4" PRIu64 ".%06" PRIu64 "  ",
+	    cmd->start / 1000000, cmd->start % 1000000);
+
+	if(replied(cmd)) {
+		printf("%8" PRIu64 "us  ", cmd->end - cmd->start);
+	} else {
+		printf("%10s  ", "");
+	}
+
+	printf("%s%s", cmd->name, cmd->args);
+
+	if(cmd->need) {
+		printf(" ->");
+		show_bytes(cmd->reply, cmd->got, SHOW_BYTES);
+		if(cmd->got < cmd->need) {
+			printf(" (%lu of %lu bytes)",
+			    (unsigned long)cmd->got, (unsigned long)cmd->need);
+		}
+	}
+	printf("\n");
+
+	return;
+}
+
+/**************************************************************
+ * Print commands at the head of the queue that are complete.
+ * If all is set, print incomplete ones too.
+ */
+
+void show_pending(int all)
+{
+	while(pending_count) {
+		struct command *cmd;
+
+		cmd = &pending[pending_head];
+		if(!all && cmd->got < cmd->need) {
+			break;
+		}
+		show_command(cmd);
+		pending_head = (pending_head + 1) % pending_max;
+		pending_count--;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * Add a command to the pending queue.
+ */
+
+struct command *new_command(void)
+{
+	struct command *cmd;
+
+	if(pending_count == pending_max) {
+		struct command *p;
+		int i, max;
+
+		max = pending_max ? pending_max * 2 : 64;
+		p = (struct command *)xmalloc(max * sizeof(struct command));
+		for(i=0; i<pending_count; i++) {
+			p[i] = pending[(pending_head + i) % pending_max];
+		}
+		free(pending);
+		pending = p;
+		pending_max = max;
+		pending_head = 0;
+	}
+
+	cmd = &pending[(pending_head + pending_count) % pending_max];
+	pending_count++;
+
+	memset(cmd, 0, sizeof(struct command));
+
+	return cmd;
+}
+
+/**************************************************************
+ * This will decode one command from the start of the host
+ * bytes. Returns the command length, or 0 if more bytes are
+ * needed.
+ */
+
+size_t parse_command(const uint8_t *p, size_t len, uint64_t time)
+{
+	struct command *cmd;
+	const char *name;
+	char args[64];
+	size_t size, need;
+	unsigned int n;
+
+	if(!len) {
+		return 0;
+	}
+
+	args[0] = '\0';
+	need = 0;
+
+#define	NEED(x)	do { if(len < (x)) { return 0; } } while(0)
+
+	switch(p[0]) {
+	case DBG_CMD_AUTOBAUD:
+		name = "autobaud";
+		size = 1;
+		break;
+	case DBG_CMD_RD_REVID:
+		name = "rd_revid";
+		size = 1;
+		need = 2;
+		break;
+	case DBG_CMD_WR_CNTR:
+		NEED(3);
+		name = "wr_cntr";
+		size = 3;
+		sprintf(args, " %04X", p[1] << 8 | p[2]);
+		break;
+	case DBG_CMD_RD_DBGSTAT:
+		name = "rd_dbgstat";
+		size = 1;
+		need = 1;
+		break;
+	case DBG_CMD_RD_CNTR:
+		name = "rd_cntr";
+		size = 1;
+		need = 2;
+		break;
+	case DBG_CMD_WR_DBGCTL:
+		NEED(2);
+		name = "wr_dbgctl";
+		size = 2;
+		sprintf(args, " %02X", p[1]);
+		break;
+	case DBG_CMD_RD_DBGCTL:
+		name = "rd_dbgctl";
+		size = 1;
+		need = 1;
+		break;
+	case DBG_CMD_WR_PC:
+		NEED(3);
+		name = "wr_pc";
+		size = 3;
+		sprintf(args, " %04X", p[1] << 8 | p[2]);
+		break;
+	case DBG_CMD_RD_PC:
+		name = "rd_pc";
+		size = 1;
+		need = 2;
+		break;
+	case DBG_CMD_WR_REG:
+	case DBG_CMD_RD_REG:
+		NEED(4);
+		n = p[3] ? p[3] : 0x100;
+		sprintf(args, " %03X %u", (p[1] << 8 | p[2]) & 0xfff, n);
+		if(p[0] == DBG_CMD_WR_REG) {
+			NEED(4 + n);
+			name = "wr_regs";
+			size = 4 + n;
+		} else {
+			name = "rd_regs";
+			size = 4;
+			need = n;
+		}
+		break;
+	case DBG_CMD_WR_MEM:
+	case DBG_CMD_RD_MEM:
+	case DBG_CMD_WR_EDATA:
+	case DBG_CMD_RD_EDATA:
+		NEED(5);
+		n = p[3] << 8 | p[4];
+		if(!n) {
+			n = 0x10000;
+		}
+		sprintf(args, " %04X %u", p[1] << 8 | p[2], n);
+		if(p[0] == DBG_CMD_WR_MEM || p[0] == DBG_CMD_WR_EDATA) {
+			NEED(5 + n);
+			name = p[0] == DBG_CMD_WR_MEM ? "wr_mem" : "wr_data";
+			size = 5 + n;
+		} else {
+			name = p[0] == DBG_CMD_RD_MEM ? "rd_mem" : "rd_data";
+			size = 5;
+			need = n;
+		}
+		break;
+	case DBG_CMD_RD_MEMCRC:
+		name = "rd_crc";
+		size = 1;
+		need = 2;
+		break;
+	case DBG_CMD_STEP_INST:
+		name = "step";
+		size = 1;
+		break;
+	case DBG_CMD_STUFF_INST:
+		NEED(2);
+		name = "stuf";
+		size = 2;
+		sprintf(args, " %02X", p[1]);
+		break;
+	case DBG_CMD_EXEC_INST:
+		/* opcodes are sent with the command in one write */
+		name = "exec";
+		size = len;
+		for(n=1; n<len && n<6; n++) {
+			sprintf(args + strlen(args), " %02X", p[n]);
+		}
+		break;
+	case DBG_CMD_RD_RELOAD:
+		name = "rd_reload";
+		size = 1;
+		need = 2;
+		break;
+	case DBG_CMD_TRCE_CMD:
+		NEED(2);
+		switch(p[1]) {
+		case TRCE_CMD_RD_TRCE_STATUS:
+			name = "rd_trce_status";
+			size = 2;
+			need = 1;
+			break;
+		case TRCE_CMD_WR_TRCE_CTL:
+			NEED(3);
+			name = "wr_trce_ctl";
+			size = 3;
+			sprintf(args, " %02X", p[2]);
+			break;
+		case TRCE_CMD_RD_TRCE_CTL:
+			name = "rd_trce_ctl";
+			size = 2;
+			need = 1;
+			break;
+		case TRCE_CMD_WR_TRCE_EVENT:
+			NEED(16);
+			name = "wr_trce_event";
+			size = 16;
+			sprintf(args, " %u", p[2]);
+			break;
+		case TRCE_CMD_RD_TRCE_EVENT:
+			NEED(3);
+			name = "rd_trce_event";
+			size = 3;
+			need = 13;
+			sprintf(args, " %u", p[2]);
+			break;
+		case TRCE_CMD_RD_TRCE_WR_PTR:
+			name = "rd_trce_wr_ptr";
+			size = 2;
+			need = 2;
+			break;
+		case TRCE_CMD_RD_TRCE_BUFF:
+			NEED(6);
+			n = p[4] << 8 | p[5];
+			if(!n) {
+				n = 0x10000;
+			}
+			name = "rd_trce_buff";
+			size = 6;
+			need = n * 8;
+			sprintf(args, " %04X %u", p[2] << 8 | p[3], n);
+			break;
+		default:
+			name = "trce_unknown";
+			size = 2;
+			sprintf(args, " %02X", p[1]);
+			break;
+		}
+		break;
+	case 0xf3:
+		NEED(2);
+		if(p[1] == 0x84) {
+			name = "rd_memsize";
+			size = 2;
+			need = 1;
+			break;
+		}
+		/* fall through */
+	default:
+		name = "unknown";
+		size = 1;
+		sprintf(args, " %02X", p[0]);
+		break;
+	}
+
+#undef	NEED
+
+	cmd = new_command();
+	cmd->start = time;
+	cmd->name = name;
+	strcpy(cmd->args, args);
+	cmd->need = need;
+
+	return size;
+}
+
+/**************************************************************
+ * Host to on-chip debugger bytes.
+ */
+
+void host_write(uint64_t time, const uint8_t *data, size_t size)
+{
+	size_t len;
+
+	if(host_len + size > host_max) {
+		host_max = (host_len + size) * 2;
+		host = (uint8_t *)xrealloc(host, host_max);
+	}
+	if(!host_len) {
+		host_start = time;
+	}
+	memcpy(host + host_len, data, size);
+	host_len += size;
+	bytes_out += size;
+
+	while((len = parse_command(host, host_len, host_start)) != 0) {
+		host_len -= len;
+		memmove(host, host + len, host_len);
+		host_start = time;
+	}
+
+	show_pending(0);
+
+	return;
+}
+
+/**************************************************************
+ * On-chip debugger to host bytes, handed to the oldest
+ * command still waiting for a reply.
+ */
+
+void host_read(uint64_t time, const uint8_t *data, size_t size)
+{
+	int i;
+
+	bytes_in += size;
+
+	for(i=0; i<pending_count && size; i++) {
+		struct command *cmd;
+		size_t len;
+
+		cmd = &pending[(pending_head + i) % pending_max];
+		if(cmd->got >= cmd->need) {
+			continue;
+		}
+		len = cmd->need - cmd->got;
+		if(len > size) {
+			len = size;
+		}
+		if(cmd->got < SHOW_BYTES) {
+			size_t n;
+
+			n = SHOW_BYTES - cmd->got;
+			memcpy(cmd->reply + cmd->got, data, n < len ? n : len);
+		}
+		cmd->got += len;
+		cmd->end = time;
+		data += len;
+		size -= len;
+	}
+
+	show_pending(0);
+
+	if(size) {
+		/* nothing asked for this, a break acknowledge */
+		unsolicited += size;
+		if(!quiet) {
+			printf("%4" PRIu64 ".%06" PRIu64 "  %10s  %s",
+			    time / 1000000, time % 1000000, "",
+			    size == 1 && *data == 0xff ? "ack" : "unsolicited");
+			show_bytes(data, size, SHOW_BYTES);
+			printf("\n");
+		}
+	}
+
+	return;
+}
+
+/**************************************************************
+ * A debugger operation run by an ocd server for the host.
+ */
+
+void server_op(uint64_t time, const uint8_t *data, size_t size)
+{
+	show_pending(1);
+
+	memset(&op, 0, sizeof(op));
+	op.start = time;
+	op_pending = 1;
+	bytes_out += size;
+
+	switch(size ? data[0] : 0) {
+	case PROTO_RD_MEM:
+		op.name = "srv_rd_mem";
+		if(size >= 7) {
+			sprintf(op.args, " %04X %lu", data[1] << 8 | data[2],
+			    (unsigned long)data[3] << 24 | data[4] << 16 | 
+			    data[5] << 8 | data[6]);
+		}
+		break;
+	case PROTO_WR_MEM:
+		op.name = "srv_wr_mem";
+		if(size >= 3) {
+			sprintf(op.args, " %04X %lu", data[1] << 8 | data[2],
+			    (unsigned long)size - 3);
+		}
+		break;
+	case PROTO_ERASE:
+		op.name = "srv_erase";
+		break;
+	case PROTO_RD_CRC:
+		op.name = "srv_rd_crc";
+		break;
+	case PROTO_RD_REGS:
+		op.name = "srv_rd_regs";
+		if(size >= 5) {
+			sprintf(op.args, " %03X %u", data[1] << 8 | data[2],
+			    data[3] << 8 | data[4]);
+		}
+		break;
+	case PROTO_RUN:
+		op.name = "srv_run";
+		break;
+	case PROTO_STOP:
+		op.name = "srv_stop";
+		break;
+	case PROTO_STEP:
+		op.name = "srv_step";
+		break;
+	default:
+		op.name = "srv_unknown";
+		break;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * The result of a server operation.
+ */
+
+void server_result(uint64_t time, const uint8_t *data, size_t size)
+{
+	bytes_in += size;
+
+	if(!op_pending) {
+		unsolicited += size;
+		return;
+	}
+
+	op.end = time;
+	op.need = op.got = size;
+	memcpy(op.reply, data, size < SHOW_BYTES ? size : SHOW_BYTES);
+	show_command(&op);
+	op_pending = 0;
+
+	return;
+}
+
+/**************************************************************
+ * A reset or error ends any command in progress.
+ */
+
+void host_break(uint64_t time, const char *what, const uint8_t *data,
+    size_t size)
+{
+	show_pending(1);
+	host_len = 0;
+	if(op_pending) {
+		show_command(&op);
+		op_pending = 0;
+	}
+
+	if(quiet) {
+		return;
+	}
+
+	printf("%4" PRIu64 ".%06" PRIu64 "  %10s  %s",
+	    time / 1000000, time % 1000000, "", what);
+	if(data) {
+		size_t i;
+
+		printf(": ");
+		for(i=0; i<size; i++) {
+			if(data[i] == '\n') {
+				if(i+1 < size) {
+					printf(", ");
+				}
+			} else {
+				putchar(data[i]);
+			}
+		}
+	}
+	printf("\n");
+
+	return;
+}
+
+/**************************************************************
+ * Print a record as it is stored.
+ */
+
+void show_record(struct capture_record *rec)
+{
+	static const char *types[] = { "?", "write", "read", "reset", "error",
+	    "op", "result" };
+	size_t i;
+
+	printf("%4" PRIu64 ".%06" PRIu64 "  %-5s %5lu ",
+	    rec->time / 1000000, rec->time % 1000000,
+	    rec->type < 7 ? types[rec->type] : "?",
+	    (unsigned long)rec->size);
+
+	if(rec->type == CAPTURE_ERROR) {
+		for(i=1; i<rec->size; i++) {
+			putchar(rec->data[i] == '\n' ? ' ' : rec->data[i]);
+		}
+		printf("\n");
+		return;
+	}
+
+	for(i=0; i<rec->size; i++) {
+		if(i % 16 == 0 && i) {
+			printf("\n%19s", "");
+		} else if(i % 8 == 0 && i) {
+			printf(" ");
+		}
+		printf(" %02X", rec->data[i]);
+	}
+	printf("\n");
+
+	return;
+}
+
+/**************************************************************/
+
+void show_summary(uint64_t duration)
+{
+	int i;
+
+	printf("\n%lu records over %" PRIu64 ".%06" PRIu64 " seconds\n",
+	    records, duration / 1000000, duration % 1000000);
+	printf("%" PRIu64 " bytes sent, %" PRIu64 " bytes received\n",
+	    bytes_out, bytes_in);
+	printf("%lu resets, %lu errors, %lu unsolicited bytes\n",
+	    resets, errors, unsolicited);
+
+	if(!total_count) {
+		return;
+	}
+
+	printf("\n%-16s %8s %8s %10s %10s\n",
+	    "command", "count", "replies", "avg us", "max us");
+	for(i=0; i<total_count; i++) {
+		printf("%-16s %8lu %8lu ", totals[i].name,
+		    totals[i].count, totals[i].replied);
+		if(totals[i].replied) {
+			printf("%10" PRIu64 " %10" PRIu64 "\n",
+			    totals[i].latency / totals[i].replied,
+			    totals[i].max);
+		} else {
+			printf("%10s %10s\n", "-", "-");
+		}
+	}
+
+	return;
+}
+
+/**************************************************************/
+
+int dump(const char *filename)
+{
+	FILE *fp;
+	uint64_t start, wallclock;
+	struct capture_record rec;
+	time_t t;
+	int err;
+
+	fp = fopen(filename, "rb");
+	if(!fp) {
+		perror(filename);
+		return -1;
+	}
+
+	if(capture_read_header(fp, &start, &wallclock)) {
+		fprintf(stderr, "%s: not a link capture\n", filename);
+		fclose(fp);
+		return -1;
+	}
+
+	t = (time_t)wallclock;
+	printf("%s: captured %s", filename, ctime(&t));
+
+	memset(&rec, 0, sizeof(rec));
+	while((err = capture_read_record(fp, &rec)) == 0) {
+		records++;
+		if(raw) {
+			show_record(&rec);
+			continue;
+		}
+		switch(rec.type) {
+		case CAPTURE_WRITE:
+			host_write(rec.time, rec.data, rec.size);
+			break;
+		case CAPTURE_READ:
+			host_read(rec.time, rec.data, rec.size);
+			break;
+		case CAPTURE_RESET:
+			resets++;
+			host_break(rec.time, "reset", NULL, 0);
+			break;
+		case CAPTURE_ERROR:
+			errors++;
+			host_break(rec.time, rec.size && 
+			    rec.data[0] == CAPTURE_WRITE ? "write error" :
+			    rec.size && rec.data[0] == CAPTURE_RESET ? 
+			    "reset error" : rec.size && 
+			    rec.data[0] == CAPTURE_OP ? "server error" :
+			    "read error",
+			    rec.data + 1, rec.size ? rec.size - 1 : 0);
+			break;
+		case CAPTURE_OP:
+			server_op(rec.time, rec.data, rec.size);
+			break;
+		case CAPTURE_RESULT:
+			server_result(rec.time, rec.data, rec.size);
+			break;
+		default:
+			fprintf(stderr, "%s: unknown record type %02X\n",
+			    filename, rec.type);
+			break;
+		}
+	}
+
+	if(err < 0) {
+		fprintf(stderr, "%s: truncated record\n", filename);
+	}
+
+	if(!raw) {
+		show_pending(1);
+		if(host_len && !quiet) {
+			printf("%10s  %10s  incomplete", "", "");
+			show_bytes(host, host_len, SHOW_BYTES);
+			printf("\n");
+		}
+		show_summary(rec.time);
+	}
+
+	free(rec.data);
+	fclose(fp);
+
+	return 0;
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	int err;
+
+	err = setup(argc, argv);
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	if(optind + 1 < argc) {
+		fprintf(stderr, "%s: too many arguments\n", PROGNAME);
+		return EXIT_FAILURE;
+	}
+
+	err = dump(argv[optind]);
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
+
+/**************************************************************/
+
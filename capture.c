@@ -0,0 +1,336 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * Binary capture of on-chip debugger link traffic.
+ *
+ * Records are collected in memory and written out a buffer at
+ * a time, so capturing costs a clock read and a copy per 
+ * transfer. Error records flush the buffer right away so the
+ * lead-up to a failure is on disk even if the program dies.
+ *
+ * With a size limit, a full capture file is renamed to
+ * FILE.1 (replacing any older one) and a new FILE is started,
+ * so at most about twice the limit is kept.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<time.h>
+#include	<assert.h>
+
+#include	"xmalloc.h"
+#include	"timer.h"
+#include	"capture.h"
+
+/**************************************************************
+ * Store a little endian 64 bit value.
+ */
+
+static void put64(uint8_t *p, uint64_t value)
+{
+	int i;
+
+	for(i=0; i<8; i++) {
+		p[i] = (value >> (i * 8)) & 0xff;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * Fetch a little endian 64 bit value.
+ */
+
+static uint64_t get64(const uint8_t *p)
+{
+	uint64_t value;
+	int i;
+
+	value = 0;
+	for(i=7; i>=0; i--) {
+		value = (value << 8) | p[i];
+	}
+
+	return value;
+}
+
+/**************************************************************
+ * Store a varint, returns the number of bytes used.
+ */
+
+static size_t putvarint(uint8_t *p, uint64_t value)
+{
+	size_t n;
+
+	n = 0;
+	while(value >= 0x80) {
+		p[n++] = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	p[n++] = value;
+
+	return n;
+}
+
+/**************************************************************
+ * Fetch a varint from a file, returns -1 at end of file.
+ */
+
+static int getvarint(FILE *fp, uint64_t *value)
+{
+	int c, shift;
+
+	*value = 0;
+	for(shift=0; shift<64; shift+=7) {
+		c = getc(fp);
+		if(c == EOF) {
+			return -1;
+		}
+		*value |= (uint64_t)(c & 0x7f) << shift;
+		if(!(c & 0x80)) {
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+/**************************************************************
+ * Open the capture file and write its header, with start as
+ * the time the first record's delta is taken from.
+ */
+
+static int capture_start(struct capture *cap, uint64_t start)
+{
+	uint8_t head[CAPTURE_HEADSIZ];
+
+	cap->fp = fopen(cap->path, "wb");
+	if(!cap->fp) {
+		return -1;
+	}
+
+	memcpy(head, CAPTURE_MAGIC, 6);
+	head[6] = CAPTURE_VERSION;
+	head[7] = 0;
+	put64(head + 8, start);
+	put64(head + 16, (uint64_t)time(NULL));
+
+	if(fwrite(head, sizeof(head), 1, cap->fp) != 1 || fflush(cap->fp)) {
+		fclose(cap->fp);
+		cap->fp = NULL;
+		return -1;
+	}
+	cap->size = sizeof(head);
+
+	return 0;
+}
+
+/**************************************************************
+ * This will create a capture file. Returns NULL if the file
+ * cannot be created.
+ */
+
+struct capture *capture_open(const char *path, size_t limit)
+{
+	struct capture *cap;
+
+	assert(path != NULL);
+
+	cap = (struct capture *)xmalloc(sizeof(struct capture));
+	cap->path = xstrdup(path);
+	cap->limit = limit;
+	cap->len = 0;
+	cap->last = timernow();
+
+	if(capture_start(cap, cap->last)) {
+		free(cap->path);
+		free(cap);
+		return NULL;
+	}
+
+	return cap;
+}
+
+/**************************************************************
+ * This will write buffered records to the file, starting a
+ * new file first if the size limit would be exceeded.
+ */
+
+void capture_flush(struct capture *cap)
+{
+	if(!cap->fp || !cap->len) {
+		return;
+	}
+
+	if(cap->limit && cap->size + cap->len > cap->limit) {
+		char *old;
+
+		fclose(cap->fp);
+		old = (char *)xmalloc(strlen(cap->path) + 3);
+		sprintf(old, "%s.1", cap->path);
+		remove(old);
+		rename(cap->path, old);
+		free(old);
+
+		if(capture_start(cap, cap->base)) {
+			cap->len = 0;
+			return;
+		}
+	}
+
+	if(fwrite(cap->buff, cap->len, 1, cap->fp) != 1) {
+		/* out of space, give up capturing */
+		fclose(cap->fp);
+		cap->fp = NULL;
+	} else {
+		cap->size += cap->len;
+		if(fflush(cap->fp)) {
+			fclose(cap->fp);
+			cap->fp = NULL;
+		}
+	}
+	cap->len = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will add a record to the capture.
+ */
+
+void capture_record(struct capture *cap, int type, const uint8_t *data, 
+    size_t size)
+{
+	uint8_t head[1+10+10];
+	uint64_t now;
+	size_t n;
+
+	if(!cap->fp) {
+		return;
+	}
+
+	now = timernow();
+
+	head[0] = type;
+	n = 1;
+	n += putvarint(head + n, now - cap->last);
+	n += putvarint(head + n, size);
+
+	if(cap->len + n + size > sizeof(cap->buff)) {
+		capture_flush(cap);
+	}
+	if(!cap->len) {
+		cap->base = cap->last;
+	}
+	cap->last = now;
+
+	if(n + size > sizeof(cap->buff)) {
+		/* too large to buffer, write it straight out */
+		if(fwrite(head, n, 1, cap->fp) != 1 ||
+		    (size && fwrite(data, size, 1, cap->fp) != 1)) {
+			fclose(cap->fp);
+			cap->fp = NULL;
+			return;
+		}
+		cap->size += n + size;
+	} else {
+		memcpy(cap->buff + cap->len, head, n);
+		if(size) {
+			memcpy(cap->buff + cap->len + n, data, size);
+		}
+		cap->len += n + size;
+	}
+
+	if(type == CAPTURE_ERROR) {
+		capture_flush(cap);
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will flush and close a capture.
+ */
+
+void capture_close(struct capture *cap)
+{
+	if(!cap) {
+		return;
+	}
+
+	capture_flush(cap);
+	if(cap->fp) {
+		fclose(cap->fp);
+	}
+	free(cap->path);
+	free(cap);
+
+	return;
+}
+
+/**************************************************************
+ * This will read and check a capture file header. Returns 0
+ * on success.
+ */
+
+int capture_read_header(FILE *fp, uint64_t *start, uint64_t *wallclock)
+{
+	uint8_t head[CAPTURE_HEADSIZ];
+
+	if(fread(head, sizeof(head), 1, fp) != 1) {
+		return -1;
+	}
+	if(memcmp(head, CAPTURE_MAGIC, 6) || head[6] != CAPTURE_VERSION) {
+		return -1;
+	}
+
+	if(start) {
+		*start = get64(head + 8);
+	}
+	if(wallclock) {
+		*wallclock = get64(head + 16);
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * This will read the next record from a capture file. The
+ * record's time accumulates, so it must be zeroed before the
+ * first call. The data is allocated and replaces (and frees)
+ * any previous record data. Returns 0 on success, 1 at end
+ * of file, or -1 on a truncated or corrupt record.
+ */
+
+int capture_read_record(FILE *fp, struct capture_record *rec)
+{
+	uint64_t delta, size;
+	int type;
+
+	type = getc(fp);
+	if(type == EOF) {
+		return 1;
+	}
+	if(getvarint(fp, &delta) || getvarint(fp, &size)) {
+		return -1;
+	}
+	if(size > 0x1000000) {
+		return -1;
+	}
+
+	rec->type = type;
+	rec->time += delta;
+	rec->size = size;
+	rec->data = (uint8_t *)xrealloc(rec->data, size ? size : 1);
+
+	if(size && fread(rec->data, size, 1, fp) != 1) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
@@ -0,0 +1,92 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * Binary capture of on-chip debugger link traffic.
+ */
+
+#ifndef	CAPTURE_HEADER
+#define	CAPTURE_HEADER
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<inttypes.h>
+
+/**************************************************************
+ * A capture file starts with a header:
+ *
+ *	"EZ8CAP"	magic
+ *	uint8		version (CAPTURE_VERSION)
+ *	uint8		reserved
+ *	uint64		monotonic start time, microseconds
+ *	uint64		wall clock start time, seconds since epoch
+ *
+ * followed by records:
+ *
+ *	uint8		type (CAPTURE_*)
+ *	varint		microseconds since the previous record
+ *	varint		payload length
+ *	payload
+ *
+ * Integers are little endian. Varints are 7 bits per byte,
+ * low bits first, with the top bit set on all but the last.
+ *
+ * The payload of an error record is the type of the transfer
+ * that failed (write, read, reset or op) followed by the message.
+ *
+ * An op record holds a debugger operation a server runs for 
+ * the host, as its protocol request type followed by the 
+ * request. The server's reply follows in a result record.
+ */
+
+#define	CAPTURE_MAGIC		"EZ8CAP"
+#define	CAPTURE_VERSION		1
+#define	CAPTURE_HEADSIZ		24
+
+/* record types */
+#define	CAPTURE_WRITE		0x01	/* host to on-chip debugger */
+#define	CAPTURE_READ		0x02	/* on-chip debugger to host */
+#define	CAPTURE_RESET		0x03	/* link reset (autobaud) */
+#define	CAPTURE_ERROR		0x04	/* error message text */
+#define	CAPTURE_OP		0x05	/* operation run by an ocd server */
+#define	CAPTURE_RESULT		0x06	/* reply to an operation */
+
+/* write buffer size */
+#define	CAPTURE_BUFSIZ		0x10000
+
+struct capture {
+	FILE *fp;
+	char *path;
+	size_t limit;		/* rotate when file exceeds, 0 = never */
+	size_t size;		/* bytes in current file */
+	uint64_t last;		/* time of last record */
+	uint64_t base;		/* time before first buffered record */
+	size_t len;
+	uint8_t buff[CAPTURE_BUFSIZ];
+};
+
+struct capture_record {
+	int type;
+	uint64_t time;		/* microseconds since capture start */
+	size_t size;
+	uint8_t *data;
+};
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+struct capture *capture_open(const char *, size_t);
+void capture_record(struct capture *, int, const uint8_t *, size_t);
+void capture_flush(struct capture *);
+void capture_close(struct capture *);
+
+int capture_read_header(FILE *, uint64_t *, uint64_t *);
+int capture_read_record(FILE *, struct capture_record *);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* CAPTURE_HEADER */
+
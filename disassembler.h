@@ -11,7 +11,12 @@ extern "C" {
 #endif
 
 
+struct opcode_t;
+
 int disassemble(char *, size_t, uint8_t *, uint16_t);
+int opcode_size(const struct opcode_t *);
+const struct opcode_t *find_opcode(uint8_t);
+const struct opcode_t *find_alt_opcode(uint8_t);
 
 
 #ifdef	__cplusplus
@@ -8,7 +8,6 @@
 #include	<stdio.h>
 #include	"err_msg.h"
 
-static char err_buff[BUFSIZ];
-char *err_msg = err_buff;
-const size_t err_len = sizeof(err_buff);
+__thread char err_msg[BUFSIZ];
+const size_t err_len = sizeof(err_msg);
 
@@ -2,19 +2,21 @@
  *
  * $Id: err_msg.h,v 1.1 2004/08/03 14:23:48 jnekl Exp $
  * 
- * Static buffer for error messages.
+ * Static buffer for error messages. Each thread has its own,
+ * so debuggers can be driven from several threads at once.
  */
 
 #ifndef	ERR_MSG_HEADER
 #define	ERR_MSG_HEADER
 
+#include	<stdio.h>
 #include	<stdlib.h>
 
 #ifdef	__cplusplus
 extern "C" {
 #endif
 
-extern char *err_msg;
+extern __thread char err_msg[BUFSIZ];
 extern const size_t err_len;
 
 #ifdef	__cplusplus
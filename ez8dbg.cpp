@@ -23,11 +23,84 @@
 #include	"winunistd.h"
 #endif
 
+#include	"serialport.h"
 #include	"ez8dbg.h"
 #include	"ez8.h"
 #include	"crc.h"
+#include	"mtucache.h"
 #include	"err_msg.h"
 
+/**************************************************************
+ * Program memory sizes, as decoded from the memory size
+ * register by each family of devices.
+ */
+
+static const int memsizes_2k[8] = {
+	0x0800, 0x1000, 0x2000, 0x4000, 0x6000, 0x8000, 0xc000, 0x10000
+};
+
+static const int memsizes_1k[8] = {
+	0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000, 0x10000, 0x10000
+};
+
+static const int memsizes_12k[8] = {
+	0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000, 0x10000, 0x3000
+};
+
+static const int memsizes_24k[8] = {
+	0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000, 0x10000, 0x6000
+};
+
+/**************************************************************
+ * The registers each known revision of the on-chip debugger
+ * has. Revisions not listed have neither a memory size nor a
+ * baud reload register.
+ */
+
+static const struct revision {
+	uint16_t revid;
+	const int *memsizes;
+	bool has_reload;
+} revisions[] = {
+	{ 0x0100, memsizes_2k, 0 },
+	{ 0x0110, memsizes_2k, 0 },
+	{ 0x0120, memsizes_2k, 0 },
+	{ 0x0121, memsizes_2k, 0 },
+	{ 0x0122, memsizes_2k, 0 },
+	{ 0x0123, memsizes_2k, 0 },
+	{ 0x0124, memsizes_1k, 0 },
+	{ 0x0125, memsizes_2k, 0 },
+	{ 0x0126, memsizes_2k, 1 },
+	{ 0x0127, memsizes_2k, 0 },
+	{ 0x0128, memsizes_1k, 0 },
+	{ 0x012A, memsizes_1k, 0 },
+	{ 0x012B, memsizes_2k, 0 },
+	{ 0x012C, memsizes_2k, 0 },
+	{ 0x012D, memsizes_2k, 1 },
+	{ 0x012E, memsizes_1k, 0 },
+	{ 0x012F, memsizes_1k, 0 },
+	{ 0x0130, memsizes_12k, 0 },
+	{ 0x0131, memsizes_24k, 0 },
+	{ 0x0000, NULL, 0 }
+};
+
+/**************************************************************
+ * This will look up a revision, ignoring the emulator bit.
+ */
+
+static const struct revision *find_revision(uint16_t revid)
+{
+	const struct revision *r;
+
+	for(r=revisions; r->memsizes; r++) {
+		if(r->revid == (revid & 0x7fff)) {
+			return r;
+		}
+	}
+
+	return NULL;
+}
+
 /**************************************************************
  * Constructor for the debugger.
  */
@@ -79,9 +152,15 @@ ez8dbg::~ez8dbg(void)
 {
 	int addr;
 
-	while(num_breakpoints > 0) {
-		addr = breakpoints[num_breakpoints-1].address;
-		remove_breakpoint(addr);
+	/* a destructor must not throw, a link that is already
+	 * gone is simply left as it is */
+	try {
+		while(num_breakpoints > 0) {
+			addr = breakpoints[num_breakpoints-1].address;
+			remove_breakpoint(addr);
+		}
+	} catch(char *err) {
+		num_breakpoints = 0;
 	}
 
 	if(main_mem) {
@@ -97,8 +176,11 @@ ez8dbg::~ez8dbg(void)
 		free(buffer);
 	}
 
-	if(dbg && link_open() && link_up()) {
-		ez8ocd::wr_dbgctl(0x00);
+	try {
+		if(dbg && link_open() && link_up()) {
+			ez8ocd::wr_dbgctl(0x00);
+		}
+	} catch(char *err) {
 	}
 
 	return;
@@ -124,6 +206,7 @@ bool ez8dbg::state(enum dbg_state state)
 	 *   This happens when interrupts are being serviced 
 	 *   in the background. */
 	case state_running:
+		cache_status();
 		if(cached_dbgctl() & DBGCTL_DBG_MODE) {
 			/* fully stopped */
 			return 0;
@@ -214,6 +297,26 @@ uint8_t ez8dbg::cached_dbgstat(void)
 	return dbgstat;
 }
 
+/**************************************************************
+ * This will read and cache both the dbgctl and dbgstat 
+ * registers if either is not already cached. The reads go out
+ * as batched writes, though each reply is still waited for.
+ */
+
+void ez8dbg::cache_status(void)
+{
+	if(!(cache & DBGCTL_CACHED)) {
+		queue_rd_dbgctl(&dbgctl);
+	}
+	if(!(cache & DBGSTAT_CACHED)) {
+		queue_rd_dbgstat(&dbgstat);
+	}
+	flush_queue();
+	cache |= DBGCTL_CACHED | DBGSTAT_CACHED;
+
+	return;
+}
+
 /**************************************************************
  * This will read and cache the memory size if it is not
  * already cached.
@@ -234,147 +337,14 @@ uint8_t ez8dbg::cached_memsize(void)
 
 int ez8dbg::memory_size(void)
 {
-	int size = 0;
+	const struct revision *r;
 
-	switch(cached_revid() & 0x7fff) {
-	case 0x0100:
-	case 0x0110:
-	case 0x0120:
-	case 0x0121:
-	case 0x0122:
-	case 0x0123:
-	case 0x0125:
-	case 0x0126:
-	case 0x0127:
-	case 0x012B:
-	case 0x012C:
-	case 0x012D: 	
-		switch(cached_memsize() & 0x07) {
-		case 0x00:	// 2k
-			size = 0x0800;
-			break;
-		case 0x01:	// 4k
-			size = 0x1000;
-			break;
-		case 0x02:	// 8k
-			size = 0x2000;
-			break;
-		case 0x03:	// 16k
-			size = 0x4000;
-			break;
-		case 0x04:	// 24k
-			size = 0x6000;
-			break;
-		case 0x05:	// 32k
-			size = 0x8000;
-			break;
-		case 0x06:	// 48k
-			size = 0xc000;
-			break;
-		case 0x07:	// 64k
-			size = 0x10000;
-			break;
-		default:
-			abort();
-		}
-		break;
-	case 0x0124: 	
-	case 0x0128: 	
-	case 0x012A: 	
-	case 0x012E: 	
-	case 0x012F: 	
-		switch(cached_memsize() & 0x07) {
-		case 0x00:	// 1k
-			size = 0x0400;
-			break;
-		case 0x01:	// 2k
-			size = 0x0800;
-			break;
-		case 0x02:	// 4k
-			size = 0x1000;
-			break;
-		case 0x03:	// 8k 
-			size = 0x2000;
-			break;
-		case 0x04:	// 16k
-			size = 0x4000;
-			break;
-		case 0x05:	// 32k
-			size = 0x8000;
-			break;
-		case 0x06:
-		case 0x07:	// 64k
-			size = 0x10000;
-			break;
-		default:
-			abort();
-		}
-		break;
-	case 0x0130: 	
-		switch(cached_memsize() & 0x07) {
-		case 0x00:	// 1k
-			size = 0x0400;
-			break;
-		case 0x01:	// 2k
-			size = 0x0800;
-			break;
-		case 0x02:	// 4k
-			size = 0x1000;
-			break;
-		case 0x03:	// 8k 
-			size = 0x2000;
-			break;
-		case 0x04:	// 16k
-			size = 0x4000;
-			break;
-		case 0x05:	// 32k
-			size = 0x8000;
-			break;
-		case 0x06:	// 64k
-			size = 0x10000;
-			break;
-		case 0x07:	// 12k
-			size = 0x03000;
-			break;
-		default:
-			abort();
-		}
-		break;
-	case 0x0131: 	
-		switch(cached_memsize() & 0x07) {
-		case 0x00:	// 1k
-			size = 0x0400;
-			break;
-		case 0x01:	// 2k
-			size = 0x0800;
-			break;
-		case 0x02:	// 4k
-			size = 0x1000;
-			break;
-		case 0x03:	// 8k 
-			size = 0x2000;
-			break;
-		case 0x04:	// 16k
-			size = 0x4000;
-			break;
-		case 0x05:	// 32k
-			size = 0x8000;
-			break;
-		case 0x06:	// 64k
-			size = 0x10000;
-			break;
-		case 0x07:	// 24k
-			size = 0x06000;
-			break;
-		default:
-			abort();
-		}
-		break;
-	default:
-		size = 0;
+	r = find_revision(cached_revid());
+	if(!r) {
+		return 0;
 	}
 
-	return size;
+	return r->memsizes[cached_memsize() & 0x07];
 }
 
 /**************************************************************
@@ -423,34 +393,14 @@ uint16_t ez8dbg::cached_reload(void)
 
 uint16_t ez8dbg::rd_reload(void)
 {
-	uint16_t rld;
+	const struct revision *r;
 
-	switch(cached_revid() & 0x7fff) {
-	case 0x0000:
-	case 0x0100:
-	case 0x0110:
-	case 0x0120:
-	case 0x0121:
-	case 0x0122:
-	case 0x0123:
-	case 0x0124:
-	case 0x0125:
-	case 0x0127:
-	case 0x0128:
-	case 0x012A:
-	case 0x012B:
-	case 0x012E:
-	case 0x0130:
-	default:
-		rld = 0x0000;
-		break;
-	case 0x0126:
-	case 0x012D:
-		rld = ez8ocd::rd_reload();
-		break;
+	r = find_revision(cached_revid());
+	if(!r || !r->has_reload) {
+		return 0x0000;
 	}
 
-	return rld;
+	return ez8ocd::rd_reload();
 }
 
 /**************************************************************
@@ -549,6 +499,200 @@ void ez8dbg::reset_chip(void)
 	return;
 }
 
+/**************************************************************
+ * identify()
+ *
+ * This will read and cache the device identification and
+ * status at connect time. The revid, dbgctl and dbgstat reads
+ * go out as batched writes, followed by whichever of the memory
+ * size and baud reload registers the revid says exist.
+ */
+
+void ez8dbg::identify(void)
+{
+	const struct revision *r;
+
+	queue_rd_revid(&revid);
+	queue_rd_dbgctl(&dbgctl);
+	queue_rd_dbgstat(&dbgstat);
+	flush_queue();
+	cache |= REVID_CACHED | DBGCTL_CACHED | DBGSTAT_CACHED;
+
+	r = find_revision(revid);
+	if(!r || !r->has_reload) {
+		reload = 0x0000;
+		cache |= RELOAD_CACHED;
+	}
+	if(!(cache & MEMSIZE_CACHED) && r) {
+		queue_rd_memsize(&memsize);
+	}
+	if(!(cache & RELOAD_CACHED)) {
+		queue_rd_reload(&reload);
+	}
+	flush_queue();
+	if(r) {
+		cache |= MEMSIZE_CACHED;
+	}
+	cache |= RELOAD_CACHED;
+
+	return;
+}
+
+/**************************************************************
+ * negotiate_baudrate()
+ *
+ * This will move the link to the fastest baudrate the on-chip
+ * debugger can autobaud to at the measured system clock (one 
+ * bit must span at least 8 system clocks), limited to max if 
+ * max is non-zero. Each candidate rate is tried with a burst 
+ * of RevID reads and a reload read that must measure the same
+ * clock, falling back to slower rates if it fails. Afterwards,
+ * repeated link errors step the rate back down, but never
+ * below the rate we started at. Returns the new baudrate.
+ */
+
+int ez8dbg::negotiate_baudrate(int max)
+{
+	const struct baudvalue *b;
+	int start, clk, limit, i;
+	uint16_t id, check[BAUD_TEST_BURST], measured;
+	bool found;
+
+	start = link_speed();
+	if(!cached_reload() || !cached_sysclk()) {
+		return start;
+	}
+	id = cached_revid();
+	clk = sysclk;
+
+	limit = clk / 8;
+	if(max && max < limit) {
+		limit = max;
+	}
+
+	for(b=baudrates; b->value; b++) {
+		continue;
+	}
+
+	found = 0;
+	while(!found && b-- != baudrates && b->value > start) {
+		int64_t delta;
+
+		if(b->value > limit) {
+			continue;
+		}
+
+		try {
+			set_baudrate(b->value);
+			ez8ocd::reset_link();
+			for(i=0; i<BAUD_TEST_BURST; i++) {
+				queue_rd_revid(&check[i]);
+			}
+			queue_rd_reload(&measured);
+			flush_queue();
+		} catch(char *err) {
+			continue;
+		}
+
+		for(i=0; i<BAUD_TEST_BURST && check[i] == id; i++) {
+			continue;
+		}
+		delta = (int64_t)measured * b->value / 8 - clk;
+		if(i == BAUD_TEST_BURST && 
+		    delta < clk / 16 && -delta < clk / 16) {
+			found = 1;
+		}
+	}
+
+	if(!found && link_speed() != start) {
+		set_baudrate(start);
+		ez8ocd::reset_link();
+	}
+
+	cache = 0;
+	baud_floor = start;
+
+	return link_speed();
+}
+
+/**************************************************************
+ * discover_mtu()
+ *
+ * This will find the largest reply the link passes without 
+ * losing or garbling data. Program memory is read twice at 
+ * each size, doubling from MTU_PROBE_MIN, and the largest
+ * size read completely and identically both times sets the 
+ * mtu. If every size up to MTU_PROBE_MAX passes, the mtu is
+ * left unlimited. Later failures of long replies shrink the
+ * mtu again (see ez8ocd::read). Returns the new mtu.
+ */
+
+size_t ez8dbg::discover_mtu(void)
+{
+	size_t size, limit, good;
+	uint8_t *a, *b;
+
+	limit = memory_size();
+	if(!limit || limit > MTU_PROBE_MAX) {
+		limit = MTU_PROBE_MAX;
+	}
+
+	a = buffer;
+	b = buffer + MTU_PROBE_MAX;
+
+	mtu = 0;
+	good = 0;
+	for(size = MTU_PROBE_MIN; size <= limit; size *= 2) {
+		try {
+			ez8ocd::rd_mem(0x0000, a, size);
+			ez8ocd::rd_mem(0x0000, b, size);
+		} catch(char *err) {
+			reset_link();
+			break;
+		}
+		if(memcmp(a, b, size)) {
+			break;
+		}
+		good = size;
+	}
+
+	if(good == limit && limit == MTU_PROBE_MAX) {
+		mtu = 0;
+	} else if(good) {
+		mtu = good + 1;
+	} else {
+		mtu = MTU_PROBE_MIN;
+	}
+	mtu_auto = 1;
+
+	return mtu;
+}
+
+/**************************************************************
+ * tune_mtu()
+ *
+ * This will set the mtu remembered for this serial device, 
+ * baudrate and chip, or discover and remember it if there is
+ * none yet. Returns the new mtu.
+ */
+
+size_t ez8dbg::tune_mtu(const char *device)
+{
+	int value;
+
+	value = mtucache_load(device, link_speed(), cached_revid());
+	if(value >= 0) {
+		mtu = value;
+		mtu_auto = 1;
+		return mtu;
+	}
+
+	discover_mtu();
+	mtucache_save(device, link_speed(), cached_revid(), mtu);
+
+	return mtu;
+}
+
 /**************************************************************
  * reset_link()
  *
@@ -579,6 +723,14 @@ void ez8dbg::stop(void)
 		return;
 	}
 
+	/* without breakpoints to track, let the server stop it */
+	if(remote && !num_breakpoints && !tbreak) {
+		remote_stop();
+		cache &= ~(DBGCTL_CACHED | DBGSTAT_CACHED | PC_CACHED | 
+		    CRC_CACHED);
+		return;
+	}
+
 	/* cache dbgctl to see if already stopped */
 	cache &= ~DBGCTL_CACHED;
 	try {
@@ -622,6 +774,14 @@ void ez8dbg::stop(void)
 
 void ez8dbg::run(void)
 {
+	/* without breakpoints to track, let the server run it */
+	if(remote && !num_breakpoints) {
+		remote_run();
+		cache &= ~(DBGCTL_CACHED | DBGSTAT_CACHED | PC_CACHED | 
+		    CRC_CACHED);
+		return;
+	}
+
 	/* check if already running */
 	if(!state(state_stopped)) {
 		return;
@@ -806,6 +966,14 @@ int ez8dbg::isrunning(void)
 
 void ez8dbg::step(void)
 {
+	/* without breakpoints to step over, let the server step */
+	if(remote && !num_breakpoints) {
+		remote_step();
+		cache &= ~(DBGCTL_CACHED | DBGSTAT_CACHED | PC_CACHED | 
+		    CRC_CACHED);
+		return;
+	}
+
 	if(!state(state_stopped)) {
 		strncpy(err_msg, "Could not single step instruction\n"
 		    "device is running\n", err_len-1);
@@ -975,7 +1143,11 @@ uint16_t ez8dbg::rd_crc(void)
 	}
 
 	set_timeout();
-	crc = ez8ocd::rd_crc();
+	if(remote) {
+		crc = remote_rd_crc();
+	} else {
+		crc = ez8ocd::rd_crc();
+	}
 	cache |= CRC_CACHED;
 
 	return crc;
@@ -1015,6 +1187,47 @@ uint16_t ez8dbg::rd_pc(void)
 	return pc;
 }
 
+/**************************************************************
+ * This will read the program counter, the special registers
+ * (flags, rp, sph, spl) and the current working registers.
+ *
+ * The program counter and special register reads go out as
+ * batched writes; the working register location depends on rp.
+ */
+
+void ez8dbg::rd_cpu_regs(uint16_t *pcp, uint8_t *special, uint8_t *working)
+{
+	uint16_t rp;
+
+	assert(special != NULL && working != NULL);
+
+	if(!state(state_stopped)) {
+		strncpy(err_msg, "Cannot read cpu registers\n"
+		    "device is running\n", err_len-1);
+		throw err_msg;
+	}
+
+	if(state(state_protected)) {
+		strncpy(err_msg, "Cannot read cpu registers\n"
+		    "memory read protect enabled\n", err_len-1);
+		throw err_msg;
+	}
+
+	queue_rd_pc(&pc);
+	queue_rd_regs(0xffc, special, 4);
+	flush_queue();
+	cache |= PC_CACHED;
+
+	rp = ((special[1] << 8) | special[1]) & 0x0ff0;
+	ez8ocd::rd_regs(rp, working, 16);
+
+	if(pcp) {
+		*pcp = pc;
+	}
+
+	return;
+}
+
 uint16_t ez8dbg::cached_pc(void)
 {
 	if(!(cache & PC_CACHED)) {
@@ -1072,13 +1285,17 @@ void ez8dbg::rd_regs(uint16_t address, uint8_t *data, size_t size)
 		}
 	}
 
-	if(address + size > EZ8REG_SIZE) {
+	if(!size || address + size > EZ8REG_SIZE) {
 		strncpy(err_msg, "Cannot read register file\n"
 		    "invalid address range\n", err_len-1);
 		throw err_msg;
 	}
 
-	ez8ocd::rd_regs(address, data, size);
+	if(remote) {
+		remote_rd_regs(address, data, size);
+	} else {
+		ez8ocd::rd_regs(address, data, size);
+	}
 
 	return;
 }
@@ -33,6 +33,9 @@
 /* 5 second reset timeout (typical reset is 10ms) */
 #define	RESET_TIMEOUT	5
 
+/* RevID reads used to try out a negotiated baudrate */
+#define	BAUD_TEST_BURST	32
+
 /**************************************************************/
 
 class ez8dbg : public ez8ocd
@@ -78,6 +81,7 @@ private:
 	uint8_t  cached_dbgstat(void);
 	uint16_t cached_memcrc(void);
 	uint8_t  cached_memsize(void);
+	void cache_status(void);
 	void cache_freq(void);
 	void set_timeout(void);
 
@@ -107,6 +111,10 @@ public:
 
 	void reset_chip(void);
 	void reset_link(void);
+	void identify(void);
+	int negotiate_baudrate(int);
+	size_t discover_mtu(void);
+	size_t tune_mtu(const char *);
 
 	void stop(void);
 	void run(void);
@@ -125,6 +133,7 @@ public:
 	void wr_pc(uint16_t);
 	void rd_regs(uint16_t, uint8_t *, size_t);
 	void wr_regs(uint16_t, const uint8_t *, size_t);
+	void rd_cpu_regs(uint16_t *, uint8_t *, uint8_t *);
 	void rd_data(uint16_t, uint8_t *, size_t);
 	void wr_data(uint16_t, const uint8_t *, size_t);
 	void rd_mem(uint16_t, uint8_t *, size_t);
@@ -96,7 +96,11 @@ void ez8dbg::rd_mem(uint16_t address, uint8_t *data, size_t size)
 	}
 
 	cache &= ~MEMCRC_CACHED;
-	ez8ocd::rd_mem(address, main_mem+address, size);
+	if(remote) {
+		remote_rd_mem(address, main_mem+address, size);
+	} else {
+		ez8ocd::rd_mem(address, main_mem+address, size);
+	}
 	memcpy(data, main_mem+address, size);
 
 	return;
@@ -201,6 +205,14 @@ void ez8dbg::wr_mem(uint16_t address, const uint8_t *data, size_t size)
 		throw err_msg;
 	}
 
+	/* the server erases and programs the pages in one request */
+	if(remote) {
+		cache &= ~(CRC_CACHED | MEMCRC_CACHED);
+		remote_wr_mem(address, data, size);
+		memcpy(main_mem + address, data, size);
+		return;
+	}
+
 	save_flash_state(flash_state);
 
 	/* calculate block address (must start on page boundary) */
@@ -618,6 +630,11 @@ void ez8dbg::mass_erase(bool info)
 	/* invalidate cache */
 	cache &= ~(CRC_CACHED | MEMCRC_CACHED);
 
+	if(remote && !info) {
+		remote_erase();
+		return;
+	}
+
 	/* execute mass erase */
 	flash_setup(info?0x80:0x00);
 	wr_regs(EZ8_FIF_BASE, erase, 1);
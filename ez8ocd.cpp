@@ -11,14 +11,19 @@
 #include	<stdlib.h>
 #include	<assert.h>
 #include	<stdarg.h>
+#include	<errno.h>
 
 #include	"xmalloc.h"
 #include	"err_msg.h"
+#include	"timer.h"
 
 #include	"ocd.h"
 #include	"ocd_serial.h"
 #include	"ocd_parport.h"
 #include	"ocd_tcpip.h"
+#include	"ocd_replay.h"
+#include	"ocd_sim.h"
+#include	"netproto.h"
 #include	"ez8ocd.h"
 #include	"ez8.h"
 
@@ -32,8 +37,33 @@ ez8ocd::ez8ocd()
 	dbg = NULL;
 	cache = 0;
 	mtu = 0;
+	mtu_auto = 0;
 	callback = NULL;
 
+	queue_cmd = NULL;
+	queue_len = 0;
+	queue_max = 0;
+	queue_reply = NULL;
+	queue_replies = 0;
+	queue_reply_max = 0;
+	queue_check = 0;
+	queue_busy = 0;
+
+	check_interval = 0;
+	unchecked = 0;
+	check_valid = 0;
+
+	baud_floor = 0;
+	link_batches = 0;
+	link_errors = 0;
+
+	stats = (struct ocd_stat *)xmalloc(256 * sizeof(struct ocd_stat));
+	clear_stats();
+
+	capture = NULL;
+	faults = NULL;
+	remote = NULL;
+
 	return;
 }
 
@@ -49,14 +79,28 @@ ez8ocd::~ez8ocd()
 		dbg = NULL;
 	}
 
+	if(queue_cmd) {
+		free(queue_cmd);
+	}
+	if(queue_reply) {
+		free(queue_reply);
+	}
+	free(stats);
+	stop_capture();
+
 	return;
 }
 
 /**************************************************************
  * This will connect the debugger to the specified serial port.
+ *
+ * If loopback is false, the adapter does not echo transmitted
+ * data, so a RevID probe is sent every so often instead to
+ * catch a corrupted link.
  */
 
-void ez8ocd::connect_serial(const char *device, int baudrate, int unlock_ocd)
+void ez8ocd::connect_serial(const char *device, int baudrate, int unlock_ocd,
+                            bool loopback)
 {
 	ocd_serial *ocdptr;
 
@@ -69,7 +113,7 @@ void ez8ocd::connect_serial(const char *device, int baudrate, int unlock_ocd)
 	ocdptr = new ocd_serial();
 
 	try {
-		ocdptr->connect(device, baudrate, unlock_ocd);
+		ocdptr->connect(device, baudrate, unlock_ocd, loopback);
 	} catch(char *err) {
 		delete ocdptr;
 		throw err;
@@ -77,6 +121,10 @@ void ez8ocd::connect_serial(const char *device, int baudrate, int unlock_ocd)
 
 	dbg = ocdptr;
 
+	check_interval = loopback ? 0 : LINK_CHECK_INTERVAL;
+	unchecked = 0;
+	check_valid = 0;
+
 	return;
 }
 
@@ -109,10 +157,11 @@ void ez8ocd::connect_parport(const char *device)
 }
 
 /**************************************************************
- * This will connect the debugger to the specified serial port.
+ * This will connect the debugger to an ocd server. If monitor
+ * is set, the server only lets it read from the device.
  */
 
-void ez8ocd::connect_tcpip(const char *device)
+void ez8ocd::connect_tcpip(const char *device, bool monitor)
 {
 	ocd_tcpip *ocdptr;
 
@@ -125,7 +174,68 @@ void ez8ocd::connect_tcpip(const char *device)
 	ocdptr = new ocd_tcpip();
 
 	try {
-		ocdptr->connect(device);
+		ocdptr->connect(device, monitor);
+	} catch(char *err) {
+		delete ocdptr;
+		throw err;
+	}
+
+	dbg = ocdptr;
+	if(ocdptr->remote_ops()) {
+		remote = ocdptr;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will connect the debugger to a capture to replay.
+ */
+
+void ez8ocd::connect_replay(const char *filename, int baudrate)
+{
+	ocd_replay *ocdptr;
+
+	if(dbg) {
+		strncpy(err_msg, "Cannot replay capture\n"
+		    "already connected\n", err_len-1);
+		throw err_msg;
+	}
+
+	ocdptr = new ocd_replay();
+
+	try {
+		ocdptr->connect(filename, baudrate);
+	} catch(char *err) {
+		delete ocdptr;
+		throw err;
+	}
+
+	dbg = ocdptr;
+
+	return;
+}
+
+/**************************************************************
+ * This will connect the debugger to a simulated device. The
+ * device is chosen by spec, see ocd_sim. The clock is the
+ * simulated system clock.
+ */
+
+void ez8ocd::connect_sim(const char *spec, int baudrate, int clk)
+{
+	ocd_sim *ocdptr;
+
+	if(dbg) {
+		strncpy(err_msg, "Cannot connect to simulator\n"
+		    "already connected\n", err_len-1);
+		throw err_msg;
+	}
+
+	ocdptr = new ocd_sim();
+
+	try {
+		ocdptr->connect(spec, baudrate, clk);
 	} catch(char *err) {
 		delete ocdptr;
 		throw err;
@@ -136,6 +246,27 @@ void ez8ocd::connect_tcpip(const char *device)
 	return;
 }
 
+/**************************************************************
+ * This will connect the debugger to a port as given on a 
+ * command line: "sim[:spec]" for a simulated device, else
+ * a serial port.
+ */
+
+void ez8ocd::connect_port(const char *port, int baudrate, int clk, 
+                          int unlock_ocd, bool loopback)
+{
+	assert(port != NULL);
+
+	if(!strncasecmp(port, "sim", 3) && 
+	    (port[3] == '\0' || port[3] == ':')) {
+		connect_sim(port[3] ? port + 4 : NULL, baudrate, clk);
+	} else {
+		connect_serial(port, baudrate, unlock_ocd, loopback);
+	}
+
+	return;
+}
+
 /**************************************************************
  * If we are currently connected to an interface, disconnect
  * from it.
@@ -151,6 +282,119 @@ void ez8ocd::disconnect(void)
 
 	delete dbg;
 	dbg = NULL;
+	faults = NULL;
+	remote = NULL;
+
+	check_interval = 0;
+	check_valid = 0;
+	baud_floor = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will log data sent to or received from the on-chip
+ * debugger, if protocol logging is enabled.
+ */
+
+void ez8ocd::log_data(const char *dir, const uint8_t *buff, size_t size)
+{
+	size_t i;
+
+	if(!log_proto) {
+		return;
+	}
+
+	fprintf(log_proto, "%s\t", dir);
+
+	for(i=0; i<size; i++) {
+		if(i % 16 == 0 && i) {
+			fprintf(log_proto, "\n\t");
+		} else if(i % 8 == 0 && i) {
+			fprintf(log_proto, " ");
+		}
+		fprintf(log_proto, "%02X ", buff[i]);
+	}
+	fprintf(log_proto, "\n");
+
+	return;
+}
+
+/**************************************************************
+ * This will account for data about to be sent to the on-chip
+ * debugger, and for it once it has been sent.
+ */
+
+void ez8ocd::sending(const uint8_t *buff, size_t size)
+{
+	log_data("dbg <-", buff, size);
+
+	if(callback) {
+		callback();
+	}
+	unchecked += size;
+	if(capture) {
+		capture_record(capture, CAPTURE_WRITE, buff, size);
+	}
+
+	return;
+}
+
+void ez8ocd::sent(size_t size)
+{
+	if(stat_op >= 0) {
+		stats[stat_op].bytes_out += size;
+		stat_wrote = 1;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will account for data received from the on-chip 
+ * debugger.
+ */
+
+void ez8ocd::received(const uint8_t *buff, size_t size)
+{
+	if(capture) {
+		capture_record(capture, CAPTURE_READ, buff, size);
+	}
+
+	if(stat_op >= 0) {
+		stats[stat_op].bytes_in += size;
+		if(stat_wrote) {
+			stats[stat_op].turnarounds++;
+			stat_wrote = 0;
+		}
+	}
+
+	/* if protocol logging enabled, log what we read */
+	log_data("dbg ->", buff, size);
+
+	return;
+}
+
+/**************************************************************
+ * This will account for a failed transfer of size bytes.
+ */
+
+void ez8ocd::failed(int type, const char *err, size_t size)
+{
+	if(log_proto) {
+		fprintf(log_proto, "%s", err);
+	}
+	capture_error(type, err);
+	if(stat_op >= 0) {
+		stats[stat_op].errors++;
+		stat_op = -1;
+	}
+
+	/* a long reply failed, shorten the ones that follow */
+	if(type == CAPTURE_READ && mtu_auto && size > MTU_PROBE_MIN && 
+	    (!mtu || size * 2 >= mtu)) {
+		mtu = size / 2 > MTU_PROBE_MIN ? size / 2 : MTU_PROBE_MIN;
+	}
 
 	return;
 }
@@ -170,34 +414,22 @@ void ez8ocd::read(uint8_t *buff, size_t size)
 		throw err_msg;
 	}
 
+	/* keep queued commands in order with direct access */
+	if(queue_len && !queue_busy) {
+		flush_queue();
+	}
+
 	if(callback) {
 		callback();
 	}
 	try {
 		dbg->read(buff, size);
 	} catch(char *err) {
-		if(log_proto) {
-			fprintf(log_proto, "%s", err);
-		}
+		failed(CAPTURE_READ, err, size);
 		throw err;
 	}
 
-	/* if protocol logging enabled, log what we read */
-	if(log_proto) {
-		size_t i;
-
-		fprintf(log_proto, "dbg ->\t");
-
-		for(i=0; i<size; i++) {
-			if(i % 16 == 0 && i) {
-				fprintf(log_proto, "\n\t");
-			} else if(i % 8 == 0 && i) {
-				fprintf(log_proto, " ");
-			}
-			fprintf(log_proto, "%02X ", buff[i]);
-		}
-		fprintf(log_proto, "\n");
-	}
+	received(buff, size);
 
 	return;
 }
@@ -217,6 +449,11 @@ void ez8ocd::write(const uint8_t *buff, size_t size)
 		throw err_msg;
 	}
 
+	/* keep queued commands in order with direct access */
+	if(queue_len && !queue_busy) {
+		flush_queue();
+	}
+
 	while(size > 0) {
 		int len;
 
@@ -225,33 +462,15 @@ void ez8ocd::write(const uint8_t *buff, size_t size)
 		} else {
 			len = size;
 		}
-		if(log_proto) {
-			int i;
-
-			fprintf(log_proto, "dbg <-\t");
-
-			for(i=0; i<len; i++) {
-				if(i % 16 == 0 && i) {
-					fprintf(log_proto, "\n\t");
-				} else if(i % 8 == 0 && i) {
-					fprintf(log_proto, " ");
-				}
-				fprintf(log_proto, "%02X ", buff[i]);
-			}
-			fprintf(log_proto, "\n");
-		}
 
-		if(callback) {
-			callback();
-		}
+		sending(buff, len);
 		try {
 			dbg->write(buff, len);
 		} catch(char *err) {
-			if(log_proto) {
-				fprintf(log_proto, "%s", err);
-			}
+			failed(CAPTURE_WRITE, err, len);
 			throw err;
 		}
+		sent(len);
 
 		buff += len;
 		size -= len;
@@ -260,6 +479,207 @@ void ez8ocd::write(const uint8_t *buff, size_t size)
 	return;
 }
 
+/**************************************************************
+ * This will write a command to the on-chip debugger and read
+ * its reply, in one exchange where the link can do that (over
+ * the network this saves a round trip). A command longer than
+ * the mtu is written and read separately.
+ */
+
+void ez8ocd::transact(const uint8_t *out, size_t outsize, uint8_t *in, 
+    size_t insize)
+{
+	assert(in != NULL && insize != 0);
+
+	if(!outsize) {
+		read(in, insize);
+		return;
+	}
+	if(!dbg) {
+		strncpy(err_msg, "Cannot write to on-chip debugger\n"
+		    "not connected\n", err_len-1);
+		throw err_msg;
+	}
+
+	/* a link that writes and then reads reports which failed */
+	if(!dbg->combined() || (mtu > 0 && outsize > mtu)) {
+		write(out, outsize);
+		read(in, insize);
+		return;
+	}
+
+	/* keep queued commands in order with direct access */
+	if(queue_len && !queue_busy) {
+		flush_queue();
+	}
+
+	/* a failed exchange is one failure, the reply lost with it */
+	sending(out, outsize);
+	try {
+		dbg->transact(out, outsize, in, insize);
+	} catch(char *err) {
+		failed(CAPTURE_READ, err, insize);
+		throw err;
+	}
+	sent(outsize);
+	received(in, insize);
+
+	return;
+}
+
+/**************************************************************
+ * This will run a debugger operation on the ocd server. The
+ * request starts with its protocol type. It is logged, 
+ * captured and counted like a command to the on-chip 
+ * debugger, under its protocol type, which no command uses.
+ */
+
+void ez8ocd::remote_op(const uint8_t *request, size_t size, uint8_t *in,
+    size_t insize)
+{
+	assert(remote != NULL && size > 0);
+
+	stat_begin(request[0]);
+
+	log_data("srv <-", request, size);
+	if(callback) {
+		callback();
+	}
+	if(capture) {
+		capture_record(capture, CAPTURE_OP, request, size);
+	}
+
+	try {
+		remote->remote_op(request[0], request + 1, size - 1, in, 
+		    insize);
+	} catch(char *err) {
+		failed(CAPTURE_OP, err, insize);
+		throw err;
+	}
+	sent(size);
+
+	if(capture) {
+		capture_record(capture, CAPTURE_RESULT, in, insize);
+	}
+	stats[stat_op].bytes_in += insize;
+	stats[stat_op].turnarounds++;
+	log_data("srv ->", in, insize);
+
+	stat_end();
+
+	return;
+}
+
+/**************************************************************
+ * These build the requests for the operations a server runs.
+ */
+
+void ez8ocd::remote_rd_mem(uint16_t address, uint8_t *data, size_t size)
+{
+	uint8_t request[7];
+
+	request[0] = PROTO_RD_MEM;
+	request[1] = address >> 8;
+	request[2] = address;
+	request[3] = size >> 24;
+	request[4] = size >> 16;
+	request[5] = size >> 8;
+	request[6] = size;
+
+	remote_op(request, 7, data, size);
+
+	return;
+}
+
+void ez8ocd::remote_wr_mem(uint16_t address, const uint8_t *data, 
+    size_t size)
+{
+	uint8_t *request;
+
+	if(size > PROTO_MAXDATA) {
+		strncpy(err_msg, "Could not write memory\n"
+		    "invalid address range\n", err_len-1);
+		throw err_msg;
+	}
+
+	request = (uint8_t *)xmalloc(size + 3);
+	request[0] = PROTO_WR_MEM;
+	request[1] = address >> 8;
+	request[2] = address;
+	memcpy(request + 3, data, size);
+
+	try {
+		remote_op(request, size + 3, NULL, 0);
+	} catch(char *err) {
+		free(request);
+		throw err;
+	}
+	free(request);
+
+	return;
+}
+
+void ez8ocd::remote_erase(void)
+{
+	const uint8_t request[1] = { PROTO_ERASE };
+
+	remote_op(request, 1, NULL, 0);
+
+	return;
+}
+
+uint16_t ez8ocd::remote_rd_crc(void)
+{
+	const uint8_t request[1] = { PROTO_RD_CRC };
+	uint8_t crc[2];
+
+	remote_op(request, 1, crc, 2);
+
+	return crc[0] << 8 | crc[1];
+}
+
+void ez8ocd::remote_rd_regs(uint16_t address, uint8_t *data, size_t size)
+{
+	uint8_t request[5];
+
+	request[0] = PROTO_RD_REGS;
+	request[1] = address >> 8;
+	request[2] = address;
+	request[3] = size >> 8;
+	request[4] = size;
+
+	remote_op(request, 5, data, size);
+
+	return;
+}
+
+void ez8ocd::remote_run(void)
+{
+	const uint8_t request[1] = { PROTO_RUN };
+
+	remote_op(request, 1, NULL, 0);
+
+	return;
+}
+
+void ez8ocd::remote_stop(void)
+{
+	const uint8_t request[1] = { PROTO_STOP };
+
+	remote_op(request, 1, NULL, 0);
+
+	return;
+}
+
+void ez8ocd::remote_step(void)
+{
+	const uint8_t request[1] = { PROTO_STEP };
+
+	remote_op(request, 1, NULL, 0);
+
+	return;
+}
+
 /**************************************************************
  * This will determine if the on-chip debugger link is open.
  */
@@ -336,7 +756,7 @@ void ez8ocd::reset_link(void)
 		throw err_msg;
 	}
 
-	dbg->reset();
+	reset_dbg();
 
 	return;
 }
@@ -348,28 +768,42 @@ void ez8ocd::reset_link(void)
 void ez8ocd::new_command(void)
 {
 	if(dbg->error()) {
-		dbg->reset();
+		reset_dbg();
 		cache = 0;
 	}
 }
 
 /**************************************************************
- * This will retrieve the ez8 DBG RevID.
+ * This will autobaud the link, capturing the reset and any
+ * error it raises.
  */
 
-uint16_t ez8ocd::rd_revid(void)
+void ez8ocd::reset_dbg(void)
 {
-	uint16_t revid;
-	uint8_t command[1];
-	uint8_t data[2];
+	if(capture) {
+		capture_record(capture, CAPTURE_RESET, NULL, 0);
+	}
+	try {
+		dbg->reset();
+	} catch(char *err) {
+		capture_error(CAPTURE_RESET, err);
+		throw err;
+	}
+	stat_resets++;
 
-	command[0] = DBG_CMD_RD_REVID;
+	return;
+}
 
-	new_command();
-	write(command, 1);
-	read(data, 2);
+/**************************************************************
+ * This will retrieve the ez8 DBG RevID.
+ */
+
+uint16_t ez8ocd::rd_revid(void)
+{
+	uint16_t revid;
 
-	revid = (data[0] << 8) | data[1];
+	queue_rd_revid(&revid);
+	flush_queue();
 
 	return revid;
 }
@@ -380,16 +814,12 @@ uint16_t ez8ocd::rd_revid(void)
 
 uint8_t ez8ocd::rd_dbgstat(void)
 {
-	uint8_t command[1];
-	uint8_t data[1];
-
-	command[0] = DBG_CMD_RD_DBGSTAT;
+	uint8_t data;
 
-	new_command();
-	write(command, 1);
-	read(data, 1);
+	queue_rd_dbgstat(&data);
+	flush_queue();
 
-	return *data;
+	return data;
 }
 
 /**************************************************************
@@ -425,13 +855,8 @@ bool ez8ocd::rd_ack(void)
 
 void ez8ocd::wr_dbgctl(uint8_t data)
 {
-	uint8_t command[2];
-
-	command[0] = DBG_CMD_WR_DBGCTL;
-	command[1] = data;
-
-	new_command();
-	write(command, 2);
+	queue_wr_dbgctl(data);
+	flush_queue();
 
 	return;
 }
@@ -442,16 +867,12 @@ void ez8ocd::wr_dbgctl(uint8_t data)
 
 uint8_t ez8ocd::rd_dbgctl(void)
 {
-	uint8_t command[1];
-	uint8_t data[1];
+	uint8_t data;
 
-	command[0] = DBG_CMD_RD_DBGCTL;
-
-	new_command();
-	write(command, 1);
-	read(data, 1);
+	queue_rd_dbgctl(&data);
+	flush_queue();
 
-	return *data;
+	return data;
 }
 
 /**************************************************************
@@ -460,14 +881,8 @@ uint8_t ez8ocd::rd_dbgctl(void)
 
 void ez8ocd::wr_cntr(uint16_t cntr) 
 {
-	uint8_t command[3];
-
-	command[0] = DBG_CMD_WR_CNTR;
-	command[1] = (cntr >> 8) & 0xff;
-	command[2] = cntr & 0xff;
-
-	new_command();
-	write(command, 3);
+	queue_wr_cntr(cntr);
+	flush_queue();
 
 	return;
 }
@@ -479,16 +894,9 @@ void ez8ocd::wr_cntr(uint16_t cntr)
 uint16_t ez8ocd::rd_cntr(void) 
 {
 	uint16_t cntr;
-	uint8_t command[1];
-	uint8_t data[2];
-
-	command[0] = DBG_CMD_RD_CNTR;
-
-	new_command();
-	write(command, 1);
-	read(data, 2);
 
-	cntr = (data[0] << 8) | data[1];
+	queue_rd_cntr(&cntr);
+	flush_queue();
 
 	return cntr;
 }
@@ -499,14 +907,8 @@ uint16_t ez8ocd::rd_cntr(void)
 
 void ez8ocd::wr_pc(uint16_t pc)
 {
-	uint8_t command[3];
-
-	command[0] = DBG_CMD_WR_PC;
-	command[1] = (pc >> 8) & 0xff;
-	command[2] = pc & 0xff;
-
-	new_command();
-	write(command, 3);
+	queue_wr_pc(pc);
+	flush_queue();
 
 	return;
 }
@@ -518,16 +920,9 @@ void ez8ocd::wr_pc(uint16_t pc)
 uint16_t ez8ocd::rd_pc(void)
 {
 	uint16_t pc;
-	uint8_t command[1];
-	uint8_t data[2];
-
-	command[0] = DBG_CMD_RD_PC;
-
-	new_command();
-	write(command, 1);
-	read(data, 2);
 
-	pc = (data[0] << 8) | data[1];
+	queue_rd_pc(&pc);
+	flush_queue();
 
 	return pc;
 }
@@ -538,30 +933,8 @@ uint16_t ez8ocd::rd_pc(void)
 
 void ez8ocd::wr_regs(uint16_t address, const uint8_t *buff, size_t size)
 {
-	uint8_t command[4];
-
-	assert((long)address + size <= EZ8REG_SIZE);
-	assert(size != 0);
-
-	command[0] = DBG_CMD_WR_REG;
-
-	while(size > 0) {
-		size_t len;
-
-		len = size > EZ8REG_BUFSIZ ?  EZ8REG_BUFSIZ : size;
-
-		command[1] = (address >> 8) & 0xff;
-		command[2] = address & 0xff;
-		command[3] = len < EZ8REG_BUFSIZ ? len & 0xff : 0;
-
-		new_command();
-		write(command, 4);
-		write(buff, len);
-
-		address += len;
-		buff += len;
-		size -= len;
-	}
+	queue_wr_regs(address, buff, size);
+	flush_queue();
 
 	return;
 }
@@ -572,40 +945,8 @@ void ez8ocd::wr_regs(uint16_t address, const uint8_t *buff, size_t size)
 
 void ez8ocd::rd_regs(uint16_t address, uint8_t *buff, size_t size)
 {
-	uint8_t command[4];
-
-	assert((long)address + size <= EZ8REG_SIZE);
-	assert(size != 0);
-
-	command[0] = DBG_CMD_RD_REG;
-
-	while(size > 0) {
-		size_t len;
-
-		len = size > EZ8REG_BUFSIZ ? EZ8REG_BUFSIZ : size;
-		if(mtu > 0 && len > mtu-1) {
-			len = mtu-1;
-		}
-
-		command[1] = (address >> 8) & 0xff;
-		command[2] = address & 0xff;
-		command[3] = len < EZ8REG_BUFSIZ ?  len & 0xff : 0;
-
-		if(mtu > 0 && len+4 > mtu) {
-			new_command();
-			write(command, 3);
-			write(command+3, 1);
-		} else {
-			new_command();
-			write(command, 4);
-		}
-
-		read(buff, len);
-
-		address += len;
-		buff += len;
-		size -= len;
-	}
+	queue_rd_regs(address, buff, size);
+	flush_queue();
 
 	return;
 }
@@ -628,8 +969,10 @@ void ez8ocd::wr_mem(uint16_t address, const uint8_t *buff, size_t size)
 		command[3] = (size >> 8) & 0xff;
 		command[4] = size & 0xff;
 
+		stat_begin(command[0]);
 		write(command, 5);
 		write(buff, size);
+		stat_end();
 	}
 
 	return;
@@ -659,14 +1002,9 @@ void ez8ocd::rd_mem(uint16_t address, uint8_t *buff, size_t size)
 		command[3] = (len >> 8) & 0xff;
 		command[4] = len & 0xff;
 	
-		if(mtu > 0 && len+5 > mtu) {
-			write(command, 4);
-			write(command+4, 1);
-		} else {
-			write(command, 5);
-		}
-
-		read(buff, len);
+		stat_begin(command[0]);
+		transact(command, 5, buff, len);
+		stat_end();
 
 		address += len;
 		buff += len;
@@ -694,8 +1032,10 @@ void ez8ocd::wr_data(uint16_t address, const uint8_t *buff, size_t size)
 		command[3] = (size >> 8) & 0xff;
 		command[4] = size & 0xff;
 	
+		stat_begin(command[0]);
 		write(command, 5);
 		write(buff, size);
+		stat_end();
 	}
 
 	return;
@@ -725,14 +1065,9 @@ void ez8ocd::rd_data(uint16_t address, uint8_t *buff, size_t size)
 		command[3] = (len >> 8) & 0xff;
 		command[4] = len & 0xff;
 
-		if(mtu > 0 && len+5 > mtu) {
-			write(command, 4);
-			write(command+4, 1);
-		} else {
-			write(command, 5);
-		}
-
-		read(buff, len);
+		stat_begin(command[0]);
+		transact(command, 5, buff, len);
+		stat_end();
 
 		address += len;
 		buff += len;
@@ -754,8 +1089,9 @@ uint16_t ez8ocd::rd_crc(void)
 
 	command[0] = DBG_CMD_RD_MEMCRC;
 		
-	write(command, 1);
-	read(data, 2);
+	stat_begin(command[0]);
+	transact(command, 1, data, 2);
+	stat_end();
 
 	crc = (data[0] << 8) | data[1];
 
@@ -772,7 +1108,9 @@ void ez8ocd::step_inst(void)
 
 	command[0] = DBG_CMD_STEP_INST;
 
+	stat_begin(command[0]);
 	write(command, 1);
+	stat_end();
 
 	return;
 }
@@ -789,7 +1127,9 @@ void ez8ocd::stuf_inst(uint8_t opcode)
 	command[0] = DBG_CMD_STUFF_INST;
 	command[1] = opcode;
 
+	stat_begin(command[0]);
 	write(command, 2);
+	stat_end();
 
 	return;
 }
@@ -807,44 +1147,33 @@ void ez8ocd::exec_inst(const uint8_t *opcodes, size_t size)
 	command[0] = DBG_CMD_EXEC_INST;
 	memcpy(command+1, opcodes, size);
 
+	stat_begin(command[0]);
 	write(command, size+1);
+	stat_end();
 
 	return;
 }
 
 /**************************************************************/
-
 uint16_t ez8ocd::rd_reload(void)
 {
-	uint8_t command[1];
-	uint8_t data[2];
 	uint16_t reload;
 
-	command[0] = DBG_CMD_RD_RELOAD;
-
-	new_command();
-	write(command, 1);
-	read(data, 2);
-
-	reload = (data[0] << 8) | data[1];
+	queue_rd_reload(&reload);
+	flush_queue();
 
 	return reload;
 }
 
 /**************************************************************/
-
 uint8_t ez8ocd::rd_memsize(void)
 {
-	uint8_t command[2];
-	uint8_t data[1];
+	uint8_t memsize;
 
-	command[0] = 0xf3;
-	command[1] = 0x84;
-
-	write(command, 2);
-	read(data, 1);
+	queue_rd_memsize(&memsize);
+	flush_queue();
 
-	return *data;
+	return memsize;
 }
 
 /**************************************************************/
@@ -857,8 +1186,9 @@ uint8_t ez8ocd::rd_trce_status(void)
 	command[0] = DBG_CMD_TRCE_CMD;
 	command[1] = TRCE_CMD_RD_TRCE_STATUS;
 
-	write(command, 2);
-	read(data, 1);
+	stat_begin(command[0]);
+	transact(command, 2, data, 1);
+	stat_end();
 
 	return *data;
 }
@@ -873,7 +1203,9 @@ void ez8ocd::wr_trce_ctl(uint8_t ctl)
 	command[1] = TRCE_CMD_WR_TRCE_CTL;
 	command[2] = ctl;
 
+	stat_begin(command[0]);
 	write(command, 3);
+	stat_end();
 
 	return;
 }
@@ -888,8 +1220,9 @@ uint8_t ez8ocd::rd_trce_ctl(void)
 	command[0] = DBG_CMD_TRCE_CMD;
 	command[1] = TRCE_CMD_RD_TRCE_CTL;
 
-	write(command, 2);
-	read(data, 1);
+	stat_begin(command[0]);
+	transact(command, 2, data, 1);
+	stat_end();
 
 	return *data;
 }
@@ -922,7 +1255,9 @@ void ez8ocd::wr_trce_event(uint8_t event_num, struct trce_event *event)
 	command[14] = (event->data.pc >> 8) & 0xff;
 	command[15] = event->data.pc & 0xff;
 
+	stat_begin(command[0]);
 	write(command, 16);
+	stat_end();
 
 	return;
 }
@@ -938,8 +1273,9 @@ void ez8ocd::rd_trce_event(uint8_t event_num, struct trce_event *event)
 	command[1] = TRCE_CMD_RD_TRCE_EVENT;
 	command[2] = event_num;
 
-	write(command, 3);
-	read(data, 13);
+	stat_begin(command[0]);
+	transact(command, 3, data, 13);
+	stat_end();
 
 	assert(event != NULL);
 	event->ctl = data[0];
@@ -968,8 +1304,9 @@ uint16_t ez8ocd::rd_trce_wr_ptr(void)
 	command[0] = DBG_CMD_TRCE_CMD;
 	command[1] = TRCE_CMD_RD_TRCE_WR_PTR;
 
-	write(command, 2);
-	read(data, 2);
+	stat_begin(command[0]);
+	transact(command, 2, data, 2);
+	stat_end();
 
 	wr_ptr = (data[0] << 8) | data[1];
 
@@ -996,15 +1333,15 @@ void ez8ocd::rd_trce_buff(uint16_t addr, struct trce_frame *buff,
 	command[4] = (size >> 8) & 0xff;
 	command[5] = size & 0xff;
 
-	write(command, 6);
-
 	if(!size) {
 		size = 0x10000;
 	}
 
 	data = (uint8_t *)xmalloc(size * 8);
 
-	read(data, size * 8);
+	stat_begin(command[0]);
+	transact(command, 6, data, size * 8);
+	stat_end();
 
 	for(i=0; i<size; i++) {
 		int j;
@@ -1020,15 +1357,901 @@ void ez8ocd::rd_trce_buff(uint16_t addr, struct trce_frame *buff,
 }
 
 /**************************************************************
- * Return pointer to ocd link.
+ * Command queue.
+ *
+ * Queued commands are held until flush_queue(), which sends
+ * each reply-bearing command together with any write-only
+ * commands queued ahead of it as one contiguous write, then
+ * collects the reply. The link is checked once per flush
+ * rather than once per command.
+ *
+ * Replies cannot overlap the following command: the DBG pin
+ * is a single half-duplex wire, so a command sent while the
+ * on-chip debugger is still answering would collide with it.
  */
 
-ocd *ez8ocd::iflink(void)
+void ez8ocd::queue(const uint8_t *command, size_t size, bool check)
 {
-	return dbg;
+	assert(command != NULL);
+
+	if(queue_len + size > queue_max) {
+		queue_max = (queue_len + size) * 2;
+		queue_cmd = (uint8_t *)xrealloc(queue_cmd, queue_max);
+	}
+	memcpy(queue_cmd + queue_len, command, size);
+	queue_len += size;
+
+	if(check) {
+		queue_check = 1;
+	}
+
+	queue_op = command[0];
+	stats[queue_op].calls++;
+	stats[queue_op].bytes_out += size;
+
+	return;
 }
 
-/**************************************************************/
+/**************************************************************
+ * This will append data to the last queued command.
+ */
+
+void ez8ocd::queue_data(const uint8_t *data, size_t size)
+{
+	assert(data != NULL);
+	assert(queue_len > 0);
+
+	if(queue_len + size > queue_max) {
+		queue_max = (queue_len + size) * 2;
+		queue_cmd = (uint8_t *)xrealloc(queue_cmd, queue_max);
+	}
+	memcpy(queue_cmd + queue_len, data, size);
+	queue_len += size;
+
+	stats[queue_op].bytes_out += size;
+
+	return;
+}
+
+/**************************************************************
+ * This will register a destination for the reply to the last
+ * queued command.
+ */
+
+void ez8ocd::queue_reply_to(uint8_t *buff, size_t size, uint16_t *word)
+{
+	struct queued_reply *reply;
+
+	assert(queue_len > 0);
+	assert(size != 0);
+
+	if(queue_replies >= queue_reply_max) {
+		queue_reply_max = queue_reply_max ? queue_reply_max * 2 : 8;
+		queue_reply = (struct queued_reply *)xrealloc(queue_reply, 
+		    queue_reply_max * sizeof(struct queued_reply));
+	}
+
+	reply = &queue_reply[queue_replies++];
+	reply->offset = queue_len;
+	reply->buff = buff;
+	reply->size = size;
+	reply->word = word;
+	reply->op = queue_op;
+
+	return;
+}
+
+/**************************************************************
+ * This will discard all queued commands.
+ */
 
+void ez8ocd::clear_queue(void)
+{
+	queue_len = 0;
+	queue_replies = 0;
+	queue_check = 0;
+	queue_busy = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will write the queued commands and read their replies
+ * in order.
+ */
+
+void ez8ocd::send_queue(void)
+{
+	size_t sent;
+	int i;
+
+	sent = 0;
+
+	for(i=0; i<queue_replies; i++) {
+		struct queued_reply *reply;
+		size_t len;
+		uint64_t start;
+
+		reply = &queue_reply[i];
+		len = reply->offset - sent;
+		start = timernow();
+
+		/* keep last write and its reply within mtu */
+		if(mtu > reply->size && len + reply->size > mtu) {
+			size_t head;
+
+			head = len - (mtu - reply->size);
+			write(queue_cmd + sent, head);
+			sent += head;
+			len -= head;
+		}
+
+		try {
+			if(reply->word) {
+				transact(queue_cmd + sent, len, reply->data, 2);
+				*reply->word = (reply->data[0] << 8) | 
+				    reply->data[1];
+			} else {
+				transact(queue_cmd + sent, len, reply->buff, 
+				    reply->size);
+			}
+			sent = reply->offset;
+		} catch(char *err) {
+			stats[reply->op].errors++;
+			throw err;
+		}
+
+		stats[reply->op].bytes_in += reply->size;
+		stats[reply->op].turnarounds++;
+		stat_sample(reply->op, timernow() - start);
+	}
+
+	if(sent < queue_len) {
+		write(queue_cmd + sent, queue_len - sent);
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will send all queued commands and collect their
+ * replies in order.
+ *
+ * A break caused by a clock switch is only seen once the 
+ * receive path runs into it, which may be partway through
+ * the batch. In that case the link is autobauded and the 
+ * batch is sent once more.
+ */
+
+void ez8ocd::flush_queue(void)
+{
+	int i;
+	bool check;
+	uint16_t revid;
+
+	if(!queue_len || queue_busy) {
+		return;
+	}
+
+	/* piggyback a link check on this batch when one is due */
+	check = check_interval && unchecked >= check_interval;
+	if(check) {
+		queue_rd_revid(&revid);
+	}
+
+	queue_busy = 1;
+	stat_op = -1;
+
+	if(++link_batches >= STEPDOWN_WINDOW) {
+		link_batches = 0;
+		link_errors = 0;
+	}
+
+	try {
+		if(queue_check) {
+			new_command();
+		}
+
+		try {
+			send_queue();
+		} catch(char *err) {
+			if(!queue_check || !dbg->error()) {
+				throw err;
+			}
+			for(i=0; i<queue_replies; i++) {
+				stats[queue_reply[i].op].retries++;
+			}
+			new_command();
+			send_queue();
+		}
+	} catch(char *err) {
+		clear_queue();
+		if(baud_floor && ++link_errors >= STEPDOWN_ERRORS) {
+			step_down();
+		}
+		throw err;
+	}
+
+	clear_queue();
+
+	if(check) {
+		check_link(revid);
+	}
+
+	return;
+}
 
+/**************************************************************
+ * This will drop the link to the next slower standard 
+ * baudrate, but not below baud_floor, and autobaud again.
+ */
+
+void ez8ocd::step_down(void)
+{
+	const struct baudvalue *b;
+	int baud, lower;
+
+	link_batches = 0;
+	link_errors = 0;
+
+	baud = dbg->link_speed();
+	lower = 0;
+	for(b=baudrates; b->value; b++) {
+		if(b->value < baud && b->value >= baud_floor) {
+			lower = b->value;
+		}
+	}
+	if(!lower) {
+		return;
+	}
+
+	dbg->set_baudrate(lower);
+	reset_dbg();
+	cache = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will compare a RevID probe against the first one read
+ * since connecting. Without loopback, this is the only sign
+ * that commands sent since the last probe were garbled.
+ */
+
+void ez8ocd::check_link(uint16_t revid)
+{
+	unchecked = 0;
+
+	if(!check_valid) {
+		check_revid = revid;
+		check_valid = 1;
+	} else if(revid != check_revid) {
+		snprintf(err_msg, err_len-1, "Link check failed\n"
+		    "RevID read %04X, expected %04X\n",
+		    revid, check_revid);
+		throw err_msg;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a read of the ez8 DBG RevID.
+ */
+
+void ez8ocd::queue_rd_revid(uint16_t *revid)
+{
+	uint8_t command[1];
+
+	command[0] = DBG_CMD_RD_REVID;
+
+	queue(command, 1, 1);
+	queue_reply_to(NULL, 2, revid);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a read of the dbgstat register.
+ */
+
+void ez8ocd::queue_rd_dbgstat(uint8_t *data)
+{
+	uint8_t command[1];
+
+	command[0] = DBG_CMD_RD_DBGSTAT;
+
+	queue(command, 1, 1);
+	queue_reply_to(data, 1, NULL);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a write to the debug control register.
+ */
+
+void ez8ocd::queue_wr_dbgctl(uint8_t data)
+{
+	uint8_t command[2];
+
+	command[0] = DBG_CMD_WR_DBGCTL;
+	command[1] = data;
+
+	queue(command, 2, 1);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a read of the debug control register.
+ */
+
+void ez8ocd::queue_rd_dbgctl(uint8_t *data)
+{
+	uint8_t command[1];
+
+	command[0] = DBG_CMD_RD_DBGCTL;
+
+	queue(command, 1, 1);
+	queue_reply_to(data, 1, NULL);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a write of the 16 bit debug cntrreg.
+ */
+
+void ez8ocd::queue_wr_cntr(uint16_t cntr)
+{
+	uint8_t command[3];
+
+	command[0] = DBG_CMD_WR_CNTR;
+	command[1] = (cntr >> 8) & 0xff;
+	command[2] = cntr & 0xff;
+
+	queue(command, 3, 1);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a read of the 16 bit debug cntrreg.
+ */
+
+void ez8ocd::queue_rd_cntr(uint16_t *cntr)
+{
+	uint8_t command[1];
+
+	command[0] = DBG_CMD_RD_CNTR;
+
+	queue(command, 1, 1);
+	queue_reply_to(NULL, 2, cntr);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a write of the program counter.
+ */
+
+void ez8ocd::queue_wr_pc(uint16_t pc)
+{
+	uint8_t command[3];
+
+	command[0] = DBG_CMD_WR_PC;
+	command[1] = (pc >> 8) & 0xff;
+	command[2] = pc & 0xff;
+
+	queue(command, 3, 1);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a read of the program counter.
+ */
+
+void ez8ocd::queue_rd_pc(uint16_t *pc)
+{
+	uint8_t command[1];
+
+	command[0] = DBG_CMD_RD_PC;
+
+	queue(command, 1, 1);
+	queue_reply_to(NULL, 2, pc);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a write of ez8 register memory.
+ */
+
+void ez8ocd::queue_wr_regs(uint16_t address, const uint8_t *buff, 
+                           size_t size)
+{
+	uint8_t command[4];
+
+	assert((long)address + size <= EZ8REG_SIZE);
+	assert(size != 0);
+
+	command[0] = DBG_CMD_WR_REG;
+
+	while(size > 0) {
+		size_t len;
+
+		len = size > EZ8REG_BUFSIZ ?  EZ8REG_BUFSIZ : size;
+
+		command[1] = (address >> 8) & 0xff;
+		command[2] = address & 0xff;
+		command[3] = len < EZ8REG_BUFSIZ ? len & 0xff : 0;
+
+		queue(command, 4, 1);
+		queue_data(buff, len);
+
+		address += len;
+		buff += len;
+		size -= len;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a read of ez8 register memory.
+ */
+
+void ez8ocd::queue_rd_regs(uint16_t address, uint8_t *buff, size_t size)
+{
+	uint8_t command[4];
+
+	assert((long)address + size <= EZ8REG_SIZE);
+	assert(size != 0);
+
+	command[0] = DBG_CMD_RD_REG;
+
+	while(size > 0) {
+		size_t len;
+
+		len = size > EZ8REG_BUFSIZ ? EZ8REG_BUFSIZ : size;
+		if(mtu > 0 && len > mtu-1) {
+			len = mtu-1;
+		}
+
+		command[1] = (address >> 8) & 0xff;
+		command[2] = address & 0xff;
+		command[3] = len < EZ8REG_BUFSIZ ?  len & 0xff : 0;
+
+		queue(command, 4, 1);
+		queue_reply_to(buff, len, NULL);
+
+		address += len;
+		buff += len;
+		size -= len;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a read of the baud reload register.
+ */
+
+void ez8ocd::queue_rd_reload(uint16_t *reload)
+{
+	uint8_t command[1];
+
+	command[0] = DBG_CMD_RD_RELOAD;
+
+	queue(command, 1, 1);
+	queue_reply_to(NULL, 2, reload);
+
+	return;
+}
+
+/**************************************************************
+ * This will queue a read of the memory size.
+ */
+
+void ez8ocd::queue_rd_memsize(uint8_t *memsize)
+{
+	uint8_t command[2];
+
+	command[0] = 0xf3;
+	command[1] = 0x84;
+
+	queue(command, 2, 0);
+	queue_reply_to(memsize, 1, NULL);
+
+	return;
+}
+
+/**************************************************************
+ * This will start timing a command sent directly (not through
+ * the queue). Anything still queued goes out first so it is
+ * not counted against this command.
+ */
+
+void ez8ocd::stat_begin(uint8_t op)
+{
+	if(queue_len && !queue_busy) {
+		flush_queue();
+	}
+
+	/* recover from a break latched since the last command */
+	new_command();
+
+	stat_op = op;
+	stat_wrote = 0;
+	stats[op].calls++;
+	stat_start = timernow();
+
+	return;
+}
+
+/**************************************************************
+ * This will finish timing a direct command.
+ */
+
+void ez8ocd::stat_end(void)
+{
+	if(stat_op >= 0) {
+		stat_sample(stat_op, timernow() - stat_start);
+		stat_op = -1;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will add a latency measurement (in microseconds) to an
+ * opcode's histogram. Buckets 0-3 hold 0-3us exactly, after 
+ * that each power of two is split into four buckets.
+ */
+
+void ez8ocd::stat_sample(uint8_t op, uint64_t us)
+{
+	int bucket, octave;
+
+	if(us < 4) {
+		bucket = us;
+	} else {
+		for(octave=2; octave<63 && us >> (octave+1); octave++) {
+			continue;
+		}
+		bucket = (octave - 1) * 4 + ((us >> (octave - 2)) & 3);
+		if(bucket >= OCD_STAT_BUCKETS) {
+			bucket = OCD_STAT_BUCKETS - 1;
+		}
+	}
+
+	stats[op].hist[bucket]++;
+	stats[op].samples++;
+	stats[op].total_us += us;
+
+	return;
+}
+
+/**************************************************************
+ * This will return the statistics for one opcode.
+ */
+
+const struct ocd_stat *ez8ocd::get_stat(uint8_t op)
+{
+	return &stats[op];
+}
+
+/**************************************************************
+ * This will return the number of link resets (autobauds).
+ */
+
+unsigned long ez8ocd::get_stat_resets(void)
+{
+	return stat_resets;
+}
+
+/**************************************************************
+ * This will estimate the latency in microseconds that pct 
+ * percent of an opcode's measured commands completed within.
+ * The result is the upper edge of the histogram bucket.
+ */
+
+unsigned long ez8ocd::stat_percentile(uint8_t op, int pct)
+{
+	unsigned long rank, count;
+	int bucket, octave;
+
+	if(!stats[op].samples) {
+		return 0;
+	}
+
+	rank = (stats[op].samples * pct + 99) / 100;
+	if(!rank) {
+		rank = 1;
+	}
+
+	count = 0;
+	for(bucket=0; bucket<OCD_STAT_BUCKETS-1; bucket++) {
+		count += stats[op].hist[bucket];
+		if(count >= rank) {
+			break;
+		}
+	}
+
+	if(bucket < 4) {
+		return bucket;
+	}
+	octave = bucket / 4 + 1;
+
+	return ((unsigned long)(4 + bucket % 4 + 1) << (octave - 2)) - 1;
+}
+
+/**************************************************************
+ * This will zero all link statistics.
+ */
+
+void ez8ocd::clear_stats(void)
+{
+	memset(stats, 0, 256 * sizeof(struct ocd_stat));
+	stat_resets = 0;
+	stat_op = -1;
+	stat_wrote = 0;
+	stat_start = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will add the link statistics of another debugger to
+ * these, to report several links as one.
+ */
+
+void ez8ocd::add_stats(const ez8ocd *other)
+{
+	struct ocd_stat *s;
+	const struct ocd_stat *o;
+	int op, i;
+
+	for(op=0; op<256; op++) {
+		s = &stats[op];
+		o = &other->stats[op];
+
+		s->calls += o->calls;
+		s->turnarounds += o->turnarounds;
+		s->errors += o->errors;
+		s->retries += o->retries;
+		s->bytes_out += o->bytes_out;
+		s->bytes_in += o->bytes_in;
+		s->samples += o->samples;
+		s->total_us += o->total_us;
+		for(i=0; i<OCD_STAT_BUCKETS; i++) {
+			s->hist[i] += o->hist[i];
+		}
+	}
+	stat_resets += other->stat_resets;
+
+	return;
+}
+
+/**************************************************************
+ * This will print a table of link statistics for every opcode
+ * that has been used.
+ */
+
+void ez8ocd::dump_stats(FILE *fp)
+{
+	static const struct {
+		uint8_t op;
+		const char *name;
+	} names[] = {
+		{ DBG_CMD_RD_REVID, "rd_revid" },
+		{ DBG_CMD_WR_CNTR, "wr_cntr" },
+		{ DBG_CMD_RD_DBGSTAT, "rd_dbgstat" },
+		{ DBG_CMD_RD_CNTR, "rd_cntr" },
+		{ DBG_CMD_WR_DBGCTL, "wr_dbgctl" },
+		{ DBG_CMD_RD_DBGCTL, "rd_dbgctl" },
+		{ DBG_CMD_WR_PC, "wr_pc" },
+		{ DBG_CMD_RD_PC, "rd_pc" },
+		{ DBG_CMD_WR_REG, "wr_reg" },
+		{ DBG_CMD_RD_REG, "rd_reg" },
+		{ DBG_CMD_WR_MEM, "wr_mem" },
+		{ DBG_CMD_RD_MEM, "rd_mem" },
+		{ DBG_CMD_WR_EDATA, "wr_edata" },
+		{ DBG_CMD_RD_EDATA, "rd_edata" },
+		{ DBG_CMD_RD_MEMCRC, "rd_memcrc" },
+		{ DBG_CMD_STEP_INST, "step_inst" },
+		{ DBG_CMD_STUFF_INST, "stuff_inst" },
+		{ DBG_CMD_EXEC_INST, "exec_inst" },
+		{ DBG_CMD_RD_RELOAD, "rd_reload" },
+		{ DBG_CMD_TRCE_CMD, "trce_cmd" },
+		{ 0xf3, "rd_memsize" },
+		{ PROTO_RD_MEM, "srv_rd_mem" },
+		{ PROTO_WR_MEM, "srv_wr_mem" },
+		{ PROTO_ERASE, "srv_erase" },
+		{ PROTO_RD_CRC, "srv_rd_crc" },
+		{ PROTO_RD_REGS, "srv_rd_regs" },
+		{ PROTO_RUN, "srv_run" },
+		{ PROTO_STOP, "srv_stop" },
+		{ PROTO_STEP, "srv_step" },
+	};
+	int op, i;
+
+	fprintf(fp, "%-11s %8s %10s %10s %8s %6s %6s %8s %8s\n",
+	    "command", "calls", "bytes out", "bytes in", "turns", 
+	    "errors", "retry", "p50 us", "p99 us");
+
+	for(op=0; op<256; op++) {
+		struct ocd_stat *s;
+		char name[16];
+
+		s = &stats[op];
+		if(!s->calls && !s->errors) {
+			continue;
+		}
+
+		snprintf(name, sizeof(name), "0x%02X", op);
+		for(i=0; i<(int)(sizeof(names)/sizeof(*names)); i++) {
+			if(names[i].op == op) {
+				snprintf(name, sizeof(name), "%s", 
+				    names[i].name);
+			}
+		}
+
+		fprintf(fp, "%-11s %8lu %10llu %10llu %8lu %6lu %6lu "
+		    "%8lu %8lu\n", name, s->calls, 
+		    (unsigned long long)s->bytes_out, 
+		    (unsigned long long)s->bytes_in, s->turnarounds, 
+		    s->errors, s->retries, stat_percentile(op, 50), 
+		    stat_percentile(op, 99));
+	}
+
+	fprintf(fp, "link resets: %lu\n", stat_resets);
+
+	if(faults) {
+		faults->dump_stats(fp);
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will wrap the link in a fault injector, configured by
+ * spec, see ocd_fault. A link already wrapped is reconfigured.
+ */
+
+void ez8ocd::inject_faults(const char *spec)
+{
+	ocd_fault *ocdptr;
+
+	if(!dbg) {
+		strncpy(err_msg, "Cannot inject faults\n"
+		    "not connected\n", err_len-1);
+		throw err_msg;
+	}
+
+	if(faults) {
+		faults->configure(spec);
+		return;
+	}
+
+	ocdptr = new ocd_fault(dbg);
+	try {
+		ocdptr->configure(spec);
+	} catch(char *err) {
+		ocdptr->release();
+		delete ocdptr;
+		throw err;
+	}
+
+	dbg = ocdptr;
+	faults = ocdptr;
+
+	return;
+}
+
+/**************************************************************
+ * This will unwrap the link from the fault injector.
+ */
+
+void ez8ocd::remove_faults(void)
+{
+	if(!faults) {
+		return;
+	}
+
+	dbg = faults->release();
+	delete faults;
+	faults = NULL;
+
+	return;
+}
+
+/**************************************************************
+ * Return pointer to the fault injector, if there is one.
+ */
+
+ocd_fault *ez8ocd::fault_link(void)
+{
+	return faults;
+}
+
+/**************************************************************
+ * Return pointer to ocd link.
+ */
+
+ocd *ez8ocd::iflink(void)
+{
+	return dbg;
+}
+
+/**************************************************************
+ * This will start a binary capture of all link traffic to
+ * the file path. If limit is non-zero, the capture is rotated
+ * to path.1 when it grows beyond limit bytes.
+ */
+
+void ez8ocd::start_capture(const char *path, size_t limit)
+{
+	stop_capture();
+
+	capture = capture_open(path, limit);
+	if(!capture) {
+		snprintf(err_msg, err_len-1, "Cannot start link capture\n"
+		    "%s: %s\n", path, strerror(errno));
+		throw err_msg;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will flush and close the link capture.
+ */
+
+void ez8ocd::stop_capture(void)
+{
+	if(capture) {
+		capture_close(capture);
+		capture = NULL;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * Returns non-zero if link traffic is being captured.
+ */
+
+bool ez8ocd::capturing(void)
+{
+	return capture != NULL;
+}
+
+/**************************************************************
+ * This will add an error message to the capture, tagged with
+ * the record type of the transfer that failed.
+ */
+
+void ez8ocd::capture_error(int type, const char *err)
+{
+	uint8_t *data;
+	size_t len;
+
+	if(!capture) {
+		return;
+	}
+
+	len = strlen(err);
+	data = (uint8_t *)xmalloc(len + 1);
+	data[0] = type;
+	memcpy(data + 1, err, len);
+	capture_record(capture, CAPTURE_ERROR, data, len + 1);
+	free(data);
+
+	return;
+}
+
+/**************************************************************/
 
@@ -13,6 +13,26 @@
 #include	<stdlib.h>
 #include	<inttypes.h>
 #include	"ocd.h"
+#include	"ocd_fault.h"
+#include	"ocd_tcpip.h"
+#include	"capture.h"
+
+/**************************************************************/
+
+/* bytes sent between link checks when the adapter has no echo */
+#define	LINK_CHECK_INTERVAL	4096
+
+/* failed batches within a window of batches that will step a
+ * negotiated baudrate down to the next slower rate */
+#define	STEPDOWN_ERRORS		3
+#define	STEPDOWN_WINDOW		256
+
+/* range of reply sizes tried by mtu discovery */
+#define	MTU_PROBE_MIN		16
+#define	MTU_PROBE_MAX		4096
+
+/* latency histogram, four buckets per power of two microseconds */
+#define	OCD_STAT_BUCKETS	128
 
 /**************************************************************/
 
@@ -33,6 +53,19 @@ struct trce_frame {
 	uint8_t data[8];
 };
 
+/* link statistics for one command opcode */
+struct ocd_stat {
+	unsigned long calls;
+	unsigned long turnarounds;	/* replies waited for */
+	unsigned long errors;
+	unsigned long retries;
+	uint64_t bytes_out;
+	uint64_t bytes_in;
+	unsigned long samples;		/* latencies measured */
+	uint64_t total_us;
+	unsigned long hist[OCD_STAT_BUCKETS];
+};
+
 enum ocd_exception {
 	ocd_none,
 	ocd_init,
@@ -46,9 +79,86 @@ private:
 	/* Prohibit use of copy constructor */
 	ez8ocd(ez8ocd &);
 
+	/* pipelined command queue */
+	struct queued_reply {
+		size_t offset;		/* end of command in queue_cmd */
+		uint8_t *buff;		/* reply destination */
+		size_t size;
+		uint16_t *word;		/* 16 bit big-endian reply */
+		uint8_t data[2];
+		uint8_t op;		/* command opcode */
+	};
+	uint8_t *queue_cmd;
+	size_t queue_len;
+	size_t queue_max;
+	struct queued_reply *queue_reply;
+	int queue_replies;
+	int queue_reply_max;
+	bool queue_check;
+	bool queue_busy;
+	uint8_t queue_op;
+
+	void queue(const uint8_t *, size_t, bool);
+	void queue_data(const uint8_t *, size_t);
+	void queue_reply_to(uint8_t *, size_t, uint16_t *);
+	void clear_queue(void);
+	void send_queue(void);
+
+	/* link check for adapters without loopback */
+	size_t check_interval;
+	size_t unchecked;
+	uint16_t check_revid;
+	bool check_valid;
+	void check_link(uint16_t);
+
+	/* baudrate step down on link errors */
+	int link_batches;
+	int link_errors;
+	void step_down(void);
+
+	/* per opcode link statistics */
+	struct ocd_stat *stats;
+	unsigned long stat_resets;
+	int stat_op;
+	bool stat_wrote;
+	uint64_t stat_start;
+	void stat_begin(uint8_t);
+	void stat_end(void);
+	void stat_sample(uint8_t, uint64_t);
+
+	/* fault injection, wrapping dbg */
+	ocd_fault *faults;
+
+	/* binary link capture */
+	struct capture *capture;
+	void capture_error(int, const char *);
+	void reset_dbg(void);
+
+	/* logging, capture and statistics of link transfers */
+	void log_data(const char *, const uint8_t *, size_t);
+	void sending(const uint8_t *, size_t);
+	void sent(size_t);
+	void received(const uint8_t *, size_t);
+	void failed(int, const char *, size_t);
+
 protected:
 	int cache;
 
+	/* server running high level operations, or NULL */
+	ocd_tcpip *remote;
+	void remote_op(const uint8_t *, size_t, uint8_t *, size_t);
+	void remote_rd_mem(uint16_t, uint8_t *, size_t);
+	void remote_wr_mem(uint16_t, const uint8_t *, size_t);
+	void remote_erase(void);
+	uint16_t remote_rd_crc(void);
+	void remote_rd_regs(uint16_t, uint8_t *, size_t);
+	void remote_run(void);
+	void remote_stop(void);
+	void remote_step(void);
+
+	/* slowest rate to step down to, 0 if disabled */
+	int baud_floor;
+
 public:
 	/* polymorphic class for ocd link */
 	ocd *dbg;
@@ -91,8 +201,24 @@ public:
 	uint16_t rd_trce_wr_ptr(void);
 	void rd_trce_buff(uint16_t, struct trce_frame *, size_t);
 
+	/* queued commands, sent by flush_queue() */
+	void queue_rd_revid(uint16_t *);
+	void queue_rd_dbgstat(uint8_t *);
+	void queue_wr_dbgctl(uint8_t);
+	void queue_rd_dbgctl(uint8_t *);
+	void queue_wr_cntr(uint16_t);
+	void queue_rd_cntr(uint16_t *);
+	void queue_wr_pc(uint16_t);
+	void queue_rd_pc(uint16_t *);
+	void queue_wr_regs(uint16_t, const uint8_t *, size_t);
+	void queue_rd_regs(uint16_t, uint8_t *, size_t);
+	void queue_rd_reload(uint16_t *);
+	void queue_rd_memsize(uint8_t *);
+	void flush_queue(void);
+
 public:
 	size_t mtu;
+	bool mtu_auto;
 	FILE *log_proto;
 
 	ez8ocd();
@@ -100,9 +226,12 @@ public:
 
 	void (*callback)(void);
 
-	void connect_serial(const char *, int, int = 0);
+	void connect_serial(const char *, int, int = 0, bool = 1);
 	void connect_parport(const char *);
-	void connect_tcpip(const char *);
+	void connect_tcpip(const char *, bool = 0);
+	void connect_replay(const char *, int);
+	void connect_sim(const char *, int, int);
+	void connect_port(const char *, int, int, int = 0, bool = 1);
 	void disconnect(void);
 	ocd *iflink(void);
 
@@ -115,10 +244,29 @@ public:
 
 	void read(uint8_t *, size_t);
 	void write(const uint8_t *, size_t);
+	void transact(const uint8_t *, size_t, uint8_t *, size_t);
 
 	uint16_t rd_revid(void);
 	uint16_t rd_reload(void);
 	uint8_t rd_dbgstat(void);
+
+	/* link statistics */
+	const struct ocd_stat *get_stat(uint8_t);
+	unsigned long get_stat_resets(void);
+	unsigned long stat_percentile(uint8_t, int);
+	void clear_stats(void);
+	void add_stats(const ez8ocd *);
+	void dump_stats(FILE *);
+
+	/* fault injection */
+	void inject_faults(const char *);
+	void remove_faults(void);
+	ocd_fault *fault_link(void);
+
+	/* binary link capture */
+	void start_capture(const char *, size_t = 0);
+	void stop_capture(void);
+	bool capturing(void);
 };
 
 /**************************************************************/
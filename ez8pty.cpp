@@ -0,0 +1,492 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This program is a virtual dongle on a pseudo-terminal. The
+ * debugger opens the slave side like a serial port, and the
+ * program answers on the master side the way a dongle with a
+ * target attached would: transmitted data is echoed back and
+ * commands are run on a simulated device.
+ *
+ * Data bytes of 0xFF reach the host escaped by the kernel,
+ * since the host sets PARMRK. A pty cannot carry line errors,
+ * so breaks and framing errors are injected by turning PARMRK
+ * off for a moment and writing the marked sequence directly.
+ * The host's break cannot be seen on a pty either; the flushes
+ * around it are, through packet mode, and reset the device's
+ * link.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<errno.h>
+#include	<fcntl.h>
+#include	<poll.h>
+#include	<signal.h>
+#include	<termios.h>
+#include	<unistd.h>
+#include	<inttypes.h>
+#include	<sys/ioctl.h>
+
+#include	"ocd_sim.h"
+#include	"baudrate.h"
+#include	"err_msg.h"
+
+/**************************************************************/
+
+#define	PROGNAME	"ez8pty"
+
+/* time to wait for injected errors to reach the host's
+ * input queue, in microseconds */
+#define	INJECT_WAIT	10000
+
+/* poll interval, for break acknowledges from the device */
+#define	POLL_INTERVAL	10
+
+extern const char *build;
+const char *progname;
+
+const char *link_name = NULL;
+const char *device = NULL;
+int sysclk = SIM_DEFAULT_SYSCLK;
+int echo = 1;
+int rate = 0;
+unsigned long break_every = 0;
+unsigned long framing_every = 0;
+int verbose = 0;
+
+int master = -1;
+int slave = -1;
+volatile sig_atomic_t done = 0;
+
+/* totals */
+unsigned long bytes_echoed = 0;
+unsigned long bytes_replied = 0;
+unsigned long link_resets = 0;
+unsigned long breaks = 0;
+unsigned long framing_errors = 0;
+
+/**************************************************************/
+
+void help(void)
+{
+printf("%s - build %s\n", progname, build);
+printf(
+"Usage: ez8pty [OPTIONS]\n"
+"This utility runs a virtual dongle with a simulated device on a\n"
+"pseudo-terminal, and prints the name of the terminal to connect to.\n\n"
+"  -h               show this help\n"
+"  -l LINK          also make the symbolic link LINK to the terminal\n"
+"  -d REVID[:SIZE]  simulated device (default: auto)\n"
+"  -c FREQUENCY     simulated clock in hertz (default: %d)\n"
+"  -E               do not echo transmitted data\n"
+"  -s BAUDRATE      pace data sent back at BAUDRATE (default: unpaced)\n"
+"  -b N             send a break in place of every Nth reply byte\n"
+"  -f N             send a framing error in place of every Nth reply byte\n"
+"  -v               report link resets and injected errors\n\n",
+    SIM_DEFAULT_SYSCLK);
+printf(
+"The program runs until interrupted, then shows what it has sent.\n");
+
+	return;
+}
+
+/**************************************************************/
+
+int setup(int argc, char **argv)
+{
+	int c;
+	const char *s;
+	char *tail;
+
+	progname = *argv;
+	s = strrchr(progname, '/');
+	if(s) {
+		progname = s+1;
+	}
+
+	while((c = getopt(argc, argv, "hl:d:c:Es:b:f:v")) != EOF) {
+		switch(c) {
+		case '?':
+			printf("Try '%s -h' for more information.\n", PROGNAME);
+			return -1;
+		case 'h':
+			help();
+			exit(EXIT_SUCCESS);
+		case 'l':
+			link_name = optarg;
+			break;
+		case 'd':
+			device = optarg;
+			break;
+		case 'c':
+			sysclk = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || sysclk <= 0) {
+				fprintf(stderr, "%s: invalid frequency %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'E':
+			echo = 0;
+			break;
+		case 's':
+			rate = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || rate < 0) {
+				fprintf(stderr, "%s: invalid baudrate %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'b':
+		case 'f':
+			s = optarg;
+			if(c == 'b') {
+				break_every = strtoul(s, &tail, 10);
+			} else {
+				framing_every = strtoul(s, &tail, 10);
+			}
+			if(tail == s || *tail) {
+				fprintf(stderr, "%s: invalid count %s\n",
+				    PROGNAME, s);
+				return -1;
+			}
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		}
+	}
+
+	if(optind < argc) {
+		fprintf(stderr, "%s: too many arguments\n", PROGNAME);
+		printf("Try '%s -h' for more information.\n", PROGNAME);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
+void stop(int)
+{
+	done = 1;
+
+	return;
+}
+
+/**************************************************************
+ * This will create the pseudo-terminal. The slave side is
+ * kept open so the terminal outlives each host session.
+ */
+
+int open_pty(void)
+{
+	struct termios cfg;
+	char *name;
+	int on;
+
+	master = posix_openpt(O_RDWR | O_NOCTTY);
+	if(master < 0) {
+		perror("posix_openpt");
+		return -1;
+	}
+	if(grantpt(master) || unlockpt(master)) {
+		perror("grantpt");
+		return -1;
+	}
+	name = ptsname(master);
+	if(!name) {
+		perror("ptsname");
+		return -1;
+	}
+
+	/* nothing from the host may be altered on its way here */
+	if(tcgetattr(master, &cfg)) {
+		perror("tcgetattr");
+		return -1;
+	}
+	cfmakeraw(&cfg);
+	if(tcsetattr(master, TCSANOW, &cfg)) {
+		perror("tcsetattr");
+		return -1;
+	}
+
+	/* report flushes by the host */
+	on = 1;
+	if(ioctl(master, TIOCPKT, &on)) {
+		perror("TIOCPKT");
+		return -1;
+	}
+
+	slave = open(name, O_RDWR | O_NOCTTY);
+	if(slave < 0) {
+		perror(name);
+		return -1;
+	}
+
+	if(link_name) {
+		unlink(link_name);
+		if(symlink(name, link_name)) {
+			perror(link_name);
+			return -1;
+		}
+	}
+
+	printf("%s\n", name);
+	fflush(stdout);
+
+	return 0;
+}
+
+/**************************************************************
+ * This will write to the host, paced at the given rate.
+ */
+
+void send_host(const uint8_t *data, size_t size)
+{
+	ssize_t n;
+
+	while(size > 0) {
+		n = write(master, data, size);
+		if(n < 0) {
+			if(errno == EINTR || errno == EAGAIN) {
+				continue;
+			}
+			perror("write");
+			done = 1;
+			return;
+		}
+		if(rate) {
+			usleep((uint64_t)n * 10 * 1000000 / rate);
+		}
+		data += n;
+		size -= n;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will send a line error as the kernel marks it with
+ * PARMRK: FF 00 00 for a break, FF 00 XX for a framing error.
+ */
+
+void inject(uint8_t value)
+{
+	struct termios cfg;
+	uint8_t mark[3];
+	bool parmrk;
+	int queued, before, wait;
+
+	mark[0] = 0xff;
+	mark[1] = 0x00;
+	mark[2] = value;
+
+	if(tcgetattr(slave, &cfg)) {
+		perror("tcgetattr");
+		return;
+	}
+	parmrk = cfg.c_iflag & PARMRK;
+	if(parmrk) {
+		cfg.c_iflag &= ~PARMRK;
+		tcsetattr(slave, TCSANOW, &cfg);
+	}
+
+	if(ioctl(slave, FIONREAD, &before)) {
+		before = 0;
+	}
+	send_host(mark, sizeof(mark));
+
+	/* the line discipline escapes data when it is queued
+	 * for the host, so wait until it has been */
+	for(wait=0; wait<INJECT_WAIT; wait+=100) {
+		if(ioctl(slave, FIONREAD, &queued) ||
+		    queued >= before + (int)sizeof(mark)) {
+			break;
+		}
+		usleep(100);
+	}
+
+	if(parmrk && !tcgetattr(slave, &cfg)) {
+		cfg.c_iflag |= PARMRK;
+		tcsetattr(slave, TCSANOW, &cfg);
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will send the device's replies, replacing bytes with
+ * line errors if asked to. The rest of a reply with an error
+ * is lost, as when a real link drops.
+ */
+
+void reply(const uint8_t *data, size_t size)
+{
+	size_t i;
+
+	for(i=0; i<size; i++) {
+		bytes_replied++;
+		if(break_every && bytes_replied % break_every == 0) {
+			send_host(data, i);
+			inject(0x00);
+			breaks++;
+			if(verbose) {
+				fprintf(stderr, "break injected\n");
+			}
+			return;
+		}
+		if(framing_every && bytes_replied % framing_every == 0) {
+			send_host(data, i);
+			inject(data[i] ? data[i] : 0x01);
+			framing_errors++;
+			if(verbose) {
+				fprintf(stderr, "framing error injected\n");
+			}
+			return;
+		}
+	}
+
+	send_host(data, size);
+
+	return;
+}
+
+/**************************************************************
+ * This will run the dongle until interrupted.
+ */
+
+int run(ocd_sim *sim)
+{
+	uint8_t buff[4096];
+	uint8_t out[4096];
+	struct pollfd pfd;
+	ssize_t n;
+	size_t len;
+	int baud;
+
+	while(!done) {
+		pfd.fd = master;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		n = poll(&pfd, 1, POLL_INTERVAL);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			return -1;
+		}
+
+		if(n > 0) {
+			n = read(master, buff, sizeof(buff));
+			if(n < 0) {
+				if(errno == EINTR || errno == EAGAIN ||
+				    errno == EIO) {
+					continue;
+				}
+				perror("read");
+				return -1;
+			}
+			if(n == 0) {
+				continue;
+			}
+
+			if(buff[0] != TIOCPKT_DATA) {
+				if(buff[0] & (TIOCPKT_FLUSHREAD |
+				    TIOCPKT_FLUSHWRITE)) {
+					sim->reset();
+					link_resets++;
+					if(verbose) {
+						fprintf(stderr,
+						    "link reset\n");
+					}
+				}
+				continue;
+			}
+
+			if(echo) {
+				send_host(buff + 1, n - 1);
+				bytes_echoed += n - 1;
+			}
+
+			baud = get_custom_baudrate(slave);
+			if(baud > 0) {
+				sim->set_baudrate(baud);
+			}
+
+			try {
+				sim->write(buff + 1, n - 1);
+			} catch(char *err) {
+				fprintf(stderr, "%s", err);
+				sim->reset();
+			}
+		}
+
+		/* replies, and acknowledges of breakpoints hit */
+		len = 0;
+		while(sim->available() && len < sizeof(out)) {
+			sim->read(out + len, 1);
+			len++;
+		}
+		if(len) {
+			reply(out, len);
+		}
+	}
+
+	return 0;
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	ocd_sim *sim;
+	int err;
+
+	err = setup(argc, argv);
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+	signal(SIGHUP, SIG_IGN);
+
+	err = open_pty();
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	sim = new ocd_sim();
+	try {
+		sim->connect(device, 0, sysclk);
+		sim->reset();
+	} catch(char *err) {
+		fprintf(stderr, "%s", err);
+		return EXIT_FAILURE;
+	}
+
+	err = run(sim);
+
+	fprintf(stderr, "%lu bytes echoed, %lu bytes replied, "
+	    "%lu link resets, %lu breaks, %lu framing errors\n",
+	    bytes_echoed, bytes_replied, link_resets, breaks,
+	    framing_errors);
+
+	if(link_name) {
+		unlink(link_name);
+	}
+	delete sim;
+	close(slave);
+	close(master);
+
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**************************************************************/
+
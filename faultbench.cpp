@@ -0,0 +1,396 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This program measures what link faults cost. It runs a
+ * fixed mix of debugger operations once without faults, then
+ * once for each kind of fault with only that kind injected,
+ * recovering from each failure the way the monitor does. For
+ * each kind it reports how many link resets (autobauds) a
+ * failure took, how long recovery took, and how long it was
+ * from a fault to the next operation that succeeded.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	<inttypes.h>
+
+#include	"ez8dbg.h"
+#include	"ocd_fault.h"
+#include	"timer.h"
+#include	"err_msg.h"
+
+/**************************************************************/
+
+#define	PROGNAME	"faultbench"
+
+#ifndef	DEFAULT_BAUDRATE
+#define	DEFAULT_BAUDRATE 57600
+#endif
+
+/* link resets tried before a failure is given up on */
+#define	MAX_RECOVERY	16
+
+/* operations between device resets */
+#define	RESET_EVERY	50
+
+extern const char *build;
+const char *progname;
+
+const char *port = "sim";
+int baudrate = 0;
+int sysclk = 20000000;
+unsigned long ops = 2000;
+double rate = 0.01;
+int latency = FAULT_DEFAULT_DELAY;
+unsigned long seed = 1;
+int verbose = 0;
+
+/* results of one run */
+struct result {
+	uint64_t elapsed;
+	unsigned long failed;		/* operations that threw */
+	unsigned long lost;		/* failures not recovered from */
+	unsigned long resumed;		/* failures followed by success */
+	uint64_t resume_us;		/* from fault to that success */
+	uint64_t resume_max;
+	struct fault_stat stat;
+};
+
+/**************************************************************/
+
+void help(void)
+{
+printf("%s - build %s\n", progname, build);
+printf(
+"Usage: faultbench [OPTIONS]\n"
+"This utility measures how long the debugger takes to recover from\n"
+"each kind of link fault, and how many link resets it costs.\n\n"
+"  -h               show this help\n"
+"  -p SERIALPORT    serialport to use, or sim[:REVID[:MEMSIZE]]\n"
+"                   for a simulated device (default: sim)\n"
+"  -b BAUDRATE      use baudrate (default: %d)\n"
+"  -c FREQUENCY     clock frequency in hertz (default: %d)\n"
+"  -n COUNT         operations per run (default: %lu)\n"
+"  -r RATE          probability of a transfer failing (default: %g)\n"
+"  -l LATENCY       microseconds added by a delay (default: %d)\n"
+"  -s SEED          random seed (default: %lu)\n"
+"  -v               show each failure\n\n",
+    DEFAULT_BAUDRATE, sysclk, ops, rate, latency, seed);
+
+	return;
+}
+
+/**************************************************************/
+
+int setup(int argc, char **argv)
+{
+	int c;
+	const char *s;
+	char *tail;
+
+	progname = *argv;
+	s = strrchr(progname, '/');
+	if(s) {
+		progname = s+1;
+	}
+
+	baudrate = DEFAULT_BAUDRATE;
+
+	while((c = getopt(argc, argv, "hp:b:c:n:r:l:s:v")) != EOF) {
+		switch(c) {
+		case '?':
+			printf("Try '%s -h' for more information.\n", PROGNAME);
+			return -1;
+		case 'h':
+			help();
+			exit(EXIT_SUCCESS);
+		case 'p':
+			port = optarg;
+			break;
+		case 'b':
+			baudrate = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || baudrate <= 0) {
+				fprintf(stderr, "%s: invalid baudrate %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'c':
+			sysclk = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || sysclk <= 0) {
+				fprintf(stderr, "%s: invalid frequency %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'n':
+			ops = strtoul(optarg, &tail, 10);
+			if(tail == optarg || *tail || !ops) {
+				fprintf(stderr, "%s: invalid count %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'r':
+			rate = strtod(optarg, &tail);
+			if(tail == optarg || *tail || rate < 0 || rate > 1) {
+				fprintf(stderr, "%s: invalid rate %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'l':
+			latency = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || latency < 0) {
+				fprintf(stderr, "%s: invalid latency %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 's':
+			seed = strtoul(optarg, &tail, 10);
+			if(tail == optarg || *tail) {
+				fprintf(stderr, "%s: invalid seed %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		}
+	}
+
+	if(optind < argc) {
+		fprintf(stderr, "%s: too many arguments\n", PROGNAME);
+		printf("Try '%s -h' for more information.\n", PROGNAME);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * This will connect to the device and stop it.
+ */
+
+void connect(ez8dbg *dbg)
+{
+	dbg->connect_port(port, baudrate, sysclk);
+	dbg->set_sysclk(sysclk);
+	dbg->reset_link();
+	dbg->stop();
+
+	return;
+}
+
+/**************************************************************
+ * This will run one operation of the mix. Link traffic is
+ * forced past the memory cache.
+ */
+
+void operation(ez8dbg *dbg, unsigned long n)
+{
+	static uint8_t buff[1024];
+
+	if(n % RESET_EVERY == RESET_EVERY - 1) {
+		dbg->reset_chip();
+		return;
+	}
+
+	switch(n % 5) {
+	case 0:
+		dbg->stop();
+		break;
+	case 1:
+		dbg->ez8ocd::rd_regs(0x000, buff, 256);
+		break;
+	case 2:
+		dbg->ez8ocd::rd_mem(0x0000, buff, sizeof(buff));
+		break;
+	case 3:
+		dbg->isrunning();
+		break;
+	case 4:
+		dbg->rd_pc();
+		break;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will bring the link back up as the monitor does,
+ * returning non-zero if it cannot be.
+ */
+
+int recover(ez8dbg *dbg)
+{
+	int i;
+
+	for(i=0; i<MAX_RECOVERY; i++) {
+		if(dbg->link_up()) {
+			return 0;
+		}
+		try {
+			dbg->reset_link();
+			dbg->rd_revid();
+		} catch(char *err) {
+			if(verbose) {
+				fprintf(stderr, "  recovery: %s", err);
+			}
+		}
+	}
+
+	return !dbg->link_up();
+}
+
+/**************************************************************
+ * This will run the mix with faults from spec, or none.
+ */
+
+int run(const char *spec, struct result *res)
+{
+	ez8dbg *dbg;
+	ocd_fault *faults;
+	unsigned long n;
+	uint64_t start, fault, elapsed;
+	int i;
+
+	memset(res, 0, sizeof(*res));
+
+	dbg = new ez8dbg();
+	try {
+		connect(dbg);
+		if(spec) {
+			dbg->inject_faults(spec);
+		}
+	} catch(char *err) {
+		fprintf(stderr, "%s", err);
+		delete dbg;
+		return -1;
+	}
+
+	faults = dbg->fault_link();
+	fault = 0;
+
+	start = timernow();
+	for(n=0; n<ops; n++) {
+		try {
+			operation(dbg, n);
+		} catch(char *err) {
+			res->failed++;
+			if(verbose) {
+				fprintf(stderr, "op %lu: %s", n, err);
+			}
+
+			/* timed from the fault, not from its failure,
+			 * and from the first of several in a row */
+			if(!fault && faults) {
+				fault = faults->fault_time();
+			}
+			if(!fault) {
+				fault = timernow();
+			}
+
+			if(recover(dbg)) {
+				res->lost++;
+				break;
+			}
+			continue;
+		}
+
+		if(fault) {
+			elapsed = timernow() - fault;
+			res->resumed++;
+			res->resume_us += elapsed;
+			if(elapsed > res->resume_max) {
+				res->resume_max = elapsed;
+			}
+			fault = 0;
+		}
+	}
+	res->elapsed = timernow() - start;
+
+	if(faults) {
+		for(i=0; i<fault_modes; i++) {
+			const struct fault_stat *s;
+
+			s = faults->get_stat((enum ocd_fault_mode)i);
+			res->stat.injected += s->injected;
+			res->stat.recovered += s->recovered;
+			res->stat.resets += s->resets;
+			res->stat.total_us += s->total_us;
+			if(s->max_us > res->stat.max_us) {
+				res->stat.max_us = s->max_us;
+			}
+		}
+	}
+
+	delete dbg;
+
+	return 0;
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	struct result base, res;
+	char spec[128];
+	double per;
+	int i, err;
+
+	err = setup(argc, argv);
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	err = run(NULL, &base);
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	printf("%lu operations on %s, fault rate %g\n", ops, port, rate);
+	printf("no faults: %llu us\n\n",
+	    (unsigned long long)base.elapsed);
+
+	printf("%-10s %8s %6s %6s %8s %10s %10s %10s %10s\n", "fault",
+	    "injected", "failed", "lost", "resets", "mean us", "max us",
+	    "resume us", "max us");
+
+	for(i=0; i<fault_modes; i++) {
+		snprintf(spec, sizeof(spec), "%s=%g,latency=%d,seed=%lu",
+		    ocd_fault::mode_name(i), rate, latency, seed);
+
+		err = run(spec, &res);
+		if(err) {
+			return EXIT_FAILURE;
+		}
+
+		per = res.stat.recovered ?
+		    (double)res.stat.resets / res.stat.recovered : 0;
+
+		printf("%-10s %8lu %6lu %6lu %8.2f %10llu %10llu %10llu "
+		    "%10llu\n", ocd_fault::mode_name(i), res.stat.injected, 
+		    res.failed, res.lost, per, 
+		    (unsigned long long)(res.stat.recovered ?
+		    res.stat.total_us / res.stat.recovered : 0),
+		    (unsigned long long)res.stat.max_us,
+		    (unsigned long long)(res.resumed ? 
+		    res.resume_us / res.resumed : 0),
+		    (unsigned long long)res.resume_max);
+	}
+
+	printf("\nresets are link resets per fault recovered from, "
+	    "including those\nmade by the debugger itself; resume is "
+	    "from a fault to the next\noperation that succeeded\n");
+
+	return EXIT_SUCCESS;
+}
+
+/**************************************************************/
+
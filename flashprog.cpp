@@ -0,0 +1,115 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * The steps of programming a flash device: erase with a blank
+ * check, program, and verify. None of them print; each fills
+ * in a result for the caller to report.
+ */
+
+#include	<stdio.h>
+#include	<string.h>
+
+#include	"ez8.h"
+#include	"ez8dbg.h"
+#include	"flashprog.h"
+
+/**************************************************************
+ * This will read the crc of the device's memory and compare
+ * it with the one expected.
+ */
+
+static int check_crc(ez8dbg *dbg, uint16_t expect, const char *title,
+    struct flash_result *result)
+{
+	result->crc = dbg->rd_crc();
+	result->crc_read = 1;
+
+	if(result->crc != expect) {
+		snprintf(result->err, sizeof(result->err), 
+		    "%s\ncrc %04x, expected %04x\n", title, result->crc,
+		    expect);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * This will erase the device and check that it is blank. The
+ * crc of blank memory depends on the memory size, so it is
+ * passed in.
+ */
+
+int erase_device(ez8dbg *dbg, uint16_t blank_crc, 
+    struct flash_result *result)
+{
+	int err;
+
+	memset(result, 0, sizeof(*result));
+	result->step = flash_erase;
+
+	try {
+		dbg->flash_mass_erase();
+
+		/* if memory read protect enabled, 
+		 * reset after erased to clear it */
+		if(dbg->state(dbg->state_protected)) {
+			dbg->reset_chip();
+		}
+
+		result->step = flash_blank;
+		err = check_crc(dbg, blank_crc, "Blank check failed", 
+		    result);
+	} catch(char *msg) {
+		snprintf(result->err, sizeof(result->err), "%s", msg);
+		err = -1;
+	}
+
+	return err;
+}
+
+/**************************************************************
+ * This will write the whole image to the device.
+ */
+
+int program_device(ez8dbg *dbg, const uint8_t *image, 
+    struct flash_result *result)
+{
+	memset(result, 0, sizeof(*result));
+	result->step = flash_program;
+
+	try {
+		dbg->wr_mem(0x0000, image, EZ8MEM_SIZE);
+	} catch(char *msg) {
+		snprintf(result->err, sizeof(result->err), "%s", msg);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * This will check the device's memory against the crc of the
+ * image programmed.
+ */
+
+int verify_device(ez8dbg *dbg, uint16_t crc, struct flash_result *result)
+{
+	int err;
+
+	memset(result, 0, sizeof(*result));
+	result->step = flash_verify;
+
+	try {
+		err = check_crc(dbg, crc, "Verify failed", result);
+	} catch(char *msg) {
+		snprintf(result->err, sizeof(result->err), "%s", msg);
+		err = -1;
+	}
+
+	return err;
+}
+
+/**************************************************************/
+
@@ -0,0 +1,40 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * The steps of programming a flash device, shared by the
+ * flash utility and the flash programming sweep.
+ */
+
+#ifndef	FLASHPROG_HEADER
+#define	FLASHPROG_HEADER
+
+#include	<inttypes.h>
+#include	"ez8dbg.h"
+
+/**************************************************************/
+
+enum flash_step {
+	flash_erase,
+	flash_blank,			/* blank check after erase */
+	flash_program,
+	flash_verify
+};
+
+/* outcome of a step, so several devices can be programmed
+ * at once without sharing the terminal */
+struct flash_result {
+	enum flash_step step;		/* last step run */
+	bool crc_read;			/* crc was read from the device */
+	uint16_t crc;
+	char err[128];			/* as thrown, title and reason */
+};
+
+int erase_device(ez8dbg *, uint16_t, struct flash_result *);
+int program_device(ez8dbg *, const uint8_t *, struct flash_result *);
+int verify_device(ez8dbg *, uint16_t, struct flash_result *);
+
+/**************************************************************/
+
+#endif	/* FLASHPROG_HEADER */
+
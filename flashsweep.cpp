@@ -0,0 +1,528 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This program sweeps flash programming settings. For each
+ * combination of baudrate, mtu, image density and device it
+ * erases, blank checks, programs and verifies the device the
+ * way flashutil does, and reports the time in each phase, the
+ * programming throughput and how busy the link was.
+ *
+ * A simulated device moves data instantly, so for it the time
+ * the data would take on the wire is added to each phase: ten
+ * bits per byte at the baudrate, plus a latency for each reply
+ * waited for, as USB serial adapters add. On a serial port
+ * only measured time is used.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	<inttypes.h>
+
+#include	"ez8.h"
+#include	"ez8dbg.h"
+#include	"crc.h"
+#include	"flashprog.h"
+#include	"timer.h"
+#include	"err_msg.h"
+
+/**************************************************************/
+
+#define	PROGNAME	"flashsweep"
+
+#define	MAX_POINTS	16
+
+/* flash programming phases */
+enum phase {
+	phase_erase,			/* erase and blank check */
+	phase_program,
+	phase_verify,
+	phases
+};
+
+extern const char *build;
+const char *progname;
+
+const char *port = "sim";
+const char *baud_list = "57600,115200";
+const char *mtu_list = "0";
+const char *density_list = "10,100";
+const char *device_list = NULL;
+int sysclk = 20000000;
+int latency = 0;
+int repeats = 1;
+int json = 0;
+int verbose = 0;
+
+bool simulated;
+uint8_t *image;
+uint8_t *blank;
+
+/* one point of the sweep */
+struct point {
+	const char *device;
+	int baud;
+	int mtu;
+	int density;
+	int mem_size;
+	size_t image_bytes;
+	uint64_t time[phases];		/* microseconds */
+	uint64_t wire[phases];		/* link busy, microseconds */
+	uint64_t link_bytes;
+	unsigned long turns;
+};
+
+int results = 0;
+
+/**************************************************************/
+
+void help(void)
+{
+printf("%s - build %s\n", progname, build);
+printf(
+"Usage: flashsweep [OPTIONS]\n"
+"This utility programs a device with every combination of the\n"
+"settings given, and reports the time taken and link utilisation.\n"
+"Lists are comma separated.\n\n"
+"  -h               show this help\n"
+"  -p SERIALPORT    serialport to use, or sim (default: %s)\n"
+"  -b BAUDRATES     baudrates (default: %s)\n"
+"  -t MTUS          maximum transmission units, 0 for none (default: %s)\n"
+"  -D DENSITIES     percent of flash pages with data (default: %s)\n"
+"  -d DEVICES       simulated devices as REVID:MEMSIZE (default: auto)\n"
+"  -c FREQUENCY     clock frequency in hertz (default: %d)\n"
+"  -l LATENCY       simulated microseconds per reply waited for\n"
+"                   (default: %d)\n"
+"  -n COUNT         runs per point, the median is shown (default: %d)\n"
+"  -j               print JSON instead of CSV\n"
+"  -v               show progress\n\n",
+    port, baud_list, mtu_list, density_list, sysclk, latency, repeats);
+
+	return;
+}
+
+/**************************************************************/
+
+int setup(int argc, char **argv)
+{
+	int c;
+	const char *s;
+	char *tail;
+
+	progname = *argv;
+	s = strrchr(progname, '/');
+	if(s) {
+		progname = s+1;
+	}
+
+	while((c = getopt(argc, argv, "hp:b:t:D:d:c:l:n:jv")) != EOF) {
+		switch(c) {
+		case '?':
+			printf("Try '%s -h' for more information.\n", PROGNAME);
+			return -1;
+		case 'h':
+			help();
+			exit(EXIT_SUCCESS);
+		case 'p':
+			port = optarg;
+			break;
+		case 'b':
+			baud_list = optarg;
+			break;
+		case 't':
+			mtu_list = optarg;
+			break;
+		case 'D':
+			density_list = optarg;
+			break;
+		case 'd':
+			device_list = optarg;
+			break;
+		case 'c':
+			sysclk = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || sysclk <= 0) {
+				fprintf(stderr, "%s: invalid frequency %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'l':
+			latency = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || latency < 0) {
+				fprintf(stderr, "%s: invalid latency %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'n':
+			repeats = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || repeats <= 0) {
+				fprintf(stderr, "%s: invalid count %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'j':
+			json = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		}
+	}
+
+	if(optind < argc) {
+		fprintf(stderr, "%s: too many arguments\n", PROGNAME);
+		printf("Try '%s -h' for more information.\n", PROGNAME);
+		return -1;
+	}
+
+	simulated = !strcasecmp(port, "sim");
+	if(device_list && !simulated) {
+		fprintf(stderr, "%s: devices can only be chosen when "
+		    "simulated\n", PROGNAME);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * This will split a comma separated list of numbers.
+ */
+
+int parse_list(const char *list, int *values, const char *what)
+{
+	const char *s;
+	char *tail;
+	int n;
+
+	n = 0;
+	for(s=list; *s; s=tail) {
+		if(n >= MAX_POINTS) {
+			fprintf(stderr, "%s: too many %s\n", PROGNAME, what);
+			return -1;
+		}
+		values[n] = strtol(s, &tail, 0);
+		if(tail == s || (*tail && *tail != ',') || values[n] < 0) {
+			fprintf(stderr, "%s: invalid %s list %s\n", PROGNAME,
+			    what, list);
+			return -1;
+		}
+		n++;
+		if(*tail) {
+			tail++;
+		}
+	}
+
+	return n;
+}
+
+/**************************************************************
+ * This will fill the image for a density: that percentage of
+ * the pages hold data, spread evenly and starting with the
+ * first, the rest are erased.
+ */
+
+size_t make_image(int mem_size, int density)
+{
+	uint32_t seed;
+	int page, pages, i;
+	size_t bytes;
+
+	memset(image, 0xff, EZ8MEM_SIZE);
+
+	seed = 1;
+	pages = mem_size / EZ8MEM_PAGESIZE;
+	bytes = 0;
+	for(page=0; page<pages; page++) {
+		if(page * density % 100 >= density) {
+			continue;
+		}
+		for(i=0; i<EZ8MEM_PAGESIZE; i++) {
+			seed = seed * 1103515245 + 12345;
+			image[page * EZ8MEM_PAGESIZE + i] = seed >> 16;
+		}
+		bytes += EZ8MEM_PAGESIZE;
+	}
+
+	return bytes;
+}
+
+/**************************************************************
+ * This will total the link traffic since the statistics were
+ * cleared, and the time it took on the wire.
+ */
+
+uint64_t link_traffic(ez8dbg *dbg, int baud, struct point *p)
+{
+	const struct ocd_stat *s;
+	uint64_t bytes;
+	unsigned long turns;
+	int op;
+
+	bytes = 0;
+	turns = 0;
+	for(op=0; op<256; op++) {
+		s = dbg->get_stat(op);
+		bytes += s->bytes_out + s->bytes_in;
+		turns += s->turnarounds;
+	}
+	dbg->clear_stats();
+
+	p->link_bytes += bytes;
+	p->turns += turns;
+
+	return bytes * 10 * 1000000 / baud + (uint64_t)turns * latency;
+}
+
+/**************************************************************
+ * This will time one phase. Simulated phases are charged the
+ * time their traffic would take on the wire.
+ */
+
+void end_phase(ez8dbg *dbg, struct point *p, enum phase ph,
+    uint64_t start)
+{
+	p->time[ph] = timernow() - start;
+	p->wire[ph] = link_traffic(dbg, p->baud, p);
+	if(simulated) {
+		p->time[ph] += p->wire[ph];
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will erase, program and verify the device with the
+ * steps flashutil uses.
+ */
+
+void program(struct point *p)
+{
+	ez8dbg *dbg;
+	struct flash_result result;
+	uint64_t start;
+	int err;
+
+	dbg = new ez8dbg();
+	try {
+		if(simulated) {
+			dbg->connect_sim(p->device, p->baud, sysclk);
+		} else {
+			dbg->connect_serial(port, p->baud);
+		}
+		dbg->set_sysclk(sysclk);
+		dbg->mtu = p->mtu;
+		dbg->reset_link();
+		dbg->stop();
+		dbg->reset_chip();
+		p->mem_size = dbg->memory_size();
+		p->image_bytes = make_image(p->mem_size, p->density);
+		dbg->clear_stats();
+
+		start = timernow();
+		err = erase_device(dbg, crc_ccitt(0x0000, blank, 
+		    p->mem_size), &result);
+		if(!err) {
+			end_phase(dbg, p, phase_erase, start);
+
+			start = timernow();
+			err = program_device(dbg, image, &result);
+		}
+		if(!err) {
+			end_phase(dbg, p, phase_program, start);
+
+			start = timernow();
+			err = verify_device(dbg, crc_ccitt(0x0000, image, 
+			    p->mem_size), &result);
+		}
+		if(err) {
+			strncpy(err_msg, result.err, err_len-1);
+			throw err_msg;
+		}
+		end_phase(dbg, p, phase_verify, start);
+	} catch(char *err) {
+		delete dbg;
+		throw err;
+	}
+
+	delete dbg;
+
+	return;
+}
+
+/**************************************************************/
+
+int compare(const void *a, const void *b)
+{
+	const struct point *x, *y;
+	uint64_t tx, ty;
+	int i;
+
+	x = (const struct point *)a;
+	y = (const struct point *)b;
+
+	tx = ty = 0;
+	for(i=0; i<phases; i++) {
+		tx += x->time[i];
+		ty += y->time[i];
+	}
+
+	return tx < ty ? -1 : tx > ty;
+}
+
+/**************************************************************
+ * This will print the median run of a point.
+ */
+
+void report(struct point *p)
+{
+	uint64_t total, wire;
+	double rate, busy;
+	int i;
+
+	total = wire = 0;
+	for(i=0; i<phases; i++) {
+		total += p->time[i];
+		wire += p->wire[i];
+	}
+	rate = total ? p->image_bytes * 1000000.0 / total : 0;
+	busy = total ? 100.0 * wire / total : 0;
+
+	if(json) {
+		printf("%s\n  {\"device\": \"%s\", \"baud\": %d, \"mtu\": %d, "
+		    "\"density\": %d, \"mem_size\": %d, \"image_bytes\": %lu, "
+		    "\"erase_ms\": %.1f, \"program_ms\": %.1f, "
+		    "\"verify_ms\": %.1f, \"total_ms\": %.1f, "
+		    "\"bytes_per_s\": %.0f, \"link_bytes\": %llu, "
+		    "\"turns\": %lu, \"link_busy\": %.1f}",
+		    results ? "," : "", p->device ? p->device : "auto",
+		    p->baud, p->mtu, p->density, p->mem_size,
+		    (unsigned long)p->image_bytes,
+		    p->time[phase_erase] / 1000.0,
+		    p->time[phase_program] / 1000.0,
+		    p->time[phase_verify] / 1000.0, total / 1000.0, rate,
+		    (unsigned long long)p->link_bytes, p->turns, busy);
+	} else {
+		printf("%s,%d,%d,%d,%d,%lu,%.1f,%.1f,%.1f,%.1f,%.0f,%llu,"
+		    "%lu,%.1f\n", p->device ? p->device : "auto", p->baud,
+		    p->mtu, p->density, p->mem_size,
+		    (unsigned long)p->image_bytes,
+		    p->time[phase_erase] / 1000.0,
+		    p->time[phase_program] / 1000.0,
+		    p->time[phase_verify] / 1000.0, total / 1000.0, rate,
+		    (unsigned long long)p->link_bytes, p->turns, busy);
+	}
+	fflush(stdout);
+	results++;
+
+	return;
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	int bauds[MAX_POINTS], mtus[MAX_POINTS], densities[MAX_POINTS];
+	int num_bauds, num_mtus, num_densities;
+	const char *devices[MAX_POINTS];
+	int num_devices;
+	char *device_buff, *s;
+	struct point *runs;
+	int b, m, d, v, r, err;
+
+	err = setup(argc, argv);
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	num_bauds = parse_list(baud_list, bauds, "baudrate");
+	num_mtus = parse_list(mtu_list, mtus, "mtu");
+	num_densities = parse_list(density_list, densities, "density");
+	if(num_bauds <= 0 || num_mtus <= 0 || num_densities <= 0) {
+		return EXIT_FAILURE;
+	}
+	for(d=0; d<num_densities; d++) {
+		if(densities[d] > 100) {
+			fprintf(stderr, "%s: invalid density %d\n", PROGNAME,
+			    densities[d]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	num_devices = 0;
+	device_buff = NULL;
+	if(device_list) {
+		device_buff = strdup(device_list);
+		for(s=strtok(device_buff, ","); s && num_devices<MAX_POINTS;
+		    s=strtok(NULL, ",")) {
+			devices[num_devices++] = s;
+		}
+	} else {
+		devices[num_devices++] = NULL;
+	}
+
+	image = (uint8_t *)malloc(EZ8MEM_SIZE);
+	blank = (uint8_t *)malloc(EZ8MEM_SIZE);
+	memset(blank, 0xff, EZ8MEM_SIZE);
+	runs = (struct point *)malloc(repeats * sizeof(struct point));
+
+	if(json) {
+		printf("{\"build\": \"%s\", \"port\": \"%s\", "
+		    "\"simulated\": %s, \"latency_us\": %d, \"results\": [",
+		    build, port, simulated ? "true" : "false", latency);
+	} else {
+		printf("device,baud,mtu,density,mem_size,image_bytes,"
+		    "erase_ms,program_ms,verify_ms,total_ms,bytes_per_s,"
+		    "link_bytes,turns,link_busy\n");
+	}
+
+	err = 0;
+	for(v=0; v<num_devices && !err; v++)
+	for(b=0; b<num_bauds && !err; b++)
+	for(m=0; m<num_mtus && !err; m++)
+	for(d=0; d<num_densities && !err; d++) {
+		for(r=0; r<repeats; r++) {
+			memset(&runs[r], 0, sizeof(struct point));
+			runs[r].device = devices[v];
+			runs[r].baud = bauds[b];
+			runs[r].mtu = mtus[m];
+			runs[r].density = densities[d];
+			if(verbose) {
+				fprintf(stderr, "%s @ %d, mtu %d, %d%% ...\n",
+				    devices[v] ? devices[v] : "auto",
+				    bauds[b], mtus[m], densities[d]);
+			}
+			try {
+				program(&runs[r]);
+			} catch(char *msg) {
+				fprintf(stderr, "%s", msg);
+				err = 1;
+				break;
+			}
+		}
+		if(!err) {
+			qsort(runs, repeats, sizeof(struct point), compare);
+			report(&runs[repeats / 2]);
+		}
+	}
+
+	if(json) {
+		printf("\n]}\n");
+	}
+
+	free(runs);
+	free(image);
+	free(blank);
+	if(device_buff) {
+		free(device_buff);
+	}
+
+	return err ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**************************************************************/
+
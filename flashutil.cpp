@@ -11,13 +11,20 @@
 #include	<ctype.h>
 #include	<string.h>
 #include	<assert.h>
+#include	<pthread.h>
+#include	<signal.h>
+#include	<time.h>
 #include	<readline/readline.h>
 #include	"xmalloc.h"
 
+#include	"ez8.h"
 #include	"ez8dbg.h"
 #include	"crc.h"
+#include	"flashprog.h"
 #include	"hexfile.h"
+#include	"timer.h"
 #include	"version.h"
+#include	"err_msg.h"
 
 /**************************************************************/
 
@@ -71,6 +78,20 @@ static uint32_t serial_number;
 static int serial_size;
 
 static int unlock_ocd = 0;
+static int disable_echo = 0;
+static int auto_mtu = 0;
+static int show_stats = 0;
+static char *capture_file = NULL;
+static char *replay_file = NULL;
+static char *fault_spec = NULL;
+static char *gang_ports = NULL;
+static char *daemon_log = NULL;
+
+/* ms between probes for a device in daemon mode */
+#define	DAEMON_POLL	250
+
+/* probes in a row a device must miss to count as removed */
+#define	DAEMON_GONE	4
 
 /**************************************************************/
 
@@ -104,15 +125,23 @@ printf("  -n ADDR=NUMBER   serialize part at ADDR, starting with NUMBER\n");
 printf("  -e               erase device\n");
 printf("  -p SERIALPORT    specify serialport to use (default: %s)\n",
     DEFAULT_SERIALPORT);
+printf("                   sim[:REVID[:MEMSIZE]] for a simulated device\n");
 printf("  -b BAUDRATE      use baudrate (default: %d)\n", 
     DEFAULT_BAUDRATE);
-printf("  -t MTU           maximum transmission unit (default %d)\n", 
+printf("  -t MTU           maximum transmission unit, or auto (default %d)\n", 
     DEFAULT_MTU);
 printf("  -c FREQUENCY     clock frequency in hertz (default: %d)\n", 
     DEFAULT_XTAL);
 printf("  -s FILENAME      save memory to file\n");
 printf("  -z               fill memory with 00 instead of FF\n");
 printf("  -u               issue OCD unlock sequence for 8-pin device\n");
+printf("  -E               adapter does not echo transmitted data\n");
+printf("  -T               display link statistics on exit\n");
+printf("  -C FILE          capture ocd communication to FILE\n");
+printf("  -R FILE          replay a capture instead of a serialport\n");
+printf("  -F SPEC          inject link faults, as drop=RATE,timeout=RATE,...\n");
+printf("  -g PORTS         gang program on a comma separated list of ports\n");
+printf("  -d LOGFILE       daemon mode, program each device attached\n");
 printf("\n");
 
 return;
@@ -136,7 +165,7 @@ int setup(int argc, char **argv)
 		progname = s+1;
 	}
 	
-	while((c = getopt(argc, argv, "hiemn:p:b:c:s:t:zr:vu")) != EOF) {
+	while((c = getopt(argc, argv, "hiemn:p:b:c:s:t:zr:vuETC:R:F:g:d:")) != EOF) {
 		switch(c) {
 		case '?':
 			printf("Try '%s -h' for more information.\n", argv[0]);
@@ -219,6 +248,10 @@ int setup(int argc, char **argv)
 			xtal = (int)clock;
 			break;
 		case 't':
+			if(!strcasecmp(optarg, "auto")) {
+				auto_mtu = 1;
+				break;
+			}
 			mtu = strtol(optarg, &last, 0);
 			if(last == NULL || last == optarg || *last != '\0') {
 				fprintf(stderr, 
@@ -250,6 +283,27 @@ int setup(int argc, char **argv)
 		case 'u':
 			unlock_ocd = 1;
 			break;
+		case 'E':
+			disable_echo = 1;
+			break;
+		case 'T':
+			show_stats = 1;
+			break;
+		case 'C':
+			capture_file = optarg;
+			break;
+		case 'R':
+			replay_file = optarg;
+			break;
+		case 'F':
+			fault_spec = optarg;
+			break;
+		case 'g':
+			gang_ports = optarg;
+			break;
+		case 'd':
+			daemon_log = optarg;
+			break;
 		default:
 			abort();
 		}
@@ -279,6 +333,23 @@ int setup(int argc, char **argv)
 		return -1;
 	}
 
+	if(gang_ports && (multipass || info || savefilename || 
+	    capture_file || replay_file)) {
+		printf("Gang mode can only erase and program\n");
+		return -1;
+	}
+
+	if(daemon_log && (multipass || gang_ports || info || 
+	    savefilename || replay_file || !programfilename)) {
+		printf("Daemon mode needs an input file, and only programs\n");
+		return -1;
+	}
+
+	if(daemon_log && !strcasecmp(serialport, "auto")) {
+		printf("Daemon mode needs a serialport\n");
+		return -1;
+	}
+
 	dbg->mtu = mtu;
 
 	dbg->set_sysclk(xtal);
@@ -291,6 +362,28 @@ int setup(int argc, char **argv)
 	return 0;
 }
 
+/**************************************************************
+ * This will wrap a new connection in the fault injector, if
+ * asked to.
+ */
+
+int add_faults(void)
+{
+	if(!fault_spec) {
+		return 0;
+	}
+
+	try {
+		dbg->inject_faults(fault_spec);
+	} catch(char *err) {
+		fprintf(stderr, "%s", err);
+		dbg->disconnect();
+		return -1;
+	}
+
+	return 0;
+}
+
 /**************************************************************/
 
 int connect(void)
@@ -298,7 +391,7 @@ int connect(void)
 	int i;
 	const char *port;
 
-	if(strcasecmp(serialport, "auto") == 0) {
+	if(!replay_file && strcasecmp(serialport, "auto") == 0) {
 
 		printf("Autoconnecting to device ... ");
 		fflush(stdout);
@@ -306,7 +399,8 @@ int connect(void)
 		for(i=0; serialport_selection[i]; i++) {
 			port = serialport_selection[i];
 			try {
-				dbg->connect_serial(port, baudrate, unlock_ocd);
+				dbg->connect_serial(port, baudrate, unlock_ocd,
+				    !disable_echo);
 			} catch(char *err) {
 				continue;
 			}
@@ -319,7 +413,8 @@ int connect(void)
 			}
 
 			printf("found on %s\n", port);
-			return 0;
+			serialport = port;
+			return add_faults();
 		}
 
 		printf("fail\n");
@@ -329,7 +424,12 @@ int connect(void)
 
 	} else {
 		try {
-			dbg->connect_serial(serialport, baudrate, unlock_ocd);
+			if(replay_file) {
+				dbg->connect_replay(replay_file, baudrate);
+			} else {
+				dbg->connect_port(serialport, baudrate, xtal,
+				    unlock_ocd, !disable_echo);
+			}
 		} catch(char *err) {
 			printf("Could not connect to device\n");
 			fprintf(stderr, "%s", err);
@@ -345,7 +445,7 @@ int connect(void)
 		}
 	}
 
-	return 0;
+	return add_faults();
 }
 
 /**************************************************************/
@@ -508,81 +608,81 @@ int load_file(const char *filename)
 	return 0;
 }
 
+/**************************************************************
+ * This will report a step that ends with a crc check.
+ */
+
+int report_crc(int err, struct flash_result *result)
+{
+	if(!result->crc_read) {
+		printf("fail\n");
+		fprintf(stderr, "%s", result->err);
+		return -1;
+	}
+
+	printf("%s, crc: %04x\n", err ? "fail" : "ok", result->crc);
+
+	return err;
+}
+
 /**************************************************************/
 
-int erase_device(void)
+int do_erase(void)
 {
-	uint16_t crc;
+	struct flash_result result;
+	int err;
 
 	printf("Erasing device ... ");
 	fflush(stdout);
 
-	try {
 #ifdef	TEST
-		if(erase) {
-			extern void prepare_for_erase(void);
-			prepare_for_erase();
-			dbg->mass_erase(1);
-			dbg->reset_chip();
-			mem_size = dbg->memory_size();
-			blank_crc = crc_ccitt(0x0000, blank, mem_size);
-		} else
-#endif
-			dbg->flash_mass_erase();
-	} catch(char *err) {
-		printf("fail\n");
-		fprintf(stderr, "%s", err);
-		return -1;
-	}
+	if(erase) {
+		extern void prepare_for_erase(void);
 
-	/* if memory read protect enabled, 
-	 * reset after erased to clear it */
-	if(dbg->state(dbg->state_protected)) {
 		try {
+			prepare_for_erase();
+			dbg->mass_erase(1);
 			dbg->reset_chip();
 		} catch(char *err) {
 			printf("fail\n");
 			fprintf(stderr, "%s", err);
 			return -1;
 		}
+		mem_size = dbg->memory_size();
+		blank_crc = crc_ccitt(0x0000, blank, mem_size);
 	}
+#endif
 
-	printf("ok\n");
-
-	printf("Blank check ... ");
-	fflush(stdout);
-
-	try {
-		crc = dbg->rd_crc();
-	} catch(char *err) {
+	err = erase_device(dbg, blank_crc, &result);
+	if(err && result.step == flash_erase) {
 		printf("fail\n");
-		fprintf(stderr, "%s", err);
+		fprintf(stderr, "%s", result.err);
 		return -1;
 	}
 
-	if(crc != blank_crc) {
-		printf("fail, crc: %04x\n", crc);
-		return -1;
-	} else {
-		printf("ok, crc: %04x\n", crc);
-	}
+	printf("ok\n");
 
-	return 0;
+	printf("Blank check ... ");
+
+	return report_crc(err, &result);
 }
 
-/**************************************************************/
+/**************************************************************
+ * This will program and verify the device, leaving the crc
+ * read back in result.
+ */
 
-int program_device()
+int do_program(struct flash_result *result)
 {
-	uint16_t crc;
+	int err;
 
 	printf("Programming device ... ");
 	fflush(stdout);
-	try {
-		dbg->wr_mem(0x0000, buff, 0x10000);
-	} catch(char *err) {
+
+	err = program_device(dbg, buff, result);
+	if(err) {
 		printf("fail\n");
-		fprintf(stderr, "%s", err);
+		fprintf(stderr, "%s", result->err);
 		return -1;
 	}
  
@@ -590,28 +690,17 @@ int program_device()
 
 	printf("Verifying ... ");
 	fflush(stdout);
-	try {
-		crc = dbg->rd_crc();
-	} catch(char *err) {
-		printf("fail\n");
-		fprintf(stderr, "%s", err);
-		return -1;
-	}
 
-	if(crc != buff_crc) {
-		printf("fail, crc: %04x\n", crc);
-		return -1;
-	} else {
-		printf("ok, crc: %04x\n", crc);
-	}
+	err = verify_device(dbg, buff_crc, result);
 
-	return 0;
+	return report_crc(err, result);
 }
 
 /**************************************************************/
 
 int singlepassmode(void)
 {
+	struct flash_result result;
 	int err;
 
 	err = connect();
@@ -628,6 +717,10 @@ int singlepassmode(void)
 
 	try {
 		dbg->reset_chip();
+		dbg->identify();
+		if(auto_mtu) {
+			dbg->tune_mtu(serialport);
+		}
 	} catch(char *err) {
 		fprintf(stderr, "%s", err);
 		return -1;
@@ -671,7 +764,7 @@ int singlepassmode(void)
 	if(erase || programfilename) {
 		blank_crc = crc_ccitt(0x0000, blank, mem_size);
 
-		err = erase_device();
+		err = do_erase();
 		if(err) {
 			return -1;
 		}
@@ -680,7 +773,7 @@ int singlepassmode(void)
 	if(programfilename) {
 		serialize();
 		buff_crc = crc_ccitt(0x0000, buff, mem_size);
-		err = program_device();
+		err = do_program(&result);
 		if(err) {
 			return -1;
 		}
@@ -693,6 +786,7 @@ int singlepassmode(void)
 
 int multipassmode(void)
 {
+	struct flash_result result;
 	int err;
 	int connected;
 	char *input;
@@ -732,6 +826,10 @@ int multipassmode(void)
 
 			dbg->stop();
 			dbg->reset_chip();
+			dbg->identify();
+			if(auto_mtu) {
+				dbg->tune_mtu(serialport);
+			}
 
 			size = dbg->memory_size();
 			printf("Memory size: %dk\n", size / 1024);
@@ -753,14 +851,14 @@ int multipassmode(void)
 				mem_size = size;
 			}
 
-			err = erase_device();
+			err = do_erase();
 			if(err) {
 				continue;
 			}
 
 			serialize();
 
-			err = program_device();
+			err = do_program(&result);
 			if(err) {
 				continue;
 			}
@@ -774,6 +872,536 @@ int multipassmode(void)
 	return 0;
 }
 
+/**************************************************************
+ * Daemon mode programs devices without an operator. The file
+ * is read once, then the link is polled with a link reset and
+ * a revision id read; a device that answers is programmed, and
+ * the next is waited for once it stops answering. A record of
+ * each unit is appended to the log file.
+ */
+
+static volatile int daemon_running;
+
+void daemon_stop(int sig)
+{
+	daemon_running = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will check whether a device is attached, with the
+ * cheapest exchange that needs one to answer.
+ */
+
+bool probe_device(uint16_t *revid)
+{
+	try {
+		dbg->reset_link();
+		*revid = dbg->rd_revid();
+	} catch(char *err) {
+		return 0;
+	}
+
+	return *revid != 0x0000 && *revid != 0xffff;
+}
+
+/**************************************************************
+ * This will wait until a device is attached, or removed. One
+ * probe that goes unanswered does not mean the device is gone,
+ * so it only counts as removed after DAEMON_GONE in a row.
+ */
+
+int wait_device(bool attached, uint16_t *revid)
+{
+	int missed;
+
+	missed = 0;
+	while(daemon_running) {
+		if(probe_device(revid)) {
+			missed = 0;
+			if(attached) {
+				return 0;
+			}
+		} else if(!attached && ++missed >= DAEMON_GONE) {
+			return 0;
+		}
+		usleep(DAEMON_POLL * 1000);
+	}
+
+	return -1;
+}
+
+/**************************************************************
+ * This will program the device just attached, returning the
+ * time each step took, its memory size and the crc read back
+ * from it. Either is left alone if it was never found out.
+ */
+
+int daemon_program(uint64_t *steps, int *size, bool *crc_read, 
+    uint16_t *crc)
+{
+	struct flash_result result;
+	uint64_t start;
+	int err;
+
+	start = timernow();
+	try {
+		dbg->stop();
+		dbg->reset_chip();
+		dbg->identify();
+		if(auto_mtu) {
+			dbg->tune_mtu(serialport);
+		}
+		*size = dbg->memory_size();
+	} catch(char *err) {
+		fprintf(stderr, "%s", err);
+		return -1;
+	}
+	steps[0] = timernow() - start;
+
+	printf("Memory size: %dk\n", *size / 1024);
+	if(*size <= max_mem) {
+		fprintf(stderr, "ERROR: data out-of-range\n");
+		return -1;
+	}
+	if(*size < serial_address + serial_size) {
+		fprintf(stderr, "ERROR: serial address out-of-range\n");
+		return -1;
+	}
+	if(*size != mem_size) {
+		blank_crc = crc_ccitt(0x0000, blank, *size);
+		buff_crc = crc_ccitt(0x0000, buff, *size);
+		mem_size = *size;
+	}
+
+	start = timernow();
+	err = do_erase();
+	steps[1] = timernow() - start;
+	if(err) {
+		return -1;
+	}
+
+	serialize();
+
+	start = timernow();
+	err = do_program(&result);
+	steps[2] = timernow() - start;
+	if(result.crc_read) {
+		*crc = result.crc;
+		*crc_read = 1;
+	}
+
+	return err;
+}
+
+/**************************************************************/
+
+int daemonmode(void)
+{
+	FILE *log;
+	uint64_t steps[3], start, total;
+	uint16_t revid, crc;
+	uint32_t serial;
+	unsigned long units, passed;
+	char date[32];
+	time_t now;
+	bool crc_read;
+	int size, err;
+
+	printf("Daemon mode\n");
+
+	err = load_file(programfilename);
+	if(err) {
+		return -1;
+	}
+	mem_size = 0;
+
+	log = fopen(daemon_log, "a");
+	if(!log) {
+		perror(daemon_log);
+		return -1;
+	}
+	if(ftell(log) == 0) {
+		fprintf(log, "# date unit port revid memory serial result "
+		    "crc attach erase program total\n");
+		fflush(log);
+	}
+
+	try {
+		dbg->connect_port(serialport, baudrate, xtal, unlock_ocd,
+		    !disable_echo);
+	} catch(char *err) {
+		printf("Could not connect to device\n");
+		fprintf(stderr, "%s", err);
+		fclose(log);
+		return -1;
+	}
+	if(add_faults()) {
+		fclose(log);
+		return -1;
+	}
+
+	daemon_running = 1;
+	signal(SIGINT, daemon_stop);
+	signal(SIGTERM, daemon_stop);
+
+	units = passed = 0;
+	while(daemon_running) {
+		printf("\nWaiting for device on %s ... ", serialport);
+		fflush(stdout);
+		if(wait_device(1, &revid)) {
+			break;
+		}
+		printf("found, revid %04x\n", revid);
+
+		units++;
+		serial = serial_number;
+		memset(steps, 0, sizeof(steps));
+		size = 0;
+		crc_read = 0;
+
+		start = timernow();
+		err = daemon_program(steps, &size, &crc_read, &crc);
+		total = timernow() - start;
+		if(!err) {
+			passed++;
+		}
+
+		now = time(NULL);
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", 
+		    localtime(&now));
+		fprintf(log, "%s %lu %s %04x ", date, units, serialport,
+		    revid);
+		if(size) {
+			fprintf(log, "%d ", size);
+		} else {
+			fprintf(log, "- ");
+		}
+		if(serial_size) {
+			fprintf(log, "%0*x ", serial_size * 2, serial);
+		} else {
+			fprintf(log, "- ");
+		}
+		fprintf(log, "%s ", err ? "fail" : "pass");
+		if(crc_read) {
+			fprintf(log, "%04x ", crc);
+		} else {
+			fprintf(log, "- ");
+		}
+		fprintf(log, "%.3f %.3f %.3f %.3f\n", steps[0] / 1000000.0,
+		    steps[1] / 1000000.0, steps[2] / 1000000.0, 
+		    total / 1000000.0);
+		fflush(log);
+
+		printf("Unit %lu %s, remove device ... ", units, 
+		    err ? "FAILED" : "passed");
+		fflush(stdout);
+		if(wait_device(0, &revid)) {
+			break;
+		}
+		printf("removed\n");
+	}
+
+	printf("\n%lu units, %lu passed, %lu failed\n", units, passed,
+	    units - passed);
+
+	signal(SIGINT, SIG_DFL);
+	signal(SIGTERM, SIG_DFL);
+	fclose(log);
+
+	return 0;
+}
+
+/**************************************************************
+ * Gang mode programs devices on several ports at once, with a
+ * thread and a debugger for each port. The image is read and
+ * its CRCs are computed once, and shared by all threads.
+ */
+
+/* crc of the image and of blank memory, up to each page */
+static uint16_t *page_crc, *blank_page_crc;
+
+static pthread_mutex_t gang_lock = PTHREAD_MUTEX_INITIALIZER;
+
+struct gang_unit {
+	const char *port;
+	pthread_t thread;
+	bool started;
+	int err;
+	char msg[80];
+	int mem_size;
+	uint32_t serial;
+	uint16_t crc;
+	uint64_t time[4];		/* connect, erase, program, verify */
+};
+
+/**************************************************************
+ * This will compute the crc of the data up to each page
+ * boundary, so the crc for any memory size is a lookup.
+ */
+
+uint16_t *page_crcs(uint8_t *data)
+{
+	uint16_t *crc;
+	int page;
+
+	crc = (uint16_t *)xmalloc((MEMSIZE / EZ8MEM_PAGESIZE + 1) * 
+	    sizeof(uint16_t));
+
+	crc[0] = crc_ccitt(0x0000, data, 0);
+	for(page=0; page<MEMSIZE/EZ8MEM_PAGESIZE; page++) {
+		crc[page+1] = crc_ccitt(crc[page], 
+		    data + page * EZ8MEM_PAGESIZE, EZ8MEM_PAGESIZE);
+	}
+
+	return crc;
+}
+
+/**************************************************************
+ * This will keep the reason of an error, its second line, in
+ * the unit, as the threads share the terminal.
+ */
+
+void gang_error(struct gang_unit *unit, const char *err)
+{
+	const char *nl;
+	char *end;
+
+	nl = strchr(err, '\n');
+	snprintf(unit->msg, sizeof(unit->msg), "%s", 
+	    nl && nl[1] ? nl + 1 : err);
+	end = strchr(unit->msg, '\n');
+	if(end) {
+		*end = '\0';
+	}
+	unit->err = -1;
+
+	return;
+}
+
+/**************************************************************
+ * This will program one device.
+ */
+
+void gang_program(struct gang_unit *unit)
+{
+	ez8dbg *gdbg;
+	struct flash_result result;
+	uint8_t *image;
+	uint16_t expect;
+	uint64_t start;
+	uint32_t number;
+	int i;
+
+	image = buff;
+	gdbg = new ez8dbg();
+
+	try {
+		start = timernow();
+		gdbg->connect_port(unit->port, baudrate, xtal, unlock_ocd,
+		    !disable_echo);
+		gdbg->mtu = mtu;
+		gdbg->set_sysclk(xtal);
+		if(fault_spec) {
+			gdbg->inject_faults(fault_spec);
+		}
+		gdbg->reset_link();
+		gdbg->stop();
+		gdbg->reset_chip();
+		gdbg->identify();
+		if(auto_mtu) {
+			/* the mtu cache is one file */
+			pthread_mutex_lock(&gang_lock);
+			try {
+				gdbg->tune_mtu(unit->port);
+			} catch(char *err) {
+				pthread_mutex_unlock(&gang_lock);
+				throw err;
+			}
+			pthread_mutex_unlock(&gang_lock);
+		}
+		unit->mem_size = gdbg->memory_size();
+		unit->time[0] = timernow() - start;
+
+		if(unit->mem_size <= max_mem) {
+			strncpy(err_msg, "Cannot program device\n"
+			    "data too large for device\n", err_len-1);
+			throw err_msg;
+		}
+		if(unit->mem_size < serial_address + serial_size) {
+			strncpy(err_msg, "Cannot program device\n"
+			    "serial address out-of-range for device\n", 
+			    err_len-1);
+			throw err_msg;
+		}
+	} catch(char *err) {
+		gang_error(unit, err);
+	}
+
+	if(!unit->err) {
+		start = timernow();
+		if(erase_device(gdbg, blank_page_crc[unit->mem_size / 
+		    EZ8MEM_PAGESIZE], &result)) {
+			gang_error(unit, result.err);
+		}
+		unit->time[1] = timernow() - start;
+	}
+
+	if(!unit->err && programfilename) {
+		expect = page_crc[unit->mem_size / EZ8MEM_PAGESIZE];
+
+		/* serialized units get their own copy */
+		if(serial_size) {
+			image = (uint8_t *)xmalloc(MEMSIZE);
+			memcpy(image, buff, MEMSIZE);
+
+			pthread_mutex_lock(&gang_lock);
+			unit->serial = serial_number++;
+			pthread_mutex_unlock(&gang_lock);
+
+			number = unit->serial;
+			for(i=serial_size; i>0; i--) {
+				image[serial_address + i - 1] = number & 0xff;
+				number >>= 8;
+			}
+			expect = crc_ccitt(0x0000, image, unit->mem_size);
+		}
+
+		start = timernow();
+		if(program_device(gdbg, image, &result)) {
+			gang_error(unit, result.err);
+		}
+		unit->time[2] = timernow() - start;
+	}
+
+	if(!unit->err && programfilename) {
+		start = timernow();
+		if(verify_device(gdbg, expect, &result)) {
+			gang_error(unit, result.err);
+		}
+		unit->crc = result.crc;
+		unit->time[3] = timernow() - start;
+	}
+
+	/* -T reports the gang as a whole */
+	pthread_mutex_lock(&gang_lock);
+	dbg->add_stats(gdbg);
+	pthread_mutex_unlock(&gang_lock);
+
+	if(image != buff) {
+		free(image);
+	}
+	delete gdbg;
+
+	return;
+}
+
+/**************************************************************/
+
+void *gang_thread(void *arg)
+{
+	gang_program((struct gang_unit *)arg);
+
+	return NULL;
+}
+
+/**************************************************************
+ * This will program all ports in the gang, and report each
+ * one's result and timing.
+ */
+
+int gangmode(void)
+{
+	struct gang_unit *units;
+	char *ports, *port;
+	int num_units, failed, i, j;
+	struct timer t;
+
+	if(programfilename) {
+		if(load_file(programfilename)) {
+			return -1;
+		}
+	}
+	page_crc = page_crcs(buff);
+	blank_page_crc = page_crcs(blank);
+
+	ports = xstrdup(gang_ports);
+	num_units = 1;
+	for(port=ports; *port; port++) {
+		if(*port == ',') {
+			num_units++;
+		}
+	}
+	units = (struct gang_unit *)xmalloc(num_units * 
+	    sizeof(struct gang_unit));
+	memset(units, 0, num_units * sizeof(struct gang_unit));
+
+	num_units = 0;
+	for(port=strtok(ports, ","); port; port=strtok(NULL, ",")) {
+		units[num_units++].port = port;
+	}
+
+	printf("Gang %s %d devices ... ", 
+	    programfilename ? "programming" : "erasing", num_units);
+	fflush(stdout);
+
+	timerstart(&t);
+	for(i=0; i<num_units; i++) {
+		if(pthread_create(&units[i].thread, NULL, gang_thread,
+		    &units[i])) {
+			units[i].err = -1;
+			snprintf(units[i].msg, sizeof(units[i].msg),
+			    "cannot create thread");
+			continue;
+		}
+		units[i].started = 1;
+	}
+	for(i=0; i<num_units; i++) {
+		if(units[i].started) {
+			pthread_join(units[i].thread, NULL);
+		}
+	}
+	timerstop(&t);
+	printf("done in %s\n", timerstr(&t));
+
+	printf("%-16s %-4s %6s %8s %8s %8s %8s %8s  %s\n", "port", 
+	    "pass", "memory", "serial", "connect", "erase", "program", 
+	    "verify", "crc");
+	failed = 0;
+	for(i=0; i<num_units; i++) {
+		struct gang_unit *u = &units[i];
+
+		printf("%-16s %-4s %5dk ", u->port, u->err ? "FAIL" : "ok",
+		    u->mem_size / 1024);
+		if(serial_size && !u->err) {
+			printf("%*s%0*x ", 8 - serial_size * 2, "",
+			    serial_size * 2, u->serial);
+		} else {
+			printf("%8s ", "-");
+		}
+		for(j=0; j<4; j++) {
+			printf("%8.2f ", u->time[j] / 1000000.0);
+		}
+		if(u->err) {
+			printf(" %s\n", u->msg);
+			failed++;
+		} else if(programfilename) {
+			printf(" %04x\n", u->crc);
+		} else {
+			printf(" -\n");
+		}
+	}
+	printf("%d passed, %d failed\n", num_units - failed, failed);
+
+	free(units);
+	free(ports);
+	free(page_crc);
+	free(blank_page_crc);
+
+	return failed ? -1 : 0;
+}
+
 /**************************************************************/
 
 int main(int argc, char **argv)
@@ -787,12 +1415,30 @@ int main(int argc, char **argv)
 
 	printf("%s - build %s\n", banner, build);
 
-	if(multipass) {
+	if(capture_file) {
+		try {
+			dbg->start_capture(capture_file);
+		} catch(char *err) {
+			fprintf(stderr, "%s", err);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if(daemon_log) {
+		err = daemonmode();
+	} else if(gang_ports) {
+		err = gangmode();
+	} else if(multipass) {
 		err = multipassmode();
 	} else {
 		err = singlepassmode();
 	}
 
+	if(show_stats) {
+		dbg->dump_stats(stderr);
+	}
+	dbg->stop_capture();
+
 	if(err) {
 		return EXIT_FAILURE;
 	}
@@ -459,7 +459,7 @@ int rd_hexfile(uint8_t *buff, size_t buffsize, const char *filename)
 		fclose(file);
 		return -1;
 	}
-
+	fclose(file);
 
 	return err;
 }
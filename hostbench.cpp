@@ -0,0 +1,468 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This program times the host side of the debugger: the CRC,
+ * hexfile, disassembler and dump routines, and the encoding of
+ * on-chip debugger commands against a link that does nothing.
+ * No device is needed. Each benchmark is run in batches long
+ * enough to time accurately, and the minimum, median and 99th
+ * percentile time per call are printed as CSV or JSON so that
+ * builds can be compared.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	<inttypes.h>
+
+#include	"ocd.h"
+#include	"ez8ocd.h"
+#include	"crc.h"
+#include	"hexfile.h"
+#include	"disassembler.h"
+#include	"dump.h"
+#include	"timer.h"
+#include	"err_msg.h"
+
+/**************************************************************/
+
+#define	PROGNAME	"hostbench"
+
+#define	IMAGE_SIZE	0x10000
+
+/* shortest batch to time, in microseconds */
+#define	MIN_BATCH	2000
+
+#ifndef	_WIN32
+#define	NULL_DEVICE	"/dev/null"
+#else
+#define	NULL_DEVICE	"NUL"
+#endif
+
+extern const char *build;
+const char *progname;
+
+int samples = 31;
+int json = 0;
+const char *tmpdir = NULL;
+const char *only = NULL;
+
+FILE *out;
+int results = 0;
+
+uint8_t *image;			/* code-like data */
+uint8_t *buff;
+char ihex_file[256];
+char srec_file[256];
+char save_file[256];
+
+/**************************************************************/
+
+void help(void)
+{
+printf("%s - build %s\n", progname, build);
+printf(
+"Usage: hostbench [OPTIONS]\n"
+"This utility times the host side of the debugger and prints the\n"
+"minimum, median and 99th percentile time per call.\n\n"
+"  -h               show this help\n"
+"  -j               print JSON instead of CSV\n"
+"  -n SAMPLES       batches timed per benchmark (default: %d)\n"
+"  -b NAME          only run benchmarks whose name starts with NAME\n"
+"  -d DIR           directory for temporary files (default: $TMPDIR\n"
+"                   or /tmp)\n\n", samples);
+
+	return;
+}
+
+/**************************************************************/
+
+int setup(int argc, char **argv)
+{
+	int c;
+	const char *s;
+	char *tail;
+
+	progname = *argv;
+	s = strrchr(progname, '/');
+	if(s) {
+		progname = s+1;
+	}
+
+	while((c = getopt(argc, argv, "hjn:b:d:")) != EOF) {
+		switch(c) {
+		case '?':
+			printf("Try '%s -h' for more information.\n", PROGNAME);
+			return -1;
+		case 'h':
+			help();
+			exit(EXIT_SUCCESS);
+		case 'j':
+			json = 1;
+			break;
+		case 'n':
+			samples = strtol(optarg, &tail, 10);
+			if(tail == optarg || *tail || samples <= 0) {
+				fprintf(stderr, "%s: invalid count %s\n",
+				    PROGNAME, optarg);
+				return -1;
+			}
+			break;
+		case 'b':
+			only = optarg;
+			break;
+		case 'd':
+			tmpdir = optarg;
+			break;
+		}
+	}
+
+	if(optind < argc) {
+		fprintf(stderr, "%s: too many arguments\n", PROGNAME);
+		printf("Try '%s -h' for more information.\n", PROGNAME);
+		return -1;
+	}
+
+	if(!tmpdir) {
+		tmpdir = getenv("TMPDIR");
+	}
+	if(!tmpdir) {
+		tmpdir = "/tmp";
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * This is an on-chip debugger link that accepts everything
+ * and replies with zeros, so only the encoding is timed.
+ */
+
+class ocd_null : public ocd
+{
+public:
+	void reset(void) { };
+	bool link_open(void) { return 1; };
+	bool link_up(void) { return 1; };
+	int  link_speed(void) { return 115200; };
+	void set_baudrate(int) { };
+	void set_timeout(int) { };
+	void read(uint8_t *data, size_t size) { memset(data, 0, size); };
+	void write(const uint8_t *, size_t) { };
+	bool available(void) { return 0; };
+	bool error(void) { return 0; };
+};
+
+/**************************************************************
+ * This will fill the image with a repeatable mix of random
+ * bytes and runs of erased flash, as firmware images have.
+ */
+
+void make_image(void)
+{
+	uint32_t seed;
+	int i;
+
+	seed = 1;
+	for(i=0; i<IMAGE_SIZE; i++) {
+		seed = seed * 1103515245 + 12345;
+		image[i] = seed >> 16;
+	}
+	for(i=0; i<IMAGE_SIZE; i+=0x1000) {
+		memset(image + i + 0x0c00, 0xff, 0x400);
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will write the image as S-records, since wr_hexfile()
+ * only writes Intel hex.
+ */
+
+int wr_srec(const uint8_t *data, size_t size, const char *filename)
+{
+	FILE *file;
+	size_t addr, len, i;
+	uint8_t checksum;
+
+	file = fopen(filename, "wb");
+	if(!file) {
+		perror(filename);
+		return -1;
+	}
+
+	for(addr=0; addr<size; addr+=len) {
+		len = size - addr < 32 ? size - addr : 32;
+		checksum = len + 3 + (addr >> 8) + addr;
+		fprintf(file, "S1%02X%04X", (int)len + 3, (int)addr);
+		for(i=0; i<len; i++) {
+			fprintf(file, "%02X", data[addr+i]);
+			checksum += data[addr+i];
+		}
+		fprintf(file, "%02X\n", (uint8_t)~checksum);
+	}
+	fprintf(file, "S9030000FC\n");
+	fclose(file);
+
+	return 0;
+}
+
+/**************************************************************
+ * The benchmarks. Each runs its operation once per call.
+ */
+
+size_t crc_size;
+
+void bench_crc(void)
+{
+	crc_ccitt(0, image, crc_size);
+
+	return;
+}
+
+void bench_rd_ihex(void)
+{
+	memset(buff, 0xff, IMAGE_SIZE);
+	if(rd_hexfile(buff, IMAGE_SIZE, ihex_file)) {
+		exit(EXIT_FAILURE);
+	}
+
+	return;
+}
+
+void bench_rd_srec(void)
+{
+	memset(buff, 0xff, IMAGE_SIZE);
+	if(rd_hexfile(buff, IMAGE_SIZE, srec_file)) {
+		exit(EXIT_FAILURE);
+	}
+
+	return;
+}
+
+void bench_wr_ihex(void)
+{
+	if(wr_hexfile(image, IMAGE_SIZE, 0, save_file)) {
+		exit(EXIT_FAILURE);
+	}
+
+	return;
+}
+
+void bench_disassemble(void)
+{
+	char text[64];
+	int pc, size;
+
+	/* disassemble() may look past the instruction */
+	for(pc=0; pc<IMAGE_SIZE-8; pc+=size) {
+		size = disassemble(text, sizeof(text), image + pc, pc);
+		if(size <= 0) {
+			size = 1;
+		}
+	}
+
+	return;
+}
+
+void bench_dump(void)
+{
+	dump_data_repeat(0x0000, image, IMAGE_SIZE, 0x40);
+
+	return;
+}
+
+ez8ocd *ocd_bench;
+
+void bench_rd_mem(void)
+{
+	ocd_bench->rd_mem(0x0000, buff, 1024);
+
+	return;
+}
+
+void bench_wr_mem(void)
+{
+	ocd_bench->wr_mem(0x0000, image, 1024);
+
+	return;
+}
+
+void bench_rd_regs(void)
+{
+	ocd_bench->rd_regs(0x000, buff, 256);
+
+	return;
+}
+
+void bench_rd_pc(void)
+{
+	ocd_bench->rd_pc();
+
+	return;
+}
+
+/**************************************************************/
+
+int compare(const void *a, const void *b)
+{
+	double x, y;
+
+	x = *(const double *)a;
+	y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/**************************************************************
+ * This will time a benchmark. The batch size is doubled until
+ * a batch takes MIN_BATCH microseconds, then samples batches
+ * are timed. Times are per call, in nanoseconds.
+ */
+
+void run(const char *name, size_t bytes, void (*fn)(void))
+{
+	double *t, min, median, p99;
+	unsigned long reps, i;
+	uint64_t start, elapsed;
+	int s;
+
+	if(only && strncmp(name, only, strlen(only))) {
+		return;
+	}
+
+	/* warm up, then find a batch size */
+	fn();
+	for(reps=1; ; reps*=2) {
+		start = timernow();
+		for(i=0; i<reps; i++) {
+			fn();
+		}
+		elapsed = timernow() - start;
+		if(elapsed >= MIN_BATCH) {
+			break;
+		}
+	}
+
+	t = (double *)malloc(samples * sizeof(double));
+	for(s=0; s<samples; s++) {
+		start = timernow();
+		for(i=0; i<reps; i++) {
+			fn();
+		}
+		elapsed = timernow() - start;
+		t[s] = elapsed * 1000.0 / reps;
+	}
+	qsort(t, samples, sizeof(double), compare);
+
+	min = t[0];
+	median = t[samples / 2];
+	p99 = t[(samples * 99 + 99) / 100 - 1];
+	free(t);
+
+	if(json) {
+		fprintf(out, "%s\n  {\"name\": \"%s\", \"bytes\": %lu, "
+		    "\"reps\": %lu, \"samples\": %d, \"min_ns\": %.1f, "
+		    "\"median_ns\": %.1f, \"p99_ns\": %.1f, "
+		    "\"mb_per_s\": %.2f}", results ? "," : "", name,
+		    (unsigned long)bytes, reps, samples, min, median, p99,
+		    median > 0 ? bytes * 1000.0 / median : 0);
+	} else {
+		fprintf(out, "%s,%lu,%lu,%d,%.1f,%.1f,%.1f,%.2f\n", name,
+		    (unsigned long)bytes, reps, samples, min, median, p99,
+		    median > 0 ? bytes * 1000.0 / median : 0);
+	}
+	fflush(out);
+	results++;
+
+	return;
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	static const size_t crc_sizes[] = { 1024, 4096, 16384, 65536 };
+	char name[32];
+	int err, failed, i;
+
+	err = setup(argc, argv);
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	/* the dump routines write to stdout */
+	out = fdopen(dup(fileno(stdout)), "w");
+	if(!out || !freopen(NULL_DEVICE, "w", stdout)) {
+		perror(NULL_DEVICE);
+		return EXIT_FAILURE;
+	}
+
+	image = (uint8_t *)malloc(IMAGE_SIZE + 8);
+	buff = (uint8_t *)malloc(IMAGE_SIZE);
+	make_image();
+	memset(image + IMAGE_SIZE, 0xff, 8);
+
+	snprintf(ihex_file, sizeof(ihex_file), "%s/hostbench-%d.hex",
+	    tmpdir, (int)getpid());
+	snprintf(srec_file, sizeof(srec_file), "%s/hostbench-%d.s19",
+	    tmpdir, (int)getpid());
+	snprintf(save_file, sizeof(save_file), "%s/hostbench-%d.out",
+	    tmpdir, (int)getpid());
+	if(wr_hexfile(image, IMAGE_SIZE, 0, ihex_file) ||
+	    wr_srec(image, IMAGE_SIZE, srec_file)) {
+		return EXIT_FAILURE;
+	}
+
+	ocd_bench = new ez8ocd();
+	ocd_bench->dbg = new ocd_null();
+
+	if(json) {
+		fprintf(out, "{\"build\": \"%s\", \"results\": [", build);
+	} else {
+		fprintf(out, "name,bytes,reps,samples,min_ns,median_ns,"
+		    "p99_ns,mb_per_s\n");
+	}
+
+	failed = 0;
+	try {
+		for(i=0; i<(int)(sizeof(crc_sizes)/sizeof(*crc_sizes)); i++) {
+			crc_size = crc_sizes[i];
+			snprintf(name, sizeof(name), "crc_ccitt_%luk",
+			    (unsigned long)crc_size / 1024);
+			run(name, crc_size, bench_crc);
+		}
+		run("rd_hexfile_ihex", IMAGE_SIZE, bench_rd_ihex);
+		run("rd_hexfile_srec", IMAGE_SIZE, bench_rd_srec);
+		run("wr_hexfile", IMAGE_SIZE, bench_wr_ihex);
+		run("disassemble_64k", IMAGE_SIZE, bench_disassemble);
+		run("dump_data_repeat_64k", IMAGE_SIZE, bench_dump);
+		run("ez8ocd_rd_mem_1k", 1024, bench_rd_mem);
+		run("ez8ocd_wr_mem_1k", 1024, bench_wr_mem);
+		run("ez8ocd_rd_regs_256", 256, bench_rd_regs);
+		run("ez8ocd_rd_pc", 0, bench_rd_pc);
+	} catch(char *err) {
+		fprintf(stderr, "%s", err);
+		failed = 1;
+	}
+
+	if(json) {
+		fprintf(out, "\n]}\n");
+	}
+	fclose(out);
+
+	unlink(ihex_file);
+	unlink(srec_file);
+	unlink(save_file);
+	delete ocd_bench;
+	free(image);
+	free(buff);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**************************************************************/
+
@@ -0,0 +1,422 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This program checks what high level debugger operations
+ * cost on the link. Each operation is run against a simulated
+ * device through a link that counts turnarounds (replies
+ * waited for) and bytes each way, and the counts are compared
+ * with the budgets in a configuration file:
+ *
+ *	# operation = turnarounds bytes_out bytes_in
+ *	stop = 2 4 2
+ *
+ * The program exits with failure if any operation goes over
+ * its budget, so an extra register read or verify pass shows
+ * up as soon as it is added. With -w the counts measured are
+ * printed in the same format, to start a new budget file.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	<unistd.h>
+#include	<inttypes.h>
+
+#include	"ocd.h"
+#include	"ocd_sim.h"
+#include	"ez8.h"
+#include	"ez8dbg.h"
+#include	"cfg.h"
+#include	"err_msg.h"
+
+/**************************************************************/
+
+#define	PROGNAME	"linkbudget"
+
+#define	DEFAULT_BUDGET	"linkbudget.cfg"
+#define	BAUDRATE	57600
+#define	SYSCLK		20000000
+
+/* most milliseconds to wait for the image to reach its break */
+#define	BREAK_WAIT	10000
+
+extern const char *build;
+const char *progname;
+
+const char *budget_file = DEFAULT_BUDGET;
+const char *device = NULL;
+int write_budget = 0;
+int verbose = 0;
+
+/**************************************************************/
+
+void help(void)
+{
+printf("%s - build %s\n", progname, build);
+printf(
+"Usage: linkbudget [OPTIONS] [BUDGETFILE]\n"
+"This utility counts the link turnarounds and bytes each debugger\n"
+"operation costs against a simulated device, and fails if any is\n"
+"over the budget in BUDGETFILE (default: %s).\n\n"
+"  -h               show this help\n"
+"  -d REVID[:SIZE]  simulated device (default: auto)\n"
+"  -w               print the counts as a new budget file\n"
+"  -v               show every operation, not only failures\n\n",
+    DEFAULT_BUDGET);
+
+	return;
+}
+
+/**************************************************************/
+
+int setup(int argc, char **argv)
+{
+	int c;
+	const char *s;
+
+	progname = *argv;
+	s = strrchr(progname, '/');
+	if(s) {
+		progname = s+1;
+	}
+
+	while((c = getopt(argc, argv, "hd:wv")) != EOF) {
+		switch(c) {
+		case '?':
+			printf("Try '%s -h' for more information.\n", PROGNAME);
+			return -1;
+		case 'h':
+			help();
+			exit(EXIT_SUCCESS);
+		case 'd':
+			device = optarg;
+			break;
+		case 'w':
+			write_budget = 1;
+			break;
+		case 'v':
+			verbose = 1;
+			break;
+		}
+	}
+
+	if(optind < argc) {
+		budget_file = argv[optind++];
+	}
+	if(optind < argc) {
+		fprintf(stderr, "%s: too many arguments\n", PROGNAME);
+		printf("Try '%s -h' for more information.\n", PROGNAME);
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * This is an on-chip debugger link that counts the traffic
+ * through it. A read following a write is a turnaround, the
+ * host waiting for the device to reply.
+ */
+
+class ocd_count : public ocd
+{
+private:
+	ocd *link;
+	bool wrote;
+
+public:
+	unsigned long turns;
+	unsigned long bytes_out;
+	unsigned long bytes_in;
+	unsigned long resets;
+
+	ocd_count(ocd *ocdptr) {
+		link = ocdptr;
+		clear();
+	};
+	~ocd_count() {
+		delete link;
+	};
+
+	void clear(void) {
+		wrote = 0;
+		turns = 0;
+		bytes_out = 0;
+		bytes_in = 0;
+		resets = 0;
+	};
+
+	void reset(void) {
+		resets++;
+		wrote = 0;
+		link->reset();
+	};
+	bool link_open(void) { return link->link_open(); };
+	bool link_up(void) { return link->link_up(); };
+	int  link_speed(void) { return link->link_speed(); };
+	void set_baudrate(int baud) { link->set_baudrate(baud); };
+	void set_timeout(int ms) { link->set_timeout(ms); };
+	bool available(void) { return link->available(); };
+	bool error(void) { return link->error(); };
+
+	void read(uint8_t *buff, size_t size) {
+		link->read(buff, size);
+		if(wrote) {
+			turns++;
+			wrote = 0;
+		}
+		bytes_in += size;
+	};
+	void write(const uint8_t *buff, size_t size) {
+		link->write(buff, size);
+		wrote = 1;
+		bytes_out += size;
+	};
+};
+
+/**************************************************************/
+
+ez8dbg *dbg;
+ocd_count *counter;
+cfgfile *budget;
+uint8_t *image;
+uint8_t buff[0x100];
+
+int checked = 0;
+int failed = 0;
+
+/**************************************************************
+ * This will compare the counts for an operation with its
+ * budget, or print them as a budget.
+ */
+
+void check(const char *name)
+{
+	unsigned long limit[3], count[3];
+	static const char *what[3] = {
+		"turnarounds", "bytes out", "bytes in"
+	};
+	const char *value;
+	char *tail;
+	int i, over;
+
+	count[0] = counter->turns;
+	count[1] = counter->bytes_out;
+	count[2] = counter->bytes_in;
+
+	if(write_budget) {
+		printf("%-20s = %lu %lu %lu\n", name, count[0], count[1],
+		    count[2]);
+		return;
+	}
+
+	checked++;
+
+	value = budget->get(name);
+	if(!value) {
+		printf("%-20s %6lu %6lu %6lu   no budget\n", name,
+		    count[0], count[1], count[2]);
+		failed++;
+		return;
+	}
+
+	for(i=0; i<3; i++) {
+		limit[i] = strtoul(value, &tail, 10);
+		if(tail == value) {
+			printf("%-20s invalid budget \"%s\"\n", name,
+			    budget->get(name));
+			failed++;
+			return;
+		}
+		value = tail;
+	}
+
+	over = 0;
+	for(i=0; i<3; i++) {
+		if(count[i] > limit[i]) {
+			printf("%-20s %s %lu over budget of %lu\n", name,
+			    what[i], count[i], limit[i]);
+			over = 1;
+		}
+	}
+	if(over) {
+		failed++;
+	} else if(verbose) {
+		printf("%-20s %6lu %6lu %6lu   ok\n", name, count[0],
+		    count[1], count[2]);
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will connect to a simulated device, through the
+ * counting link.
+ */
+
+void connect(void)
+{
+	ocd_sim *sim;
+
+	dbg = new ez8dbg();
+	dbg->set_sysclk(SYSCLK);
+
+	sim = new ocd_sim();
+	try {
+		sim->connect(device, BAUDRATE, SYSCLK);
+	} catch(char *err) {
+		delete sim;
+		throw err;
+	}
+	counter = new ocd_count(sim);
+	dbg->dbg = counter;
+
+	dbg->reset_link();
+	dbg->stop();
+	dbg->reset_chip();
+
+	return;
+}
+
+/**************************************************************
+ * The operations, each measured from a known state. They run
+ * in order, and each leaves the state the next expects.
+ */
+
+void measure(void)
+{
+	uint16_t pc;
+	uint8_t special[4], working[16];
+	uint8_t data;
+	int size, i;
+
+	/* the first 6k of the image is code, the rest erased */
+	size = dbg->memory_size();
+	memset(image, 0xff, size);
+	for(i=0; i<0x1800 && i<size; i++) {
+		image[i] = i * 7 + (i >> 8);
+	}
+
+	counter->clear();
+	dbg->flash_mass_erase();
+	if(dbg->state(dbg->state_protected)) {
+		dbg->reset_chip();
+	}
+	dbg->wr_mem(0x0000, image, size);
+	dbg->reset_chip();
+	check("load_file");
+
+	counter->clear();
+	dbg->rd_cpu_regs(&pc, special, working);
+	dbg->rd_mem(pc, buff, 4);
+	check("display_registers");
+
+	counter->clear();
+	dbg->step();
+	check("step");
+
+	counter->clear();
+	dbg->set_breakpoint(0x0200);
+	check("set_breakpoint");
+
+	counter->clear();
+	dbg->remove_breakpoint(0x0200);
+	check("remove_breakpoint");
+
+	counter->clear();
+	dbg->run();
+	check("run");
+
+	counter->clear();
+	dbg->isrunning();
+	check("isrunning");
+
+	/* the simulated cpu runs in real time; wait until it has
+	 * reached the break in the image however slow the host is,
+	 * then have stop read the control register afresh */
+	for(i=0; dbg->isrunning(); i++) {
+		if(i >= BREAK_WAIT) {
+			strncpy(err_msg, "Simulated device did not stop\n"
+			    "break in the image not reached\n", err_len-1);
+			throw err_msg;
+		}
+		usleep(1000);
+	}
+	dbg->flush_cache();
+
+	counter->clear();
+	dbg->stop();
+	check("stop");
+
+	counter->clear();
+	dbg->stop();
+	check("stop_stopped");
+
+	dbg->flush_cache();
+	counter->clear();
+	dbg->rd_mem(0x0100, buff, sizeof(buff));
+	check("rd_mem_cold");
+
+	counter->clear();
+	dbg->rd_mem(0x0100, buff, sizeof(buff));
+	check("rd_mem_warm");
+
+	data = 0x00;
+	counter->clear();
+	dbg->wr_mem(0x1000, &data, 1);
+	check("wr_mem_byte");
+
+	counter->clear();
+	dbg->rd_crc();
+	check("rd_crc");
+
+	counter->clear();
+	dbg->reset_chip();
+	check("reset_chip");
+
+	return;
+}
+
+/**************************************************************/
+
+int main(int argc, char **argv)
+{
+	int err;
+
+	err = setup(argc, argv);
+	if(err) {
+		return EXIT_FAILURE;
+	}
+
+	budget = new cfgfile();
+	if(!write_budget && budget->open(budget_file)) {
+		fprintf(stderr, "%s: cannot read budget file %s\n",
+		    PROGNAME, budget_file);
+		return EXIT_FAILURE;
+	}
+
+	image = (uint8_t *)malloc(EZ8MEM_SIZE);
+
+	try {
+		connect();
+		measure();
+	} catch(char *err) {
+		fprintf(stderr, "%s", err);
+		return EXIT_FAILURE;
+	}
+
+	if(!write_budget) {
+		printf("%d operations checked, %d over budget\n", checked,
+		    failed);
+	}
+
+	delete dbg;
+	delete budget;
+	free(image);
+
+	return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
+
+/**************************************************************/
+
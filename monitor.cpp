@@ -28,6 +28,7 @@ extern int testmenu;
 extern int repeat;
 extern int verbose;
 extern int show_times;
+extern int monitor_only;
 
 extern rl_command_func_t *tab_function;
 
@@ -942,12 +943,7 @@ void display_registers(void)
 	uint8_t special_regs[4];
 	uint8_t working_regs[16];
 
-	pc = ez8->rd_pc();
-
-	ez8->rd_regs(0xffc, special_regs, 4);
-
-	ez8->rd_regs(((special_regs[1] << 8) | special_regs[1]) 
-	    & 0x0ff0, working_regs, 16);
+	ez8->rd_cpu_regs(&pc, special_regs, working_regs);
 
 	printf("PC: %04X  SP: %04X  RP: %02X  FLAGS: %02X ", pc, 
 	    (special_regs[2] << 8) | special_regs[3], 
@@ -1552,6 +1548,45 @@ void reset_part(void)
 
 /**************************************************************/
 
+void link_statistics(void)
+{
+	char key;
+	char *buff;
+
+	rl_num_chars_to_read = 1;
+	buff = readline("Link statistics: [S]how, [C]lear ? ");
+	rl_num_chars_to_read = 0;
+	if(!buff) {
+		printf("Abort\n");
+		return;
+	}
+
+	key = toupper(*buff);
+	free(buff);
+
+	if(esc_key) {
+		esc_key = 0;
+		printf("\nAbort\n");
+		return;
+	}
+
+	switch(key) {
+	case 'S':
+		ez8->dump_stats(stdout);
+		break;
+	case 'C':
+		ez8->clear_stats();
+		break;
+	default:
+		printf("Abort\n");
+		return;
+	}
+
+	return;
+}
+
+/**************************************************************/
+
 #ifndef	_WIN32
 #define	SHELL	"SHELL"
 #else	/* _WIN32 */
@@ -1592,6 +1627,7 @@ void help(void)
 	printf("\tL - load program memory from file\n");
 	printf("\tM - modify registers\n");
 	printf("\tN - next (step over calls)\n");
+	printf("\tO - ocd link statistics\n");
 	printf("\tQ - exit debugger\n");
 	printf("\tR - display working registers\n");
 	printf("\tS - step (step into calls)\n");
@@ -1673,6 +1709,9 @@ int command(int key)
 	case 'N':
 		next_inst();
 		break;
+	case 'O':
+		link_statistics();
+		break;
 	case 'Q':
 		key = quit();
 		break;
@@ -1759,8 +1798,9 @@ int command_loop(void)
 			}
 		}
 
+		/* a monitor watches the device without stopping it */
 		try {
-			if(!ez8->state(ez8->state_stopped)) {
+			if(!monitor_only && !ez8->state(ez8->state_stopped)) {
 				ez8->stop();
 			}
 		} catch(char *err) {
@@ -0,0 +1,152 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * Remembers discovered mtu values per serial adapter and device.
+ *
+ * Entries are kept in $HOME/.ez8mtu, one per line:
+ *
+ *	DEVICE BAUDRATE REVID MTU
+ *
+ * An mtu of 0 means unlimited. The cache is only a hint, so
+ * a missing or unwritable file is silently ignored.
+ */
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<string.h>
+#include	"mtucache.h"
+
+#define	MTUCACHE_FILE	".ez8mtu"
+#define	MTUCACHE_LINE	1024
+
+/**************************************************************
+ * Build the cache file name.
+ */
+
+static int mtucache_path(char *path, size_t n)
+{
+	const char *home;
+
+	home = getenv("HOME");
+	if(!home || !*home) {
+		return -1;
+	}
+	if(snprintf(path, n, "%s/%s", home, MTUCACHE_FILE) >= (int)n) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * Parse one cache entry, returns 0 on success.
+ */
+
+static int mtucache_parse(const char *line, char *device, size_t n,
+    int *baud, unsigned int *revid, int *mtu)
+{
+	char fmt[32];
+
+	snprintf(fmt, sizeof(fmt), "%%%ds %%d %%x %%d", (int)n-1);
+	if(sscanf(line, fmt, device, baud, revid, mtu) != 4) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * Look up the mtu for an adapter and device. Returns -1 if
+ * there is no entry.
+ */
+
+int mtucache_load(const char *device, int baud, unsigned int revid)
+{
+	char path[MTUCACHE_LINE];
+	char line[MTUCACHE_LINE];
+	char dev[MTUCACHE_LINE];
+	int b, mtu, found;
+	unsigned int r;
+	FILE *fp;
+
+	if(mtucache_path(path, sizeof(path))) {
+		return -1;
+	}
+
+	fp = fopen(path, "r");
+	if(!fp) {
+		return -1;
+	}
+
+	found = -1;
+	while(fgets(line, sizeof(line), fp)) {
+		if(mtucache_parse(line, dev, sizeof(dev), &b, &r, &mtu)) {
+			continue;
+		}
+		if(!strcmp(dev, device) && b == baud && r == revid) {
+			found = mtu;
+		}
+	}
+	fclose(fp);
+
+	return found;
+}
+
+/**************************************************************
+ * Store the mtu for an adapter and device, replacing any 
+ * earlier entry.
+ */
+
+void mtucache_save(const char *device, int baud, unsigned int revid, 
+    int mtu)
+{
+	char path[MTUCACHE_LINE];
+	char temp[MTUCACHE_LINE];
+	char line[MTUCACHE_LINE];
+	char dev[MTUCACHE_LINE];
+	int b, m;
+	unsigned int r;
+	FILE *in, *out;
+
+	if(mtucache_path(path, sizeof(path))) {
+		return;
+	}
+	if(snprintf(temp, sizeof(temp), "%s.tmp", path) >= 
+	    (int)sizeof(temp)) {
+		return;
+	}
+
+	out = fopen(temp, "w");
+	if(!out) {
+		return;
+	}
+
+	in = fopen(path, "r");
+	if(in) {
+		while(fgets(line, sizeof(line), in)) {
+			if(!mtucache_parse(line, dev, sizeof(dev), 
+			    &b, &r, &m) && !strcmp(dev, device) && 
+			    b == baud && r == revid) {
+				continue;
+			}
+			fputs(line, out);
+		}
+		fclose(in);
+	}
+
+	fprintf(out, "%s %d %04X %d\n", device, baud, revid, mtu);
+
+	if(fclose(out)) {
+		remove(temp);
+		return;
+	}
+	if(rename(temp, path)) {
+		remove(temp);
+	}
+
+	return;
+}
+
+/**************************************************************/
+
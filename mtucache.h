@@ -0,0 +1,23 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * Remembers discovered mtu values per serial adapter and device.
+ */
+
+#ifndef	MTUCACHE_HEADER
+#define	MTUCACHE_HEADER
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+int mtucache_load(const char *, int, unsigned int);
+void mtucache_save(const char *, int, unsigned int, int);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MTUCACHE_HEADER */
+
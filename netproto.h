@@ -0,0 +1,50 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * Frames of the binary (version 2) network protocol, see
+ * docs/netproto.txt. Each frame is a type byte and a 32 bit
+ * big endian length, followed by that many bytes of data.
+ */
+
+#ifndef	NETPROTO_HEADER
+#define	NETPROTO_HEADER
+
+#define	PROTO_HEADER	5
+#define	PROTO_MAXDATA	0x10000
+
+/* largest frame, data with its request parameters */
+#define	PROTO_MAXFRAME	(PROTO_MAXDATA + 8)
+
+/* requests */
+#define	PROTO_STATUS	'S'
+#define	PROTO_RESET	'R'
+#define	PROTO_READ	'r'
+#define	PROTO_WRITE	'w'
+#define	PROTO_TRANSACT	't'
+#define	PROTO_CLOSE	'Q'
+
+/* debugger operations, run by the server */
+#define	PROTO_OPS	'o'
+#define	PROTO_RD_MEM	'm'
+#define	PROTO_WR_MEM	'p'
+#define	PROTO_ERASE	'e'
+#define	PROTO_RD_CRC	'c'
+#define	PROTO_RD_REGS	'x'
+#define	PROTO_RUN	'g'
+#define	PROTO_STOP	'h'
+#define	PROTO_STEP	's'
+
+/* responses */
+#define	PROTO_OK	'+'
+#define	PROTO_ERR	'-'
+
+/* status response data */
+#define	PROTO_UP	'U'
+#define	PROTO_DOWN	'D'
+
+/* error text for a write refused to a monitoring client */
+#define	PROTO_READONLY	"read only"
+
+#endif	/* NETPROTO_HEADER */
+
@@ -36,6 +36,20 @@ public:
 	virtual void read(uint8_t *, size_t) = 0;
 	virtual void write(const uint8_t *, size_t) = 0;
 
+	/* write a command and read its reply, links that can do
+	 * both in one exchange override this */
+	virtual void transact(const uint8_t *out, size_t outsize, 
+	    uint8_t *in, size_t insize) {
+		write(out, outsize);
+		read(in, insize);
+	};
+
+	/* true if transact() is one exchange rather than a write
+	 * and a read */
+	virtual bool combined(void) {
+		return 0;
+	};
+
 	virtual bool available(void) = 0;
 	virtual bool error(void) = 0;
 };
@@ -0,0 +1,464 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This is the fault injecting ocd connection. It passes
+ * everything through to another connection, real or
+ * simulated, and at the configured rates turns a transfer
+ * into a failure, the way the serial link reports it.
+ *
+ * A fault is injected after the transfer has been made, so
+ * the other end sees the command and the link is left in the
+ * same state a real fault would leave it. Each fault is then
+ * timed until the next successful read, counting the link
+ * resets it took to get there.
+ *
+ * Rates are given with a specification string such as
+ * "drop=0.001,timeout=0.001,delay=0.01,latency=5000,seed=1",
+ * as the probability of each transfer failing that way.
+ */
+
+#include	<string.h>
+#include	<stdlib.h>
+#include	<stdio.h>
+#include	<unistd.h>
+#include	<assert.h>
+
+#include	"timer.h"
+#include	"ocd_fault.h"
+
+#include	"err_msg.h"
+
+/**************************************************************/
+
+static const char *fault_names[fault_modes] = {
+	"drop",
+	"delay",
+	"collision",
+	"break",
+	"timeout",
+};
+
+/**************************************************************
+ * A timeout lasts as long as the serial link's would, the time
+ * to receive 256 characters.
+ */
+
+static int default_timeout(int baud)
+{
+	int ms;
+
+	if(baud <= 0) {
+		return FAULT_DEFAULT_TIMEOUT;
+	}
+	ms = 256 * 1000 * 10 / baud;
+
+	return ms ? ms : 1;
+}
+
+/**************************************************************
+ * Constructor for ocd_fault class. The link is owned by us
+ * from now on, until released.
+ */
+
+ocd_fault::ocd_fault(ocd *ocdptr)
+{
+	int i;
+
+	assert(ocdptr != NULL);
+
+	link = ocdptr;
+	up = 1;
+	brk = 0;
+	timeout = default_timeout(link->link_speed());
+
+	for(i=0; i<fault_modes; i++) {
+		rate[i] = 0;
+	}
+	delay = FAULT_DEFAULT_DELAY;
+	seed = 1;
+
+	pending = -1;
+	pending_start = 0;
+	pending_resets = 0;
+
+	clear_stats();
+
+	return;
+}
+
+/**************************************************************
+ * Destructor for ocd_fault class.
+ */
+
+ocd_fault::~ocd_fault()
+{
+	if(link) {
+		delete link;
+		link = NULL;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will hand back the wrapped link, which is no longer
+ * ours to delete.
+ */
+
+ocd *ocd_fault::release(void)
+{
+	ocd *ocdptr;
+
+	ocdptr = link;
+	link = NULL;
+
+	return ocdptr;
+}
+
+/**************************************************************
+ * This will set the fault rates from a specification string
+ * of comma separated name=value pairs. Names are the fault
+ * modes, "latency" for the time a delay adds in microseconds,
+ * and "seed" for the random sequence.
+ */
+
+void ocd_fault::configure(const char *spec)
+{
+	char buff[256];
+	char *item, *next, *value, *tail;
+	double r;
+	int i;
+
+	assert(spec != NULL);
+
+	strncpy(buff, spec, sizeof(buff)-1);
+	buff[sizeof(buff)-1] = '\0';
+
+	for(item=buff; item && *item; item=next) {
+		next = strchr(item, ',');
+		if(next) {
+			*next++ = '\0';
+		}
+
+		value = strchr(item, '=');
+		if(!value || value == item || !value[1]) {
+			snprintf(err_msg, err_len-1, "Invalid fault "
+			    "specification\n\"%s\" is not name=value\n",
+			    item);
+			throw err_msg;
+		}
+		*value++ = '\0';
+
+		if(!strcmp(item, "latency")) {
+			delay = strtol(value, &tail, 10);
+			if(*tail || delay < 0) {
+				snprintf(err_msg, err_len-1, "Invalid fault "
+				    "specification\ninvalid latency %s\n",
+				    value);
+				throw err_msg;
+			}
+			continue;
+		}
+
+		if(!strcmp(item, "seed")) {
+			seed = strtoul(value, &tail, 10);
+			if(*tail) {
+				snprintf(err_msg, err_len-1, "Invalid fault "
+				    "specification\ninvalid seed %s\n",
+				    value);
+				throw err_msg;
+			}
+			continue;
+		}
+
+		for(i=0; i<fault_modes; i++) {
+			if(!strcmp(item, fault_names[i])) {
+				break;
+			}
+		}
+		if(i >= fault_modes) {
+			snprintf(err_msg, err_len-1, "Invalid fault "
+			    "specification\nunknown fault %s\n", item);
+			throw err_msg;
+		}
+
+		r = strtod(value, &tail);
+		if(*tail || r < 0 || r > 1) {
+			snprintf(err_msg, err_len-1, "Invalid fault "
+			    "specification\ninvalid rate %s\n", value);
+			throw err_msg;
+		}
+		rate[i] = r;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will decide if a transfer fails in the given mode. The
+ * generator is our own, so a seed gives the same faults on
+ * every host.
+ */
+
+bool ocd_fault::roll(enum ocd_fault_mode mode)
+{
+	if(rate[mode] <= 0) {
+		return 0;
+	}
+
+	seed = seed * 1103515245 + 12345;
+
+	return ((seed >> 8) & 0xffffff) < rate[mode] * 0x1000000;
+}
+
+/**************************************************************
+ * This will record a fault as injected. A fault injected
+ * while recovering from another one is timed from the first.
+ */
+
+void ocd_fault::inject(enum ocd_fault_mode mode)
+{
+	stats[mode].injected++;
+
+	if(pending < 0) {
+		pending = mode;
+		pending_start = timernow();
+		pending_resets = 0;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will record recovery from the pending fault.
+ */
+
+void ocd_fault::recovered(void)
+{
+	struct fault_stat *s;
+	uint64_t elapsed;
+
+	if(pending < 0) {
+		return;
+	}
+
+	s = &stats[pending];
+	elapsed = timernow() - pending_start;
+	s->recovered++;
+	s->resets += pending_resets;
+	s->total_us += elapsed;
+	if(elapsed > s->max_us) {
+		s->max_us = elapsed;
+	}
+
+	pending = -1;
+
+	return;
+}
+
+/**************************************************************
+ * This will reset the link, clearing any fault.
+ */
+
+void ocd_fault::reset(void)
+{
+	link->reset();
+
+	up = 1;
+	brk = 0;
+	if(pending >= 0) {
+		pending_resets++;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * The link state is that of the wrapped link, unless a fault
+ * has brought it down.
+ */
+
+bool ocd_fault::link_open(void)
+{
+	return link->link_open();
+}
+
+bool ocd_fault::link_up(void)
+{
+	return up && link->link_up();
+}
+
+int ocd_fault::link_speed(void)
+{
+	return link->link_speed();
+}
+
+void ocd_fault::set_baudrate(int baud)
+{
+	link->set_baudrate(baud);
+	timeout = default_timeout(baud);
+
+	return;
+}
+
+void ocd_fault::set_timeout(int ms)
+{
+	timeout = ms;
+	link->set_timeout(ms);
+
+	return;
+}
+
+bool ocd_fault::available(void)
+{
+	return link->available();
+}
+
+bool ocd_fault::error(void)
+{
+	return brk || link->error();
+}
+
+/**************************************************************
+ * This will read data from the wrapped link, and may fail.
+ */
+
+void ocd_fault::read(uint8_t *buff, size_t size)
+{
+	if(!up) {
+		strncpy(err_msg, "Cannot read from on-chip debugger\n"
+		    "link needs to be reset first\n", err_len-1);
+		throw err_msg;
+	}
+
+	link->read(buff, size);
+
+	if(roll(fault_drop)) {
+		inject(fault_drop);
+		up = 0;
+		strncpy(err_msg, "Read from on-chip debugger failed\n"
+		    "characters lost\n", err_len-1);
+		throw err_msg;
+	}
+
+	if(roll(fault_timeout)) {
+		inject(fault_timeout);
+		usleep(timeout * 1000);
+		up = 0;
+		strncpy(err_msg, "Read from on-chip debugger failed\n"
+		    "serial port read timeout\n", err_len-1);
+		throw err_msg;
+	}
+
+	if(roll(fault_break)) {
+		inject(fault_break);
+		brk = 1;
+		up = 0;
+		strncpy(err_msg, "Serial port read failed\n"
+		    "break detected\n", err_len-1);
+		throw err_msg;
+	}
+
+	/* a delay is recovered from as soon as it is over */
+	if(roll(fault_delay)) {
+		inject(fault_delay);
+		usleep(delay);
+	}
+
+	recovered();
+
+	return;
+}
+
+/**************************************************************
+ * This will write data to the wrapped link, and may fail.
+ */
+
+void ocd_fault::write(const uint8_t *buff, size_t size)
+{
+	if(!up) {
+		strncpy(err_msg, "Cannot write to on-chip debugger\n"
+		    "link needs to be reset first\n", err_len-1);
+		throw err_msg;
+	}
+
+	link->write(buff, size);
+
+	if(roll(fault_collision)) {
+		inject(fault_collision);
+		up = 0;
+		strncpy(err_msg, "Write to on-chip debugger failed\n"
+		    "transmit collision detected\n", err_len-1);
+		throw err_msg;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will return when the fault being recovered from was
+ * injected, or 0 if there is none.
+ */
+
+uint64_t ocd_fault::fault_time(void)
+{
+	return pending >= 0 ? pending_start : 0;
+}
+
+/**************************************************************
+ * Fault statistics.
+ */
+
+const struct fault_stat *ocd_fault::get_stat(enum ocd_fault_mode mode)
+{
+	return &stats[mode];
+}
+
+const char *ocd_fault::mode_name(int mode)
+{
+	if(mode < 0 || mode >= fault_modes) {
+		return "unknown";
+	}
+
+	return fault_names[mode];
+}
+
+void ocd_fault::clear_stats(void)
+{
+	memset(stats, 0, sizeof(stats));
+	pending = -1;
+
+	return;
+}
+
+/**************************************************************
+ * This will show how long each kind of fault took to recover
+ * from, and how many link resets it cost.
+ */
+
+void ocd_fault::dump_stats(FILE *fp)
+{
+	struct fault_stat *s;
+	int i;
+
+	fprintf(fp, "%-11s %8s %9s %8s %10s %10s\n", "fault",
+	    "injected", "recovered", "resets", "mean us", "max us");
+
+	for(i=0; i<fault_modes; i++) {
+		s = &stats[i];
+		if(!s->injected) {
+			continue;
+		}
+		fprintf(fp, "%-11s %8lu %9lu %8lu %10llu %10llu\n",
+		    fault_names[i], s->injected, s->recovered, s->resets,
+		    (unsigned long long)(s->recovered ?
+		    s->total_us / s->recovered : 0),
+		    (unsigned long long)s->max_us);
+	}
+
+	return;
+}
+
+/**************************************************************/
+
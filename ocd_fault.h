@@ -0,0 +1,104 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This is an on-chip debugger interface class that wraps
+ * another one and injects link faults into it, to measure how
+ * long the debugger takes to recover from them.
+ */
+
+#ifndef	OCD_FAULT_HEADER
+#define	OCD_FAULT_HEADER
+
+#include	<stdio.h>
+#include	<stdlib.h>
+#include	<inttypes.h>
+
+#include	"ocd.h"
+
+/**************************************************************/
+
+/* kinds of fault */
+enum ocd_fault_mode {
+	fault_drop,			/* reply byte lost */
+	fault_delay,			/* reply late, but intact */
+	fault_collision,		/* transmit echo corrupted */
+	fault_break,			/* break received */
+	fault_timeout,			/* no reply at all */
+	fault_modes
+};
+
+/* default added latency of a delay fault, in microseconds */
+#define	FAULT_DEFAULT_DELAY	5000
+
+/* time spent by a timeout when the link speed is unknown,
+ * in milliseconds */
+#define	FAULT_DEFAULT_TIMEOUT	50
+
+/* recovery statistics for one kind of fault */
+struct fault_stat {
+	unsigned long injected;
+	unsigned long recovered;
+	unsigned long resets;		/* link resets until recovered */
+	uint64_t total_us;		/* time until recovered */
+	uint64_t max_us;
+};
+
+class ocd_fault : public ocd
+{
+private:
+	ocd *link;
+	bool up;
+	bool brk;			/* break latched until reset */
+	int timeout;			/* ms, spent by a timeout */
+
+	double rate[fault_modes];
+	int delay;
+	unsigned int seed;
+
+	/* fault being recovered from */
+	int pending;
+	uint64_t pending_start;
+	unsigned long pending_resets;
+
+	struct fault_stat stats[fault_modes];
+
+	/* Prohibit use of copy constructor */
+	ocd_fault(ocd_fault &);
+
+	bool roll(enum ocd_fault_mode);
+	void inject(enum ocd_fault_mode);
+	void recovered(void);
+
+public:
+	ocd_fault(ocd *);
+	~ocd_fault();
+
+	void configure(const char *);
+	ocd *release(void);
+
+	void reset(void);
+
+	bool link_open(void);
+	bool link_up(void);
+	int  link_speed(void);
+	void set_baudrate(int);
+	void set_timeout(int);
+
+	bool available(void);
+	bool error(void);
+
+	void read(uint8_t *, size_t);
+	void write(const uint8_t *, size_t);
+
+	uint64_t fault_time(void);
+	const struct fault_stat *get_stat(enum ocd_fault_mode);
+	static const char *mode_name(int);
+	void clear_stats(void);
+	void dump_stats(FILE *);
+};
+
+/**************************************************************/
+
+#endif	/* OCD_FAULT_HEADER */
+
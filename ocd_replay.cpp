@@ -0,0 +1,408 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This is the replay ocd connection. It plays back a capture
+ * made with ez8ocd::start_capture(), so the debugger and
+ * flash code can be run and profiled at full speed without
+ * hardware.
+ *
+ * Reads are answered from the capture and writes must match
+ * what was captured; the first difference throws an error
+ * showing where the host diverged, and the link is marked
+ * down so nothing more is sent. Transfers may be split
+ * differently than when captured, only the byte stream is
+ * compared. Captured errors are thrown again at the same point.
+ */
+
+#include	<string.h>
+#include	<stdlib.h>
+#include	<stdio.h>
+#include	<errno.h>
+#include	<assert.h>
+#include	"xmalloc.h"
+
+#include	"capture.h"
+#include	"ocd_replay.h"
+
+#include	"err_msg.h"
+
+/**************************************************************
+ * Constructor for ocd_replay class.
+ */
+
+ocd_replay::ocd_replay(void)
+{
+	records = NULL;
+	count = 0;
+	next = 0;
+	pos = 0;
+	data = NULL;
+	open = 0;
+	up = 0;
+	baudrate = 0;
+
+	return;
+}
+
+/**************************************************************
+ * Destructor for ocd_replay class.
+ */
+
+ocd_replay::~ocd_replay(void)
+{
+	if(records) {
+		free(records);
+		records = NULL;
+	}
+	if(data) {
+		free(data);
+		data = NULL;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will read the whole capture into memory.
+ */
+
+void ocd_replay::load(const char *filename)
+{
+	FILE *fp;
+	struct capture_record rec;
+	size_t len, max;
+	int err, n;
+
+	fp = fopen(filename, "rb");
+	if(!fp) {
+		snprintf(err_msg, err_len-1, "Cannot open capture\n"
+		    "%s: %s\n", filename, strerror(errno));
+		throw err_msg;
+	}
+
+	if(capture_read_header(fp, NULL, NULL)) {
+		fclose(fp);
+		snprintf(err_msg, err_len-1, "Cannot open capture\n"
+		    "%s: not a link capture\n", filename);
+		throw err_msg;
+	}
+
+	memset(&rec, 0, sizeof(rec));
+	len = 0;
+	max = 0;
+	n = 0;
+	while((err = capture_read_record(fp, &rec)) == 0) {
+		if(count == n) {
+			n = n ? n * 2 : 1024;
+			records = (struct replay_record *)xrealloc(records,
+			    n * sizeof(struct replay_record));
+		}
+		if(len + rec.size > max) {
+			max = (len + rec.size) * 2;
+			data = (uint8_t *)xrealloc(data, max);
+		}
+		records[count].type = rec.type;
+		records[count].offset = len;
+		records[count].size = rec.size;
+		memcpy(data + len, rec.data, rec.size);
+		len += rec.size;
+		count++;
+	}
+	free(rec.data);
+	fclose(fp);
+
+	if(err < 0) {
+		snprintf(err_msg, err_len-1, "Cannot open capture\n"
+		    "%s: truncated record %d\n", filename, count);
+		throw err_msg;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will open the capture to replay. The baudrate is only
+ * reported back by link_speed().
+ */
+
+void ocd_replay::connect(const char *filename, int baud)
+{
+	assert(filename != NULL);
+
+	load(filename);
+
+	next = 0;
+	pos = 0;
+	baudrate = baud;
+	open = 1;
+	up = 0;
+
+	return;
+}
+
+/**************************************************************
+ * Returns a name for a record type, for error messages.
+ */
+
+const char *ocd_replay::record_name(int type)
+{
+	switch(type) {
+	case CAPTURE_WRITE:
+		return "write";
+	case CAPTURE_READ:
+		return "read";
+	case CAPTURE_RESET:
+		return "reset";
+	case CAPTURE_ERROR:
+		return "error";
+	case CAPTURE_OP:
+		return "server operation";
+	case CAPTURE_RESULT:
+		return "server result";
+	default:
+		return "unknown";
+	}
+}
+
+/**************************************************************
+ * Returns non-zero if the next record is of the given type.
+ * For error records, the failed transfer type must match too.
+ */
+
+bool ocd_replay::next_is(int type, int failed)
+{
+	struct replay_record *r;
+
+	if(next >= count) {
+		return 0;
+	}
+	r = &records[next];
+	if(r->type != type) {
+		return 0;
+	}
+	if(type == CAPTURE_ERROR) {
+		return r->size && data[r->offset] == failed;
+	}
+
+	return 1;
+}
+
+/**************************************************************
+ * This will throw the captured error message at the current
+ * record.
+ */
+
+void ocd_replay::replay_error(void)
+{
+	struct replay_record *r;
+	size_t len;
+
+	r = &records[next++];
+	pos = 0;
+
+	len = r->size - 1;
+	if(len > (size_t)err_len - 1) {
+		len = err_len - 1;
+	}
+	memcpy(err_msg, data + r->offset + 1, len);
+	err_msg[len] = '\0';
+	up = 0;
+
+	throw err_msg;
+}
+
+/**************************************************************
+ * This will replay a link reset.
+ */
+
+void ocd_replay::reset(void)
+{
+	if(!next_is(CAPTURE_RESET)) {
+		snprintf(err_msg, err_len-1, "Replay diverged from capture\n"
+		    "record %d: host reset link, captured %s\n", next,
+		    next < count ? record_name(records[next].type) : "end");
+		up = 0;
+		throw err_msg;
+	}
+	next++;
+	pos = 0;
+
+	if(next_is(CAPTURE_ERROR, CAPTURE_RESET)) {
+		replay_error();
+	}
+
+	up = 1;
+
+	return;
+}
+
+/**************************************************************/
+
+bool ocd_replay::link_open(void)
+{
+	return open;
+}
+
+/**************************************************************/
+
+bool ocd_replay::link_up(void)
+{
+	return up;
+}
+
+/**************************************************************/
+
+int ocd_replay::link_speed(void)
+{
+	return baudrate;
+}
+
+/**************************************************************/
+
+void ocd_replay::set_baudrate(int baud)
+{
+	baudrate = baud;
+
+	return;
+}
+
+/**************************************************************/
+
+void ocd_replay::set_timeout(int)
+{
+	return;
+}
+
+/**************************************************************
+ * Data is available if the capture has a read next.
+ */
+
+bool ocd_replay::available(void)
+{
+	return next_is(CAPTURE_READ);
+}
+
+/**************************************************************
+ * The link reports an error where the captured session reset
+ * the link next, so the host takes the same recovery path.
+ */
+
+bool ocd_replay::error(void)
+{
+	return next_is(CAPTURE_RESET);
+}
+
+/**************************************************************
+ * This will answer a read from the capture.
+ */
+
+void ocd_replay::read(uint8_t *buff, size_t size)
+{
+	assert(buff != NULL);
+
+	if(next_is(CAPTURE_ERROR, CAPTURE_READ)) {
+		replay_error();
+	}
+
+	while(size > 0) {
+		struct replay_record *r;
+		size_t len;
+
+		if(!next_is(CAPTURE_READ)) {
+			snprintf(err_msg, err_len-1,
+			    "Replay diverged from capture\n"
+			    "record %d: host read %lu bytes, captured %s\n",
+			    next, (unsigned long)size, next < count ?
+			    record_name(records[next].type) : "end");
+			up = 0;
+			throw err_msg;
+		}
+		r = &records[next];
+
+		len = r->size - pos;
+		if(len > size) {
+			len = size;
+		}
+		memcpy(buff, data + r->offset + pos, len);
+		buff += len;
+		size -= len;
+		pos += len;
+
+		if(pos == r->size) {
+			next++;
+			pos = 0;
+		}
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will check a write against the capture.
+ */
+
+void ocd_replay::write(const uint8_t *buff, size_t size)
+{
+	assert(buff != NULL);
+
+	while(size > 0) {
+		struct replay_record *r;
+		const uint8_t *p;
+		size_t len, i;
+
+		if(!next_is(CAPTURE_WRITE)) {
+			snprintf(err_msg, err_len-1,
+			    "Replay diverged from capture\n"
+			    "record %d: host wrote %02X, captured %s\n",
+			    next, *buff, next < count ?
+			    record_name(records[next].type) : "end");
+			up = 0;
+			throw err_msg;
+		}
+		r = &records[next];
+		p = data + r->offset + pos;
+
+		len = r->size - pos;
+		if(len > size) {
+			len = size;
+		}
+		for(i=0; i<len; i++) {
+			if(buff[i] != p[i]) {
+				snprintf(err_msg, err_len-1,
+				    "Replay diverged from capture\n"
+				    "record %d byte %lu: host wrote %02X, "
+				    "captured %02X\n", next,
+				    (unsigned long)(pos + i), buff[i], p[i]);
+				up = 0;
+				throw err_msg;
+			}
+		}
+		buff += len;
+		size -= len;
+		pos += len;
+
+		if(pos == r->size) {
+			next++;
+			pos = 0;
+		}
+	}
+
+	if(!pos && next_is(CAPTURE_ERROR, CAPTURE_WRITE)) {
+		replay_error();
+	}
+
+	return;
+}
+
+/**************************************************************
+ * Returns the number of records not yet replayed.
+ */
+
+int ocd_replay::remaining(void)
+{
+	return count - next;
+}
+
+/**************************************************************/
+
@@ -0,0 +1,68 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This is an on-chip debugger interface class that replays
+ * a link capture instead of talking to a device.
+ */
+
+#ifndef	OCD_REPLAY_HEADER
+#define	OCD_REPLAY_HEADER
+
+#include	<stdlib.h>
+#include	<inttypes.h>
+
+#include	"ocd.h"
+
+/**************************************************************/
+
+class ocd_replay : public ocd
+{
+private:
+	struct replay_record {
+		int type;
+		size_t offset;		/* payload in data */
+		size_t size;
+	};
+	struct replay_record *records;
+	int count;
+	int next;			/* record being replayed */
+	size_t pos;			/* bytes used of next */
+	uint8_t *data;
+	bool open, up;
+	int baudrate;
+
+	/* Prohibit use of copy constructor */
+	ocd_replay(ocd_replay &);
+
+	void load(const char *);
+	bool next_is(int, int = 0);
+	void replay_error(void);
+	const char *record_name(int);
+
+public:
+	ocd_replay();
+	~ocd_replay();
+
+	void connect(const char *, int);
+	void reset(void);
+
+	bool link_open(void);
+	bool link_up(void);
+	int  link_speed(void);
+	void set_baudrate(int);
+	void set_timeout(int);
+
+	bool available(void);
+	bool error(void);
+
+	void read(uint8_t *, size_t);
+	void write(const uint8_t *, size_t);
+
+	int remaining(void);
+};
+
+/**************************************************************/
+
+#endif	/* OCD_REPLAY_HEADER */
+
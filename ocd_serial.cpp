@@ -31,6 +31,8 @@
 ocd_serial::ocd_serial(void)
 {
 	open = up = 0;
+	loopback = 1;
+	echo_head = echo_count = 0;
 
 	return;
 }
@@ -44,9 +46,13 @@ ocd_serial::~ocd_serial(void)
 
 /**************************************************************
  * This will open and setup the serial port.
+ *
+ * If loopback is false, the adapter does not echo what it
+ * transmits and writes are not read back.
  */
 
-void ocd_serial::connect(const char *device, int baudrate, int unlock_ocd)
+void ocd_serial::connect(const char *device, int baudrate, int unlock_ocd,
+                         bool loopback)
 {
 	assert(device != NULL);
 
@@ -72,6 +78,7 @@ void ocd_serial::connect(const char *device, int baudrate, int unlock_ocd)
 	open = 1;
 
 	this->unlock_ocd = unlock_ocd;
+	this->loopback = loopback;
 
 	return;
 }
@@ -101,15 +108,17 @@ void ocd_serial::read(uint8_t *buff, size_t size)
 		throw err_msg;
 	}
 
-	/* intelligently increase timout only when needed */
+	/* echo of everything sent comes ahead of the reply */
+	sync();
+
+	/* lengthen the deadline for large transfers */
 	t = 1000 * 3 / 2 * 10 * size / serialport::baudrate;
-	if(t > serialport::timeout) {
-		serialport::timeout = t;
-		serialport::configure();
+	if(t < serialport::timeout) {
+		t = serialport::timeout;
 	}
 
 	try {
-		bytes_read = serialport::read(buff, size);
+		bytes_read = serialport::read(buff, size, t);
 	} catch(char *err) {
 		up = 0;
 		throw err;
@@ -136,17 +145,18 @@ void ocd_serial::read(uint8_t *buff, size_t size)
  * This will write data to the serial port. 
  *
  * Since tx/rx lines tied together, everything transmitted
- * should be available to be read. This function will 
- * automatically try to read back what it wrote, and verify
- * what it wrote is read back properly and that no transmit
- * collisions occurred.
+ * should be available to be read. Transmitted data is kept in
+ * the echo ring and verified against the loopback as later
+ * data goes out, so a write does not wait for its own echo.
+ * Whatever is still unverified is checked at the next sync
+ * point (read, available or reset), which is where a transmit
+ * collision gets reported.
+ *
+ * Adapters without loopback skip all of this.
  */
 
 void ocd_serial::write(const uint8_t *buff, size_t size)
 {
-	int t;
-	uint8_t verify[BUFSIZ];
-
 	assert(buff != NULL);
 
 	if(!open) {
@@ -154,70 +164,123 @@ void ocd_serial::write(const uint8_t *buff, size_t size)
 		    "serial port not open\n", err_len-1);
 		throw err_msg;
 	}
+
+	/* A break from a clock switch is recovered from here, even
+	 * when the read that ran into it took the link down. The 
+	 * echo of earlier writes is still waiting to be read back,
+	 * and is checked by verify_echo() instead. */
+	if(!echo_count && serialport::error()) {
+		try {
+			reset();
+		} catch(char *err) {
+			up = 0;
+			throw err;
+		}
+	}
+
 	if(!up) {
 		strncpy(err_msg, "Cannot write to on-chip debugger\n"
 		    "link needs to be reset first\n", err_len-1);
 		throw err_msg;
 	}
 
-	if(serialport::error()) {
+	while(size > 0) {
+		size_t len, tail, i;
+
+		len = size > ECHO_CHUNK ? ECHO_CHUNK : size;
+
+		/* bound the amount of unverified data in flight */
+		if(echo_count + len > ECHO_RINGSIZE) {
+			verify_echo(echo_count + len - ECHO_RINGSIZE);
+		}
+
 		try {
-			reset();
+			serialport::write(buff, len);
 		} catch(char *err) {
 			up = 0;
 			throw err;
 		}
+
+		if(loopback) {
+			tail = (echo_head + echo_count) % ECHO_RINGSIZE;
+			for(i=0; i<len; i++) {
+				echo[tail] = buff[i];
+				tail = (tail + 1) % ECHO_RINGSIZE;
+			}
+			echo_count += len;
+		}
+
+		buff += len;
+		size -= len;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will read back the oldest transmitted bytes from the
+ * loopback and compare them with what was sent.
+ */
+
+void ocd_serial::verify_echo(size_t size)
+{
+	int t;
+	uint8_t verify[ECHO_RINGSIZE];
+	ssize_t bytes_read;
+	size_t i;
+
+	assert(size <= echo_count);
+
+	if(!size) {
+		return;
 	}
 
-	/* intelligently increase timout only when needed */
+	/* lengthen the deadline for large transfers */
 	t = 1000 * 3 / 2 * 10 * size / serialport::baudrate;
-	if(t > serialport::timeout) {
-		serialport::timeout = t;
-		serialport::configure();
+	if(t < serialport::timeout) {
+		t = serialport::timeout;
 	}
 
 	try {
-		serialport::write(buff, size);
+		bytes_read = serialport::read(verify, size, t);
 	} catch(char *err) {
 		up = 0;
+		echo_count = 0;
 		throw err;
 	}
 
-	do {
-		ssize_t read_size;
-		ssize_t bytes_read;
-
-		read_size = size > sizeof(verify) ? sizeof(verify) : size;
-
-		try {
-			bytes_read = serialport::read(verify, read_size);
-		} catch(char *err) {
-			up = 0;
-			throw err;
-		}
+	if((size_t)bytes_read < size) {
+		up = 0;
+		echo_count = 0;
+		strncpy(err_msg, "Write to on-chip debugger failed\n"
+		    "loop readback timeout\n", err_len-1);
+		throw err_msg;
+	}
 
-		if(bytes_read < read_size) {
+	for(i=0; i<size; i++) {
+		if(verify[i] != echo[echo_head]) {
 			up = 0;
-			strncpy(err_msg, "Write to on-chip debugger failed\n"
-			    "loop readback timeout\n", err_len-1);
+			echo_count = 0;
+			strncpy(err_msg, 
+			    "Write to on-chip debugger failed\n"
+			    "transmit collision detected\n",
+			    err_len-1);
 			throw err_msg;
 		}
+		echo_head = (echo_head + 1) % ECHO_RINGSIZE;
+	}
+	echo_count -= size;
 
-		for(int i=0; i < read_size; i++) {
-			if(verify[i] != buff[i]) {
-				up = 0;
-				strncpy(err_msg, 
-				    "Write to on-chip debugger failed\n"
-				    "transmit collision detected\n",
-				    err_len-1);
-				throw err_msg;
-			}
-		}
+	return;
+}
 
-		size -= bytes_read;
-		buff += bytes_read;
-		
-	} while(size > 0);
+/**************************************************************
+ * This will verify all outstanding loopback data.
+ */
+
+void ocd_serial::sync(void)
+{
+	verify_echo(echo_count);
 
 	return;
 }
@@ -244,9 +307,14 @@ void ocd_serial::reset(void)
 		throw err_msg;
 	}
 
+	/* Anything still in flight is discarded with the flush. It
+	 * also clears a latched break, so the writes below do not
+	 * reset the link again. */
+	up = 0;
+	echo_head = echo_count = 0;
+	serialport::flush();
+
 	if (!unlock_ocd) {
-		up = 0;
-		serialport::flush();
 		serialport::sendbreak();
 		serialport::flush();
 		up = 1;
@@ -263,6 +331,7 @@ void ocd_serial::reset(void)
 	}
 
 	write(autobaud, sizeof(autobaud));
+	sync();
 
 	return;
 }
@@ -274,7 +343,6 @@ void ocd_serial::reset(void)
 void ocd_serial::set_timeout(int mstimeout)
 {
 	serialport::timeout = mstimeout;
-	serialport::configure();
 }
 
 /**************************************************************
@@ -283,12 +351,16 @@ void ocd_serial::set_timeout(int mstimeout)
 
 void ocd_serial::set_baudrate(int baud)
 {
-	serialport::baudrate = baud;
 	serialport::timeout = 256 * 1000 * 10 / baud;
 	if(!serialport::timeout) {
 		serialport::timeout = 1;
 	}
-	serialport::configure();
+
+	/* only a change of line speed needs the port reconfigured */
+	if(baud != serialport::baudrate) {
+		serialport::baudrate = baud;
+		serialport::configure();
+	}
 }
 
 /**************************************************************
@@ -330,6 +402,8 @@ bool ocd_serial::available(void)
 		throw err_msg;
 	}
 
+	sync();
+
 	return serialport::available();
 }
 
@@ -338,6 +412,10 @@ bool ocd_serial::available(void)
  * (such as a break condition). This is used to determine
  * if we need to re-autobaud due to a break caused by a
  * clock switch.
+ *
+ * The error is latched when the receive path decodes it and
+ * stays set until the next reset, so it can still be checked
+ * after the read that found it took the link down.
  */
 
 bool ocd_serial::error(void)
@@ -348,12 +426,6 @@ bool ocd_serial::error(void)
 		throw err_msg;
 	}
 
-	if(!up) {
-		strncpy(err_msg, "Cannot read from on-chip debugger\n"
-		    "link needs to be reset first\n", err_len-1);
-		throw err_msg;
-	}
-
 	return serialport::error();
 }
 
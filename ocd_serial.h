@@ -16,11 +16,25 @@
 
 /**************************************************************/
 
+/* transmitted bytes not yet verified against the loopback echo */
+#define	ECHO_RINGSIZE	256
+#define	ECHO_CHUNK	64
+
+/**************************************************************/
+
 class ocd_serial : public ocd, private serialport
 {
 private:
 	bool open, up;
 	int unlock_ocd;
+	bool loopback;
+
+	/* loopback echo ring */
+	uint8_t echo[ECHO_RINGSIZE];
+	size_t echo_head;
+	size_t echo_count;
+	void verify_echo(size_t);
+	void sync(void);
 
 	/* Prohibit copy constructor */
 	ocd_serial(ocd_serial &);	
@@ -29,7 +43,7 @@ public:
 	ocd_serial(void);
 	~ocd_serial(void);
 
-	void connect(const char *, int, int = 0);
+	void connect(const char *, int, int = 0, bool = 1);
 	void reset(void);
 	void set_timeout(int);
 	void set_baudrate(int);
@@ -0,0 +1,732 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This is the simulated ocd connection. It decodes the
+ * on-chip debugger protocol and runs each command against a
+ * model of the device, so the debugger and flash code can be
+ * run without a dongle.
+ *
+ * The model has program and information flash with the flash
+ * controller at EZ8_FIF_BASE, a 4k register file, external
+ * data memory and the DBGCTL, PC and counter registers. Flash
+ * is only programmed while the controller is unlocked, and
+ * can only clear bits, as on a real device. Erases keep the
+ * controller busy for a realistic time. The memory CRC is
+ * computed the same way as crc_ccitt().
+ *
+ * The device is chosen with a specification string of
+ * "REVID[:MEMSIZE]", in hex, or "auto" for the default.
+ * The cpu is in ocd_sim_cpu.cpp.
+ */
+
+#include	<string.h>
+#include	<stdlib.h>
+#include	<stdio.h>
+#include	<assert.h>
+#include	"xmalloc.h"
+
+#include	"ez8.h"
+#include	"crc.h"
+#include	"timer.h"
+#include	"ocd_sim.h"
+
+#include	"err_msg.h"
+
+/**************************************************************
+ * Program memory sizes by memory size code, for each family
+ * of RevIDs, as decoded by ez8dbg::memory_size().
+ */
+
+static const size_t sim_sizes[3][8] = {
+	{ 0x0800, 0x1000, 0x2000, 0x4000, 0x6000, 0x8000, 0xc000, 0x10000 },
+	{ 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000, 0x10000, 0x10000 },
+	{ 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000, 0x10000, 0x3000 },
+};
+
+static size_t sim_flash_size(uint16_t revid, uint8_t memsize)
+{
+	switch(revid & 0x7fff) {
+	case 0x0124:
+	case 0x0128:
+	case 0x012A:
+	case 0x012E:
+	case 0x012F:
+		return sim_sizes[1][memsize & 0x07];
+	case 0x0130:
+		return sim_sizes[2][memsize & 0x07];
+	case 0x0131:
+		if((memsize & 0x07) == 0x07) {
+			return 0x6000;
+		}
+		return sim_sizes[2][memsize & 0x07];
+	default:
+		return sim_sizes[0][memsize & 0x07];
+	}
+}
+
+/**************************************************************
+ * Constructor for ocd_sim class.
+ */
+
+ocd_sim::ocd_sim(void)
+{
+	open = 0;
+	up = 0;
+	baudrate = 0;
+
+	revid = SIM_DEFAULT_REVID;
+	memsize = SIM_DEFAULT_MEMSIZE;
+	flash_size = EZ8MEM_SIZE;
+	sysclk = SIM_DEFAULT_SYSCLK;
+
+	flash = (uint8_t *)xmalloc(EZ8MEM_SIZE);
+	info = (uint8_t *)xmalloc(EZ8MEM_PAGESIZE);
+	edata = (uint8_t *)xmalloc(EZ8MEM_SIZE);
+	regs = (uint8_t *)xmalloc(EZ8REG_SIZE);
+
+	memset(flash, 0xff, EZ8MEM_SIZE);
+	memset(info, 0xff, EZ8MEM_PAGESIZE);
+	memset(edata, 0x00, EZ8MEM_SIZE);
+	memset(regs, 0x00, EZ8REG_SIZE);
+
+	dbgctl = 0x00;
+	pc = 0x0000;
+	cntr = 0x0000;
+	flash_state = SIM_FLASH_LOCKED;
+	fprot = 0xff;
+	erase_done = 0;
+
+	halted = 0;
+	ack_pending = 0;
+	cpu_start = 0;
+	cpu_cycles = 0;
+	inject = NULL;
+	inject_len = 0;
+	inject_pos = 0;
+
+	cmd_max = EZ8MEM_SIZE + 16;
+	cmd = (uint8_t *)xmalloc(cmd_max);
+	cmd_len = 0;
+
+	reply_max = EZ8MEM_SIZE;
+	reply = (uint8_t *)xmalloc(reply_max);
+	reply_head = 0;
+	reply_len = 0;
+
+	return;
+}
+
+/**************************************************************
+ * Destructor for ocd_sim class.
+ */
+
+ocd_sim::~ocd_sim(void)
+{
+	free(flash);
+	free(info);
+	free(edata);
+	free(regs);
+	free(cmd);
+	free(reply);
+
+	return;
+}
+
+/**************************************************************
+ * This will create the simulated device. The clock is used
+ * to answer baud reload register reads.
+ */
+
+void ocd_sim::connect(const char *spec, int baud, int clk)
+{
+	unsigned long value;
+	char *tail;
+
+	if(spec && *spec && strcasecmp(spec, "auto")) {
+		value = strtoul(spec, &tail, 16);
+		if(tail == spec || value > 0xffff ||
+		    (*tail && *tail != ':')) {
+			snprintf(err_msg, err_len-1,
+			    "Cannot create simulated device\n"
+			    "invalid device \"%s\"\n", spec);
+			throw err_msg;
+		}
+		revid = value;
+		if(*tail == ':') {
+			spec = tail + 1;
+			value = strtoul(spec, &tail, 16);
+			if(tail == spec || *tail || value > 0x07) {
+				snprintf(err_msg, err_len-1,
+				    "Cannot create simulated device\n"
+				    "invalid memory size \"%s\"\n", spec);
+				throw err_msg;
+			}
+			memsize = value;
+		}
+	}
+
+	flash_size = sim_flash_size(revid, memsize);
+	if(clk > 0) {
+		sysclk = clk;
+	}
+	baudrate = baud;
+	open = 1;
+	up = 0;
+
+	/* powered up running */
+	cpu_reset();
+	cpu_go();
+
+	return;
+}
+
+/**************************************************************
+ * Autobaud. Anything partly sent or not yet read is lost.
+ */
+
+void ocd_sim::reset(void)
+{
+	if(!open) {
+		strncpy(err_msg, "Cannot reset on-chip debugger link\n"
+		    "simulator not open\n", err_len-1);
+		throw err_msg;
+	}
+
+	cmd_len = 0;
+	reply_head = 0;
+	reply_len = 0;
+	up = 1;
+
+	return;
+}
+
+/**************************************************************/
+
+bool ocd_sim::link_open(void)
+{
+	return open;
+}
+
+/**************************************************************/
+
+bool ocd_sim::link_up(void)
+{
+	return up;
+}
+
+/**************************************************************/
+
+int ocd_sim::link_speed(void)
+{
+	return baudrate;
+}
+
+/**************************************************************/
+
+void ocd_sim::set_baudrate(int baud)
+{
+	baudrate = baud;
+
+	return;
+}
+
+/**************************************************************/
+
+void ocd_sim::set_timeout(int)
+{
+	return;
+}
+
+/**************************************************************
+ * A pending break acknowledge is only sent while no reply is
+ * waiting, so it cannot be taken for part of one.
+ */
+
+bool ocd_sim::available(void)
+{
+	cpu_run();
+
+	if(ack_pending && !reply_len) {
+		uint8_t ack[1] = { 0xff };
+
+		send(ack, 1);
+		ack_pending = 0;
+	}
+
+	return reply_len > 0;
+}
+
+/**************************************************************/
+
+bool ocd_sim::error(void)
+{
+	return 0;
+}
+
+/**************************************************************
+ * This will read replies from the simulated device.
+ */
+
+void ocd_sim::read(uint8_t *buff, size_t size)
+{
+	assert(buff != NULL);
+
+	if(!up) {
+		strncpy(err_msg, "Cannot read from on-chip debugger\n"
+		    "link needs to be reset first\n", err_len-1);
+		throw err_msg;
+	}
+
+	if(size > reply_len) {
+		up = 0;
+		strncpy(err_msg, "Read from on-chip debugger failed\n"
+		    "simulated device did not reply\n", err_len-1);
+		throw err_msg;
+	}
+
+	memcpy(buff, reply + reply_head, size);
+	reply_head += size;
+	reply_len -= size;
+	if(!reply_len) {
+		reply_head = 0;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will send commands to the simulated device. Commands
+ * may be split across writes, except for exec, which takes
+ * the rest of the write as opcodes.
+ */
+
+void ocd_sim::write(const uint8_t *buff, size_t size)
+{
+	assert(buff != NULL);
+
+	if(!up) {
+		strncpy(err_msg, "Cannot write to on-chip debugger\n"
+		    "link needs to be reset first\n", err_len-1);
+		throw err_msg;
+	}
+
+	cpu_run();
+
+	while(size > 0) {
+		size_t len;
+
+		cmd[cmd_len++] = *buff++;
+		size--;
+
+		len = command_length(cmd, cmd_len, size);
+		if(!len) {
+			continue;
+		}
+		if(len > cmd_len) {
+			/* rest of write belongs to this command */
+			memcpy(cmd + cmd_len, buff, len - cmd_len);
+			buff += len - cmd_len;
+			size -= len - cmd_len;
+			cmd_len = len;
+		}
+		command(cmd, cmd_len);
+		cmd_len = 0;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * Returns the length of the command at the start of p, or 0
+ * if more bytes are needed. rest is the number of bytes left
+ * in the current write.
+ */
+
+size_t ocd_sim::command_length(const uint8_t *p, size_t len, size_t rest)
+{
+	size_t n;
+
+	switch(p[0]) {
+	case DBG_CMD_WR_CNTR:
+	case DBG_CMD_WR_PC:
+		return len >= 3 ? 3 : 0;
+	case DBG_CMD_WR_DBGCTL:
+	case DBG_CMD_STUFF_INST:
+		return len >= 2 ? 2 : 0;
+	case DBG_CMD_WR_REG:
+		if(len < 4) {
+			return 0;
+		}
+		n = p[3] ? p[3] : 0x100;
+		return len >= 4 + n ? 4 + n : 0;
+	case DBG_CMD_RD_REG:
+		return len >= 4 ? 4 : 0;
+	case DBG_CMD_WR_MEM:
+	case DBG_CMD_WR_EDATA:
+		if(len < 5) {
+			return 0;
+		}
+		n = p[3] << 8 | p[4] ? p[3] << 8 | p[4] : 0x10000;
+		return len >= 5 + n ? 5 + n : 0;
+	case DBG_CMD_RD_MEM:
+	case DBG_CMD_RD_EDATA:
+		return len >= 5 ? 5 : 0;
+	case DBG_CMD_EXEC_INST:
+		/* at most five opcodes */
+		return len + (rest < 5 ? rest : 5);
+	case 0xf3:
+		return len >= 2 ? 2 : 0;
+	default:
+		return 1;
+	}
+}
+
+/**************************************************************
+ * This will queue reply bytes.
+ */
+
+void ocd_sim::send(const uint8_t *data, size_t size)
+{
+	if(reply_head + reply_len + size > reply_max) {
+		memmove(reply, reply + reply_head, reply_len);
+		reply_head = 0;
+		if(reply_len + size > reply_max) {
+			reply_max = (reply_len + size) * 2;
+			reply = (uint8_t *)xrealloc(reply, reply_max);
+		}
+	}
+	memcpy(reply + reply_head + reply_len, data, size);
+	reply_len += size;
+
+	return;
+}
+
+/**************************************************************/
+
+void ocd_sim::send_word(uint16_t word)
+{
+	uint8_t data[2];
+
+	data[0] = word >> 8;
+	data[1] = word & 0xff;
+	send(data, 2);
+
+	return;
+}
+
+/**************************************************************
+ * This will run one complete command.
+ */
+
+void ocd_sim::command(const uint8_t *p, size_t len)
+{
+	uint16_t addr;
+	size_t n;
+	uint8_t data[1];
+
+	switch(p[0]) {
+	case DBG_CMD_RD_REVID:
+		send_word(revid);
+		break;
+	case DBG_CMD_WR_CNTR:
+		cntr = p[1] << 8 | p[2];
+		break;
+	case DBG_CMD_RD_DBGSTAT:
+		data[0] = (dbgctl & DBGCTL_DBG_MODE ? DBGSTAT_STOPPED : 0x00) |
+		    (halted ? DBGSTAT_HALT_MODE : 0x00);
+		send(data, 1);
+		break;
+	case DBG_CMD_RD_CNTR:
+		send_word(cntr);
+		break;
+	case DBG_CMD_WR_DBGCTL:
+		data[0] = dbgctl;
+		dbgctl = p[1];
+		if(dbgctl & DBGCTL_RST) {
+			reset_chip();
+			dbgctl &= ~DBGCTL_RST;
+		}
+		if(!(dbgctl & DBGCTL_DBG_MODE) &&
+		    (data[0] & DBGCTL_DBG_MODE || p[1] & DBGCTL_RST)) {
+			cpu_go();
+		}
+		break;
+	case DBG_CMD_RD_DBGCTL:
+		send(&dbgctl, 1);
+		break;
+	case DBG_CMD_WR_PC:
+		pc = p[1] << 8 | p[2];
+		break;
+	case DBG_CMD_RD_PC:
+		send_word(pc);
+		break;
+	case DBG_CMD_WR_REG:
+		addr = (p[1] << 8 | p[2]) & 0xfff;
+		n = p[3] ? p[3] : 0x100;
+		for(len=0; len<n; len++) {
+			wr_reg((addr + len) & 0xfff, p[4 + len]);
+		}
+		break;
+	case DBG_CMD_RD_REG:
+		addr = (p[1] << 8 | p[2]) & 0xfff;
+		n = p[3] ? p[3] : 0x100;
+		for(len=0; len<n; len++) {
+			data[0] = rd_reg((addr + len) & 0xfff);
+			send(data, 1);
+		}
+		break;
+	case DBG_CMD_WR_MEM:
+		n = p[3] << 8 | p[4] ? p[3] << 8 | p[4] : 0x10000;
+		wr_mem(p[1] << 8 | p[2], p + 5, n);
+		break;
+	case DBG_CMD_RD_MEM:
+		n = p[3] << 8 | p[4] ? p[3] << 8 | p[4] : 0x10000;
+		addr = p[1] << 8 | p[2];
+		while(n > 0) {
+			size_t chunk;
+			uint8_t buff[256];
+
+			chunk = n > sizeof(buff) ? sizeof(buff) : n;
+			rd_mem(addr, buff, chunk);
+			send(buff, chunk);
+			addr += chunk;
+			n -= chunk;
+		}
+		break;
+	case DBG_CMD_WR_EDATA:
+		addr = p[1] << 8 | p[2];
+		n = p[3] << 8 | p[4] ? p[3] << 8 | p[4] : 0x10000;
+		for(len=0; len<n; len++) {
+			edata[(addr + len) & 0xffff] = p[5 + len];
+		}
+		break;
+	case DBG_CMD_RD_EDATA:
+		addr = p[1] << 8 | p[2];
+		n = p[3] << 8 | p[4] ? p[3] << 8 | p[4] : 0x10000;
+		for(len=0; len<n; len++) {
+			send(&edata[(addr + len) & 0xffff], 1);
+		}
+		break;
+	case DBG_CMD_RD_MEMCRC:
+		send_word(crc_ccitt(0x0000, flash, flash_size));
+		break;
+	case DBG_CMD_STEP_INST:
+		cpu_exec(NULL, 0, 0);
+		break;
+	case DBG_CMD_STUFF_INST:
+		cpu_exec(p + 1, 1, 0);
+		break;
+	case DBG_CMD_EXEC_INST:
+		cpu_exec(p + 1, len - 1, 1);
+		break;
+	case DBG_CMD_RD_RELOAD:
+		send_word(baudrate ? (uint16_t)((long long)sysclk * 8 /
+		    baudrate) : 0);
+		break;
+	case 0xf3:
+		if(p[1] == 0x84) {
+			send(&memsize, 1);
+		}
+		break;
+	default:
+		/* unsupported commands are ignored, as on a device
+		 * without them */
+		break;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will reset the simulated chip.
+ */
+
+void ocd_sim::reset_chip(void)
+{
+	memset(regs, 0x00, EZ8REG_SIZE);
+	flash_state = SIM_FLASH_LOCKED;
+	erase_done = 0;
+	cpu_reset();
+
+	return;
+}
+
+/**************************************************************
+ * Returns the flash status register.
+ */
+
+uint8_t ocd_sim::flash_status(void)
+{
+	if(flash_state & (SIM_FLASH_PAGE_ERASE | SIM_FLASH_MASS_ERASE)) {
+		if(timernow() >= erase_done) {
+			/* controller locks when the erase is done */
+			flash_state = SIM_FLASH_LOCKED;
+		}
+	}
+
+	return flash_state;
+}
+
+/**************************************************************
+ * This will write the flash control register.
+ */
+
+void ocd_sim::flash_control(uint8_t value)
+{
+	uint8_t page;
+
+	if(flash_status() & (SIM_FLASH_PAGE_ERASE | SIM_FLASH_MASS_ERASE)) {
+		return;
+	}
+
+	page = regs[EZ8_FIF_BASE + 1];
+
+	switch(value) {
+	case EZ8_FIF_UNLOCK_0:
+		flash_state = flash_state == SIM_FLASH_LOCKED ?
+		    SIM_FLASH_UNLOCK_0 : SIM_FLASH_LOCKED;
+		break;
+	case EZ8_FIF_UNLOCK_1:
+		flash_state = flash_state == SIM_FLASH_UNLOCK_0 ?
+		    SIM_FLASH_UNLOCKED : SIM_FLASH_LOCKED;
+		break;
+	case EZ8_FIF_PROT_REG:
+		flash_state = flash_state == SIM_FLASH_LOCKED ?
+		    SIM_FLASH_PROTECT : SIM_FLASH_LOCKED;
+		break;
+	case EZ8_FIF_PAGE_ERASE:
+		if(flash_state != SIM_FLASH_UNLOCKED) {
+			flash_state = SIM_FLASH_LOCKED;
+			break;
+		}
+		if(page & 0x80) {
+			memset(info, 0xff, EZ8MEM_PAGESIZE);
+		} else if((size_t)(page & 0x7f) * EZ8MEM_PAGESIZE <
+		    flash_size) {
+			memset(flash + (page & 0x7f) * EZ8MEM_PAGESIZE,
+			    0xff, EZ8MEM_PAGESIZE);
+		}
+		flash_state = SIM_FLASH_PAGE_ERASE;
+		erase_done = timernow() + SIM_PAGE_ERASE_TIME;
+		break;
+	case EZ8_FIF_MASS_ERASE:
+		if(flash_state != SIM_FLASH_UNLOCKED) {
+			flash_state = SIM_FLASH_LOCKED;
+			break;
+		}
+		memset(flash, 0xff, EZ8MEM_SIZE);
+		if(page & 0x80) {
+			memset(info, 0xff, EZ8MEM_PAGESIZE);
+		}
+		flash_state = SIM_FLASH_MASS_ERASE;
+		erase_done = timernow() + SIM_MASS_ERASE_TIME;
+		break;
+	default:
+		flash_state = SIM_FLASH_LOCKED;
+		break;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will write a register. The flash controller registers
+ * are decoded, others are plain memory.
+ */
+
+void ocd_sim::wr_reg(uint16_t addr, uint8_t value)
+{
+	switch(addr) {
+	case EZ8_FIF_BASE:
+		flash_control(value);
+		break;
+	case EZ8_FIF_BASE + 1:
+		if(flash_status() == SIM_FLASH_PROTECT) {
+			fprot = value;
+			flash_state = SIM_FLASH_LOCKED;
+		} else {
+			regs[addr] = value;
+		}
+		break;
+	default:
+		regs[addr] = value;
+		break;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will read a register.
+ */
+
+uint8_t ocd_sim::rd_reg(uint16_t addr)
+{
+	switch(addr) {
+	case EZ8_FIF_BASE:
+		return flash_status();
+	case EZ8_FIF_BASE + 1:
+		if(flash_status() == SIM_FLASH_PROTECT) {
+			return fprot;
+		}
+		return regs[addr];
+	default:
+		return regs[addr];
+	}
+}
+
+/**************************************************************
+ * This will program flash. Bits can only be cleared, and
+ * nothing is written unless the controller is unlocked. With
+ * the information page selected, it appears at the top page
+ * of memory.
+ */
+
+void ocd_sim::wr_mem(uint16_t addr, const uint8_t *data, size_t size)
+{
+	bool info_sel;
+
+	if(flash_status() != SIM_FLASH_UNLOCKED) {
+		return;
+	}
+
+	info_sel = regs[EZ8_FIF_BASE + 1] & 0x80;
+
+	for(; size > 0; size--, addr++, data++) {
+		if(info_sel && addr >= EZ8MEM_SIZE - EZ8MEM_PAGESIZE) {
+			info[addr & (EZ8MEM_PAGESIZE - 1)] &= *data;
+		} else if(addr < flash_size) {
+			flash[addr] &= *data;
+		}
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will read program memory. Memory past the end of flash
+ * reads as FF.
+ */
+
+void ocd_sim::rd_mem(uint16_t addr, uint8_t *data, size_t size)
+{
+	bool info_sel;
+
+	info_sel = regs[EZ8_FIF_BASE + 1] & 0x80;
+
+	for(; size > 0; size--, addr++, data++) {
+		if(info_sel && addr >= EZ8MEM_SIZE - EZ8MEM_PAGESIZE) {
+			*data = info[addr & (EZ8MEM_PAGESIZE - 1)];
+		} else if(addr < flash_size) {
+			*data = flash[addr];
+		} else {
+			*data = 0xff;
+		}
+	}
+
+	return;
+}
+
+/**************************************************************/
+
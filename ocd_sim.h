@@ -0,0 +1,147 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This is an on-chip debugger interface class that talks to
+ * a simulated Z8 Encore! device instead of a dongle. The
+ * device includes an eZ8 cpu that runs the firmware in flash.
+ */
+
+#ifndef	OCD_SIM_HEADER
+#define	OCD_SIM_HEADER
+
+#include	<stdlib.h>
+#include	<inttypes.h>
+
+#include	"ocd.h"
+
+/**************************************************************/
+
+/* device simulated if none is specified */
+#define	SIM_DEFAULT_REVID	0x0126
+#define	SIM_DEFAULT_MEMSIZE	0x07		/* 64k */
+#define	SIM_DEFAULT_SYSCLK	18432000
+
+/* flash erase times, in microseconds */
+#define	SIM_PAGE_ERASE_TIME	10000
+#define	SIM_MASS_ERASE_TIME	200000
+
+/* flash controller states, as read from FSTAT */
+#define	SIM_FLASH_LOCKED	0x00
+#define	SIM_FLASH_UNLOCK_0	0x01
+#define	SIM_FLASH_UNLOCKED	0x02
+#define	SIM_FLASH_PROTECT	0x04
+#define	SIM_FLASH_PAGE_ERASE	0x10
+#define	SIM_FLASH_MASS_ERASE	0x20
+
+/* longest the simulated cpu may fall behind real time, in
+ * microseconds, before the lost time is dropped */
+#define	SIM_MAX_LAG		100000
+
+class ocd_sim : public ocd
+{
+private:
+	bool open, up;
+	int baudrate;
+
+	/* device configuration */
+	uint16_t revid;
+	uint8_t memsize;
+	size_t flash_size;
+	int sysclk;
+
+	/* device state */
+	uint8_t *flash;			/* program memory */
+	uint8_t *info;			/* information page */
+	uint8_t *edata;			/* external data memory */
+	uint8_t *regs;			/* register file */
+	uint8_t dbgctl;
+	uint16_t pc;
+	uint16_t cntr;
+	uint8_t flash_state;
+	uint8_t fprot;
+	uint64_t erase_done;		/* time erase finishes */
+
+	/* cpu state */
+	bool halted;			/* halt or stop executed */
+	bool ack_pending;		/* break to acknowledge */
+	uint64_t cpu_start;		/* time run mode entered */
+	uint64_t cpu_cycles;		/* cycles run since then */
+	const uint8_t *inject;		/* stuffed opcodes */
+	size_t inject_len;
+	size_t inject_pos;
+
+	/* command being received */
+	uint8_t *cmd;
+	size_t cmd_len;
+	size_t cmd_max;
+
+	/* reply waiting to be read */
+	uint8_t *reply;
+	size_t reply_head;
+	size_t reply_len;
+	size_t reply_max;
+
+	/* Prohibit use of copy constructor */
+	ocd_sim(ocd_sim &);
+
+	size_t command_length(const uint8_t *, size_t, size_t);
+	void command(const uint8_t *, size_t);
+	void send(const uint8_t *, size_t);
+	void send_word(uint16_t);
+
+	void reset_chip(void);
+	uint8_t flash_status(void);
+	void flash_control(uint8_t);
+	void wr_reg(uint16_t, uint8_t);
+	uint8_t rd_reg(uint16_t);
+	void wr_mem(uint16_t, const uint8_t *, size_t);
+	void rd_mem(uint16_t, uint8_t *, size_t);
+
+	/* cpu, in ocd_sim_cpu.cpp */
+	void cpu_reset(void);
+	void cpu_go(void);
+	void cpu_break(void);
+	void cpu_run(void);
+	int cpu_tick(void);
+	void cpu_exec(const uint8_t *, size_t, bool);
+	int cpu_insn(void);
+	int cpu_interrupt(void);
+	uint8_t fetch(void);
+	uint16_t reg_r(uint8_t);
+	uint16_t reg_R(uint8_t);
+	uint16_t reg_IR(uint16_t);
+	uint16_t reg_ER(uint16_t);
+	uint16_t rd_word(uint16_t);
+	void wr_word(uint16_t, uint16_t);
+	void push(uint8_t);
+	uint8_t pop(void);
+	void set_flags(uint8_t, uint8_t);
+	bool condition(int);
+	uint8_t alu(int, uint8_t, uint8_t, bool *);
+	uint8_t single(int, uint8_t);
+
+public:
+	ocd_sim();
+	~ocd_sim();
+
+	void connect(const char *, int, int);
+	void reset(void);
+
+	bool link_open(void);
+	bool link_up(void);
+	int  link_speed(void);
+	void set_baudrate(int);
+	void set_timeout(int);
+
+	bool available(void);
+	bool error(void);
+
+	void read(uint8_t *, size_t);
+	void write(const uint8_t *, size_t);
+};
+
+/**************************************************************/
+
+#endif	/* OCD_SIM_HEADER */
+
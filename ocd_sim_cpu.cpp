@@ -0,0 +1,1142 @@
+/* Copyright (C) 2002, 2003, 2004 Zilog, Inc.
+ *
+ * $Id$
+ *
+ * This is the eZ8 cpu of the simulated device. It executes
+ * the firmware in flash, using the opcode table shared with
+ * the disassembler to decode instructions.
+ *
+ * In run mode the cpu is advanced to real time, at the
+ * simulated system clock, whenever the host talks to the
+ * device. It stops on a breakpoint opcode, on a program
+ * counter match or when the run counter expires, as set up
+ * in DBGCTL. Instruction cycle counts follow the opcode map
+ * closely but not exactly; peripherals are not simulated, so
+ * interrupts are only raised by writing the interrupt request
+ * registers or by trap.
+ */
+
+#include	<string.h>
+#include	<stdlib.h>
+#include	<stdio.h>
+#include	<assert.h>
+
+#include	"ez8.h"
+#include	"opcodes.h"
+#include	"disassembler.h"
+#include	"timer.h"
+#include	"ocd_sim.h"
+
+/* flags register */
+#define	FLAG_C		0x80
+#define	FLAG_Z		0x40
+#define	FLAG_S		0x20
+#define	FLAG_V		0x10
+#define	FLAG_D		0x08
+#define	FLAG_H		0x04
+
+/* interrupt controller */
+#define	EZ8_IRQ0	0xfc0
+#define	EZ8_IRQ_COUNT	3
+#define	EZ8_IRQE	0x80
+
+/* vectors */
+#define	EZ8_IRQ_VECTOR	0x0008
+
+/**************************************************************
+ * Opcode lookup tables, built from the disassembler's opcode
+ * table on first use.
+ */
+
+static const struct opcode_t *sim_opcodes[256];
+static const struct opcode_t *sim_alt_opcodes[256];
+static bool sim_opcodes_built = 0;
+
+static void sim_build_opcodes(void)
+{
+	int i;
+
+	for(i=0; i<256; i++) {
+		sim_opcodes[i] = find_opcode(i);
+		sim_alt_opcodes[i] = find_alt_opcode(i);
+	}
+	sim_opcodes_built = 1;
+
+	return;
+}
+
+/**************************************************************
+ * Returns the number of cycles an instruction takes, by its
+ * addressing mode.
+ */
+
+static int sim_cycles(enum address_mode_t am)
+{
+	switch(am) {
+	case am_none:
+	case am_IM:
+	case am_r1:
+	case am_R1:
+	case am_ER1:
+	case am_r1_IM:
+	case am_cc_RA:
+	case am_cc_DA:
+	case am_p_bit_r1:
+	case am_r1_ER2:
+	case am_r2_ER1:
+		return 2;
+	case am_IR1:
+	case am_r1_r2:
+	case am_r1_RA:
+	case am_R1_IM:
+	case am_R2_R1:
+	case am_DA:
+	case am_Ir1_ER2:
+	case am_Ir2_ER1:
+	case am_ER2_ER1:
+	case am_IM_ER1:
+	case am_p_bit_r1_RA:
+	case am_r1_r2_X:
+	case am_r2_r1_X:
+		return 3;
+	case am_r1_Ir2:
+	case am_Ir1_r2:
+	case am_IR1_IM:
+	case am_IR2_R1:
+	case am_R2_IR1:
+	case am_p_bit_Ir1_RA:
+	case am_rr1_rr2_X:
+		return 4;
+	case am_RR1:
+	case am_r1_Irr2:
+	case am_r2_Irr1:
+	case am_IRR2_R1:
+	case am_R2_IRR1:
+	case am_r1_rr2_X:
+	case am_rr1_r2_X:
+		return 5;
+	case am_IRR1:
+	case am_IRR2_IR1:
+	case am_IR2_IRR1:
+	case am_vec:
+		return 6;
+	case am_Ir1_Irr2:
+	case am_Ir2_Irr1:
+		return 9;
+	default:
+		return 2;
+	}
+}
+
+/**************************************************************
+ * This will reset the cpu registers.
+ */
+
+void ocd_sim::cpu_reset(void)
+{
+	pc = flash[0x0002] << 8 | flash[0x0003];
+	halted = 0;
+	ack_pending = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will put the cpu in run mode. The run counter starts
+ * from zero unless it holds a breakpoint address or count.
+ */
+
+void ocd_sim::cpu_go(void)
+{
+	if(!(dbgctl & (DBGCTL_BRK_PC | DBGCTL_BRK_CNTR))) {
+		cntr = 0x0000;
+	}
+	ack_pending = 0;
+	cpu_start = timernow();
+	cpu_cycles = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will enter debug mode on a breakpoint, acknowledging
+ * it to the host if asked to.
+ */
+
+void ocd_sim::cpu_break(void)
+{
+	dbgctl |= DBGCTL_DBG_MODE;
+	if(dbgctl & DBGCTL_BRK_ACK) {
+		ack_pending = 1;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will run the cpu up to the current time. If the host
+ * has not talked to the device for a while, the time missed
+ * is dropped rather than run all at once.
+ */
+
+void ocd_sim::cpu_run(void)
+{
+	uint64_t target;
+
+	if(dbgctl & DBGCTL_DBG_MODE) {
+		return;
+	}
+
+	target = (timernow() - cpu_start) * sysclk / 1000000;
+	if(target > cpu_cycles + (uint64_t)sysclk * SIM_MAX_LAG / 1000000) {
+		cpu_cycles = target - (uint64_t)sysclk * SIM_MAX_LAG / 1000000;
+	}
+
+	while(cpu_cycles < target && !(dbgctl & DBGCTL_DBG_MODE)) {
+		int cycles;
+
+		if(halted) {
+			cycles = cpu_interrupt();
+			if(!cycles) {
+				cycles = target - cpu_cycles;
+			}
+		} else {
+			cycles = cpu_tick();
+		}
+		cpu_cycles += cycles;
+
+		if(dbgctl & DBGCTL_BRK_CNTR) {
+			if(cntr <= cycles) {
+				cntr = 0x0000;
+				cpu_break();
+			} else {
+				cntr -= cycles;
+			}
+		} else if(!(dbgctl & DBGCTL_BRK_PC)) {
+			cntr = cntr + cycles > 0xffff ? 0xffff : cntr + cycles;
+		}
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will run one instruction in run mode, or take an
+ * interrupt. Returns the number of cycles used.
+ */
+
+int ocd_sim::cpu_tick(void)
+{
+	int cycles;
+
+	if(dbgctl & DBGCTL_BRK_PC && pc == cntr) {
+		cpu_break();
+		return 0;
+	}
+
+	cycles = cpu_interrupt();
+	if(cycles) {
+		return cycles;
+	}
+
+	return cpu_insn();
+}
+
+/**************************************************************
+ * This will run one instruction in debug mode. With opcodes
+ * given, they are used in place of the first bytes of the
+ * instruction. If exec is set, the instruction is run
+ * without moving the program counter, unless it jumps.
+ */
+
+void ocd_sim::cpu_exec(const uint8_t *opcodes, size_t size, bool exec)
+{
+	uint16_t start;
+
+	if(!(dbgctl & DBGCTL_DBG_MODE)) {
+		return;
+	}
+
+	start = pc;
+	inject = opcodes;
+	inject_len = size;
+	inject_pos = 0;
+
+	cpu_insn();
+
+	if(exec && pc == (uint16_t)(start + inject_pos)) {
+		pc = start;
+	}
+	inject = NULL;
+	inject_len = 0;
+	inject_pos = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This will take the highest priority pending interrupt, if
+ * interrupts are enabled. Returns the number of cycles used,
+ * or 0 if no interrupt was taken.
+ */
+
+int ocd_sim::cpu_interrupt(void)
+{
+	int irq, bit, level, best, best_irq, best_bit;
+	uint16_t vector;
+
+	if(!(regs[EZ8_IRQCTL] & EZ8_IRQE)) {
+		return 0;
+	}
+
+	best = 0;
+	best_irq = 0;
+	best_bit = 0;
+	for(irq=0; irq<EZ8_IRQ_COUNT; irq++) {
+		uint8_t req, enh, enl;
+
+		req = regs[EZ8_IRQ0 + irq * 3];
+		if(!req) {
+			continue;
+		}
+		enh = regs[EZ8_IRQ0 + irq * 3 + 1];
+		enl = regs[EZ8_IRQ0 + irq * 3 + 2];
+		for(bit=7; bit>=0; bit--) {
+			if(!(req & 1 << bit)) {
+				continue;
+			}
+			level = (enh >> bit & 1) << 1 | (enl >> bit & 1);
+			if(level > best) {
+				best = level;
+				best_irq = irq;
+				best_bit = bit;
+			}
+		}
+	}
+	if(!best) {
+		return 0;
+	}
+
+	regs[EZ8_IRQ0 + best_irq * 3] &= ~(1 << best_bit);
+	vector = EZ8_IRQ_VECTOR + (best_irq * 8 + 7 - best_bit) * 2;
+
+	push(pc & 0xff);
+	push(pc >> 8);
+	push(regs[EZ8_FLAGS]);
+	regs[EZ8_IRQCTL] &= ~EZ8_IRQE;
+	pc = flash[vector] << 8 | flash[vector + 1];
+	halted = 0;
+
+	return 8;
+}
+
+/**************************************************************
+ * This will fetch the next instruction byte.
+ */
+
+uint8_t ocd_sim::fetch(void)
+{
+	uint8_t data;
+
+	if(inject_pos < inject_len) {
+		data = inject[inject_pos++];
+	} else {
+		rd_mem(pc, &data, 1);
+	}
+	pc++;
+
+	return data;
+}
+
+/**************************************************************
+ * These return the register file address of a working
+ * register, an 8 bit register address, the register an 8 bit
+ * register points to, and a 12 bit register address.
+ */
+
+uint16_t ocd_sim::reg_r(uint8_t r)
+{
+	return (regs[EZ8_RP] & 0x0f) << 8 | (regs[EZ8_RP] & 0xf0) | (r & 0x0f);
+}
+
+uint16_t ocd_sim::reg_R(uint8_t R)
+{
+	if((R & 0xf0) == 0xe0) {
+		return reg_r(R);
+	}
+	return (regs[EZ8_RP] & 0x0f) << 8 | R;
+}
+
+uint16_t ocd_sim::reg_IR(uint16_t addr)
+{
+	return reg_R(rd_reg(addr));
+}
+
+uint16_t ocd_sim::reg_ER(uint16_t ER)
+{
+	if((ER & 0xff0) == 0xee0) {
+		return reg_r(ER);
+	}
+	return ER & 0xfff;
+}
+
+/**************************************************************
+ * These access a register pair.
+ */
+
+uint16_t ocd_sim::rd_word(uint16_t addr)
+{
+	return rd_reg(addr & 0xfff) << 8 | rd_reg((addr + 1) & 0xfff);
+}
+
+void ocd_sim::wr_word(uint16_t addr, uint16_t value)
+{
+	wr_reg(addr & 0xfff, value >> 8);
+	wr_reg((addr + 1) & 0xfff, value & 0xff);
+
+	return;
+}
+
+/**************************************************************
+ * These push and pop the stack in the register file.
+ */
+
+void ocd_sim::push(uint8_t value)
+{
+	uint16_t sp;
+
+	sp = (regs[EZ8_SPH] << 8 | regs[EZ8_SPL]) - 1;
+	regs[EZ8_SPH] = sp >> 8;
+	regs[EZ8_SPL] = sp & 0xff;
+	wr_reg(sp & 0xfff, value);
+
+	return;
+}
+
+uint8_t ocd_sim::pop(void)
+{
+	uint16_t sp;
+	uint8_t value;
+
+	sp = regs[EZ8_SPH] << 8 | regs[EZ8_SPL];
+	value = rd_reg(sp & 0xfff);
+	sp++;
+	regs[EZ8_SPH] = sp >> 8;
+	regs[EZ8_SPL] = sp & 0xff;
+
+	return value;
+}
+
+/**************************************************************
+ * This will update the flags selected by mask.
+ */
+
+void ocd_sim::set_flags(uint8_t mask, uint8_t value)
+{
+	regs[EZ8_FLAGS] = (regs[EZ8_FLAGS] & ~mask) | (value & mask);
+
+	return;
+}
+
+/**************************************************************
+ * Returns the result of a condition code test.
+ */
+
+bool ocd_sim::condition(int cc)
+{
+	uint8_t f;
+	bool c, z, s, v, result;
+
+	f = regs[EZ8_FLAGS];
+	c = f & FLAG_C;
+	z = f & FLAG_Z;
+	s = f & FLAG_S;
+	v = f & FLAG_V;
+
+	switch(cc & 0x07) {
+	case 0x00:
+		result = 0;
+		break;
+	case 0x01:
+		result = s != v;
+		break;
+	case 0x02:
+		result = z || s != v;
+		break;
+	case 0x03:
+		result = c || z;
+		break;
+	case 0x04:
+		result = v;
+		break;
+	case 0x05:
+		result = s;
+		break;
+	case 0x06:
+		result = z;
+		break;
+	default:
+		result = c;
+		break;
+	}
+
+	return cc & 0x08 ? !result : result;
+}
+
+/**************************************************************
+ * This will run a two operand arithmetic or logic function,
+ * given by the high nibble of its opcode. Function 0x10 is
+ * compare with carry. *store is cleared if the result is not
+ * written back.
+ */
+
+uint8_t ocd_sim::alu(int fn, uint8_t dst, uint8_t src, bool *store)
+{
+	unsigned int carry, result;
+	uint8_t r, flags;
+
+	carry = regs[EZ8_FLAGS] & FLAG_C ? 1 : 0;
+	*store = 1;
+
+	switch(fn) {
+	case 0x0:
+	case 0x1:
+		if(fn == 0x0) {
+			carry = 0;
+		}
+		result = dst + src + carry;
+		r = result;
+		flags = (result > 0xff ? FLAG_C : 0) |
+		    (r ? 0 : FLAG_Z) | (r & 0x80 ? FLAG_S : 0) |
+		    ((dst ^ r) & (src ^ r) & 0x80 ? FLAG_V : 0) |
+		    ((dst & 0x0f) + (src & 0x0f) + carry > 0x0f ? FLAG_H : 0);
+		set_flags(FLAG_C | FLAG_Z | FLAG_S | FLAG_V | FLAG_D | FLAG_H,
+		    flags);
+		return r;
+	case 0x2:
+	case 0x3:
+	case 0xa:
+	case 0x10:
+		if(fn == 0x2 || fn == 0xa) {
+			carry = 0;
+		}
+		result = dst - src - carry;
+		r = result;
+		flags = (dst < src + carry ? FLAG_C : 0) |
+		    (r ? 0 : FLAG_Z) | (r & 0x80 ? FLAG_S : 0) |
+		    ((dst ^ src) & (dst ^ r) & 0x80 ? FLAG_V : 0);
+		if(fn == 0xa) {
+			*store = 0;
+			set_flags(FLAG_C | FLAG_Z | FLAG_S | FLAG_V, flags);
+		} else if(fn == 0x10) {
+			*store = 0;
+			if(!(regs[EZ8_FLAGS] & FLAG_Z)) {
+				flags &= ~FLAG_Z;
+			}
+			set_flags(FLAG_C | FLAG_Z | FLAG_S | FLAG_V, flags);
+		} else {
+			flags |= FLAG_D |
+			    ((dst & 0x0f) < (src & 0x0f) + carry ? FLAG_H : 0);
+			set_flags(FLAG_C | FLAG_Z | FLAG_S | FLAG_V |
+			    FLAG_D | FLAG_H, flags);
+		}
+		return r;
+	case 0x4:
+		r = dst | src;
+		break;
+	case 0x5:
+		r = dst & src;
+		break;
+	case 0x6:
+		r = ~dst & src;
+		*store = 0;
+		break;
+	case 0x7:
+		r = dst & src;
+		*store = 0;
+		break;
+	default:
+		r = dst ^ src;
+		break;
+	}
+
+	set_flags(FLAG_Z | FLAG_S | FLAG_V,
+	    (r ? 0 : FLAG_Z) | (r & 0x80 ? FLAG_S : 0));
+
+	return r;
+}
+
+/**************************************************************
+ * This will run a single operand function, given by the high
+ * nibble of its opcode. Function 0x1c is shift right logical.
+ */
+
+uint8_t ocd_sim::single(int fn, uint8_t dst)
+{
+	uint8_t r, f, c;
+
+	f = regs[EZ8_FLAGS];
+	c = f & FLAG_C ? 1 : 0;
+
+	switch(fn) {
+	case 0x1:
+		/* rlc */
+		r = dst << 1 | c;
+		c = dst >> 7;
+		break;
+	case 0x2:
+		/* inc */
+		r = dst + 1;
+		set_flags(FLAG_Z | FLAG_S | FLAG_V, (r ? 0 : FLAG_Z) |
+		    (r & 0x80 ? FLAG_S : 0) | (r == 0x80 ? FLAG_V : 0));
+		return r;
+	case 0x3:
+		/* dec */
+		r = dst - 1;
+		set_flags(FLAG_Z | FLAG_S | FLAG_V, (r ? 0 : FLAG_Z) |
+		    (r & 0x80 ? FLAG_S : 0) | (r == 0x7f ? FLAG_V : 0));
+		return r;
+	case 0x4:
+		/* da */
+		r = dst;
+		if(!(f & FLAG_D)) {
+			if(c || r > 0x99) {
+				r += 0x60;
+				c = 1;
+			}
+			if(f & FLAG_H || (r & 0x0f) > 0x09) {
+				r += 0x06;
+			}
+		} else {
+			if(c) {
+				r -= 0x60;
+			}
+			if(f & FLAG_H) {
+				r -= 0x06;
+			}
+		}
+		set_flags(FLAG_C | FLAG_Z | FLAG_S, (c ? FLAG_C : 0) |
+		    (r ? 0 : FLAG_Z) | (r & 0x80 ? FLAG_S : 0));
+		return r;
+	case 0x6:
+		/* com */
+		r = ~dst;
+		set_flags(FLAG_Z | FLAG_S | FLAG_V,
+		    (r ? 0 : FLAG_Z) | (r & 0x80 ? FLAG_S : 0));
+		return r;
+	case 0x9:
+		/* rl */
+		r = dst << 1 | dst >> 7;
+		c = dst >> 7;
+		break;
+	case 0xb:
+		/* clr */
+		return 0x00;
+	case 0xc:
+		/* rrc */
+		r = dst >> 1 | c << 7;
+		c = dst & 0x01;
+		break;
+	case 0xd:
+		/* sra */
+		r = dst >> 1 | (dst & 0x80);
+		c = dst & 0x01;
+		break;
+	case 0xe:
+		/* rr */
+		r = dst >> 1 | dst << 7;
+		c = dst & 0x01;
+		break;
+	case 0xf:
+		/* swap */
+		r = dst >> 4 | dst << 4;
+		set_flags(FLAG_Z | FLAG_S,
+		    (r ? 0 : FLAG_Z) | (r & 0x80 ? FLAG_S : 0));
+		return r;
+	case 0x1c:
+		/* srl */
+		r = dst >> 1;
+		c = dst & 0x01;
+		break;
+	default:
+		return dst;
+	}
+
+	/* rotates and shifts */
+	set_flags(FLAG_C | FLAG_Z | FLAG_S | FLAG_V, (c ? FLAG_C : 0) |
+	    (r ? 0 : FLAG_Z) | (r & 0x80 ? FLAG_S : 0) |
+	    ((r ^ dst) & 0x80 ? FLAG_V : 0));
+
+	return r;
+}
+
+/**************************************************************
+ * This will run one instruction. Returns the number of cycles
+ * used.
+ */
+
+int ocd_sim::cpu_insn(void)
+{
+	const struct opcode_t *entry;
+	uint8_t buff[5], *op, hi, lo, data;
+	uint16_t start, src, dst, word;
+	bool alt, store;
+	int i, size;
+
+	if(!sim_opcodes_built) {
+		sim_build_opcodes();
+	}
+
+	start = pc;
+	buff[0] = fetch();
+	alt = buff[0] == ALT_OPCODE;
+	if(alt) {
+		buff[1] = fetch();
+		op = buff + 1;
+		entry = sim_alt_opcodes[op[0]];
+	} else {
+		op = buff;
+		entry = sim_opcodes[op[0]];
+	}
+
+	if(!entry) {
+		/* illegal opcodes are skipped */
+		return 2;
+	}
+
+	size = opcode_size(entry);
+	for(i=1; i<size; i++) {
+		op[i] = fetch();
+	}
+
+	hi = op[0] >> 4;
+	lo = op[0] & 0x0f;
+
+	if(alt && hi == 0xc) {
+		/* srl */
+		dst = reg_R(op[1]);
+		if(lo) {
+			dst = reg_IR(dst);
+		}
+		wr_reg(dst, single(0x1c, rd_reg(dst)));
+		return sim_cycles(entry->am) + 1;
+	}
+
+	/* two operand arithmetic and logic */
+	if((hi <= 0x7 || hi == 0xa || hi == 0xb) && lo >= 0x2 && lo <= 0x9) {
+		uint8_t value;
+
+		switch(lo) {
+		case 0x2:
+			dst = reg_r(op[1] >> 4);
+			value = rd_reg(reg_r(op[1]));
+			break;
+		case 0x3:
+			dst = reg_r(op[1] >> 4);
+			value = rd_reg(reg_IR(reg_r(op[1])));
+			break;
+		case 0x4:
+			dst = reg_R(op[2]);
+			value = rd_reg(reg_R(op[1]));
+			break;
+		case 0x5:
+			dst = reg_R(op[2]);
+			value = rd_reg(reg_IR(reg_R(op[1])));
+			break;
+		case 0x6:
+			dst = reg_R(op[1]);
+			value = op[2];
+			break;
+		case 0x7:
+			dst = reg_IR(reg_R(op[1]));
+			value = op[2];
+			break;
+		case 0x8:
+			dst = reg_ER((op[2] & 0x0f) << 8 | op[3]);
+			value = rd_reg(reg_ER(op[1] << 4 | op[2] >> 4));
+			break;
+		default:
+			dst = reg_ER((op[2] & 0x0f) << 8 | op[3]);
+			value = op[1];
+			break;
+		}
+
+		if(alt) {
+			alu(0x10, rd_reg(dst), value, &store);
+			return sim_cycles(entry->am) + 1;
+		}
+		data = alu(hi, rd_reg(dst), value, &store);
+		if(store) {
+			wr_reg(dst, data);
+		}
+		return sim_cycles(entry->am);
+	}
+
+	/* working register instructions */
+	switch(lo) {
+	case 0xa:
+		/* djnz */
+		dst = reg_r(hi);
+		data = rd_reg(dst) - 1;
+		wr_reg(dst, data);
+		if(data) {
+			pc += (int8_t)op[1];
+		}
+		return sim_cycles(entry->am);
+	case 0xb:
+		/* jr */
+		if(condition(hi)) {
+			pc += (int8_t)op[1];
+		}
+		return sim_cycles(entry->am);
+	case 0xc:
+		/* ld r1,#IM */
+		wr_reg(reg_r(hi), op[1]);
+		return sim_cycles(entry->am);
+	case 0xd:
+		/* jp cc,DA */
+		if(condition(hi)) {
+			pc = op[1] << 8 | op[2];
+		}
+		return sim_cycles(entry->am);
+	case 0xe:
+		/* inc r1 */
+		dst = reg_r(hi);
+		wr_reg(dst, single(0x2, rd_reg(dst)));
+		return sim_cycles(entry->am);
+	default:
+		break;
+	}
+
+	switch(op[0]) {
+	case 0x00:
+		/* brk */
+		if(dbgctl & DBGCTL_DBG_MODE || !(dbgctl & DBGCTL_BRK_EN)) {
+			break;
+		}
+		pc = start;
+		if(!(dbgctl & DBGCTL_BRK_LOOP)) {
+			cpu_break();
+		}
+		return 1;
+	case 0x01:
+		/* srp */
+		wr_reg(EZ8_RP, op[1]);
+		break;
+	case 0x10: case 0x11: case 0x20: case 0x21:
+	case 0x30: case 0x31: case 0x40: case 0x41:
+	case 0x60: case 0x61: case 0x90: case 0x91:
+	case 0xb0: case 0xb1: case 0xc0: case 0xc1:
+	case 0xd0: case 0xd1: case 0xe0: case 0xe1:
+	case 0xf0: case 0xf1:
+		dst = reg_R(op[1]);
+		if(lo) {
+			dst = reg_IR(dst);
+		}
+		wr_reg(dst, single(hi, rd_reg(dst)));
+		break;
+	case 0x50:
+	case 0x51:
+		/* pop */
+		dst = reg_R(op[1]);
+		if(lo) {
+			dst = reg_IR(dst);
+		}
+		wr_reg(dst, pop());
+		break;
+	case 0x70:
+	case 0x71:
+		/* push */
+		src = reg_R(op[1]);
+		if(lo) {
+			src = reg_IR(src);
+		}
+		push(rd_reg(src));
+		break;
+	case 0x80:
+	case 0x81:
+	case 0xa0:
+	case 0xa1:
+		/* decw, incw */
+		dst = reg_R(op[1] & 0xfe);
+		if(lo) {
+			dst = reg_R(rd_reg(dst) & 0xfe);
+		}
+		word = rd_word(dst) + (hi == 0x8 ? -1 : 1);
+		wr_word(dst, word);
+		set_flags(FLAG_Z | FLAG_S | FLAG_V, (word ? 0 : FLAG_Z) |
+		    (word & 0x8000 ? FLAG_S : 0) |
+		    (word == (hi == 0x8 ? 0x7fff : 0x8000) ? FLAG_V : 0));
+		break;
+	case 0x82:
+		/* lde r1,@rr2 */
+		wr_reg(reg_r(hi), edata[rd_word(reg_r(op[1] & 0x0e))]);
+		break;
+	case 0x92:
+		/* lde @rr1,r2 */
+		edata[rd_word(reg_r(op[1] & 0x0e))] = rd_reg(reg_r(op[1] >> 4));
+		break;
+	case 0x83:
+	case 0x93:
+	case 0xc3:
+	case 0xd3:
+		/* ldei, ldci */
+		src = reg_r(op[1] >> 4);
+		dst = reg_r(op[1] & 0x0e);
+		word = rd_word(dst);
+		if(op[0] == 0x83) {
+			wr_reg(reg_IR(src), edata[word]);
+		} else if(op[0] == 0x93) {
+			edata[word] = rd_reg(reg_IR(src));
+		} else if(op[0] == 0xc3) {
+			rd_mem(word, &data, 1);
+			wr_reg(reg_IR(src), data);
+		} else {
+			data = rd_reg(reg_IR(src));
+			wr_mem(word, &data, 1);
+		}
+		wr_reg(src, rd_reg(src) + 1);
+		wr_word(dst, word + 1);
+		break;
+	case 0xc2:
+		/* ldc r1,@rr2 */
+		rd_mem(rd_word(reg_r(op[1] & 0x0e)), &data, 1);
+		wr_reg(reg_r(op[1] >> 4), data);
+		break;
+	case 0xd2:
+		/* ldc @rr1,r2 */
+		data = rd_reg(reg_r(op[1] >> 4));
+		wr_mem(rd_word(reg_r(op[1] & 0x0e)), &data, 1);
+		break;
+	case 0xc5:
+		/* ldc @r1,@rr2 */
+		rd_mem(rd_word(reg_r(op[1] & 0x0e)), &data, 1);
+		wr_reg(reg_IR(reg_r(op[1] >> 4)), data);
+		break;
+	case 0xe3:
+		/* ld r1,@r2 */
+		wr_reg(reg_r(op[1] >> 4), rd_reg(reg_IR(reg_r(op[1]))));
+		break;
+	case 0xf3:
+		/* ld @r1,r2 */
+		wr_reg(reg_IR(reg_r(op[1] >> 4)), rd_reg(reg_r(op[1])));
+		break;
+	case 0x84:
+		/* ldx r1,ER2 */
+		wr_reg(reg_r(op[1] >> 4),
+		    rd_reg(reg_ER((op[1] & 0x0f) << 8 | op[2])));
+		break;
+	case 0x94:
+		/* ldx ER1,r2 */
+		wr_reg(reg_ER((op[1] & 0x0f) << 8 | op[2]),
+		    rd_reg(reg_r(op[1] >> 4)));
+		break;
+	case 0x85:
+		/* ldx @r1,ER2 */
+		wr_reg(reg_IR(reg_r(op[1] >> 4)),
+		    rd_reg(reg_ER((op[1] & 0x0f) << 8 | op[2])));
+		break;
+	case 0x95:
+		/* ldx ER1,@r2 */
+		wr_reg(reg_ER((op[1] & 0x0f) << 8 | op[2]),
+		    rd_reg(reg_IR(reg_r(op[1] >> 4))));
+		break;
+	case 0x86:
+		/* ldx R1,@RR2 */
+		wr_reg(reg_R(op[2]),
+		    rd_reg(rd_word(reg_R(op[1] & 0xfe)) & 0xfff));
+		break;
+	case 0x96:
+		/* ldx @RR1,R2 */
+		wr_reg(rd_word(reg_R(op[2] & 0xfe)) & 0xfff,
+		    rd_reg(reg_R(op[1])));
+		break;
+	case 0x87:
+		/* ldx @R1,@RR2 */
+		wr_reg(reg_IR(reg_R(op[2])),
+		    rd_reg(rd_word(reg_R(op[1] & 0xfe)) & 0xfff));
+		break;
+	case 0x97:
+		/* ldx @RR1,@R2 */
+		wr_reg(rd_word(reg_R(op[2] & 0xfe)) & 0xfff,
+		    rd_reg(reg_IR(reg_R(op[1]))));
+		break;
+	case 0x88:
+		/* ldx r1,X(rr2) */
+		wr_reg(reg_r(op[1] >> 4), rd_reg((rd_word(reg_r(op[1] & 0x0e))
+		    + (int8_t)op[2]) & 0xfff));
+		break;
+	case 0x89:
+		/* ldx X(rr1),r2 */
+		wr_reg((rd_word(reg_r(op[1] >> 4 & 0x0e)) + (int8_t)op[2]) &
+		    0xfff, rd_reg(reg_r(op[1])));
+		break;
+	case 0x98:
+		/* lea r1,X(r2) */
+		wr_reg(reg_r(op[1] >> 4), rd_reg(reg_r(op[1])) + (int8_t)op[2]);
+		break;
+	case 0x99:
+		/* leax rr1,X(rr2) */
+		wr_word(reg_r(op[1] >> 4 & 0x0e),
+		    rd_word(reg_r(op[1] & 0x0e)) + (int8_t)op[2]);
+		break;
+	case 0xc7:
+		/* ld r1,X(r2) */
+		wr_reg(reg_r(op[1] >> 4), rd_reg((regs[EZ8_RP] & 0x0f) << 8 |
+		    ((rd_reg(reg_r(op[1])) + op[2]) & 0xff)));
+		break;
+	case 0xd7:
+		/* ld X(r1),r2 */
+		wr_reg((regs[EZ8_RP] & 0x0f) << 8 | ((rd_reg(reg_r(op[1])) +
+		    op[2]) & 0xff), rd_reg(reg_r(op[1] >> 4)));
+		break;
+	case 0xc8:
+		/* pushx */
+		push(rd_reg(reg_ER(op[1] << 4 | op[2] >> 4)));
+		break;
+	case 0xd8:
+		/* popx */
+		wr_reg(reg_ER(op[1] << 4 | op[2] >> 4), pop());
+		break;
+	case 0xe8:
+		/* ldx ER2,ER1 */
+		wr_reg(reg_ER((op[2] & 0x0f) << 8 | op[3]),
+		    rd_reg(reg_ER(op[1] << 4 | op[2] >> 4)));
+		break;
+	case 0xe9:
+		/* ldx IM,ER1 */
+		wr_reg(reg_ER((op[2] & 0x0f) << 8 | op[3]), op[1]);
+		break;
+	case 0xc4:
+	case 0xd4:
+		/* jp @rr1, call @rr1 */
+		word = rd_word(reg_R(op[1] & 0xfe));
+		if(op[0] == 0xd4) {
+			push(pc & 0xff);
+			push(pc >> 8);
+		}
+		pc = word;
+		break;
+	case 0xd6:
+		/* call DA */
+		push(pc & 0xff);
+		push(pc >> 8);
+		pc = op[1] << 8 | op[2];
+		break;
+	case 0xe2:
+		/* bset, bclr */
+		dst = reg_r(op[1]);
+		data = rd_reg(dst);
+		if(op[1] & 0x80) {
+			data |= 1 << (op[1] >> 4 & 0x07);
+		} else {
+			data &= ~(1 << (op[1] >> 4 & 0x07));
+		}
+		wr_reg(dst, data);
+		set_flags(FLAG_Z | FLAG_S | FLAG_V,
+		    (data ? 0 : FLAG_Z) | (data & 0x80 ? FLAG_S : 0));
+		break;
+	case 0xf6:
+	case 0xf7:
+		/* btj */
+		src = reg_r(op[1]);
+		if(lo == 0x7) {
+			src = reg_IR(src);
+		}
+		data = rd_reg(src) >> (op[1] >> 4 & 0x07) & 0x01;
+		if(data == op[1] >> 7) {
+			pc += (int8_t)op[2];
+		}
+		break;
+	case 0xe4:
+		/* ld R2,R1 */
+		wr_reg(reg_R(op[2]), rd_reg(reg_R(op[1])));
+		break;
+	case 0xe5:
+		/* ld IR2,R1 */
+		wr_reg(reg_R(op[2]), rd_reg(reg_IR(reg_R(op[1]))));
+		break;
+	case 0xf5:
+		/* ld R2,IR1 */
+		wr_reg(reg_IR(reg_R(op[2])), rd_reg(reg_R(op[1])));
+		break;
+	case 0xe6:
+		/* ld R1,#IM */
+		wr_reg(reg_R(op[1]), op[2]);
+		break;
+	case 0xe7:
+		/* ld @R1,#IM */
+		wr_reg(reg_IR(reg_R(op[1])), op[2]);
+		break;
+	case 0xf2:
+		/* trap */
+		push(pc & 0xff);
+		push(pc >> 8);
+		push(regs[EZ8_FLAGS]);
+		pc = flash[op[1] * 2] << 8 | flash[op[1] * 2 + 1];
+		break;
+	case 0xf4:
+		/* mult */
+		dst = reg_R(op[1] & 0xfe);
+		wr_word(dst, rd_reg(dst) * rd_reg((dst + 1) & 0xfff));
+		return 8;
+	case 0xd5:
+		/* bswap */
+		dst = reg_R(op[1]);
+		src = rd_reg(dst);
+		for(data=0, i=0; i<8; i++) {
+			data = data << 1 | (src >> i & 0x01);
+		}
+		wr_reg(dst, data);
+		set_flags(FLAG_Z | FLAG_S,
+		    (data ? 0 : FLAG_Z) | (data & 0x80 ? FLAG_S : 0));
+		break;
+	case 0x6f:
+	case 0x7f:
+		/* stop, halt */
+		if(!(dbgctl & DBGCTL_DBG_MODE)) {
+			halted = 1;
+		}
+		break;
+	case 0x8f:
+		/* di */
+		regs[EZ8_IRQCTL] &= ~EZ8_IRQE;
+		break;
+	case 0x9f:
+		/* ei */
+		regs[EZ8_IRQCTL] |= EZ8_IRQE;
+		break;
+	case 0xaf:
+		/* ret */
+		pc = pop() << 8;
+		pc |= pop();
+		return 4;
+	case 0xbf:
+		/* iret */
+		regs[EZ8_FLAGS] = pop();
+		pc = pop() << 8;
+		pc |= pop();
+		regs[EZ8_IRQCTL] |= EZ8_IRQE;
+		return 5;
+	case 0xcf:
+		/* rcf */
+		set_flags(FLAG_C, 0);
+		break;
+	case 0xdf:
+		/* scf */
+		set_flags(FLAG_C, FLAG_C);
+		break;
+	case 0xef:
+		/* ccf */
+		regs[EZ8_FLAGS] ^= FLAG_C;
+		break;
+	default:
+		/* nop, wdt */
+		break;
+	}
+
+	return sim_cycles(entry->am);
+}
+
+/**************************************************************/
+
@@ -24,6 +24,7 @@
 
 #include	"md5.h"
 #include	"sockstream.h"
+#include	"netproto.h"
 #include	"ocd_tcpip.h"
 
 #include	"err_msg.h"
@@ -48,8 +49,11 @@ ocd_tcpip::ocd_tcpip(void)
 	s = NULL;
 
 	version_major = version_minor = 0;
+	protocol = 1;
+	ops = 0;
 
 	buff = (char *)xmalloc(BUFSIZ);
+	frame = NULL;
 
 #ifdef	_WIN32
 	err = WSAStartup(MAKEWORD(2,1), &wsa);
@@ -74,7 +78,11 @@ ocd_tcpip::~ocd_tcpip(void)
 	int err;
 #endif
 	if(s) {
-		ss_printf(s, "CLOSE\r\n");
+		if(protocol == 2) {
+			ss_putframe(s, PROTO_CLOSE, NULL, 0);
+		} else {
+			ss_printf(s, "CLOSE\r\n");
+		}
 		ss_flush(s);
 		ss_close(s);
 		delete s;
@@ -85,6 +93,10 @@ ocd_tcpip::~ocd_tcpip(void)
 		free(buff);
 		buff = NULL;
 	}
+	if(frame) {
+		free(frame);
+		frame = NULL;
+	}
 
 #ifdef	_WIN32
 	err = WSACleanup();
@@ -252,7 +264,7 @@ void ocd_tcpip::validate_server(void)
 		throw err_msg;
 	}
 
-	if(version_major > 1) {
+	if(version_major > 2) {
 		snprintf(err_msg, err_len-1, "Check server version failed\n"
 		    "version %d.%02d unknown\n",
 		    version_major, version_minor);
@@ -506,11 +518,240 @@ void ocd_tcpip::auth_server(char *user)
 	return;
 }
 
+/**************************************************************
+ * This asks the server to make the connection read only, so
+ * it can watch the device while another client debugs it.
+ */
+
+void ocd_tcpip::request_monitor(void)
+{
+	int err;
+	char *ptr;
+
+	err = ss_printf(s, "MONITOR\r\n");
+	if(err >= 0) {
+		err = ss_flush(s);
+	}
+	if(err < 0) {
+		snprintf(err_msg, err_len-1,
+		    "Failed requesting monitor mode\n"
+		    "send:%s\n", strerror(errno));
+		throw err_msg;
+	}
+
+	/* eat CRLF until we get a response */
+	do {
+		ptr = ss_gets(buff, BUFSIZ, s);
+		if(!ptr) {
+			snprintf(err_msg, err_len-1,
+			    "Failed requesting monitor mode\n"
+			    "recv:%s\n", strerror(errno));
+			throw err_msg;
+		}
+		ptr = strchr(buff, '#');
+		if(ptr) {
+			*ptr = '\0';
+		}
+		ptr = strtok(buff, " \t\r\n");
+	} while(!ptr);
+
+	if(strcasecmp(ptr, "+OK")) {
+		strncpy(err_msg, "Failed requesting monitor mode\n"
+		    "not supported by server\n", err_len-1);
+		throw err_msg;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This picks the device to use on a server that fronts 
+ * several of them.
+ */
+
+void ocd_tcpip::request_target(const char *target)
+{
+	int err;
+	char *ptr, *reason;
+
+	err = ss_printf(s, "TARGET %s\r\n", target);
+	if(err >= 0) {
+		err = ss_flush(s);
+	}
+	if(err < 0) {
+		snprintf(err_msg, err_len-1,
+		    "Failed selecting target %s\n"
+		    "send:%s\n", target, strerror(errno));
+		throw err_msg;
+	}
+
+	/* eat CRLF until we get a response */
+	do {
+		ptr = ss_gets(buff, BUFSIZ, s);
+		if(!ptr) {
+			snprintf(err_msg, err_len-1,
+			    "Failed selecting target %s\n"
+			    "recv:%s\n", target, strerror(errno));
+			throw err_msg;
+		}
+		reason = strchr(buff, '#');
+		if(reason) {
+			*reason++ = '\0';
+			reason = strtok(reason, "\r\n");
+		}
+		ptr = strtok(buff, " \t\r\n");
+	} while(!ptr);
+
+	if(strcasecmp(ptr, "+OK")) {
+		snprintf(err_msg, err_len-1, 
+		    "Failed selecting target %s\n%s\n", target, 
+		    reason ? reason : "refused by server");
+		throw err_msg;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This will switch to the binary (version 2) protocol if the
+ * server has it. Servers from version 1.01 answer the VERSION
+ * request; older ones stay with the text protocol.
+ */
+
+void ocd_tcpip::negotiate(void)
+{
+	int err;
+	char *ptr;
+
+	if(version_major == 1 && version_minor < 1) {
+		return;
+	}
+
+	err = ss_printf(s, "VERSION 2.00\r\n");
+	if(err < 0) {
+		snprintf(err_msg, err_len-1,
+		    "Failed negotiating protocol version\n"
+		    "send:%s\n", strerror(errno));
+		throw err_msg;
+	}
+	err = ss_flush(s);
+	if(err < 0) {
+		snprintf(err_msg, err_len-1,
+		    "Failed negotiating protocol version\n"
+		    "send:%s\n", strerror(errno));
+		throw err_msg;
+	}
+
+	/* eat CRLF until we get a response */
+	do {
+		ptr = ss_gets(buff, BUFSIZ, s);
+		if(!ptr) {
+			snprintf(err_msg, err_len-1,
+			    "Failed negotiating protocol version\n"
+			    "recv:%s\n", strerror(errno));
+			throw err_msg;
+		}
+		ptr = strchr(buff, '#');
+		if(ptr) {
+			*ptr = '\0';
+		}
+		ptr = strtok(buff, " \t\r\n");
+	} while(!ptr);
+
+	/* refused, keep the text protocol */
+	if(strcasecmp(ptr, "+OK")) {
+		return;
+	}
+	ptr = strtok(NULL, " \t\r\n");
+	if(!ptr || strcasecmp(ptr, "Z8ENCOREOCD")) {
+		strncpy(err_msg, "Failed negotiating protocol version\n"
+		    "protocol error\n", err_len-1);
+		throw err_msg;
+	}
+	ptr = strtok(NULL, " \t\r\n");
+	if(!ptr) {
+		strncpy(err_msg, "Failed negotiating protocol version\n"
+		    "protocol error\n", err_len-1);
+		throw err_msg;
+	}
+	if(strtol(ptr, NULL, 10) != 2) {
+		return;
+	}
+	protocol = 2;
+
+	/* find out if the server runs debugger operations */
+	ops = exchange(PROTO_OPS, NULL, 0, NULL, NULL);
+
+	return;
+}
+
+/**************************************************************
+ * This sends a version 2 request frame and reads the reply.
+ * A successful reply's data is stored in *in, which holds up
+ * to *size bytes, and *size is set to its length. An error 
+ * reply's text is left in buff.
+ *
+ * This function returns 1 if the server replied +OK, 0 if it
+ * replied -ERR.
+ */
+
+bool ocd_tcpip::exchange(int type, const void *out, size_t outsize,
+    void *in, size_t *size)
+{
+	int err, reply;
+	ssize_t len;
+
+	err = ss_putframe(s, type, out, outsize);
+	if(!err) {
+		err = ss_flush(s);
+	}
+	if(err) {
+		open = 0;
+		snprintf(err_msg, err_len-1, 
+		    "Failed communicating with server\n"
+		    "send:%s\n", strerror(errno));
+		throw err_msg;
+	}
+
+	len = ss_getframe(s, &reply);
+	if(len < 0) {
+		open = 0;
+		snprintf(err_msg, err_len-1,
+		    "Failed communicating with server\n"
+		    "recv:%s\n", strerror(errno));
+		throw err_msg;
+	}
+
+	if(reply == PROTO_OK && (!size ? len == 0 : (size_t)len <= *size)) {
+		err = ss_read(s, in, len);
+		if(size) {
+			*size = len;
+		}
+	} else if(reply == PROTO_ERR && len < BUFSIZ) {
+		err = ss_read(s, buff, len);
+		buff[len] = '\0';
+	} else {
+		open = 0;
+		strncpy(err_msg, "Failed communicating with server\n"
+		    "protocol error: invalid response\n", err_len-1);
+		throw err_msg;
+	}
+	if(err) {
+		open = 0;
+		snprintf(err_msg, err_len-1,
+		    "Failed communicating with server\n"
+		    "recv:%s\n", strerror(errno));
+		throw err_msg;
+	}
+
+	return reply == PROTO_OK;
+}
+
 /**************************************************************/
 
-void ocd_tcpip::connect(const char *device)
+void ocd_tcpip::connect(const char *device, bool monitor)
 {
-	char *ptr, *userpasswd, *host;
+	char *ptr, *userpasswd, *host, *target;
 
 	if(s) {
 		strncpy(err_msg, "Failed connecting to server\n"
@@ -530,9 +771,14 @@ void ocd_tcpip::connect(const char *device)
 			host = ptr;
 			userpasswd = NULL;
 		}
+		target = strchr(host, '/');
+		if(target) {
+			*target++ = '\0';
+		}
 	} else {
 		userpasswd = NULL;
 		host = NULL;
+		target = NULL;
 	}
 
 	s = (SOCK *)xmalloc(sizeof(SOCK));
@@ -542,6 +788,13 @@ void ocd_tcpip::connect(const char *device)
 		try {
 			validate_server();
 			auth_server(userpasswd);
+			if(monitor) {
+				request_monitor();
+			}
+			if(target && *target != '\0') {
+				request_target(target);
+			}
+			negotiate();
 		} catch(char *err) {
 			ss_close(s);
 			throw err;
@@ -585,6 +838,17 @@ void ocd_tcpip::reset(void)
 
 	up = 0;
 
+	if(protocol == 2) {
+		if(!exchange(PROTO_RESET, NULL, 0, NULL, NULL)) {
+			strncpy(err_msg, 
+			    "Failed resetting on-chip debugger link\n"
+			    "remote link failure\n", err_len-1);
+			throw err_msg;
+		}
+		up = 1;
+		return;
+	}
+
 	err = ss_printf(s, "RESET\r\n");
 	if(err < 0) {
 		open = 0;
@@ -663,6 +927,8 @@ bool ocd_tcpip::link_up(void)
 {
 	int err;
 	char *ptr;
+	uint8_t status;
+	size_t size;
 
 	if(!s) {
 		strncpy(err_msg, "Could not determine link status\n"
@@ -675,6 +941,20 @@ bool ocd_tcpip::link_up(void)
 		throw err_msg;
 	}
 
+	if(protocol == 2) {
+		size = 1;
+		if(!exchange(PROTO_STATUS, NULL, 0, &status, &size) || 
+		    size != 1) {
+			open = 0; 
+			strncpy(err_msg, "Failed communicating with server\n"
+			    "protocol error: failed retrieving status\n", 
+			    err_len-1);
+			throw err_msg;
+		}
+		up = status == PROTO_UP;
+		return up;
+	}
+
 	err = ss_printf(s, "STATUS\r\n");
 	if(err < 0) {
 		open = 0;
@@ -760,6 +1040,8 @@ void ocd_tcpip::read(uint8_t *data, size_t size)
 {
 	int err;
 	char *ptr, *tail;
+	uint8_t request[4];
+	size_t len;
 
 	assert(data != NULL);
 	assert(size != 0);
@@ -780,6 +1062,28 @@ void ocd_tcpip::read(uint8_t *data, size_t size)
 		throw err_msg;
 	}
 
+	if(protocol == 2) {
+		request[0] = size >> 24;
+		request[1] = size >> 16;
+		request[2] = size >> 8;
+		request[3] = size;
+		len = size;
+		if(!exchange(PROTO_READ, request, 4, data, &len)) {
+			up = 0;
+			strncpy(err_msg, "Failed reading from on-chip debugger\n"
+			    "remote link failure\n", err_len-1);
+			throw err_msg;
+		}
+		if(len != size) {
+			open = 0;
+			strncpy(err_msg, "Failed communicating with server\n"
+			    "protocol error: returned size incorrect\n", 
+			    err_len-1);
+			throw err_msg;
+		}
+		return;
+	}
+
 	err = ss_printf(s, "READ 0x%04X\r\n", size);
 	if(err < 0) {
 		open = 0;
@@ -896,6 +1200,22 @@ void ocd_tcpip::write(const uint8_t *data, size_t size)
 		throw err_msg;
 	}
 
+	if(protocol == 2) {
+		if(!exchange(PROTO_WRITE, data, size, NULL, NULL)) {
+			if(!strcmp(buff, PROTO_READONLY)) {
+				strncpy(err_msg, 
+				    "Failed writing to on-chip debugger\n"
+				    "connection is read only\n", err_len-1);
+				throw err_msg;
+			}
+			up = 0;
+			strncpy(err_msg, "Failed writing to on-chip debugger\n"
+			    "remote link failure\n", err_len-1);
+			throw err_msg;
+		}
+		return;
+	}
+
 	err = ss_printf(s, "WRITE ");
 	if(err < 0) {
 		open = 0;
@@ -1005,6 +1325,109 @@ void ocd_tcpip::write(const uint8_t *data, size_t size)
 
 }
 
+/**************************************************************
+ * This will write a command and read its reply in one round
+ * trip to the server, with the version 2 TRANSACT request.
+ */
+
+void ocd_tcpip::transact(const uint8_t *out, size_t outsize, 
+    uint8_t *in, size_t insize)
+{
+	size_t len;
+
+	if(protocol < 2 || outsize + 4 > PROTO_MAXFRAME || 
+	    insize > PROTO_MAXDATA) {
+		write(out, outsize);
+		read(in, insize);
+		return;
+	}
+
+	if(!s || !open || !up) {
+		/* let read report why it cannot */
+		read(in, insize);
+		return;
+	}
+
+	if(!frame) {
+		frame = (uint8_t *)xmalloc(PROTO_MAXFRAME);
+	}
+	frame[0] = insize >> 24;
+	frame[1] = insize >> 16;
+	frame[2] = insize >> 8;
+	frame[3] = insize;
+	memcpy(frame + 4, out, outsize);
+
+	len = insize;
+	if(!exchange(PROTO_TRANSACT, frame, outsize + 4, in, &len)) {
+		if(!strcmp(buff, PROTO_READONLY)) {
+			strncpy(err_msg, "Failed writing to on-chip debugger\n"
+			    "connection is read only\n", err_len-1);
+			throw err_msg;
+		}
+		up = 0;
+		strncpy(err_msg, "Failed reading from on-chip debugger\n"
+		    "remote link failure\n", err_len-1);
+		throw err_msg;
+	}
+	if(len != insize) {
+		open = 0;
+		strncpy(err_msg, "Failed communicating with server\n"
+		    "protocol error: returned size incorrect\n", err_len-1);
+		throw err_msg;
+	}
+
+	return;
+}
+
+/**************************************************************
+ * Version 2 servers take a command and its reply in one
+ * TRANSACT request.
+ */
+
+bool ocd_tcpip::combined(void)
+{
+	return protocol == 2;
+}
+
+/**************************************************************
+ * This runs a debugger operation on the server, in one
+ * request, when remote_ops() is true. The server's error 
+ * message is thrown if the operation fails. The requests
+ * themselves are built by ez8ocd, which logs, captures and
+ * counts them like any link transfer.
+ */
+
+bool ocd_tcpip::remote_ops(void)
+{
+	return ops;
+}
+
+void ocd_tcpip::remote_op(int type, const uint8_t *out, size_t outsize, 
+    uint8_t *in, size_t insize)
+{
+	size_t len;
+
+	if(!s || !open || !ops) {
+		strncpy(err_msg, "Could not run debugger operation\n"
+		    "not available on server\n", err_len-1);
+		throw err_msg;
+	}
+
+	len = insize;
+	if(!exchange(type, out, outsize, in, insize ? &len : NULL)) {
+		strncpy(err_msg, buff, err_len-1);
+		throw err_msg;
+	}
+	if(len != insize) {
+		open = 0;
+		strncpy(err_msg, "Failed communicating with server\n"
+		    "protocol error: returned size incorrect\n", err_len-1);
+		throw err_msg;
+	}
+
+	return;
+}
+
 /**************************************************************/
 
 int ocd_tcpip::link_speed(void)
@@ -23,7 +23,10 @@ private:
 	SOCK *s;
 	bool open, up;
 	int version_major, version_minor;
+	int protocol;
+	bool ops;
 	char *buff;
+	uint8_t *frame;
 
 	/* Prohibit use of copy constructor */
 	ocd_tcpip(ocd_tcpip &);	
@@ -31,12 +34,16 @@ private:
 	void connect_server(char *);
 	void validate_server(void);
 	void auth_server(char *);
+	void request_monitor(void);
+	void request_target(const char *);
+	void negotiate(void);
+	bool exchange(int, const void *, size_t, void *, size_t *);
 
 public:
 	ocd_tcpip();
 	~ocd_tcpip();
 
-	void connect(const char *);
+	void connect(const char *, bool = 0);
 	void reset(void);
 
 	bool link_open(void);
@@ -50,6 +57,12 @@ public:
 
 	void read(uint8_t *, size_t);
 	void write(const uint8_t *, size_t);
+	void transact(const uint8_t *, size_t, uint8_t *, size_t);
+	bool combined(void);
+
+	/* debugger operations run by the server */
+	bool remote_ops(void);
+	void remote_op(int, const uint8_t *, size_t, uint8_t *, size_t);
 };
 
 /**************************************************************/
@@ -20,12 +20,15 @@
 
 #ifndef	_WIN32
 #include	<termios.h>
+#include	<poll.h>
 #else	/* _WIN32 */
 #include	"winunistd.h"
 #endif	/* _WIN32 */
 
 #include	"serialport.h"
+#include	"baudrate.h"
 #include	"err_msg.h"
+#include	"timer.h"
 
 /**************************************************************/
 
@@ -95,6 +98,39 @@ extern "C" const struct baudvalue baudrates[] = {
 #ifdef	B460800
 	{ 460800, B460800 },
 #endif	/* B460800 */
+#ifdef	B500000
+	{ 500000, B500000 },
+#endif	/* B500000 */
+#ifdef	B576000
+	{ 576000, B576000 },
+#endif	/* B576000 */
+#ifdef	B921600
+	{ 921600, B921600 },
+#endif	/* B921600 */
+#ifdef	B1000000
+	{ 1000000, B1000000 },
+#endif	/* B1000000 */
+#ifdef	B1152000
+	{ 1152000, B1152000 },
+#endif	/* B1152000 */
+#ifdef	B1500000
+	{ 1500000, B1500000 },
+#endif	/* B1500000 */
+#ifdef	B2000000
+	{ 2000000, B2000000 },
+#endif	/* B2000000 */
+#ifdef	B2500000
+	{ 2500000, B2500000 },
+#endif	/* B2500000 */
+#ifdef	B3000000
+	{ 3000000, B3000000 },
+#endif	/* B3000000 */
+#ifdef	B3500000
+	{ 3500000, B3500000 },
+#endif	/* B3500000 */
+#ifdef	B4000000
+	{ 4000000, B4000000 },
+#endif	/* B4000000 */
 
 #else	/* _WIN32 */
 	{ 110, CBR_110 },
@@ -186,8 +222,8 @@ serialport::serialport()
 	flowcontrol = 0;
 	timeout = 0;
 
-	memset(rxbuff, 0, sizeof(rxbuff));
-	len = 0;
+	rxhead = rxtail = 0;
+	rxerror = 0;
 
 	return;
 }
@@ -199,6 +235,8 @@ serialport::serialport()
 	parity = none;
 	stopbits = one;
 	flowcontrol = 0;
+	timeout = 0;
+	rxtimeout = -1;
 
 	return;
 }
@@ -293,6 +331,15 @@ void serialport::open(const char *device)
 		throw err_msg;
 	}
 
+	/* reads and writes are bounded by poll(), not by VTIME */
+	if(fcntl(fdes, F_SETFL, fcntl(fdes, F_GETFL) | O_NONBLOCK) < 0) {
+		close();
+		snprintf(err_msg, err_len-1,
+		    "Could not open serial port\n"
+		    "fcntl:%s\n", strerror(errno));
+		throw err_msg;
+	}
+
 	return;
 }
 #else	/* _WIN32 */
@@ -404,11 +451,16 @@ void serialport::configure(void)
 
 	assert(isatty(fdes));
 
+	/* rates without a Bxxx define are set after the rest of
+	 * the configuration, if the system supports it */
 	bauddefine = baud2def(baudrate);
 	if(bauddefine <= 0) {
-		strncpy(err_msg, "Configure serial port failed\n"
-			    "invalid baudrate\n", err_len-1);
-		throw err_msg;
+		if(baudrate <= 0) {
+			strncpy(err_msg, "Configure serial port failed\n"
+				    "invalid baudrate\n", err_len-1);
+			throw err_msg;
+		}
+		bauddefine = B38400;
 	}
 
 	err = tcgetattr(fdes, &cfg);
@@ -543,8 +595,9 @@ void serialport::configure(void)
 		#endif
 	}
 
-	/* Round timeout up to nearest 100ms */
-	cfg.c_cc[VTIME] = timeout / 100 + (timeout % 100 ? 1 : 0);
+	/* Timeouts are per-call deadlines enforced in read(), so
+	 * the termios settings do not change with the timeout. */
+	cfg.c_cc[VTIME] = 0;
 	cfg.c_cc[VMIN] = 0;
 
 	err = tcsetattr(fdes, TCSADRAIN, &cfg);
@@ -554,13 +607,26 @@ void serialport::configure(void)
 		throw err_msg;
 	}
 
+	if(baud2def(baudrate) <= 0) {
+		err = set_custom_baudrate(fdes, baudrate);
+		if(err && errno == ENOSYS) {
+			strncpy(err_msg, "Configure serial port failed\n"
+			    "invalid baudrate\n", err_len-1);
+			throw err_msg;
+		} else if(err) {
+			snprintf(err_msg, err_len-1, 
+			    "Configure serial port failed\n"
+			    "set_custom_baudrate:%s\n", strerror(errno));
+			throw err_msg;
+		}
+	}
+
 	return;
 }
 #else	/* _WIN32 */
 {
 	int err;
 	DCB cfg;
-	COMMTIMEOUTS cto;
 	int bauddefine;
 
 	if(fdes == INVALID_HANDLE_VALUE) {
@@ -583,8 +649,13 @@ void serialport::configure(void)
 		throw err_msg;
 	}
 
+	/* the CBR_xxx defines are the rates themselves, so any
+	 * other rate is passed straight to the driver */
 	bauddefine = baud2def(baudrate);
 	if(bauddefine < 0) {
+		bauddefine = baudrate;
+	}
+	if(bauddefine <= 0) {
 		strncpy(err_msg, "Configure serial port failed\n"
 		    "invalid baudrate\n", err_len-1);
 		throw err_msg;
@@ -691,39 +762,7 @@ void serialport::configure(void)
 		throw err_msg;
 	}
 
-	err = !GetCommTimeouts(fdes, &cto);
-	if(err) {
-		char *s;
-		size_t n;
-
-		strncpy(err_msg, "Configure serial port failed\n"
-		    "GetCommTimeouts:", err_len-1);
-		s = strchr(err_msg, '\0');
-		n = err_len - (err_msg - s) - 1;
-		winerr(s, n);
-		strncat(err_msg, "\n", err_len-1);
-		throw err_msg;
-	}
-
-	cto.ReadIntervalTimeout = timeout ? timeout : MAXDWORD;
-	cto.ReadTotalTimeoutMultiplier = timeout ? 2*1000*10/baudrate + 1 : 0;
-	cto.ReadTotalTimeoutConstant = timeout;
-	cto.WriteTotalTimeoutMultiplier = 0;
-	cto.WriteTotalTimeoutConstant = 0;
-
-	err = !SetCommTimeouts(fdes, &cto);
-	if(err) {
-		char *s;
-		size_t n;
-
-		strncpy(err_msg, "Configure serial port failed\n"
-		    "SetCommTimeouts:", err_len-1);
-		s = strchr(err_msg, '\0');
-		n = err_len - (err_msg - s) - 1;
-		winerr(s, n);
-		strncat(err_msg, "\n", err_len-1);
-		throw err_msg;
-	}	
+	settimeouts(timeout);
 
 	return;
 }
@@ -766,6 +805,9 @@ void serialport::loadconfig(void)
 
 	baudrate = def2baud(baud);
 	if(baudrate < 0) {
+		baudrate = get_custom_baudrate(fdes);
+	}
+	if(baudrate <= 0) {
 		strncpy(err_msg, "Get serial port configuration failed\n"
 		    "unknown baudrate\n", err_len-1);
 		throw err_msg;
@@ -851,8 +893,6 @@ void serialport::loadconfig(void)
 	}
 	#endif
 
-	timeout = cfg.c_cc[VTIME] * 100;
-
 	return;
 }
 #else	/* _WIN32 */
@@ -978,6 +1018,58 @@ void serialport::loadconfig(void)
 
 	timeout = cto.ReadIntervalTimeout == MAXDWORD ? 
 	    0 : cto.ReadIntervalTimeout;
+	rxtimeout = timeout;
+
+	return;
+}
+#endif	/* _WIN32 */
+
+/**************************************************************
+ * This applies a read timeout (in milliseconds) to the port
+ * without reconfiguring it.
+ */
+
+#ifdef	_WIN32
+void serialport::settimeouts(int ms)
+{
+	int err;
+	COMMTIMEOUTS cto;
+
+	err = !GetCommTimeouts(fdes, &cto);
+	if(err) {
+		char *s;
+		size_t n;
+
+		strncpy(err_msg, "Configure serial port failed\n"
+		    "GetCommTimeouts:", err_len-1);
+		s = strchr(err_msg, '\0');
+		n = err_len - (err_msg - s) - 1;
+		winerr(s, n);
+		strncat(err_msg, "\n", err_len-1);
+		throw err_msg;
+	}
+
+	cto.ReadIntervalTimeout = ms ? ms : MAXDWORD;
+	cto.ReadTotalTimeoutMultiplier = ms ? 2*1000*10/baudrate + 1 : 0;
+	cto.ReadTotalTimeoutConstant = ms;
+	cto.WriteTotalTimeoutMultiplier = 0;
+	cto.WriteTotalTimeoutConstant = 0;
+
+	err = !SetCommTimeouts(fdes, &cto);
+	if(err) {
+		char *s;
+		size_t n;
+
+		strncpy(err_msg, "Configure serial port failed\n"
+		    "SetCommTimeouts:", err_len-1);
+		s = strchr(err_msg, '\0');
+		n = err_len - (err_msg - s) - 1;
+		winerr(s, n);
+		strncat(err_msg, "\n", err_len-1);
+		throw err_msg;
+	}	
+
+	rxtimeout = ms;
 
 	return;
 }
@@ -1039,45 +1131,55 @@ void serialport::seterror(char *s, size_t n)
 #endif	/* _WIN32 */
 
 /**************************************************************
- * This function will return true if there is data available
- * to be read from the serial port.
+ * This will wait up to the given number of milliseconds for 
+ * the serial port to become ready. A negative timeout waits
+ * indefinitely. Returns true if the port is ready.
  */
 
-bool serialport::available(void)
 #ifndef	_WIN32
+bool serialport::wait(short events, int ms)
 {
 	int ready;
-	fd_set rd_fdes;
-	struct timeval t;
+	struct pollfd pfd;
 
-	if(fdes < 0) {
-		strncpy(err_msg, "Read serial port failed\n"
-		    "serial port not open\n", err_len-1);
-		throw err_msg;
-	}
-
-	FD_ZERO(&rd_fdes);
-	FD_SET(fdes, &rd_fdes);
-
-	t.tv_sec = 0;
-	t.tv_usec = 0;
+	pfd.fd = fdes;
+	pfd.events = events;
+	pfd.revents = 0;
 
 	do {
-		ready = select(FD_SETSIZE, &rd_fdes, NULL, NULL, &t);
+		ready = poll(&pfd, 1, ms);
 	} while(ready < 0 && errno == EINTR);
 
 	if(ready < 0) {
 		snprintf(err_msg, err_len-1,
-		    "Read serial port failed\n"
-		    "select:%s\n", strerror(errno));
+		    "Serial port poll failed\n"
+		    "poll:%s\n", strerror(errno));
 		throw err_msg;
 	}
 
-	if(!ready) {
-		return 0;
+	return ready > 0;
+}
+#endif	/* _WIN32 */
+
+/**************************************************************
+ * This function will return true if there is data available
+ * to be read from the serial port.
+ */
+
+bool serialport::available(void)
+#ifndef	_WIN32
+{
+	if(fdes < 0) {
+		strncpy(err_msg, "Read serial port failed\n"
+		    "serial port not open\n", err_len-1);
+		throw err_msg;
 	}
 
-	return 1;
+	if(rxhead < rxtail) {
+		return 1;
+	}
+
+	return wait(POLLIN, 0);
 }
 #else	/* _WIN32 */
 {
@@ -1100,15 +1202,26 @@ bool serialport::available(void)
 }
 #endif
 
+/**************************************************************
+ * This will read data from the serial port using the default
+ * timeout.
+ */
+
+int serialport::read(void *buff, size_t size)
+{
+	return read(buff, size, timeout);
+}
+
 /**************************************************************
  * This will read data from the serial port. It returns the
  * number of bytes actually read.
  *
  * The number of bytes read may be less than the number
- * of bytes requested. This happens when the timeout occurs.
+ * of bytes requested. This happens when the timeout (in
+ * milliseconds, measured from the start of the call) expires.
  */
 
-int serialport::read(void *buff, size_t size)
+int serialport::read(void *buff, size_t size, int ms)
 #ifndef	_WIN32
 
 /* Quick rundown of the unix tty driver api 
@@ -1126,7 +1239,7 @@ int serialport::read(void *buff, size_t size)
 {
 	size_t bytes_read = 0;
 	unsigned char *dst = (unsigned char *)buff;
-	enum { s_normal, s_escape, s_error } state = s_normal;
+	uint64_t deadline;
 
 	if(fdes < 0) {
 		strncpy(err_msg, "Read serial port failed\n"
@@ -1134,98 +1247,52 @@ int serialport::read(void *buff, size_t size)
 		throw err_msg;
 	}	
 
+	deadline = timernow() + (uint64_t)ms * 1000;
+
 	while(size > 0) {
-		unsigned char *src;
-		int count;
-
-		if(!len) {
-			/* read data from serial port */
-			do {
-				count = ::read(fdes, dst, size);
-			} while(count < 0 && errno == EINTR);
-		} else {
-			/* if data in read-ahead buffer */
-			count = 1;
-			*dst = *rxbuff;
-			rxbuff[0] = rxbuff[1];
-			rxbuff[1] = rxbuff[2];
-			rxbuff[2] = rxbuff[3];
-			len--;
-		}
+		unsigned char *src, *esc;
+		size_t avail, count;
 
-		if(!count) {
-			switch(state) {
-			case s_normal:
-				/* timeout reading data */
-				return bytes_read;
-			case s_escape:
-			case s_error:
-				fprintf(stderr, "Bug in tty driver\n"
-				    "read timeout during escape\n");
-			default:
-				abort();
-			}
+		src = rxbuff + rxhead;
+		avail = rxtail - rxhead;
+
+		/* copy clean data up to the next escape in one block */
+		count = avail < size ? avail : size;
+		esc = (unsigned char *)memchr(src, 0xff, count);
+		if(esc) {
+			count = esc - src;
+		}
+		if(count) {
+			memcpy(dst, src, count);
+			dst += count;
+			bytes_read += count;
+			size -= count;
+			rxhead += count;
+			continue;
 		}
 
-		/* error reading data */
-		if(count < 0) {
-			switch(state) {
-			case s_normal:
-				snprintf(err_msg, err_len-1,
-				    "Read serial port failed\n"
-				    "read:%s\n", strerror(errno));
-				throw err_msg;
-			case s_escape:
-			case s_error:
+		/* decode an escape sequence once it is complete */
+		if(avail >= 2 && src[0] == 0xff) {
+			if(src[1] == 0xff) {
+				/* escaped character 0xff */
+				*dst++ = 0xff;
+				bytes_read++;
+				size--;
+				rxhead += 2;
+				continue;
+			} else if(src[1]) {
 				fprintf(stderr, "Bug in tty driver\n"
-				    "read error during escape\n");
-			default:
+				    "invalid escaped character\n");
 				abort();
-			}
-		}
-
-		assert(count <= (int)size);
-
-		for(src=dst; count>0; count--, src++) {
-			switch(state) {
-			case s_normal:
-				if(*src == 0xff) {
-					/* If an escape character
-					 * goto escape state */
-					state = s_escape;
-				} else {
-					/* If a normal character, 
-					 * copy and continue */
-					*dst++ = *src;
-					bytes_read++;
-					size--;
-				}
-				break;
-			case s_escape:
-				if(*src == 0xff) {
-					/* If an escaped character 0xff, 
-					 * add to data stream */
-					*dst++ = *src;
-					bytes_read++;
-					size--;
-					state = s_normal;
-				} else if(!*src) {
-					/* if parity, framing, or break,
-					 * goto error state */
-					state = s_error;
-				} else {
-					fprintf(stderr, "Bug in tty driver\n"
-					    "invalid escaped character\n");
-					abort();
-				}
-				break;
-			case s_error:
-				if(*src) {
+			} else if(avail >= 3) {
+				/* parity, framing, or break */
+				rxhead += 3;
+				rxerror = 1;
+				if(src[2]) {
 					strncpy(err_msg,
 					    "Serial port read failed\n"
 					    "framing error detected\n", 
 					    err_len-1);
-
 				} else {
 					strncpy(err_msg, 
 					    "Serial port read failed\n"
@@ -1233,8 +1300,23 @@ int serialport::read(void *buff, size_t size)
 					    err_len-1);
 				}
 				throw err_msg;
-			default:
-				abort();
+			}
+		}
+
+		/* need more data from the serial port */
+		while(!fill(0)) {
+			uint64_t now;
+
+			now = timernow();
+			if(now >= deadline || 
+			    !wait(POLLIN, (deadline - now + 999) / 1000)) {
+				if(rxhead < rxtail) {
+					fprintf(stderr, "Bug in tty driver\n"
+					    "read timeout during escape\n");
+					abort();
+				}
+				/* timeout reading data */
+				return bytes_read;
 			}
 		}
 	}
@@ -1254,6 +1336,11 @@ int serialport::read(void *buff, size_t size)
 
 	assert(buff != NULL);
 
+	/* the deadline is the comm timeout; timeout stays the default */
+	if(ms != rxtimeout) {
+		settimeouts(ms);
+	}
+
 	err = !ReadFile(fdes, buff, size, &bytes_read, NULL);
 	if(err) {
 		char *s;
@@ -1297,6 +1384,12 @@ void serialport::write(const void *buff, size_t size)
 			bytes_written = ::write(fdes, buff, size);
 		} while(bytes_written < 0 && errno == EINTR);
 
+		/* transmit buffer full, wait for room */
+		if(bytes_written < 0 && errno == EAGAIN) {
+			wait(POLLOUT, -1);
+			bytes_written = 0;
+		}
+
 		if(bytes_written > 0) {
 			assert((size_t)bytes_written <= size);
 			size -= bytes_written;
@@ -1445,7 +1538,8 @@ void serialport::flush(void)
 		throw err_msg;
 	}
 
-	len = 0;
+	rxhead = rxtail = 0;
+	rxerror = 0;
 	err = tcflush(fdes, TCIOFLUSH);
 	if(err) {
 		snprintf(err_msg, err_len-1, "Serial port flush failed\n"
@@ -1488,14 +1582,34 @@ void serialport::flush(void)
 
 /**************************************************************/
 
+/**************************************************************
+ * This will move whatever the serial port has received into
+ * the read-ahead buffer, waiting up to the given number of 
+ * milliseconds for it. Returns the number of bytes added.
+ */
+
 #ifndef	_WIN32
-void serialport::read_byte(unsigned char *ptr)
+size_t serialport::fill(int ms)
 {
-	int count;
+	ssize_t count;
+
+	/* keep any partial escape sequence at the front */
+	if(rxhead) {
+		memmove(rxbuff, rxbuff + rxhead, rxtail - rxhead);
+		rxtail -= rxhead;
+		rxhead = 0;
+	}
 
-	/* read data from serial port */
 	do {
-		count = ::read(fdes, ptr, 1);
+		count = ::read(fdes, rxbuff + rxtail, 
+		    sizeof(rxbuff) - rxtail);
+		if(!count || (count < 0 && errno == EAGAIN)) {
+			if(!ms || !wait(POLLIN, ms)) {
+				return 0;
+			}
+			count = -1;
+			errno = EINTR;
+		}
 	} while(count < 0 && errno == EINTR);
 
 	if(count < 0) {
@@ -1503,32 +1617,25 @@ void serialport::read_byte(unsigned char *ptr)
 		    "read:%s\n", strerror(errno));
 		throw err_msg;
 	}
-	if(!count) {
-		snprintf(err_msg, err_len-1, "Read serial port failed\n"
-		    "read: timeout\n");
-		throw err_msg;
-	}
-	len += count;
-	return;
+
+	rxtail += count;
+
+	return count;
 }
-#endif
+#endif	/* _WIN32 */
+
+/**************************************************************
+ * This will return true if a break, framing or parity error
+ * has been received since the last flush.
+ *
+ * Errors are picked up by read() as it decodes the receive
+ * stream, so this does not touch the serial port.
+ */
 
 bool serialport::error(void)
 #ifndef	_WIN32
 {
-	if(!available()) {
-		return 0;
-	}
-	read_byte(&rxbuff[0]);
-	if(rxbuff[0] != 0xff) {
-		return 0;
-	}
-	read_byte(&rxbuff[1]);
-	if(rxbuff[1] != 0x00) {
-		return 0;
-	}
-	read_byte(&rxbuff[2]);
-	return 1;
+	return rxerror;
 }
 #else	/* _WIN32 */
 {
@@ -21,6 +21,9 @@
 #define	SERIAL_RTS_INPUT	0x0004
 #define	SERIAL_CTS_OUTPUT	0x0008
 
+/* size of the unix receive read-ahead buffer */
+#define	SERIAL_RXBUFSIZ		4096
+
 
 struct baudvalue {
 	int value;
@@ -41,13 +44,17 @@ private:
 
 	#ifndef	_WIN32
 	void setflock(void);
-	void read_byte(unsigned char *);
-	unsigned char rxbuff[4];
-	size_t len;
+	bool wait(short, int);
+	size_t fill(int);
+	unsigned char rxbuff[SERIAL_RXBUFSIZ];
+	size_t rxhead, rxtail;
+	bool rxerror;
 	#endif	/* _WIN32 */
 
 	#ifdef	_WIN32	
 	void seterror(char *, size_t n);
+	void settimeouts(int);
+	int rxtimeout;
 	#endif	/* _WIN32 */
 
 protected:
@@ -70,6 +77,7 @@ public:
 	void open(const char *);
 	void close(void);
 	int  read(void *, size_t);
+	int  read(void *, size_t, int);
 	void write(const void *, size_t);
 
 	void sendbreak(void);
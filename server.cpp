@@ -4,6 +4,19 @@
  *
  * This is the ocd tcp/ip server. It allows clients to connect
  * remotely and communicate directly with the ez8 ocd link layer.
+ *
+ * Several clients may be connected at once. The server waits
+ * for requests from all of them, and runs one at a time on the
+ * link. Short interactive requests go ahead of bulk reads and
+ * programming, so a debug session stays responsive while 
+ * another client loads a file. A client that writes to the 
+ * link keeps it until it reads the reply, so another client's
+ * command does not get between a command and its reply.
+ *
+ * One server may front several devices, such as the boards of
+ * a rack. Each is a target with its own link, opened the 
+ * first time a client picks it, and its own link hold. 
+ * Clients that do not pick a target use the server's own link.
  */
 
 #include	<string.h>
@@ -11,6 +24,7 @@
 #include	<stdio.h>
 #include	<unistd.h>
 #include	<errno.h>
+#include	<signal.h>
 #include	<time.h>
 #include	"xmalloc.h"
 
@@ -19,6 +33,9 @@
 #include	<sys/socket.h>
 #include	<arpa/inet.h>
 #include	<netdb.h>
+#ifdef	__linux__
+#include	<sys/epoll.h>
+#endif
 #else	/* _WIN32 */
 #include	<winsock2.h>
 typedef int socklen_t;
@@ -26,23 +43,106 @@ typedef int socklen_t;
 
 #include	"md5.h"
 #include	"sockstream.h"
+#include	"netproto.h"
 #include	"server.h"
+#include	"ez8.h"
+#include	"timer.h"
+#include	"err_msg.h"
 
 /**************************************************************/
 
 #define	DEFAULT_PORT	6910
 
+/* Version advertised in the greeting. It stays at 1.xx so
+ * version 1.00 clients still connect; a client that knows
+ * version 2 asks for it with the VERSION request. */
 #define	VERSION_MAJOR	1
-#define	VERSION_MINOR	0
+#define	VERSION_MINOR	1
+
+#define	PROTO_MAJOR	2
+#define	PROTO_MINOR	0
 
 #define	AUTH_MAGIC	0x69
 
+#define	MAX_CLIENTS	16
+#define	MAX_EVENTS	16
+
+/* largest request buffered, a 64k text WRITE */
+#define	MAX_REQUEST	(6 * PROTO_MAXDATA)
+
+/* transfers larger than this are bulk, served after
+ * interactive requests */
+#define	BULK_SIZE	256
+
+/* how long a client that wrote to the link keeps it,
+ * waiting for it to read the reply (ms) */
+#define	LINK_HOLD	500
+
+/* a client that leaves this much of its replies unread is
+ * not served until it catches up */
+#define	MAX_BACKLOG	PROTO_MAXFRAME
+
 static uint8_t *data = NULL;
 static int data_size = 0;
 static char *buff = NULL;
 
 enum auth_type_t { auth_none, auth_plaintext, auth_md5 };
 
+/* how a buffered request is scheduled */
+enum req_class { req_none, req_error, req_local, req_interactive, 
+    req_bulk };
+
+struct client;
+
+/* a device clients may pick */
+struct target {
+	char *name;
+	char *device;
+	ocd *link;			/* NULL until opened */
+	ez8dbg *ez8;			/* debugger opened on the link */
+
+	/* debugger on the link, for clients to run operations on */
+	ez8dbg *host;
+
+	/* client keeping the link between a write and its read */
+	struct client *holder;
+	uint64_t hold_until;
+
+	/* a reply may be waiting on the link for writer, or for a
+	 * client that went away without reading it */
+	struct client *writer;
+	int unread;
+
+	struct target *next;
+};
+
+struct client {
+	SOCK sock;
+	struct target *target;
+	int auth;
+	int version;			/* protocol major */
+	int monitor;			/* read only */
+
+	/* md5 challenge sent, waiting for the response */
+	enum auth_type_t auth_type;
+	char *pass;
+	uint8_t challenge[16];
+
+	unsigned long served;		/* turn last served on */
+	int events;			/* polled for, -1 if not yet */
+	struct client *next;
+};
+
+static struct client *clients = NULL;
+static int num_clients = 0;
+static char *users = NULL;
+static unsigned long turn = 0;
+
+/* the server's own link comes first */
+static struct target *targets = NULL;
+static ez8dbg *(*open_link)(const char *) = NULL;
+static int host_ops = 0;
+
 /**************************************************************
  * This function will bind the server to a socket.
  *
@@ -146,11 +246,10 @@ static int bind_server(char *connection)
 		return -1;
 	}
 
-	/* Start listening for connections. Accept at most one
-	 * connection. Subsequent connections will fail with
-	 * CONN_REFUSED until current client exits.
+	/* Start listening for connections. Clients past
+	 * MAX_CLIENTS are accepted and told the server is busy.
 	 */
-	err = listen(fdes, 1);
+	err = listen(fdes, MAX_CLIENTS);
 	if(err) {
 		perror("listen");
 		close(fdes);
@@ -161,22 +260,18 @@ static int bind_server(char *connection)
 }
 
 /**************************************************************
- * This will accept a client connection and return a 
- * descriptor to use for the connection.
- * 
- * This function will return a valid descriptor (>= 0) upon
- * success, or -1 upon error.
+ * This will print a message about the interface/socket the
+ * server is listening on.
+ *
+ * This function returns 0 upon success, or -1 upon error.
  */
 
-static int get_connection(int fdes)
+static int show_listening(int fdes)
 {
 	int err;
-	int client;
 	socklen_t len;
 	struct sockaddr_in sock;
-	struct hostent *h;
 
-	/* print message about interface/socket we are listening on */
 	len = sizeof(sock);
 	err = getsockname(fdes, (struct sockaddr *)&sock, &len);
 	if(err) {
@@ -190,6 +285,25 @@ static int get_connection(int fdes)
 		printf("\nListening on %s:%d\n", inet_ntoa(sock.sin_addr), 
 		    ntohs(sock.sin_port));
 	}
+	fflush(stdout);
+
+	return 0;
+}
+
+/**************************************************************
+ * This will accept a client connection and return a 
+ * descriptor to use for the connection.
+ * 
+ * This function will return a valid descriptor (>= 0) upon
+ * success, or -1 upon error.
+ */
+
+static int get_connection(int fdes)
+{
+	int client;
+	socklen_t len;
+	struct sockaddr_in sock;
+	struct hostent *h;
 
 	/* accept client connection */
 	len = sizeof(sock);
@@ -209,6 +323,7 @@ static int get_connection(int fdes)
 		printf("Accepted connection from %s:%d\n", 
 		    inet_ntoa(sock.sin_addr), ntohs(sock.sin_port));
 	}
+	fflush(stdout);
 
 	return client;
 }
@@ -263,15 +378,17 @@ static int client_flush(SOCK *s)
  * The server will then respond with +OK if authentication
  * sucessful, or -ERR if authentication failed.
  *
- * This function will return AUTH_MAGIC if authentication
- * was successful, 0 if authentication was unsuccessful, 1 if 
- * a protocol error occurred, or -1 if a failure occurred while 
- * reading/writing the socket.  
+ * The response is handled by client_auth_response() once it
+ * arrives, so other clients are served in the meantime.
+ *
+ * This function will return 0 if the client should send its
+ * response, 1 if a protocol error occurred, or -1 if a failure 
+ * occurred while reading/writing the socket.  
  *
  * NOTE: this function assumes the calling routine will flush
  * the output buffer before reading the next request.
  *
- * *userpasswd should be a comma separated list of 
+ * *users should be a comma separated list of 
  * username:password pairs. A password with an empty username
  * signifies a password to be used for any user without a 
  * specified password (for use as a default password).
@@ -280,15 +397,15 @@ static int client_flush(SOCK *s)
  * of the password.
  */
 
-static int client_auth(SOCK *s, char *userpasswd)
+static int client_auth(struct client *c)
 {
 	int err;
 	int i;
 	char *ptr, *user, *pass;
-	uint8_t challenge[16], password[16];
 	enum auth_type_t auth_type;
-	MD5_CTX context;
+	SOCK *s;
 
+	s = &c->sock;
 	auth_type = auth_none;
 
 	ptr = strtok(NULL, " \t\r\n");
@@ -301,7 +418,7 @@ static int client_auth(SOCK *s, char *userpasswd)
 	}
 
 	pass = NULL;
-	user = userpasswd;
+	user = users;
 
 	/* find user */
 	while(user) {
@@ -326,7 +443,7 @@ static int client_auth(SOCK *s, char *userpasswd)
 
 	/* if user doesn't exist, find empty user if it exists */
 	if(!user) {
-		user = userpasswd;
+		user = users;
 		while(user) {
 			pass = strchr(user, ':');
 			if(!pass) {
@@ -403,8 +520,8 @@ static int client_auth(SOCK *s, char *userpasswd)
 		 */
 		srand(time(0));
 		for(i=0; i<16; i++) {
-			challenge[i] = rand();
-			err = ss_printf(s, "%02x", challenge[i]);
+			c->challenge[i] = rand();
+			err = ss_printf(s, "%02x", c->challenge[i]);
 			if(err < 0) {
 				return -1;
 			}
@@ -419,10 +536,37 @@ static int client_auth(SOCK *s, char *userpasswd)
 		break;
 	}
 
-	err = ss_flush(s);
-	if(err < 0) {
-		return -1;
-	}
+	c->auth_type = auth_type;
+	c->pass = pass;
+
+	return 0;
+}
+
+/**************************************************************
+ * This handles the response to an authentication request, the
+ * password or the md5 hash of the challenge sent by 
+ * client_auth().
+ *
+ * This function will return AUTH_MAGIC if authentication
+ * was successful, 0 if authentication was unsuccessful, 1 if 
+ * a protocol error occurred, or -1 if a failure occurred while 
+ * reading/writing the socket.  
+ */
+
+static int client_auth_response(struct client *c)
+{
+	int err;
+	char *ptr, *pass;
+	uint8_t challenge[16], password[16];
+	enum auth_type_t auth_type;
+	MD5_CTX context;
+	SOCK *s;
+
+	s = &c->sock;
+	auth_type = c->auth_type;
+	pass = c->pass;
+	memcpy(challenge, c->challenge, sizeof(challenge));
+	c->auth_type = auth_none;
 
 	ptr = ss_gets(buff, BUFSIZ, s);
 	if(!ptr) {
@@ -717,6 +861,49 @@ static int client_read(SOCK *s, ocd *dbg)
 	return 0;
 }
 
+/**************************************************************
+ * This checks that data to write to the link only holds 
+ * commands that read from the device, so a monitoring client
+ * cannot disturb another client's debug session.
+ *
+ * This function returns 1 if the data is read only, 0 if not.
+ */
+
+static int read_only(const uint8_t *buff, size_t size)
+{
+	size_t len;
+
+	while(size > 0) {
+		switch(*buff) {
+		case DBG_CMD_RD_REVID:
+		case DBG_CMD_RD_DBGSTAT:
+		case DBG_CMD_RD_CNTR:
+		case DBG_CMD_RD_DBGCTL:
+		case DBG_CMD_RD_PC:
+		case DBG_CMD_RD_MEMCRC:
+		case DBG_CMD_RD_RELOAD:
+			len = 1;
+			break;
+		case DBG_CMD_RD_REG:
+			len = 4;
+			break;
+		case DBG_CMD_RD_MEM:
+		case DBG_CMD_RD_EDATA:
+			len = 5;
+			break;
+		default:
+			return 0;
+		}
+		if(len > size) {
+			return 0;
+		}
+		buff += len;
+		size -= len;
+	}
+
+	return 1;
+}
+
 /**************************************************************
  * This function handles a write request for an authenticated
  * client.
@@ -730,6 +917,8 @@ static int client_read(SOCK *s, ocd *dbg)
  * byte delimited by spaces ' ', tabs '\t', or carriage
  * return '\r' newline '\n' characters.
  *
+ * A monitoring client may only write commands that read.
+ *
  * This function returns 0 upon success, 1 if a protocol
  * error was detected, or -1 if an error occurred while 
  * reading/writing the socket.
@@ -738,7 +927,7 @@ static int client_read(SOCK *s, ocd *dbg)
  * the output buffer before reading the next request.
  */
 
-static int client_write(SOCK *s, ocd *dbg)
+static int client_write(SOCK *s, ocd *dbg, int monitor)
 {
 	int err;
 	char *ptr, *tail;
@@ -792,6 +981,14 @@ static int client_write(SOCK *s, ocd *dbg)
 
 	} while(!err && ptr);
 
+	if(monitor && !read_only(data, data_size)) {
+		err = ss_printf(s, "-ERR #read only\r\n");
+		if(err) {
+			return -1;
+		}
+		return 1;
+	}
+
 	if(!dbg->link_up()) {
 		err = ss_printf(s, "-ERR #link down\r\n");
 		if(err) {
@@ -817,181 +1014,1269 @@ static int client_write(SOCK *s, ocd *dbg)
 }
 
 /**************************************************************
- * This is the main service routine for client connections.
+ * This runs a debugger operation requested by a version 2
+ * client on the server's own debugger, so the link traffic
+ * it takes stays local to the server. The request data is in
+ * data[], and the reply is built there.
+ *
+ * A monitoring client may only run operations that read.
+ *
+ * This function return 0 upon success, -1 if an error occurred
+ * while reading/writing the socket.
+ */
+
+static int host_op(SOCK *s, ez8dbg *host_dbg, int type, ssize_t size, 
+    int monitor)
+{
+	uint16_t address, crc;
+	size_t len;
+
+	len = 0;
+	try {
+		if(!host_dbg) {
+			strncpy(err_msg, "Cannot run debugger operation\n"
+			    "not enabled on server\n", err_len-1);
+			throw err_msg;
+		}
+		if(monitor && (type == PROTO_WR_MEM || type == PROTO_ERASE ||
+		    type == PROTO_RUN || type == PROTO_STOP || 
+		    type == PROTO_STEP)) {
+			strncpy(err_msg, "Cannot run debugger operation\n"
+			    "client is read only\n", err_len-1);
+			throw err_msg;
+		}
+
+		switch(type) {
+		case PROTO_OPS:
+			break;
+		case PROTO_RD_MEM:
+			if(size != 6) {
+				strncpy(err_msg, "Cannot read memory\n"
+				    "invalid request\n", err_len-1);
+				throw err_msg;
+			}
+			address = data[0] << 8 | data[1];
+			len = data[2] << 24 | data[3] << 16 | 
+			    data[4] << 8 | data[5];
+			if(len > PROTO_MAXDATA) {
+				strncpy(err_msg, "Cannot read memory\n"
+				    "invalid address range\n", err_len-1);
+				throw err_msg;
+			}
+			host_dbg->rd_mem(address, data, len);
+			break;
+		case PROTO_WR_MEM:
+			if(size < 2) {
+				strncpy(err_msg, "Could not write memory\n"
+				    "invalid request\n", err_len-1);
+				throw err_msg;
+			}
+			address = data[0] << 8 | data[1];
+			host_dbg->wr_mem(address, data + 2, size - 2);
+			break;
+		case PROTO_ERASE:
+			host_dbg->flash_mass_erase();
+			break;
+		case PROTO_RD_CRC:
+			crc = host_dbg->rd_crc();
+			data[0] = crc >> 8;
+			data[1] = crc;
+			len = 2;
+			break;
+		case PROTO_RD_REGS:
+			if(size != 4) {
+				strncpy(err_msg, "Cannot read register file\n"
+				    "invalid request\n", err_len-1);
+				throw err_msg;
+			}
+			address = data[0] << 8 | data[1];
+			len = data[2] << 8 | data[3];
+			if(!len || len > EZ8REG_SIZE) {
+				strncpy(err_msg, "Cannot read register file\n"
+				    "invalid request\n", err_len-1);
+				throw err_msg;
+			}
+			host_dbg->rd_regs(address, data, len);
+			break;
+		case PROTO_RUN:
+			host_dbg->run();
+			break;
+		case PROTO_STOP:
+			host_dbg->stop();
+			break;
+		case PROTO_STEP:
+			host_dbg->step();
+			break;
+		default:
+			abort();
+		}
+	} catch(char *msg) {
+		return ss_putframe(s, PROTO_ERR, msg, strlen(msg));
+	}
+
+	return ss_putframe(s, PROTO_OK, data, len);
+}
+
+/**************************************************************
+ * This services a request from a client using the binary 
+ * (version 2) protocol. Each request is a single frame, and is
+ * answered with a single frame. A TRANSACT request writes its
+ * data and reads the reply in one round trip.
+ *
+ * This function returns 0 upon success, 1 when the client 
+ * closes, or -1 if an error occurred while reading/writing 
+ * the socket.
  */
 
-static int service_client(ocd *dbg, int client, char *userpasswd)
+static int frame_request(struct client *c, ocd *dbg)
 {
 	int err;
-	char *ptr;
-	SOCK sock;
-	int auth;
+	int type;
+	ssize_t size;
+	uint8_t status;
+	const char *msg;
+	SOCK *s;
 
-	err = ss_open(client, &sock);
-	if(err) {
-		close(client);
+	s = &c->sock;
+
+	size = ss_getframe(s, &type);
+	if(size < 0 || size > PROTO_MAXFRAME) {
 		return -1;
 	}
-
-	/* If no userpasswd requested, assume client authenticated */
-	if(!userpasswd || *userpasswd == '\0') {
-		auth = 1;
-	} else {
-		auth = 0;
+	err = ss_read(s, data, size);
+	if(err < 0) {
+		return -1;
 	}
 
-	err = ss_printf(&sock, "+OK Z8ENCOREOCD %d.%02d #build %s %s\r\n",
-	    VERSION_MAJOR, VERSION_MINOR, __DATE__, __TIME__);
+	/* a monitoring client may only read */
+	if(c->monitor && ((type == PROTO_WRITE && !read_only(data, size)) ||
+	    (type == PROTO_TRANSACT && size > 4 && 
+	    !read_only(data + 4, size - 4)))) {
+		msg = PROTO_READONLY;
+		err = ss_putframe(s, PROTO_ERR, msg, strlen(msg));
+		return err < 0 ? -1 : 0;
+	}
 
-	while(err >= 0) {
+	/* link traffic the server's debugger does not see */
+	if(c->target->host && (type == PROTO_RESET || type == PROTO_READ ||
+	    type == PROTO_WRITE || type == PROTO_TRANSACT)) {
+		c->target->host->flush_cache();
+	}
 
-		/* flush any output/response */
-		err = ss_flush(&sock);
-		if(err < 0) {
+	msg = NULL;
+	switch(type) {
+	case PROTO_STATUS:
+		status = dbg->link_up() ? PROTO_UP : PROTO_DOWN;
+		err = ss_putframe(s, PROTO_OK, &status, 1);
+		break;
+	case PROTO_RESET:
+		try {
+			dbg->reset();
+		} catch(char *txt) {
+			msg = "link reset failed";
+		}
+		break;
+	case PROTO_READ:
+		if(size != 4) {
+			msg = "size needed";
 			break;
 		}
-
-		/* get request */
-		ptr = ss_gets(buff, BUFSIZ, &sock);
-		if(!ptr) {
-			err = -1;
+		data_size = data[0] << 24 | data[1] << 16 | 
+		    data[2] << 8 | data[3];
+		if(data_size <= 0 || data_size > PROTO_MAXDATA) {
+			msg = "size out-of-range";
 			break;
 		}
-
-		/* filter comments */
-		ptr = strchr(buff, '#');
-		if(ptr) {
-			*ptr = '\0';
+		if(!dbg->link_up()) {
+			msg = "link down";
+			break;
 		}
-		ptr = strtok(buff, " \t\r\n");
-		if(!ptr) {	
-			/* skip blank lines */
-			continue;
+		try {
+			dbg->read(data, data_size);
+		} catch(char *txt) {
+			msg = "read failed";
+			break;
 		}
-
-		/* determine request */
-		if(strcasecmp(ptr, "user") == 0) {
-			err = client_auth(&sock, userpasswd);
-			if(err == AUTH_MAGIC) {
-				auth = 1;
-			}
-			if(err < 0) {
-				break;
-			}
-		} else if(strcasecmp(ptr, "status") == 0) {
-			if(!auth) {
-				err = ss_printf(&sock, "+OK AUTH\r\n");
-				if(err < 0) {
-					break;
-				}
-				continue;
-			}
-			err = client_status(&sock, dbg);
-			if(err < 0) {
-				break;
-			} 
-		} else if((strcasecmp(ptr, "close") == 0) ||
-		          (strcasecmp(ptr, "exit") == 0) ||
-		          (strcasecmp(ptr, "quit") == 0)) {
-			err = ss_printf(&sock, "+OK #exiting\r\n");
+		err = ss_putframe(s, PROTO_OK, data, data_size);
+		break;
+	case PROTO_WRITE:
+		if(!dbg->link_up()) {
+			msg = "link down";
 			break;
-		} else if(strcasecmp(ptr, "reset") == 0) {
-			if(!auth) {
-				err = ss_printf(&sock, "-ERR "
-				    "#auth required\r\n");
-				if(err < 0) {
-					break;
-				}
-				continue;
-			} 
-			err = client_reset(&sock, dbg);
-			if(err < 0) {
-				break;
-			}
-		} else if(strcasecmp(ptr, "read") == 0) {
-			if(!auth) {
-				ss_printf(&sock, "-ERR #auth required\r\n");
-				continue;
-			} 
-			err = client_read(&sock, dbg);
-			if(err < 0) {
-				break;
-			}
-		} else if(strcasecmp(ptr, "write") == 0) {
-			if(!auth) {
-				err = client_flush(&sock);
-				if(err < 0) {
-					break;
-				}
-				err = ss_printf(&sock, "-ERR "
-				    "#auth required\r\n");
-				if(err < 0) {
-					break;
-				}
-				continue;
-			}
-			err = client_write(&sock, dbg);
-			if(err < 0) {
-				break;
+		}
+		try {
+			dbg->write(data, size);
+		} catch(char *txt) {
+			msg = "write failed";
+		}
+		break;
+	case PROTO_TRANSACT:
+		if(size < 4) {
+			msg = "size needed";
+			break;
+		}
+		data_size = data[0] << 24 | data[1] << 16 | 
+		    data[2] << 8 | data[3];
+		if(data_size <= 0 || data_size > PROTO_MAXDATA) {
+			msg = "size out-of-range";
+			break;
+		}
+		if(!dbg->link_up()) {
+			msg = "link down";
+			break;
+		}
+		try {
+			if(size > 4) {
+				dbg->write(data + 4, size - 4);
 			}
-		} else {
-			err = ss_printf(&sock, "-ERR #invalid command\r\n");
+			dbg->read(data, data_size);
+		} catch(char *txt) {
+			msg = "transact failed";
+			break;
 		}
-	} 
-
-	if(err >= 0) {
-		ss_flush(&sock);
+		err = ss_putframe(s, PROTO_OK, data, data_size);
+		break;
+	case PROTO_OPS:
+	case PROTO_RD_MEM:
+	case PROTO_WR_MEM:
+	case PROTO_ERASE:
+	case PROTO_RD_CRC:
+	case PROTO_RD_REGS:
+	case PROTO_RUN:
+	case PROTO_STOP:
+	case PROTO_STEP:
+		err = host_op(s, c->target->host, type, size, c->monitor);
+		break;
+	case PROTO_CLOSE:
+		err = ss_putframe(s, PROTO_OK, NULL, 0);
+		if(err < 0) {
+			return -1;
+		}
+		return 1;
+	default:
+		msg = "invalid command";
+		break;
 	}
 
-	err = ss_close(&sock);
-	if(err) {
-		perror("ss_close");
+	if(msg) {
+		err = ss_putframe(s, PROTO_ERR, msg, strlen(msg));
+	} else if(type == PROTO_RESET || type == PROTO_WRITE) {
+		err = ss_putframe(s, PROTO_OK, NULL, 0);
+	}
+	if(err < 0) {
+		return -1;
 	}
 
 	return 0;
 }
 
 /**************************************************************
- * This will fire up and start the ocd server. 
- * 
- * *dbg should already be setup and connected to.
+ * This function handles a protocol version request from the
+ * client.
  *
- * *connection should be in the form
- *	[user:pass[,user:pass...]@][host][:port]
- * host should only be specified if you want to bind to a 
- *     specific interface. 
- * If :port is not specified, DEFAULT_PORT is used.
- * If user:pass@ is not specified, authentication will not
- *     be required.
+ * The client should send
+ *	VERSION <MAJOR.MINOR>
+ * The server responds with
+ *	+OK Z8ENCOREOCD <VERSION>
+ * giving the version it will speak from then on. Version 2
+ * switches to the binary protocol, and is only available to
+ * authenticated clients.
+ *
+ * This function returns the version major selected, 0 if the
+ * version was refused, or -1 if an error occurred while 
+ * reading/writing the socket.
  */
 
-int run_server(ocd *dbg, char *connection)
+static int client_version(SOCK *s, int auth)
 {
-	int fd, client;
-	char *host, *userpasswd;
-#ifdef	_WIN32
-	int err;
-	WSADATA wsa;
+	int err, major;
+	char *ptr, *tail;
 
-	err = WSAStartup(MAKEWORD(2,1), &wsa);
-	if(err) {
-		fprintf(stderr, "WSAStartup failed\n");
-		return -1;
+	ptr = strtok(NULL, " \t\r\n");
+	if(!ptr) {
+		err = ss_printf(s, "-ERR #version needed\r\n");
+		return err < 0 ? -1 : 0;
+	}
+	major = strtol(ptr, &tail, 10);
+	if(tail == ptr || (*tail != '\0' && *tail != '.')) {
+		err = ss_printf(s, "-ERR #invalid version \'%s\'\r\n", ptr);
+		return err < 0 ? -1 : 0;
 	}
-#endif	/* _WIN32 */
 
-	if(!data) {
-		data = (uint8_t *)xmalloc(0x10000);
+	if(major == PROTO_MAJOR && !auth) {
+		err = ss_printf(s, "-ERR #auth required\r\n");
+		return err < 0 ? -1 : 0;
 	}
-	if(!buff) {
-		buff = (char *)xmalloc(BUFSIZ+1);
-		buff[BUFSIZ] = '\0';
+	if(major == PROTO_MAJOR) {
+		err = ss_printf(s, "+OK Z8ENCOREOCD %d.%02d\r\n", 
+		    PROTO_MAJOR, PROTO_MINOR);
+	} else if(major == VERSION_MAJOR) {
+		err = ss_printf(s, "+OK Z8ENCOREOCD %d.%02d\r\n", 
+		    VERSION_MAJOR, VERSION_MINOR);
+	} else {
+		err = ss_printf(s, "-ERR #version %d unsupported\r\n", 
+		    major);
+		return err < 0 ? -1 : 0;
+	}
+	if(err < 0) {
+		return -1;
 	}
 
-	userpasswd = NULL;
-	host = NULL;
+	return major;
+}
 
-	if(connection) {
+/**************************************************************
+ * This opens the link to a target.
+ */
+
+static int connect_target(struct target *t)
+{
+	ez8dbg *ez8;
+
+	try {
+		ez8 = open_link(t->device);
+	} catch(char *msg) {
+		fprintf(stderr, "Cannot open target %s\n%s", t->name, msg);
+		return -1;
+	}
+	t->ez8 = ez8;
+	t->link = ez8->iflink();
+	t->host = host_ops ? ez8 : NULL;
+	printf("Opened target %s on %s\n", t->name, t->device);
+	fflush(stdout);
+
+	return 0;
+}
+
+/**************************************************************
+ * This picks the device a client works with. It is formatted as
+ *	TARGET [name]
+ * Without a name, the server lists its targets. A target is 
+ * opened the first time a client picks it.
+ *
+ * This function return 0 upon success, -1 if an error occurred
+ * while reading/writing the socket.
+ */
+
+static int client_target(struct client *c)
+{
+	int err;
+	char *name;
+	struct target *t;
+	SOCK *s;
+
+	s = &c->sock;
+
+	name = strtok(NULL, " \t\r\n");
+	if(!name) {
+		err = ss_printf(s, "+OK");
+		for(t = targets; t && !err; t = t->next) {
+			err = ss_printf(s, " %s", t->name);
+		}
+		if(!err) {
+			err = ss_printf(s, "\r\n");
+		}
+		return err < 0 ? -1 : 0;
+	}
+
+	for(t = targets; t; t = t->next) {
+		if(strcmp(t->name, name) == 0) {
+			break;
+		}
+	}
+	if(!t) {
+		err = ss_printf(s, "-ERR #unknown target\r\n");
+		return err < 0 ? -1 : 0;
+	}
+
+	/* one that could not be opened at startup is tried again */
+	if(!t->link && connect_target(t) < 0) {
+		err = ss_printf(s, "-ERR #cannot open %s\r\n", t->device);
+		return err < 0 ? -1 : 0;
+	}
+
+	/* let go of the link the client was using */
+	if(c->target->holder == c) {
+		c->target->holder = NULL;
+	}
+	if(c->target->writer == c) {
+		c->target->writer = NULL;
+	}
+	c->target = t;
+
+	err = ss_printf(s, "+OK #target %s\r\n", t->name);
+
+	return err < 0 ? -1 : 0;
+}
+
+/**************************************************************
+ * This services a request from a client using the text 
+ * (version 1) protocol.
+ *
+ * This function returns 0 upon success, 1 when the client 
+ * closes, or -1 if an error occurred while reading/writing 
+ * the socket.
+ */
+
+static int text_request(struct client *c, ocd *dbg)
+{
+	int err;
+	char *ptr;
+	SOCK *s;
+
+	s = &c->sock;
+
+	/* the password, or the response to a challenge */
+	if(c->auth_type != auth_none) {
+		err = client_auth_response(c);
+		if(err == AUTH_MAGIC) {
+			c->auth = 1;
+		}
+		return err < 0 ? -1 : 0;
+	}
+
+	/* get request */
+	ptr = ss_gets(buff, BUFSIZ, s);
+	if(!ptr) {
+		return -1;
+	}
+
+	/* filter comments */
+	ptr = strchr(buff, '#');
+	if(ptr) {
+		*ptr = '\0';
+	}
+	ptr = strtok(buff, " \t\r\n");
+	if(!ptr) {	
+		/* skip blank lines */
+		return 0;
+	}
+
+	/* link traffic the server's debugger does not see */
+	if(c->target->host && c->auth && (strcasecmp(ptr, "reset") == 0 || 
+	    strcasecmp(ptr, "read") == 0 || strcasecmp(ptr, "write") == 0)) {
+		c->target->host->flush_cache();
+	}
+
+	/* determine request */
+	if(strcasecmp(ptr, "user") == 0) {
+		err = client_auth(c);
+	} else if(strcasecmp(ptr, "version") == 0) {
+		err = client_version(s, c->auth);
+		if(err > 0) {
+			c->version = err;
+		}
+	} else if(strcasecmp(ptr, "target") == 0) {
+		if(!c->auth) {
+			err = ss_printf(s, "-ERR #auth required\r\n");
+		} else {
+			err = client_target(c);
+		}
+	} else if(strcasecmp(ptr, "monitor") == 0) {
+		c->monitor = 1;
+		err = ss_printf(s, "+OK #read only\r\n");
+	} else if(strcasecmp(ptr, "status") == 0) {
+		if(!c->auth) {
+			err = ss_printf(s, "+OK AUTH\r\n");
+		} else {
+			err = client_status(s, dbg);
+		}
+	} else if((strcasecmp(ptr, "close") == 0) ||
+	          (strcasecmp(ptr, "exit") == 0) ||
+	          (strcasecmp(ptr, "quit") == 0)) {
+		err = ss_printf(s, "+OK #exiting\r\n");
+		return err < 0 ? -1 : 1;
+	} else if(strcasecmp(ptr, "reset") == 0) {
+		if(!c->auth) {
+			err = ss_printf(s, "-ERR #auth required\r\n");
+		} else {
+			err = client_reset(s, dbg);
+		}
+	} else if(strcasecmp(ptr, "read") == 0) {
+		if(!c->auth) {
+			err = ss_printf(s, "-ERR #auth required\r\n");
+		} else {
+			err = client_read(s, dbg);
+		}
+	} else if(strcasecmp(ptr, "write") == 0) {
+		if(!c->auth) {
+			err = client_flush(s);
+			if(err < 0) {
+				return -1;
+			}
+			err = ss_printf(s, "-ERR #auth required\r\n");
+		} else {
+			err = client_write(s, dbg, c->monitor);
+		}
+	} else {
+		err = ss_printf(s, "-ERR #invalid command\r\n");
+	}
+
+	return err < 0 ? -1 : 0;
+}
+
+/**************************************************************
+ * This returns the length of the line at the start of *buff,
+ * including the '\n', or 0 if the whole line has not arrived.
+ */
+
+static size_t line_length(const char *buff, size_t size)
+{
+	const char *ptr;
+
+	ptr = (const char *)memchr(buff, '\n', size);
+	if(!ptr) {
+		return 0;
+	}
+
+	return ptr - buff + 1;
+}
+
+/**************************************************************
+ * This checks if a line is blank, ignoring comments.
+ */
+
+static int blank_line(const char *buff, size_t size)
+{
+	size_t i;
+
+	for(i=0; i<size && buff[i] != '#'; i++) {
+		if(!strchr(" \t\r\n", buff[i])) {
+			return 0;
+		}
+	}
+
+	return 1;
+}
+
+/**************************************************************
+ * This classifies the text request buffered for a client. A 
+ * WRITE request is only complete once its terminating blank 
+ * line has arrived. *writes is set if the request writes to 
+ * the link. A line too long for the request buffer is an 
+ * error.
+ */
+
+static enum req_class text_class(struct client *c, int *writes)
+{
+	char *rx;
+	char word[8];
+	size_t cnt, len, pos, n;
+	unsigned long size;
+
+	rx = (char *)c->sock.rxbuff;
+	cnt = c->sock.rxcnt;
+
+	len = line_length(rx, cnt);
+	if(!len) {
+		return cnt >= BUFSIZ ? req_error : req_none;
+	}
+	if(len >= BUFSIZ) {
+		return req_error;
+	}
+	if(c->auth_type != auth_none) {
+		return req_local;
+	}
+
+	/* get first word of request */
+	for(pos=0; pos<len && strchr(" \t", rx[pos]); pos++) {
+		continue;
+	}
+	for(n=0; n<sizeof(word)-1 && pos+n<len && 
+	    !strchr(" \t\r\n#", rx[pos+n]); n++) {
+		word[n] = rx[pos+n];
+	}
+	word[n] = '\0';
+
+	if(strcasecmp(word, "write") == 0) {
+		/* data follows until a blank line */
+		for(pos=len; pos<cnt; pos+=n) {
+			n = line_length(rx+pos, cnt-pos);
+			if(n >= BUFSIZ || (!n && cnt - pos >= BUFSIZ)) {
+				return req_error;
+			}
+			if(!n || blank_line(rx+pos, n)) {
+				break;
+			}
+		}
+		if(!n || pos >= cnt) {
+			return cnt >= MAX_REQUEST ? req_error : req_none;
+		}
+		*writes = 1;
+		if(!c->auth) {
+			return req_local;
+		}
+		return pos > 5 * BULK_SIZE ? req_bulk : req_interactive;
+	}
+
+	if(!c->auth) {
+		return req_local;
+	}
+	if(strcasecmp(word, "read") == 0) {
+		size = strtoul(rx+pos+n, NULL, 0);
+		return size > BULK_SIZE ? req_bulk : req_interactive;
+	}
+	if(strcasecmp(word, "reset") == 0) {
+		return req_interactive;
+	}
+
+	return req_local;
+}
+
+/**************************************************************
+ * This classifies the frame buffered for a client. *writes is
+ * set if the request writes to the link.
+ */
+
+static enum req_class frame_class(struct client *c, int *writes)
+{
+	uint8_t *rx;
+	size_t cnt, size, len;
+
+	rx = (uint8_t *)c->sock.rxbuff;
+	cnt = c->sock.rxcnt;
+
+	if(cnt < PROTO_HEADER) {
+		return req_none;
+	}
+	size = (size_t)rx[1] << 24 | rx[2] << 16 | rx[3] << 8 | rx[4];
+	if(size > PROTO_MAXFRAME) {
+		return req_error;
+	}
+	if(cnt < PROTO_HEADER + size) {
+		return req_none;
+	}
+
+	switch(rx[0]) {
+	case PROTO_WRITE:
+		*writes = 1;
+		return size > BULK_SIZE ? req_bulk : req_interactive;
+	case PROTO_READ:
+	case PROTO_TRANSACT:
+		len = 0;
+		if(size >= 4) {
+			len = (size_t)rx[5] << 24 | rx[6] << 16 | 
+			    rx[7] << 8 | rx[8];
+		}
+		if(len > BULK_SIZE || size > BULK_SIZE + 4) {
+			return req_bulk;
+		}
+		return req_interactive;
+	case PROTO_RD_MEM:
+		len = 0;
+		if(size == 6) {
+			len = (size_t)rx[7] << 24 | rx[8] << 16 | 
+			    rx[9] << 8 | rx[10];
+		}
+		return len > BULK_SIZE ? req_bulk : req_interactive;
+	case PROTO_WR_MEM:
+	case PROTO_ERASE:
+		return req_bulk;
+	case PROTO_RESET:
+	case PROTO_RD_CRC:
+	case PROTO_RD_REGS:
+	case PROTO_RUN:
+	case PROTO_STOP:
+	case PROTO_STEP:
+		return req_interactive;
+	default:
+		return req_local;
+	}
+}
+
+/**************************************************************
+ * This classifies the request buffered for a client, if it 
+ * has all arrived.
+ */
+
+static enum req_class classify(struct client *c, int *writes)
+{
+	*writes = 0;
+
+	if(c->version == PROTO_MAJOR) {
+		return frame_class(c, writes);
+	}
+
+	return text_class(c, writes);
+}
+
+/**************************************************************
+ * This picks the client whose request runs next. Requests that
+ * do not use the link go first, then interactive requests, 
+ * then bulk ones. Clients with the same class of request take
+ * turns. While a client keeps the link, the link requests of 
+ * other clients wait.
+ *
+ * This function returns the client, or NULL if no request is
+ * ready.
+ */
+
+static struct client *schedule(void)
+{
+	struct client *c, *best;
+	struct target *t;
+	enum req_class cls, best_cls;
+	int writes;
+	uint64_t now;
+
+	now = timernow();
+	for(t = targets; t; t = t->next) {
+		if(t->holder && now >= t->hold_until) {
+			t->holder = NULL;
+		}
+	}
+
+	best = NULL;
+	best_cls = req_none;
+
+	for(c = clients; c; c = c->next) {
+		/* a client not reading its replies waits */
+		if(c->sock.txcnt >= MAX_BACKLOG) {
+			continue;
+		}
+		cls = classify(c, &writes);
+		if(cls == req_none) {
+			continue;
+		}
+		t = c->target;
+		if(t->holder && c != t->holder && 
+		    (cls == req_interactive || cls == req_bulk)) {
+			continue;
+		}
+		if(!best || cls < best_cls || 
+		    (cls == best_cls && c->served < best->served)) {
+			best = c;
+			best_cls = cls;
+		}
+	}
+
+	return best;
+}
+
+/**************************************************************
+ * This drops a reply left on a target's link by another 
+ * client, so it is not handed to the next one. The link is 
+ * reset, and the server's debugger forgets what it knew about
+ * the device. If the reset fails, the link stays down and the
+ * client sees that.
+ */
+
+static void settle_link(struct target *t)
+{
+	try {
+		t->link->reset();
+	} catch(char *err) {
+		fprintf(stderr, "Reset of target %s failed\n%s", 
+		    t->name, err);
+	}
+	if(t->host) {
+		t->host->flush_cache();
+	}
+	t->writer = NULL;
+	t->unread = 0;
+
+	return;
+}
+
+/**************************************************************
+ * This runs the next request of a client, and sends the 
+ * response.
+ *
+ * This function returns 0 upon success, 1 when the client 
+ * closes, or -1 if an error occurred while reading/writing 
+ * the socket.
+ */
+
+static int serve(struct client *c)
+{
+	int err;
+	int writes;
+	enum req_class cls;
+	struct target *t;
+
+	cls = classify(c, &writes);
+	if(cls == req_error) {
+		return -1;
+	}
+	c->served = ++turn;
+	t = c->target;
+
+	if(t->unread && t->writer != c && 
+	    (cls == req_interactive || cls == req_bulk)) {
+		settle_link(t);
+	}
+
+	if(c->version == PROTO_MAJOR) {
+		err = frame_request(c, t->link);
+	} else {
+		err = text_request(c, t->link);
+	}
+
+	/* keep the link for the client until it reads the reply */
+	if(cls == req_interactive || cls == req_bulk) {
+		if(writes) {
+			t->holder = c;
+			t->hold_until = timernow() + LINK_HOLD * 1000;
+			t->writer = c;
+			t->unread = 1;
+		} else {
+			if(t->holder == c) {
+				t->holder = NULL;
+			}
+			if(t->writer == c) {
+				t->writer = NULL;
+				t->unread = 0;
+			}
+		}
+	}
+
+	if(err == 0 && ss_flush(&c->sock) < 0) {
+		err = -1;
+	}
+
+	return err;
+}
+
+/**************************************************************
+ * This disconnects a client.
+ */
+
+static void drop_client(struct client *c)
+{
+	struct client **ptr;
+	int err;
+
+	for(ptr = &clients; *ptr != c; ptr = &(*ptr)->next) {
+		continue;
+	}
+	*ptr = c->next;
+	num_clients--;
+
+	if(c->target->holder == c) {
+		c->target->holder = NULL;
+	}
+	if(c->target->writer == c) {
+		c->target->writer = NULL;
+	}
+
+	err = ss_close(&c->sock);
+	if(err) {
+		perror("ss_close");
+	}
+	free(c);
+
+	return;
+}
+
+/**************************************************************
+ * This adds a newly connected client, and greets it. If the
+ * server already has MAX_CLIENTS, the client is told the
+ * server is busy and disconnected.
+ *
+ * This function returns the client, or NULL if it was not
+ * added.
+ */
+
+static struct client *add_client(int fdes)
+{
+	struct client *c;
+	int err;
+
+	c = (struct client *)xmalloc(sizeof(struct client));
+	err = ss_open(fdes, &c->sock);
+	if(err) {
+		close(fdes);
+		free(c);
+		return NULL;
+	}
+
+	if(num_clients >= MAX_CLIENTS) {
+		ss_printf(&c->sock, "-ERR Z8ENCOREOCD #server busy\r\n");
+		ss_close(&c->sock);
+		free(c);
+		return NULL;
+	}
+
+	/* If no users, assume client authenticated */
+	if(!users || *users == '\0') {
+		c->auth = 1;
+	} else {
+		c->auth = 0;
+	}
+	c->target = targets;
+	c->version = VERSION_MAJOR;
+	c->monitor = 0;
+	c->auth_type = auth_none;
+	c->pass = NULL;
+	c->served = turn;
+	c->events = -1;
+
+	c->next = clients;
+	clients = c;
+	num_clients++;
+
+	err = ss_printf(&c->sock, "+OK Z8ENCOREOCD %d.%02d #build %s %s\r\n",
+	    VERSION_MAJOR, VERSION_MINOR, __DATE__, __TIME__);
+	if(!err) {
+		err = ss_flush(&c->sock);
+	}
+	if(err) {
+		drop_client(c);
+		return NULL;
+	}
+
+	return c;
+}
+
+/**************************************************************
+ * This sets up the targets clients may pick. The first is the
+ * server's own link, named "default". *list adds more, in the
+ * form
+ *	name=device[,name=device...]
+ *
+ * This function returns 0 upon success, -1 if *list is 
+ * invalid.
+ */
+
+static int add_targets(ocd *dbg, ez8dbg *ez8, const char *list)
+{
+	char *copy, *ptr, *device;
+	struct target *t, **tail;
+
+	t = (struct target *)xmalloc(sizeof(struct target));
+	memset(t, 0, sizeof(struct target));
+	t->name = xstrdup("default");
+	t->link = dbg;
+	t->host = ez8;
+	targets = t;
+	tail = &t->next;
+
+	if(!list) {
+		return 0;
+	}
+
+	copy = xstrdup(list);
+	for(ptr = strtok(copy, ", \t"); ptr; ptr = strtok(NULL, ", \t")) {
+		device = strchr(ptr, '=');
+		if(!device || device == ptr || device[1] == '\0') {
+			fprintf(stderr, "Invalid target \"%s\"\n", ptr);
+			free(copy);
+			return -1;
+		}
+		*device++ = '\0';
+
+		for(t = targets; t; t = t->next) {
+			if(strcmp(t->name, ptr) == 0) {
+				fprintf(stderr, "Duplicate target \"%s\"\n",
+				    ptr);
+				free(copy);
+				return -1;
+			}
+		}
+
+		t = (struct target *)xmalloc(sizeof(struct target));
+		memset(t, 0, sizeof(struct target));
+		t->name = xstrdup(ptr);
+		t->device = xstrdup(device);
+		*tail = t;
+		tail = &t->next;
+	}
+	free(copy);
+
+	return 0;
+}
+
+/**************************************************************
+ * This opens the targets before the server takes any clients,
+ * so opening one does not hold up those of another.
+ */
+
+static void open_targets(void)
+{
+	struct target *t;
+
+	for(t = targets; t; t = t->next) {
+		if(!t->link) {
+			connect_target(t);
+		}
+	}
+
+	return;
+}
+
+/**************************************************************
+ * This closes the links the server opened, and forgets its 
+ * targets.
+ */
+
+static void free_targets(void)
+{
+	struct target *t;
+
+	while(targets) {
+		t = targets;
+		targets = t->next;
+		if(t->ez8) {
+			delete t->ez8;
+		}
+		free(t->name);
+		free(t->device);
+		free(t);
+	}
+
+	return;
+}
+
+#ifdef	__linux__
+/**************************************************************
+ * This sets what epoll waits for on a client: room in the 
+ * socket while replies are waiting to go out, and requests 
+ * while there is room to buffer them.
+ *
+ * This function returns -1 if an error occurred.
+ */
+
+static int watch_client(int ep, struct client *c)
+{
+	struct epoll_event ev;
+	int err;
+
+	ev.events = 0;
+	if(c->sock.rxcnt < MAX_REQUEST) {
+		ev.events |= EPOLLIN;
+	}
+	if(c->sock.txcnt > 0) {
+		ev.events |= EPOLLOUT;
+	}
+	if((int)ev.events == c->events) {
+		return 0;
+	}
+	ev.data.ptr = c;
+
+	err = epoll_ctl(ep, c->events < 0 ? EPOLL_CTL_ADD : EPOLL_CTL_MOD, 
+	    c->sock.fd, &ev);
+	if(err) {
+		perror("epoll_ctl");
+		return -1;
+	}
+	c->events = ev.events;
+
+	return 0;
+}
+
+/**************************************************************
+ * This waits with epoll for new connections and requests from
+ * any of the connected clients, and serves the requests one 
+ * at a time as schedule() picks them. Clients are written 
+ * without blocking, so one that does not read its replies 
+ * only holds up itself.
+ *
+ * This function returns -1 if an error occurred.
+ */
+
+static int serve_clients(int fdes)
+{
+	int ep, n, i, err;
+	int client, timeout;
+	uint64_t now;
+	struct epoll_event ev, events[MAX_EVENTS];
+	struct client *c, *next;
+	struct target *t;
+
+	ep = epoll_create(MAX_CLIENTS + 1);
+	if(ep < 0) {
+		perror("epoll_create");
+		return -1;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	err = epoll_ctl(ep, EPOLL_CTL_ADD, fdes, &ev);
+	if(err) {
+		perror("epoll_ctl");
+		close(ep);
+		return -1;
+	}
+
+	for(;;) {
+		/* poll without waiting if a request is ready, and
+		 * wake up when the link hold runs out */
+		timeout = -1;
+		if(schedule()) {
+			timeout = 0;
+		} else {
+			now = timernow();
+			for(t = targets; t; t = t->next) {
+				if(!t->holder) {
+					continue;
+				}
+				if(t->hold_until <= now) {
+					timeout = 0;
+				} else if(timeout < 0 || 
+				    (t->hold_until - now + 999) / 1000 < 
+				    (uint64_t)timeout) {
+					timeout = (t->hold_until - now + 999) 
+					    / 1000;
+				}
+			}
+		}
+
+		n = epoll_wait(ep, events, MAX_EVENTS, timeout);
+		if(n < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			break;
+		}
+
+		for(i=0; i<n; i++) {
+			c = (struct client *)events[i].data.ptr;
+			if(c) {
+				err = 0;
+				if(events[i].events & EPOLLOUT) {
+					err = ss_flush(&c->sock);
+				}
+				if(!err && (events[i].events & 
+				    (EPOLLIN | EPOLLHUP | EPOLLERR)) &&
+				    ss_fill(&c->sock, MAX_REQUEST, 0) < 0) {
+					err = -1;
+				}
+				if(err) {
+					drop_client(c);
+				}
+				continue;
+			}
+
+			client = get_connection(fdes);
+			if(client < 0) {
+				continue;
+			}
+			c = add_client(client);
+			if(c && ss_nonblock(&c->sock) < 0) {
+				perror("ss_nonblock");
+				drop_client(c);
+			}
+		}
+
+		c = schedule();
+		if(c) {
+			err = serve(c);
+			if(err) {
+				drop_client(c);
+			}
+		}
+
+		/* follow what each client has buffered either way */
+		for(c = clients; c; c = next) {
+			next = c->next;
+			if(watch_client(ep, c) < 0) {
+				drop_client(c);
+			}
+		}
+	}
+
+	close(ep);
+
+	return -1;
+}
+#else	/* __linux__ */
+/**************************************************************
+ * Without epoll, clients are served one at a time.
+ *
+ * This function returns -1 if an error occurred.
+ */
+
+static int serve_clients(int fdes)
+{
+	int client, err;
+	struct client *c;
+
+	while((client = get_connection(fdes)) >= 0) {
+		c = add_client(client);
+		if(!c) {
+			continue;
+		}
+		err = 0;
+		while(!err) {
+			if(!schedule()) {
+				if(ss_fill(&c->sock, MAX_REQUEST, 1) < 0) {
+					err = -1;
+				}
+				continue;
+			}
+			err = serve(c);
+		}
+		drop_client(c);
+	}
+
+	return -1;
+}
+#endif	/* __linux__ */
+
+/**************************************************************
+ * This will fire up and start the ocd server. 
+ * 
+ * *dbg should already be setup and connected to.
+ *
+ * *connection should be in the form
+ *	[user:pass[,user:pass...]@][host][:port]
+ * host should only be specified if you want to bind to a 
+ *     specific interface. 
+ * If :port is not specified, DEFAULT_PORT is used.
+ * If user:pass@ is not specified, authentication will not
+ *     be required.
+ *
+ * If *ez8 is given, it should be a debugger on the same link,
+ * and version 2 clients may run debugger operations on it.
+ *
+ * *list names more devices clients may pick, in the form
+ *	name=device[,name=device...]
+ * Each is opened by open() before clients are taken, or the
+ * first time a client picks it if that fails. open() returns a
+ * connected debugger or throws an error.
+ */
+
+int run_server(ocd *dbg, char *connection, ez8dbg *ez8, 
+    const char *list, ez8dbg *(*open)(const char *))
+{
+	int fd;
+	char *host, *userpasswd;
+#ifdef	_WIN32
+	int err;
+	WSADATA wsa;
+
+	err = WSAStartup(MAKEWORD(2,1), &wsa);
+	if(err) {
+		fprintf(stderr, "WSAStartup failed\n");
+		return -1;
+	}
+#endif	/* _WIN32 */
+
+	if(!data) {
+		data = (uint8_t *)xmalloc(PROTO_MAXFRAME);
+	}
+	if(!buff) {
+		buff = (char *)xmalloc(BUFSIZ+1);
+		buff[BUFSIZ] = '\0';
+	}
+
+	if(list && !open) {
+		fprintf(stderr, "Cannot open server targets\n");
+		return -1;
+	}
+	if(add_targets(dbg, ez8, list) < 0) {
+		free_targets();
+		return -1;
+	}
+	open_link = open;
+	host_ops = ez8 != NULL;
+	open_targets();
+
+	userpasswd = NULL;
+	host = NULL;
+
+	if(connection) {
 		host = strchr(connection, '@');
 		if(host) {
 			*host = '\0';
@@ -1004,13 +2289,27 @@ int run_server(ocd *dbg, char *connection)
 
 	fd = bind_server(host);
 	if(fd < 0) {
+		free_targets();
 		return -1;
 	}
-
-	while((client = get_connection(fd)) >= 0) {
-		service_client(dbg, client, userpasswd);
+	if(show_listening(fd) < 0) {
+		close(fd);
+		free_targets();
+		return -1;
 	}
+	users = userpasswd;
+
+#ifndef	_WIN32
+	/* a client going away must not take the server with it */
+	signal(SIGPIPE, SIG_IGN);
+#endif
+
+	serve_clients(fd);
 
+	while(clients) {
+		drop_client(clients);
+	}
+	free_targets();
 	close(fd);	
 
 #ifdef	_WIN32
@@ -1023,6 +2322,8 @@ int run_server(ocd *dbg, char *connection)
 	data = NULL;
 	free(buff);
 	buff = NULL;
+	open_link = NULL;
+	users = NULL;
 
 	return 0;
 }
@@ -7,8 +7,10 @@
 #define	SERVER_HEADER
 
 #include	"ocd.h"
+#include	"ez8dbg.h"
 
-int run_server(ocd *, char *);
+int run_server(ocd *, char *, ez8dbg * = NULL, const char * = NULL, 
+    ez8dbg *(*)(const char *) = NULL);
 
 #endif
 
@@ -99,15 +99,24 @@ static char *baudrate = NULL;
 static char *sysclk = NULL;
 static char *mtu = NULL;
 static char *server = NULL;
+static char *targets = NULL;
 static FILE *log_proto = NULL;
+static char *capture_file = NULL;
+static char *capture_limit = NULL;
+static char *faults = NULL;
 
 static int invoke_server = 0;
+static int server_ops = 0;
 static int disable_cache = 0;
 
 static int unlock_ocd = 0;
+static int disable_echo = 0;
+static int auto_mtu = 0;
+static int system_clock = 0;
 
 int repeat = 0x40;
 int show_times = 0;
+int monitor_only = 0;
 int esc_key = 0;
 int testmenu = 0;
 
@@ -246,6 +255,25 @@ int load_config(void)
 		invoke_server = 1;
 	}
 
+	ptr = cfg->get("targets");
+	if(ptr) {
+		targets = xstrdup(ptr);
+	}
+
+	ptr = cfg->get("serverops");
+	if(ptr) {
+		if(!strcasecmp(ptr, "enabled")) {
+			server_ops = 1;
+		}
+	}
+
+	ptr = cfg->get("monitor");
+	if(ptr) {
+		if(!strcasecmp(ptr, "enabled")) {
+			monitor_only = 1;
+		}
+	}
+
 	ptr = cfg->get("cache");
 	if(ptr) {
 		if(!strcasecmp(ptr, "disabled")) {
@@ -253,6 +281,28 @@ int load_config(void)
 		}
 	}
 
+	ptr = cfg->get("echo");
+	if(ptr) {
+		if(!strcasecmp(ptr, "disabled")) {
+			disable_echo = 1;
+		}
+	}
+
+	ptr = cfg->get("capture");
+	if(ptr) {
+		capture_file = xstrdup(ptr);
+	}
+
+	ptr = cfg->get("capturelimit");
+	if(ptr) {
+		capture_limit = xstrdup(ptr);
+	}
+
+	ptr = cfg->get("faults");
+	if(ptr) {
+		faults = xstrdup(ptr);
+	}
+
 	ptr = cfg->get("testmenu");
 	if(ptr) {
 		if(!strcasecmp(ptr, "enabled")) {
@@ -322,17 +372,25 @@ printf("Z8 Encore! command line debugger.\n\n");
 printf("  -h                         show this help\n");
 printf("  -p DEVICE                  connect to specified serial port device\n");
 printf("  -b BAUDRATE                connect using specified baudrate\n");
+printf("                               (auto to negotiate fastest rate)\n");
 printf("  -l                         list valid baudrates\n");
 printf("  -t MTU                     set maximum packet size\n");
-printf("                               (used to prevent receive overrun errors)\n");
+printf("                               (used to prevent receive overrun errors,\n");
+printf("                               auto to discover it)\n");
 printf("  -c FREQUENCY               use specified clock frequency for flash\n");
 printf("                               program/erase oprations\n");
 printf("  -s [:PORT]                 run as tcp/ip server\n");
 printf("  -n [SERVER][:PORT]         connect to tcp/ip server\n");
 printf("  -m TEXT                    calculate and display md5hash of text\n");
 printf("  -d                         dump raw ocd communication\n");
+printf("  -C FILE                    capture ocd communication to FILE\n");
+printf("                               (decode with capdump)\n");
+printf("  -R FILE                    replay a capture instead of connecting\n");
+printf("  -F SPEC                    inject link faults, see manual\n");
 printf("  -D                         disable memory cache\n");
-printf("  -T                         display diagnostic run times\n");
+printf("  -E                         adapter does not echo transmitted data\n");
+printf("  -T                         display diagnostic run times and\n");
+printf("                               link statistics on exit\n");
 printf("  -S SCRIPT                  run tcl script\n");
 printf("  -u                         issue OCD unlock sequence for 8-pin device\n");
 printf("\n");
@@ -362,7 +420,7 @@ void parse_options(int argc, char **argv)
 		progname = s+1;
 	}
 
-	while((c = getopt(argc, argv, "hldDTp:b:t:c:snm:vS:u")) != EOF) {
+	while((c = getopt(argc, argv, "hldDETp:b:t:c:snm:vS:uC:R:F:")) != EOF) {
 		switch(c) {
 		case '?':
 			printf("Try '%s -h' for more information.\n", 
@@ -409,6 +467,13 @@ void parse_options(int argc, char **argv)
 		case 's':
 			invoke_server = 1;
 			break;
+		case 'R':
+			connection = xstrdup("replay");
+			if(device) {
+				free(device);
+			}
+			device = xstrdup(optarg);
+			break;
 		case 'n':
 			connection = xstrdup("tcpip");
 			if(device) {
@@ -419,9 +484,24 @@ void parse_options(int argc, char **argv)
 		case 'd':
 			log_proto = stdout;
 			break;
+		case 'C':
+			if(capture_file) {
+				free(capture_file);
+			}
+			capture_file = xstrdup(optarg);
+			break;
+		case 'F':
+			if(faults) {
+				free(faults);
+			}
+			faults = xstrdup(optarg);
+			break;
 		case 'D':
 			disable_cache = 1;
 			break;
+		case 'E':
+			disable_echo = 1;
+			break;
 		case 'T':
 			show_times = 1;
 			break;
@@ -483,6 +563,7 @@ void parse_options(int argc, char **argv)
 int connect(void)
 {
 	int i, value, clk, baud;
+	bool negotiate;
 	char *tail;
 	double clock;
 
@@ -490,7 +571,9 @@ int connect(void)
 		ez8->log_proto = log_proto;
 	}
 
-	if(mtu) {
+	if(mtu && !strcasecmp(mtu, "auto")) {
+		auto_mtu = 1;
+	} else if(mtu) {
 		value = strtol(mtu, &tail, 0);
 		if(!tail || *tail || tail == mtu) {
 			fprintf(stderr, "Invalid mtu \"%s\"\n", mtu);
@@ -531,21 +614,61 @@ int connect(void)
 		return -1;
 	}
 	ez8->set_sysclk(clk);
+	system_clock = clk;
 	if(disable_cache) {
 		ez8->memcache_enabled = 0;
 	}
 
+	if(capture_file) {
+		unsigned long limit = 0;
+
+		if(capture_limit) {
+			limit = strtoul(capture_limit, &tail, 0);
+			if(!tail || tail == capture_limit) {
+				fprintf(stderr, "Invalid capturelimit \"%s\"\n",
+				    capture_limit);
+				return -1;
+			}
+			if(*tail == 'k' || *tail == 'K') {
+				limit *= 1024;
+				tail++;
+			} else if(*tail == 'M') {
+				limit *= 1024 * 1024;
+				tail++;
+			}
+			if(*tail != '\0') {
+				fprintf(stderr, "Invalid capturelimit suffix "
+				    "\"%s\"\n", tail);
+				return -1;
+			}
+		}
+		try {
+			ez8->start_capture(capture_file, limit);
+		} catch(char *err) {
+			fprintf(stderr, "%s", err);
+			return -1;
+		}
+	}
+
 	if(connection == NULL) {
 		fprintf(stderr, "Unknown connection type.\n");
 		return -1;
 
-	} else if(!strcasecmp(connection, "serial")) {
+	} else if(!strcasecmp(connection, "serial") || 
+	    !strcasecmp(connection, "replay")) {
+		bool replay;
+
 		if(!device) {
 			fprintf(stderr, "Unknown communication device.\n");
 			return -1;
 		}
+		replay = !strcasecmp(connection, "replay");
+		negotiate = 0;
 		if(!baudrate) {
 			baud = DEFAULT_BAUDRATE;
+		} else if(!strcasecmp(baudrate, "auto")) {
+			baud = DEFAULT_BAUDRATE;
+			negotiate = 1;
 		} else {
 			baud = strtol(baudrate, &tail, 0);
 			if(!tail || *tail || tail == baudrate) {
@@ -555,7 +678,7 @@ int connect(void)
 			}
 		}
 
-		if(!strcasecmp(device, "auto")) {
+		if(!replay && !strcasecmp(device, "auto")) {
 			bool found = 0;
 
 			printf("Auto-searching for device ...\n");
@@ -564,7 +687,8 @@ int connect(void)
 				printf("Trying %s ... ", device);
 				fflush(stdout);
 				try {
-					ez8->connect_serial(device, baud, unlock_ocd);
+					ez8->connect_serial(device, baud, 
+					    unlock_ocd, !disable_echo);
 				} catch(char *err) {
 					printf("fail\n");
 					continue;
@@ -589,28 +713,28 @@ int connect(void)
 			}
 
 			try {
-				ez8->rd_revid();
+				ez8->identify();
 			} catch(char *err) {
 				baud = ALT_BAUDRATE;
 				ez8->set_baudrate(baud);
 				ez8->reset_link();
 				try {
-					ez8->rd_revid();
+					ez8->identify();
 				} catch(char *err) {
 					printf(
 "Found dongle, but did not receive response from device.\n");
 					return -1;
 				}
 			}
-			if(ez8->cached_reload() && 
-			   ez8->cached_sysclk() > 115200*8) {
-				baud = 115200;
-				ez8->set_baudrate(baud);
-				ez8->reset_link();
-			}
+			negotiate = 1;
 		} else {
 			try {
-				ez8->connect_serial(device, baud, unlock_ocd);
+				if(replay) {
+					ez8->connect_replay(device, baud);
+				} else {
+					ez8->connect_serial(device, baud, 
+					    unlock_ocd, !disable_echo);
+				}
 			} catch(char *err) {
 				fprintf(stderr, "%s", err);
 				return -1;
@@ -624,10 +748,62 @@ int connect(void)
 				ez8->disconnect();
 				return -1;
 			}
+
+			if(negotiate) {
+				try {
+					ez8->identify();
+				} catch(char *err) {
+					negotiate = 0;
+				}
+			}
+		}
+
+		if(negotiate) {
+			try {
+				baud = ez8->negotiate_baudrate(0);
+			} catch(char *err) {
+				fprintf(stderr, "%s", err);
+				return -1;
+			}
+		}
+
+		if(auto_mtu) {
+			try {
+				ez8->tune_mtu(device);
+			} catch(char *err) {
+				fprintf(stderr, "%s", err);
+				return -1;
+			}
+			printf("Using mtu %d\n", (int)ez8->mtu);
 		}
 
 		printf("Connected to %s @ %d\n", device, baud);
 
+	} else if(!strcasecmp(connection, "sim")) {
+		baud = DEFAULT_BAUDRATE;
+		if(baudrate && strcasecmp(baudrate, "auto")) {
+			baud = strtol(baudrate, &tail, 0);
+			if(!tail || *tail || tail == baudrate) {
+				fprintf(stderr, "Invalid baudrate \"%s\"\n", 
+				    baudrate);
+				return -1;
+			}
+		}
+		try {
+			ez8->connect_sim(device, baud, clk);
+		} catch(char *err) {
+			fprintf(stderr, "%s", err);
+			return -1;
+		}
+		try {
+			ez8->reset_link();
+		} catch(char *err) {
+			fprintf(stderr, "%s", err);
+			ez8->disconnect();
+			return -1;
+		}
+		printf("Connected to simulated device\n");
+
 	} else if(!strcasecmp(connection, "parport")) {
 		if(!device) {
 			fprintf(stderr, "Unknown device");
@@ -650,7 +826,7 @@ int connect(void)
 		}
 	} else if(!strcasecmp(connection, "tcpip")) {
 		try {
-			ez8->connect_tcpip(device);
+			ez8->connect_tcpip(device, monitor_only);
 		} catch(char *err) {
 			printf("Connection failed\n");
 			fprintf(stderr, "%s", err);
@@ -676,6 +852,46 @@ int connect(void)
 	return 0;
 }
 
+/**************************************************************
+ * open_target()
+ *
+ * This opens the link to a device the server was given in
+ * its target list. The device is a serial port, or 
+ * "sim[:spec]" for a simulated device. It uses the clock and
+ * mtu of the server's own link, and the baudrate given, or
+ * the default one if that is auto. The baudrate is not 
+ * negotiated, which would hold up the server's clients if 
+ * the target is opened while they are being served.
+ */
+
+static ez8dbg *open_target(const char *dev)
+{
+	ez8dbg *target;
+	int baud;
+	char *tail;
+
+	baud = DEFAULT_BAUDRATE;
+	if(baudrate && strcasecmp(baudrate, "auto")) {
+		baud = strtol(baudrate, &tail, 0);
+	}
+
+	target = new ez8dbg;
+	target->set_sysclk(system_clock);
+	target->mtu = ez8->mtu;
+	target->memcache_enabled = ez8->memcache_enabled;
+
+	try {
+		target->connect_port(dev, baud, system_clock, unlock_ocd,
+		    !disable_echo);
+		target->reset_link();
+	} catch(char *err) {
+		delete target;
+		throw err;
+	}
+
+	return target;
+}
+
 /**************************************************************
  * init()
  *
@@ -707,8 +923,19 @@ int init(int argc, char **argv)
 		return -1;
 	}
 
+	if(faults) {
+		try {
+			ez8->inject_faults(faults);
+		} catch(char *err) {
+			fprintf(stderr, "%s", err);
+			ez8->disconnect();
+			return -1;
+		}
+	}
+
 	if(invoke_server) {
-		err = run_server(ez8->iflink(), server);
+		err = run_server(ez8->iflink(), server, 
+		    server_ops ? ez8 : NULL, targets, open_target);
 		ez8->disconnect();
 		if(err) {
 			exit(EXIT_FAILURE);
@@ -727,6 +954,11 @@ int init(int argc, char **argv)
 	}
 	#endif
 
+	/* a monitor watches the device without stopping it */
+	if(monitor_only) {
+		return 0;
+	}
+
 	try {
 		ez8->stop();
 	} catch(char *err) {
@@ -743,6 +975,7 @@ int init(int argc, char **argv)
  * This does the opposite of init(), it terminates a 
  * connection. It will remove any breakpoints that are
  * set and put the part into "run" mode when finished.
+ * A monitor leaves the device as it found it.
  */
 
 int finish(void)
@@ -750,11 +983,16 @@ int finish(void)
 	try {
 		int addr;
 
-		while(ez8->get_num_breakpoints() > 0) {
+		while(!monitor_only && ez8->get_num_breakpoints() > 0) {
 			addr = ez8->get_breakpoint(0);
 			ez8->remove_breakpoint(addr);
 		}
-		ez8->run();
+		if(!monitor_only) {
+			ez8->run();
+		}
+		if(show_times) {
+			ez8->dump_stats(stderr);
+		}
 		ez8->disconnect();
 
 	} catch(char *err) {
@@ -23,14 +23,20 @@
 #include	<unistd.h>
 #include	<string.h>
 #include	<errno.h>
+#include	<inttypes.h>
 #include	"xmalloc.h"
 
 #ifndef	_WIN32
 #include	<sys/types.h>
 #include	<sys/socket.h>
+#include	<fcntl.h>
+#else
+#include	<winsock2.h>
+#define	MSG_DONTWAIT	0
 #endif
 
 #include	"sockstream.h"
+#include	"netproto.h"
 
 /**************************************************************
  * ss_open
@@ -51,6 +57,9 @@ int ss_open(int fd, SOCK *h)
 
 	h->txbuff = xmalloc(BUFSIZ);
 	h->rxbuff = xmalloc(BUFSIZ);
+	h->txsize = BUFSIZ;
+	h->rxsize = BUFSIZ;
+	h->nonblock = 0;
 
 	h->fd = fd;
 
@@ -89,11 +98,70 @@ int ss_close(SOCK *h)
 	return 0;
 }
 
+/**************************************************************
+ * ss_nonblock
+ *
+ * This function puts the socket in non-blocking mode. Output
+ * then never waits on the peer: the output buffer grows to 
+ * hold whatever the socket does not take, and ss_flush() 
+ * sends as much as it can. The caller should call ss_flush()
+ * again when the socket is writable, while txcnt is nonzero.
+ * Input is only read with ss_fill(); ss_gets() and ss_read()
+ * fail rather than wait for data that is not buffered.
+ *
+ * This function return 0 upon success, -1 on error.
+ */
+
+int ss_nonblock(SOCK *h)
+{
+#ifndef	_WIN32
+	int flags;
+
+	flags = fcntl(h->fd, F_GETFL);
+	if(flags < 0 || fcntl(h->fd, F_SETFL, flags | O_NONBLOCK) < 0) {
+		return -1;
+	}
+#else
+	u_long mode;
+
+	mode = 1;
+	if(ioctlsocket(h->fd, FIONBIO, &mode)) {
+		return -1;
+	}
+#endif
+	h->nonblock = 1;
+
+	return 0;
+}
+
+/**************************************************************
+ * This makes room for size more bytes in the output buffer of
+ * a non-blocking socket.
+ */
+
+static void ss_grow(SOCK *h, size_t size)
+{
+	ssize_t need;
+
+	need = h->txcnt + size;
+	if(need <= h->txsize) {
+		return;
+	}
+	while(h->txsize < need) {
+		h->txsize *= 2;
+	}
+	h->txbuff = xrealloc(h->txbuff, h->txsize);
+
+	return;
+}
+
 /**************************************************************
  * ss_flush
  *
  * This function works similar to fflush(). It will write
  * any data waiting in the output buffer to the descriptor.
+ * On a non-blocking socket, it stops when the socket is full
+ * and leaves the rest in the buffer.
  *
  * This function return -1 on error, 0 upon success.
  */
@@ -115,6 +183,10 @@ int ss_flush(SOCK *h)
 		}
 	}
 
+	if(n < 0 && h->nonblock && 
+	    (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
 	if(n <= 0) {
 		return -1;
 	}
@@ -126,21 +198,26 @@ int ss_flush(SOCK *h)
  * ss_gets
  * 
  * This functions works similar to fgets. It copies the data up 
- * to and including the first '\n' charater into *s, or the 
- * first n bytes of data if '\n' does not occur. This function
- * will NULL terminate *s if less than n bytes were copied 
- * to *s.
+ * to and including the first '\n' charater into *s, and NULL
+ * terminates *s. At most n-1 bytes are copied; the rest of a
+ * longer line is read and dropped.
  */
 
 char *ss_gets(char *s, size_t n, SOCK *h)
 {
 	void *ptr;
 	char *p;
-	int cnt;
+	ssize_t cnt;
+	size_t len;
+
+	if(n == 0) {
+		return NULL;
+	}
 
 	p = s;
+	n--;
 
-	while(n > 0) {
+	while(1) {
 		if(h->rxcnt > 0) {
 			ptr = memchr(h->rxbuff, '\n', h->rxcnt);
 			if(ptr) {
@@ -148,30 +225,76 @@ char *ss_gets(char *s, size_t n, SOCK *h)
 			} else {
 				cnt = h->rxcnt;
 			}
-			memcpy(p, h->rxbuff, cnt);
+			len = (size_t)cnt > n ? n : (size_t)cnt;
+			memcpy(p, h->rxbuff, len);
 			h->rxcnt -= cnt;
 			if(h->rxcnt > 0) {
 				memmove(h->rxbuff, (char *)(h->rxbuff)+cnt, 
 				    h->rxcnt);
 			}
 
-			n -= cnt;
-			p += cnt;
-			if(ptr || n <= 0) {
-				if(n > 0) {
-					*p = '\0';
-				}
+			n -= len;
+			p += len;
+			if(ptr) {
+				*p = '\0';
 				return s;
 			}
 		}
 		cnt = recv(h->fd, h->rxbuff, BUFSIZ, 0);
-		if((cnt < 0 && errno != EINTR) || (cnt == 0)) {
+		if(cnt < 0 && errno == EINTR) {
+			continue;
+		}
+		if(cnt <= 0) {
 			return NULL;
 		}
 		h->rxcnt = cnt;
 	}
+}
 
-	return s;
+/**************************************************************
+ * ss_fill
+ *
+ * This function reads the data waiting on the socket into the
+ * input buffer, growing the buffer up to limit bytes. This
+ * lets the caller check a whole request has arrived before 
+ * parsing it with ss_gets() or ss_read(). If wait is zero, 
+ * this function does not block.
+ *
+ * This function returns the number of bytes read, 0 if none
+ * were waiting or the buffer is full, or -1 on error or when
+ * the connection was closed.
+ */
+
+ssize_t ss_fill(SOCK *h, size_t limit, int wait)
+{
+	ssize_t cnt, size;
+
+	if(h->rxcnt >= h->rxsize && (size_t)h->rxsize < limit) {
+		size = h->rxsize * 2;
+		if((size_t)size > limit) {
+			size = limit;
+		}
+		h->rxbuff = xrealloc(h->rxbuff, size);
+		h->rxsize = size;
+	}
+	if(h->rxcnt >= h->rxsize) {
+		return 0;
+	}
+
+	do {
+		cnt = recv(h->fd, (char *)(h->rxbuff)+h->rxcnt, 
+		    h->rxsize - h->rxcnt, wait ? 0 : MSG_DONTWAIT);
+	} while(cnt < 0 && errno == EINTR);
+
+	if(cnt < 0 && !wait && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+		return 0;
+	}
+	if(cnt <= 0) {
+		return -1;
+	}
+	h->rxcnt += cnt;
+
+	return cnt;
 }
 
 /**************************************************************
@@ -186,21 +309,28 @@ char *ss_gets(char *s, size_t n, SOCK *h)
 int ss_printf(SOCK *h, const char *fmt, ...)
 {
 	int err;
-	va_list ap;
+	va_list ap, aq;
 	ssize_t n, cnt;
 
 	va_start(ap, fmt);
+	va_copy(aq, ap);
 
-	n = BUFSIZ - h->txcnt;
+	n = h->txsize - h->txcnt;
 
 	cnt = vsnprintf((char *)(h->txbuff)+h->txcnt, n, fmt, ap);
-	if(cnt < 0 || cnt >= n) {
+	if(cnt >= n && h->nonblock) {
+		ss_grow(h, cnt + 1);
+		vsnprintf((char *)(h->txbuff)+h->txcnt, cnt + 1, fmt, aq);
+		h->txcnt += cnt;
+	} else if(cnt < 0 || cnt >= n) {
 		err = ss_flush(h);
 		if(err) {
+			va_end(aq);
+			va_end(ap);
 			return -1;
 		}
-		n = BUFSIZ;
-		cnt = vsnprintf(h->txbuff, n, fmt, ap);
+		n = h->txsize;
+		cnt = vsnprintf(h->txbuff, n, fmt, aq);
 		if(cnt >= n) {
 			err = ss_flush(h);
 			if(err) {
@@ -213,11 +343,150 @@ int ss_printf(SOCK *h, const char *fmt, ...)
 		h->txcnt += cnt; 
 	}
 
+	va_end(aq);
 	va_end(ap);
 
 	return 0;
 }
 
-/**************************************************************/
+/**************************************************************
+ * ss_write
+ *
+ * This function works similar to fwrite(). It copies size bytes
+ * to the output buffer, calling ss_flush() as it fills.
+ *
+ * This function return -1 on error, 0 upon success.
+ */
 
+int ss_write(SOCK *h, const void *data, size_t size)
+{
+	int err;
+	size_t cnt;
+
+	if(h->nonblock) {
+		ss_grow(h, size);
+	}
 
+	while(size > 0) {
+		if(h->txcnt >= h->txsize) {
+			err = ss_flush(h);
+			if(err) {
+				return -1;
+			}
+		}
+		cnt = h->txsize - h->txcnt;
+		if(cnt > size) {
+			cnt = size;
+		}
+		memcpy((char *)(h->txbuff)+h->txcnt, data, cnt);
+		h->txcnt += cnt;
+		data = (const char *)data + cnt;
+		size -= cnt;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * ss_read
+ *
+ * This function works similar to fread(), but returns only 
+ * once all size bytes are read. Data already buffered by
+ * ss_gets() is returned first.
+ *
+ * This function return -1 on error, 0 upon success.
+ */
+
+int ss_read(SOCK *h, void *data, size_t size)
+{
+	ssize_t cnt;
+
+	while(size > 0) {
+		if(h->rxcnt > 0) {
+			cnt = h->rxcnt;
+			if((size_t)cnt > size) {
+				cnt = size;
+			}
+			memcpy(data, h->rxbuff, cnt);
+			h->rxcnt -= cnt;
+			if(h->rxcnt > 0) {
+				memmove(h->rxbuff, (char *)(h->rxbuff)+cnt,
+				    h->rxcnt);
+			}
+			data = (char *)data + cnt;
+			size -= cnt;
+			continue;
+		}
+		cnt = recv(h->fd, h->rxbuff, BUFSIZ, 0);
+		if(cnt < 0 && errno == EINTR) {
+			continue;
+		}
+		if(cnt <= 0) {
+			return -1;
+		}
+		h->rxcnt = cnt;
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * ss_putframe
+ *
+ * This function writes a protocol version 2 frame, a type 
+ * byte and a 32 bit big endian length followed by the data.
+ *
+ * This function return -1 on error, 0 upon success.
+ */
+
+int ss_putframe(SOCK *h, int type, const void *data, size_t size)
+{
+	uint8_t header[PROTO_HEADER];
+	int err;
+
+	header[0] = type;
+	header[1] = size >> 24;
+	header[2] = size >> 16;
+	header[3] = size >> 8;
+	header[4] = size;
+
+	err = ss_write(h, header, sizeof(header));
+	if(err) {
+		return -1;
+	}
+	if(size) {
+		err = ss_write(h, data, size);
+		if(err) {
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/**************************************************************
+ * ss_getframe
+ *
+ * This function reads the header of a protocol version 2 
+ * frame, storing its type in *type. The caller should then 
+ * read the data with ss_read().
+ *
+ * This function returns the length of the data, or -1 on error.
+ */
+
+ssize_t ss_getframe(SOCK *h, int *type)
+{
+	uint8_t header[PROTO_HEADER];
+	int err;
+
+	err = ss_read(h, header, sizeof(header));
+	if(err) {
+		return -1;
+	}
+	*type = header[0];
+
+	return (ssize_t)header[1] << 24 | header[2] << 16 | 
+	    header[3] << 8 | header[4];
+}
+
+/**************************************************************/
@@ -26,15 +26,25 @@ typedef struct _SOCK {
 	void *rxbuff;
 	ssize_t txcnt;
 	ssize_t rxcnt;
+	ssize_t txsize;
+	ssize_t rxsize;
+	int nonblock;
 } SOCK;
 
 int ss_open(int, SOCK *);
 int ss_close(SOCK *);
+int ss_nonblock(SOCK *);
 
 char *ss_gets(char *, size_t, SOCK *);
+ssize_t ss_fill(SOCK *, size_t, int);
 int ss_printf(SOCK *, const char *, ...);
 int ss_flush(SOCK *);
 
+int ss_write(SOCK *, const void *, size_t);
+int ss_read(SOCK *, void *, size_t);
+int ss_putframe(SOCK *, int, const void *, size_t);
+ssize_t ss_getframe(SOCK *, int *);
+
 #ifdef	__cplusplus
 }
 #endif
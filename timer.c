@@ -7,7 +7,11 @@
 
 #include	<stdio.h>
 #include	<sys/time.h>
+#include	<time.h>
 #include	<string.h>
+#ifdef	_WIN32
+#include	<windows.h>
+#endif
 #include	"xmalloc.h"
 #include	"timer.h"
 
@@ -91,3 +95,18 @@ char *timerstr(struct timer *t)
 #endif
 }
 
+/* monotonic time in microseconds, for deadlines and latency */
+uint64_t timernow(void)
+{
+#ifndef	_WIN32
+	struct timespec ts;
+
+	if(clock_gettime(CLOCK_MONOTONIC, &ts)) {
+		return 0;
+	}
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	return (uint64_t)GetTickCount() * 1000;
+#endif
+}
+
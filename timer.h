@@ -8,6 +8,8 @@
 #ifndef	TIMER_H
 #define	TIMER_H
 
+#include	<inttypes.h>
+
 #ifdef	__cplusplus
 extern "C" { 
 #endif
@@ -25,6 +27,7 @@ struct timer {
 void timerstart(struct timer *);
 void timerstop(struct timer *);
 char *timerstr(struct timer *);
+uint64_t timernow(void);
 
 #ifdef	__cplusplus
 };